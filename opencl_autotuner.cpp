@@ -0,0 +1,249 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+
+#include "opencl_autotuner.h"
+#include "opencl_log.h"
+
+namespace {
+
+const size_t MAX_CANDIDATES = 64;
+
+std::vector<size_t> getDimensionCandidates(size_t global, size_t limit, size_t multiple){
+    std::vector<size_t> sizes;
+    for (size_t size = 1 ; size <= limit && size <= global ; size <<= 1){
+        sizes.push_back(size);
+    }
+    for (size_t size = multiple ; multiple > 1 && size <= limit && size <= global ; size += multiple){
+        sizes.push_back(size);
+    }
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    std::vector<size_t> dividing;
+    for (size_t size : sizes){
+        if (global % size == 0){
+            dividing.push_back(size);
+        }
+    }
+    return dividing;
+}
+
+}
+
+OpenCLAutotuner::OpenCLAutotuner(){
+}
+
+int OpenCLAutotuner::initialize(cl_device_id device, const std::string& databasePath){
+    this->device = device;
+    this->databasePath = databasePath;
+    size_t size = 0;
+    clGetDeviceInfo(device, CL_DEVICE_NAME, 0, NULL, &size);
+    this->deviceName.assign(size, '\0');
+    clGetDeviceInfo(device, CL_DEVICE_NAME, size, &this->deviceName[0], NULL);
+    this->deviceName.resize(std::strlen(this->deviceName.c_str()));
+    return this->load();
+}
+
+bool OpenCLAutotuner::isEnabled(){
+    return this->device != nullptr;
+}
+
+std::string OpenCLAutotuner::makeKey(const std::string& kernelName, cl_uint workDimensions,
+                                     const size_t *globalWorkSize){
+    std::string key = kernelName + "\t" + this->deviceName + "\t";
+    for (cl_uint i = 0 ; i < 3 ; i++){
+        key += std::to_string(i < workDimensions ? globalWorkSize[i] : 1);
+        key += i < 2 ? "," : "";
+    }
+    return key;
+}
+
+int OpenCLAutotuner::load(){
+    if (this->databasePath.empty()){
+        return 0;
+    }
+    std::ifstream file(this->databasePath);
+    if (!file){
+        // A missing database is the normal first run.
+        return 0;
+    }
+    std::string line;
+    while (std::getline(file, line)){
+        size_t separator = line.rfind('\t');
+        if (line.empty() || line[0] == '#' || separator == std::string::npos){
+            continue;
+        }
+        WorkSize local = {0, 0, 0};
+        std::stringstream stream(line.substr(separator + 1));
+        std::string value;
+        for (size_t i = 0 ; i < 3 && std::getline(stream, value, ',') ; i++){
+            local[i] = std::strtoull(value.c_str(), NULL, 10);
+        }
+        this->entries[line.substr(0, separator)] = local;
+    }
+    OPENCL_LOG_INFO("Loaded " << this->entries.size() << " tuning entries");
+    return 0;
+}
+
+int OpenCLAutotuner::save(){
+    if (this->databasePath.empty()){
+        return 0;
+    }
+    std::random_device random;
+    std::string temporaryPath = this->databasePath + ".tmp." + std::to_string(random());
+    try {
+        {
+            std::ofstream file(temporaryPath, std::ios::trunc);
+            if (!file){
+                throw std::runtime_error("Couldn't open " + temporaryPath);
+            }
+            file << "# kernel\tdevice\tglobal size\tlocal size\n";
+            for (const auto& entry : this->entries){
+                file << entry.first << "\t" << entry.second[0] << ","
+                     << entry.second[1] << "," << entry.second[2] << "\n";
+            }
+            if (!file){
+                throw std::runtime_error("Couldn't write " + temporaryPath);
+            }
+        }
+        std::filesystem::rename(temporaryPath, this->databasePath);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't save tuning database: " << e.what());
+        std::error_code error;
+        std::filesystem::remove(temporaryPath, error);
+        return -1;
+    }
+    return 0;
+}
+
+size_t OpenCLAutotuner::getEntryCount(){
+    return this->entries.size();
+}
+
+bool OpenCLAutotuner::lookup(const std::string& kernelName, cl_uint workDimensions,
+                             const size_t *globalWorkSize, WorkSize *localWorkSize){
+    auto found = this->entries.find(this->makeKey(kernelName, workDimensions, globalWorkSize));
+    if (found == this->entries.end()){
+        return false;
+    }
+    *localWorkSize = found->second;
+    return true;
+}
+
+std::vector<WorkSize> OpenCLAutotuner::getCandidates(cl_kernel kernel, cl_uint workDimensions,
+                                                     const size_t *globalWorkSize){
+    size_t maxGroupSize = 1;
+    size_t preferredMultiple = 1;
+    size_t maxItemSizes[3] = {1, 1, 1};
+    clGetKernelWorkGroupInfo(kernel, this->device, CL_KERNEL_WORK_GROUP_SIZE,
+                             sizeof(size_t), &maxGroupSize, NULL);
+    clGetKernelWorkGroupInfo(kernel, this->device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                             sizeof(size_t), &preferredMultiple, NULL);
+    clGetDeviceInfo(this->device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItemSizes), maxItemSizes, NULL);
+
+    std::vector<size_t> dimension[3];
+    for (cl_uint i = 0 ; i < 3 ; i++){
+        if (i < workDimensions){
+            size_t limit = std::min(maxGroupSize, maxItemSizes[i]);
+            // Only dimension 0 is laid out in hardware lanes, so only it
+            // benefits from multiples of the preferred size.
+            dimension[i] = getDimensionCandidates(globalWorkSize[i], limit, i == 0 ? preferredMultiple : 1);
+        } else {
+            dimension[i] = {1};
+        }
+    }
+
+    std::vector<WorkSize> candidates = {{0, 0, 0}};
+    for (size_t x : dimension[0]){
+        for (size_t y : dimension[1]){
+            for (size_t z : dimension[2]){
+                size_t groupSize = x*y*z;
+                if (groupSize > maxGroupSize){
+                    continue;
+                }
+                // Groups narrower than the preferred multiple leave lanes
+                // idle; skip them unless the problem itself is that small.
+                if (groupSize < preferredMultiple && groupSize < globalWorkSize[0]){
+                    continue;
+                }
+                candidates.push_back({x, y, z});
+            }
+        }
+    }
+    if (candidates.size() > MAX_CANDIDATES){
+        // Keep the largest groups, which are the usual winners, and the
+        // driver default at the front.
+        std::sort(candidates.begin() + 1, candidates.end(), [](const WorkSize& a, const WorkSize& b){
+            return a[0]*a[1]*a[2] > b[0]*b[1]*b[2];
+        });
+        candidates.resize(MAX_CANDIDATES);
+    }
+    return candidates;
+}
+
+double OpenCLAutotuner::benchmark(cl_command_queue queue, cl_kernel kernel, cl_uint workDimensions,
+                                  const size_t *globalWorkSize, const WorkSize& localWorkSize,
+                                  int repetitions){
+    const size_t *local = localWorkSize[0] == 0 ? NULL : localWorkSize.data();
+    // One warm-up launch absorbs lazy compilation and first-touch costs.
+    cl_int result = clEnqueueNDRangeKernel(queue, kernel, workDimensions, NULL, globalWorkSize,
+                                           local, 0, NULL, NULL);
+    if (result != CL_SUCCESS){
+        return std::numeric_limits<double>::infinity();
+    }
+    clFinish(queue);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0 ; i < repetitions ; i++){
+        result = clEnqueueNDRangeKernel(queue, kernel, workDimensions, NULL, globalWorkSize,
+                                        local, 0, NULL, NULL);
+        if (result != CL_SUCCESS){
+            clFinish(queue);
+            return std::numeric_limits<double>::infinity();
+        }
+    }
+    clFinish(queue);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / repetitions;
+}
+
+int OpenCLAutotuner::tune(cl_command_queue queue, cl_kernel kernel, const std::string& kernelName,
+                          cl_uint workDimensions, const size_t *globalWorkSize,
+                          WorkSize *localWorkSize, int repetitions){
+    if (!this->isEnabled()){
+        return -1;
+    }
+    std::vector<WorkSize> candidates = this->getCandidates(kernel, workDimensions, globalWorkSize);
+    WorkSize best = {0, 0, 0};
+    double bestMs = std::numeric_limits<double>::infinity();
+    double defaultMs = std::numeric_limits<double>::infinity();
+    for (const WorkSize& candidate : candidates){
+        double ms = this->benchmark(queue, kernel, workDimensions, globalWorkSize,
+                                    candidate, std::max(repetitions, 1));
+        if (candidate[0] == 0){
+            defaultMs = ms;
+        }
+        if (ms < bestMs){
+            bestMs = ms;
+            best = candidate;
+        }
+    }
+    if (bestMs == std::numeric_limits<double>::infinity()){
+        OPENCL_LOG_ERROR("No local work size candidate ran for kernel " << kernelName);
+        return -1;
+    }
+    OPENCL_LOG_INFO("Tuned " << kernelName << ": local size " << best[0] << "x" << best[1] << "x" << best[2]
+                    << " (" << bestMs << " ms, driver default " << defaultMs << " ms, "
+                    << candidates.size() << " candidates)");
+    this->entries[this->makeKey(kernelName, workDimensions, globalWorkSize)] = best;
+    *localWorkSize = best;
+    return this->save();
+}
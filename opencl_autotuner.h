@@ -0,0 +1,53 @@
+#ifndef OPENCL_AUTOTUNER
+#define OPENCL_AUTOTUNER
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <array>
+#include <map>
+#include <CL/opencl.hpp>
+
+typedef std::array<size_t, 3> WorkSize;
+
+// Picks the local work size per (kernel, device, global size) by timing
+// candidate sizes on the real kernel. Candidates are built from
+// CL_KERNEL_WORK_GROUP_SIZE, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE and
+// CL_DEVICE_MAX_WORK_ITEM_SIZES, and only sizes that divide the global size
+// are tried. The driver's own choice (a NULL local size, stored as all zeros)
+// is always one of the candidates. Winners are kept in a tab separated text
+// database that is loaded on enable and rewritten atomically after each tune.
+// Tuning launches the kernel several times with its current arguments, so
+// kernels that update their buffers in place should be tuned on scratch data.
+class OpenCLAutotuner
+{
+    public:
+        OpenCLAutotuner();
+        int initialize(cl_device_id device, const std::string& databasePath);
+        bool isEnabled();
+        bool lookup(const std::string& kernelName, cl_uint workDimensions,
+                    const size_t *globalWorkSize, WorkSize *localWorkSize);
+        int tune(cl_command_queue queue, cl_kernel kernel, const std::string& kernelName,
+                 cl_uint workDimensions, const size_t *globalWorkSize,
+                 WorkSize *localWorkSize, int repetitions = 5);
+        std::vector<WorkSize> getCandidates(cl_kernel kernel, cl_uint workDimensions,
+                                            const size_t *globalWorkSize);
+        size_t getEntryCount();
+        int save();
+
+    private:
+        cl_device_id device = nullptr;
+        std::string deviceName = "";
+        std::string databasePath = "";
+        std::map<std::string, WorkSize> entries = {};
+
+        int load();
+        std::string makeKey(const std::string& kernelName, cl_uint workDimensions,
+                            const size_t *globalWorkSize);
+        double benchmark(cl_command_queue queue, cl_kernel kernel, cl_uint workDimensions,
+                         const size_t *globalWorkSize, const WorkSize& localWorkSize,
+                         int repetitions);
+};
+
+#endif // OPENCL_AUTOTUNER
@@ -0,0 +1,532 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "opencl_interface.h"
+#include "opencl_primitives.h"
+
+#ifndef OPENCL_INTERFACE_SOURCE_DIR
+#define OPENCL_INTERFACE_SOURCE_DIR "."
+#endif
+
+// Microbenchmarks for the interface. Every result is written as one JSON
+// object per line so runs can be diffed and tracked over time. The library
+// itself still logs to stdout, so results go to a file by default.
+//
+//   opencl-interface-bench [--output FILE|-] [--reps N] [--quick] [--images DIR]
+
+namespace {
+
+struct BenchmarkOptions {
+    std::string outputPath = "bench_output.txt";
+    std::string imageDirectory = OPENCL_INTERFACE_SOURCE_DIR;
+    int repetitions = 20;
+    bool quick = false;
+};
+
+struct Timing {
+    double minUs = 0.0;
+    double medianUs = 0.0;
+    double meanUs = 0.0;
+    double p95Us = 0.0;
+};
+
+const char* COPY_SOURCE =
+    "__kernel void copy(__global const float* in, __global float* out){\n"
+    "    size_t i = get_global_id(0);\n"
+    "    out[i] = in[i];\n"
+    "}\n";
+
+const char* EMPTY_SOURCE =
+    "__kernel void empty(){\n"
+    "}\n";
+
+const char* IMAGE_SOURCE =
+    "__kernel void blur(__global const float* in, __global float* out){\n"
+    "    int x = get_global_id(0);\n"
+    "    int y = get_global_id(1);\n"
+    "    int w = get_global_size(0);\n"
+    "    int h = get_global_size(1);\n"
+    "    float sum = 0.0f;\n"
+    "    for (int dy = -1 ; dy <= 1 ; dy++){\n"
+    "        for (int dx = -1 ; dx <= 1 ; dx++){\n"
+    "            int sx = clamp(x + dx, 0, w - 1);\n"
+    "            int sy = clamp(y + dy, 0, h - 1);\n"
+    "            sum += in[sy*w + sx];\n"
+    "        }\n"
+    "    }\n"
+    "    out[y*w + x] = sum / 9.0f;\n"
+    "}\n"
+    "__kernel void blend(__global const float* a, __global const float* b, __global float* out){\n"
+    "    size_t i = get_global_id(0) + get_global_id(1)*get_global_size(0);\n"
+    "    out[i] = 0.5f*a[i] + 0.5f*b[i];\n"
+    "}\n";
+
+Timing measure(int repetitions, const std::function<void()>& body){
+    std::vector<double> samples;
+    body();
+    for (int i = 0 ; i < repetitions ; i++){
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count());
+    }
+    std::sort(samples.begin(), samples.end());
+    Timing timing;
+    timing.minUs = samples.front();
+    timing.medianUs = samples[samples.size() / 2];
+    timing.p95Us = samples[std::min(samples.size() - 1, (size_t)(0.95*samples.size()))];
+    for (double sample : samples){
+        timing.meanUs += sample;
+    }
+    timing.meanUs /= samples.size();
+    return timing;
+}
+
+std::string getDeviceName(OpenCLInterface& interface){
+    size_t size = 0;
+    clGetDeviceInfo(interface.getDevice(), CL_DEVICE_NAME, 0, NULL, &size);
+    std::string name(size, '\0');
+    clGetDeviceInfo(interface.getDevice(), CL_DEVICE_NAME, size, &name[0], NULL);
+    name.resize(std::strlen(name.c_str()));
+    return name;
+}
+
+class ResultWriter
+{
+    public:
+        ResultWriter(const std::string& path, const std::string& device){
+            this->device = device;
+            if (path != "-"){
+                this->file.open(path, std::ios::trunc);
+            }
+        }
+        void write(const std::string& benchmark, const std::string& fields, const Timing& timing){
+            std::ostringstream line;
+            line << "{\"benchmark\":\"" << benchmark << "\",\"device\":\"" << this->device << "\""
+                 << (fields.empty() ? "" : ",") << fields
+                 << ",\"min_us\":" << timing.minUs
+                 << ",\"median_us\":" << timing.medianUs
+                 << ",\"mean_us\":" << timing.meanUs
+                 << ",\"p95_us\":" << timing.p95Us << "}";
+            if (this->file.is_open()){
+                this->file << line.str() << "\n";
+                this->file.flush();
+            } else {
+                std::cout << line.str() << "\n";
+            }
+        }
+
+    private:
+        std::ofstream file;
+        std::string device;
+};
+
+void benchmarkBandwidth(const BenchmarkOptions& options, ResultWriter& writer){
+    std::vector<size_t> sizes;
+    size_t maxBytes = options.quick ? (4 << 20) : (256 << 20);
+    for (size_t bytes = 4 << 10 ; bytes <= maxBytes ; bytes <<= 2){
+        sizes.push_back(bytes);
+    }
+    std::vector<float> input(sizes.back() / sizeof(float), 1.0f);
+    std::vector<float> output(sizes.back() / sizeof(float), 0.0f);
+    size_t globalWorkSize[1] = {sizes.front() / sizeof(float)};
+
+    OpenCLInterface interface;
+    interface.initialize("copy", COPY_SOURCE, 1, globalWorkSize,
+                         {globalWorkSize[0]}, {input.data()},
+                         {globalWorkSize[0]}, {output.data()});
+    if (interface.errorEncountered){
+        std::cerr << "Skipping bandwidth benchmark: interface not initialized" << std::endl;
+        return;
+    }
+    // First straight from pageable memory, then through the pinned staging
+    // ring, which takes over transfers of a megabyte and up.
+    for (std::string suffix : {"", "_staged"}){
+        if (!suffix.empty() && interface.enableStagingRing() != 0){
+            std::cerr << "Skipping staged bandwidth: couldn't create staging ring" << std::endl;
+            break;
+        }
+        for (size_t bytes : sizes){
+            size_t numElements = bytes / sizeof(float);
+            if (interface.resizeBuffer(0, true, numElements, input.data()) != 0 ||
+                interface.resizeBuffer(0, false, numElements, output.data()) != 0){
+                std::cerr << "Skipping bandwidth at " << bytes << " bytes" << std::endl;
+                break;
+            }
+            std::string fields = "\"bytes\":" + std::to_string(bytes);
+            Timing write = measure(options.repetitions, [&](){ interface.updateBuffer(0); });
+            Timing read = measure(options.repetitions, [&](){ interface.readResult(0); });
+            writer.write("bandwidth_host_to_device" + suffix, fields + ",\"gbps\":" + std::to_string(bytes / write.medianUs * 1e-3), write);
+            writer.write("bandwidth_device_to_host" + suffix, fields + ",\"gbps\":" + std::to_string(bytes / read.medianUs * 1e-3), read);
+        }
+    }
+    interface.cleanup();
+}
+
+void benchmarkLaunchLatency(const BenchmarkOptions& options, ResultWriter& writer){
+    size_t globalWorkSize[1] = {1};
+    OpenCLInterface interface;
+    interface.initialize("empty", EMPTY_SOURCE, 1, globalWorkSize, {}, {}, {}, {});
+    if (interface.errorEncountered){
+        std::cerr << "Skipping launch benchmark: interface not initialized" << std::endl;
+        return;
+    }
+    int repetitions = options.repetitions * 10;
+    Timing blocking = measure(repetitions, [&](){ interface.execute(); });
+    writer.write("launch_blocking", "", blocking);
+
+    // Back-to-back asynchronous launches show the enqueue cost without the
+    // per-launch clFinish round trip.
+    const int batch = 100;
+    Timing queued = measure(options.repetitions, [&](){
+        for (int i = 0 ; i < batch ; i++){
+            interface.executeAsync();
+        }
+        interface.finish();
+    });
+    queued.minUs /= batch;
+    queued.medianUs /= batch;
+    queued.meanUs /= batch;
+    queued.p95Us /= batch;
+    writer.write("launch_async_amortized", "\"batch\":" + std::to_string(batch), queued);
+    interface.cleanup();
+}
+
+void benchmarkBuildTime(const BenchmarkOptions& options, ResultWriter& writer){
+    std::filesystem::path cacheDirectory = std::filesystem::temp_directory_path() / "opencl-interface-bench-cache";
+    std::error_code error;
+    std::filesystem::remove_all(cacheDirectory, error);
+
+    std::vector<float> input(1024, 1.0f);
+    std::vector<float> output(1024, 0.0f);
+    size_t globalWorkSize[2] = {32, 32};
+    int repetitions = std::max(3, options.repetitions / 4);
+    int nonce = 0;
+
+    // A unique comment per build defeats driver-side caches, so the
+    // uncached number is a real front-end and back-end compile.
+    auto build = [&](const std::string& source, const char* cacheDir){
+        OpenCLInterface interface;
+        interface.setBinaryCacheDirectory(cacheDir);
+        auto start = std::chrono::steady_clock::now();
+        interface.initialize("blur", source.c_str(), 2, globalWorkSize,
+                             {input.size()}, {input.data()}, {output.size()}, {output.data()});
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        interface.cleanup();
+        return elapsed.count();
+    };
+    std::vector<double> uncached, cold, warm;
+    for (int i = 0 ; i < repetitions ; i++){
+        std::string source = std::string(IMAGE_SOURCE) + "// nonce " + std::to_string(nonce++) + "\n";
+        uncached.push_back(build(source, ""));
+        source = std::string(IMAGE_SOURCE) + "// nonce " + std::to_string(nonce++) + "\n";
+        cold.push_back(build(source, cacheDirectory.string().c_str()));
+        warm.push_back(build(source, cacheDirectory.string().c_str()));
+    }
+    auto summarize = [](std::vector<double> samples){
+        std::sort(samples.begin(), samples.end());
+        Timing timing;
+        timing.minUs = samples.front();
+        timing.medianUs = samples[samples.size() / 2];
+        timing.p95Us = samples.back();
+        for (double sample : samples){
+            timing.meanUs += sample;
+        }
+        timing.meanUs /= samples.size();
+        return timing;
+    };
+    writer.write("build_uncached", "", summarize(uncached));
+    writer.write("build_cache_miss", "", summarize(cold));
+    writer.write("build_cache_hit", "", summarize(warm));
+    std::filesystem::remove_all(cacheDirectory, error);
+}
+
+bool loadGrayscale(const std::string& path, cv::Mat *image){
+    cv::Mat decoded = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (decoded.empty()){
+        return false;
+    }
+    decoded.convertTo(*image, CV_32F, 1.0 / 255.0);
+    return true;
+}
+
+void benchmarkImages(const BenchmarkOptions& options, ResultWriter& writer){
+    cv::Mat first, second;
+    std::string directory = options.imageDirectory;
+    if (!loadGrayscale(directory + "/cat1.jpg", &first) || !loadGrayscale(directory + "/cat2.jpg", &second)){
+        std::cerr << "Skipping image benchmark: couldn't load cat1.jpg/cat2.jpg from " << directory << std::endl;
+        return;
+    }
+    int width = std::min(first.cols, second.cols);
+    int height = std::min(first.rows, second.rows);
+    cv::Mat a = first(cv::Rect(0, 0, width, height)).clone();
+    cv::Mat b = second(cv::Rect(0, 0, width, height)).clone();
+    size_t numPixels = (size_t)width*height;
+    std::vector<float> blurred(numPixels);
+    std::vector<float> blended(numPixels);
+    size_t globalWorkSize[2] = {(size_t)width, (size_t)height};
+    std::string fields = "\"width\":" + std::to_string(width) + ",\"height\":" + std::to_string(height);
+
+    // Host versions of the kernels, which take over without a device.
+    std::vector<float> boxWeights(9, 1.0f / 9.0f);
+
+    OpenCLInterface blur;
+    blur.registerHostKernel("blur", makeHostConvolutionKernel(boxWeights, 1));
+    blur.initialize("blur", IMAGE_SOURCE, 2, globalWorkSize,
+                    {numPixels}, {a.ptr<float>()}, {numPixels}, {blurred.data()});
+    if (!blur.errorEncountered){
+        Timing timing = measure(options.repetitions, [&](){
+            blur.updateBuffer(0);
+            blur.execute();
+            blur.readResult(0);
+        });
+        writer.write("image_blur3x3_end_to_end",
+                     fields + ",\"mpix_per_s\":" + std::to_string(numPixels / timing.medianUs), timing);
+        Timing kernel = measure(options.repetitions, [&](){ blur.execute(); });
+        writer.write("image_blur3x3_kernel",
+                     fields + ",\"mpix_per_s\":" + std::to_string(numPixels / kernel.medianUs), kernel);
+        blur.cleanup();
+    }
+
+    OpenCLInterface blend;
+    blend.registerHostKernel("blend", makeHostMapKernel(HostMapOp::Blend, 0.5f, 0.5f));
+    blend.initialize("blend", IMAGE_SOURCE, 2, globalWorkSize,
+                     {numPixels, numPixels}, {a.ptr<float>(), b.ptr<float>()},
+                     {numPixels}, {blended.data()});
+    if (!blend.errorEncountered){
+        Timing timing = measure(options.repetitions, [&](){
+            blend.updateBuffer(0);
+            blend.updateBuffer(1);
+            blend.execute();
+            blend.readResult(0);
+        });
+        writer.write("image_blend_end_to_end",
+                     fields + ",\"mpix_per_s\":" + std::to_string(numPixels / timing.medianUs), timing);
+        blend.cleanup();
+    }
+}
+
+// Device primitives against what they replace: reading the whole buffer
+// back and doing the work on the host. Host timings include the readback.
+void benchmarkPrimitives(const BenchmarkOptions& options, ResultWriter& writer){
+    std::vector<size_t> sizes = {1 << 20};
+    if (!options.quick){
+        sizes.push_back(16 << 20);
+    }
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    std::vector<float> input(sizes.back());
+    for (float& value : input){
+        value = distribution(generator);
+    }
+    std::vector<float> output(sizes.back(), 0.0f);
+    std::vector<float> host(sizes.back());
+    size_t globalWorkSize[1] = {sizes.front()};
+
+    OpenCLInterface interface;
+    interface.initialize("copy", COPY_SOURCE, 1, globalWorkSize,
+                         {sizes.front()}, {input.data()},
+                         {sizes.front()}, {output.data()});
+    if (interface.errorEncountered){
+        std::cerr << "Skipping primitives benchmark: interface not initialized" << std::endl;
+        return;
+    }
+    for (size_t numElements : sizes){
+        if (interface.resizeBuffer(0, true, numElements, input.data()) != 0 ||
+            interface.resizeBuffer(0, false, numElements, output.data()) != 0){
+            std::cerr << "Skipping primitives at " << numElements << " elements" << std::endl;
+            break;
+        }
+        globalWorkSize[0] = numElements;
+        interface.setGlobalWorkSize(globalWorkSize);
+        interface.execute();
+        OpenCLPrimitives primitives(&interface);
+        if (!primitives.isInitialized){
+            std::cerr << "Skipping primitives benchmark: primitives not initialized" << std::endl;
+            break;
+        }
+        PrimitiveBuffer values = primitives.getBuffer(0, false);
+        // Scan and compact results go to their own buffer so the kernel's
+        // input stays intact for the copy before the sort.
+        cl_int result;
+        OpenCLHandle<cl_mem> scratch(clCreateBuffer(interface.getContext(), CL_MEM_READ_WRITE,
+                                                    numElements*sizeof(float), NULL, &result));
+        if (result != CL_SUCCESS){
+            std::cerr << "Skipping primitives at " << numElements << " elements: no scratch buffer" << std::endl;
+            break;
+        }
+        std::string fields = "\"elements\":" + std::to_string(numElements) +
+                             ",\"subgroups\":" + (primitives.hasSubgroups() ? "true" : "false");
+        float sum = 0.0f;
+        size_t kept = 0;
+        std::vector<unsigned int> bins;
+
+        writer.write("primitive_reduce_sum", fields, measure(options.repetitions, [&](){
+            primitives.reduce(values, ReduceOp::Sum, &sum);
+        }));
+        writer.write("primitive_reduce_sum_host", fields, measure(options.repetitions, [&](){
+            interface.readResult(0);
+            sum = std::accumulate(output.begin(), output.begin() + numElements, 0.0f);
+        }));
+        writer.write("primitive_scan", fields, measure(options.repetitions, [&](){
+            primitives.scan(values, scratch);
+        }));
+        writer.write("primitive_scan_host", fields, measure(options.repetitions, [&](){
+            interface.readResult(0);
+            std::exclusive_scan(output.begin(), output.begin() + numElements, host.begin(), 0.0f);
+        }));
+        writer.write("primitive_histogram_256", fields, measure(options.repetitions, [&](){
+            primitives.histogram(values, 0.0f, 1.0f, 256, &bins);
+        }));
+        writer.write("primitive_histogram_256_host", fields, measure(options.repetitions, [&](){
+            interface.readResult(0);
+            bins.assign(256, 0);
+            for (size_t i = 0 ; i < numElements ; i++){
+                bins[std::min<size_t>((size_t)(output[i]*256.0f), 255)]++;
+            }
+        }));
+        writer.write("primitive_compact", fields, measure(options.repetitions, [&](){
+            primitives.compact(values, CompareOp::Greater, 0.5f, scratch, &kept);
+        }));
+        writer.write("primitive_compact_host", fields, measure(options.repetitions, [&](){
+            interface.readResult(0);
+            kept = std::copy_if(output.begin(), output.begin() + numElements, host.begin(),
+                                [](float value){ return value > 0.5f; }) - host.begin();
+        }));
+        // Radix sort does the same work on sorted input, so sorting in place
+        // repeatedly is representative; the host sort gets a fresh copy.
+        writer.write("primitive_sort", fields, measure(options.repetitions, [&](){
+            primitives.sort(values);
+        }));
+        interface.updateBuffer(0);
+        interface.execute();
+        writer.write("primitive_sort_host", fields, measure(options.repetitions, [&](){
+            interface.readResult(0);
+            std::copy(output.begin(), output.begin() + numElements, host.begin());
+            std::sort(host.begin(), host.begin() + numElements);
+        }));
+        primitives.cleanup();
+    }
+    interface.cleanup();
+}
+
+// The host executor's built-in routines on every thread and on one, which
+// is what kernels degrade to when no OpenCL device is usable.
+void benchmarkHostExecutor(const BenchmarkOptions& options, ResultWriter& writer){
+    size_t width = 4096;
+    size_t height = options.quick ? 256 : 4096;
+    size_t numElements = width*height;
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    std::vector<float> a(numElements);
+    std::vector<float> b(numElements);
+    std::vector<float> out(numElements);
+    for (size_t i = 0 ; i < numElements ; i++){
+        a[i] = distribution(generator);
+        b[i] = distribution(generator);
+    }
+    std::vector<float> boxWeights(9, 1.0f / 9.0f);
+    float sum = 0.0f;
+
+    for (size_t numThreads : {(size_t)0, (size_t)1}){
+        HostExecutorOptions executorOptions;
+        executorOptions.numThreads = numThreads;
+        OpenCLHostExecutor executor(executorOptions);
+        std::string suffix = numThreads == 1 ? "_1thread" : "";
+        std::string fields = "\"elements\":" + std::to_string(numElements) +
+                             ",\"threads\":" + std::to_string(executor.getNumThreads()) +
+                             ",\"isa\":\"" + OpenCLHostExecutor::getVectorExtension() + "\"";
+
+        Timing blend = measure(options.repetitions, [&](){
+            hostMap(&executor, HostMapOp::Blend, a.data(), b.data(), out.data(), numElements, 0.5f, 0.5f);
+        });
+        writer.write("host_blend" + suffix,
+                     fields + ",\"gbps\":" + std::to_string(3*numElements*sizeof(float) / blend.medianUs * 1e-3), blend);
+        Timing reduce = measure(options.repetitions, [&](){
+            hostReduce(&executor, a.data(), numElements, ReduceOp::Sum, &sum);
+        });
+        writer.write("host_reduce_sum" + suffix,
+                     fields + ",\"gbps\":" + std::to_string(numElements*sizeof(float) / reduce.medianUs * 1e-3), reduce);
+        Timing blur = measure(options.repetitions, [&](){
+            hostConvolve(&executor, a.data(), out.data(), width, height, boxWeights.data(), 1);
+        });
+        writer.write("host_blur3x3" + suffix,
+                     fields + ",\"mpix_per_s\":" + std::to_string(numElements / blur.medianUs), blur);
+    }
+}
+
+BenchmarkOptions parseOptions(int argc, char** argv){
+    BenchmarkOptions options;
+    for (int i = 1 ; i < argc ; i++){
+        std::string argument = argv[i];
+        if (argument == "--output" && i + 1 < argc){
+            options.outputPath = argv[++i];
+        } else if (argument == "--reps" && i + 1 < argc){
+            options.repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (argument == "--images" && i + 1 < argc){
+            options.imageDirectory = argv[++i];
+        } else if (argument == "--quick"){
+            options.quick = true;
+            options.repetitions = std::min(options.repetitions, 5);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--output FILE|-] [--reps N] [--quick] [--images DIR]" << std::endl;
+            std::exit(1);
+        }
+    }
+    return options;
+}
+
+}
+
+int main(int argc, char** argv){
+    BenchmarkOptions options = parseOptions(argc, argv);
+
+    std::string deviceName;
+    bool hostFallback = false;
+    {
+        OpenCLInterface probe;
+        if (probe.errorEncountered){
+            std::cerr << "No usable OpenCL device; set OPENCL_INTERFACE_DEVICE=type=cpu for PoCL" << std::endl;
+            return 1;
+        }
+        hostFallback = probe.isHostFallback();
+        deviceName = hostFallback ? "host" : getDeviceName(probe);
+        probe.cleanup();
+    }
+    ResultWriter writer(options.outputPath, deviceName);
+
+    if (hostFallback){
+        // Only the image kernels have host versions.
+        std::cerr << "No usable OpenCL device, benchmarking the host fallback only" << std::endl;
+    } else {
+        benchmarkBandwidth(options, writer);
+        benchmarkLaunchLatency(options, writer);
+        benchmarkBuildTime(options, writer);
+    }
+    benchmarkImages(options, writer);
+    if (!hostFallback){
+        benchmarkPrimitives(options, writer);
+    }
+    benchmarkHostExecutor(options, writer);
+
+    if (options.outputPath != "-"){
+        std::cerr << "Results written to " << options.outputPath << std::endl;
+    }
+    return 0;
+}
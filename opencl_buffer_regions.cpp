@@ -0,0 +1,90 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <iterator>
+
+#include "opencl_buffer_regions.h"
+
+size_t getBufferRectEnd(const BufferRect& rect){
+    if (rect.region[0] == 0 || rect.region[1] == 0 || rect.region[2] == 0){
+        return 0;
+    }
+    size_t rowPitch = rect.rowPitch != 0 ? rect.rowPitch : rect.region[0];
+    size_t slicePitch = rect.slicePitch != 0 ? rect.slicePitch : rowPitch*rect.region[1];
+    return (rect.origin[2] + rect.region[2] - 1)*slicePitch +
+           (rect.origin[1] + rect.region[1] - 1)*rowPitch +
+           rect.origin[0] + rect.region[0];
+}
+
+OpenCLDirtyRegions::OpenCLDirtyRegions(){
+}
+
+void OpenCLDirtyRegions::mark(size_t offset, size_t size){
+    if (size == 0){
+        return;
+    }
+    size_t end = offset + size;
+    // Absorb every range that overlaps or touches [offset, end).
+    auto it = this->ranges.upper_bound(offset);
+    if (it != this->ranges.begin() && std::prev(it)->second >= offset){
+        --it;
+    }
+    while (it != this->ranges.end() && it->first <= end){
+        offset = std::min(offset, it->first);
+        end = std::max(end, it->second);
+        it = this->ranges.erase(it);
+    }
+    this->ranges[offset] = end;
+}
+
+void OpenCLDirtyRegions::mark(const BufferRect& rect){
+    size_t rowPitch = rect.rowPitch != 0 ? rect.rowPitch : rect.region[0];
+    size_t slicePitch = rect.slicePitch != 0 ? rect.slicePitch : rowPitch*rect.region[1];
+    // Full-width rows are contiguous, so one range covers the whole slice.
+    if (rect.origin[0] == 0 && rect.region[0] == rowPitch){
+        for (size_t z = 0 ; z < rect.region[2] ; z++){
+            this->mark((rect.origin[2] + z)*slicePitch + rect.origin[1]*rowPitch,
+                       rect.region[1]*rowPitch);
+        }
+        return;
+    }
+    for (size_t z = 0 ; z < rect.region[2] ; z++){
+        for (size_t y = 0 ; y < rect.region[1] ; y++){
+            this->mark((rect.origin[2] + z)*slicePitch + (rect.origin[1] + y)*rowPitch + rect.origin[0],
+                       rect.region[0]);
+        }
+    }
+}
+
+void OpenCLDirtyRegions::markAll(size_t sizeBytes){
+    this->ranges.clear();
+    this->mark(0, sizeBytes);
+}
+
+void OpenCLDirtyRegions::clear(){
+    this->ranges.clear();
+}
+
+bool OpenCLDirtyRegions::isDirty() const {
+    return !this->ranges.empty();
+}
+
+size_t OpenCLDirtyRegions::getDirtyBytes() const {
+    size_t bytes = 0;
+    for (const auto& range : this->ranges){
+        bytes += range.second - range.first;
+    }
+    return bytes;
+}
+
+std::vector<BufferRange> OpenCLDirtyRegions::coalesce(size_t mergeGap) const {
+    std::vector<BufferRange> result;
+    for (const auto& range : this->ranges){
+        if (!result.empty() && range.first - (result.back().offset + result.back().size) <= mergeGap){
+            result.back().size = range.second - result.back().offset;
+            continue;
+        }
+        result.push_back({range.first, range.second - range.first});
+    }
+    return result;
+}
@@ -0,0 +1,71 @@
+#ifndef OPENCL_BUFFER_REGIONS
+#define OPENCL_BUFFER_REGIONS
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <map>
+#include <CL/opencl.hpp>
+
+// A contiguous byte range of a buffer.
+struct BufferRange {
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+// A rectangular region of a buffer laid out as rows of rowPitch bytes and
+// slices of slicePitch bytes. origin and region follow clEnqueueWriteBufferRect:
+// x and width in bytes, y and height in rows, z and depth in slices. The
+// host data mirrors the buffer, so the same origin and pitches apply to both.
+struct BufferRect {
+    size_t origin[3] = {0, 0, 0};
+    size_t region[3] = {0, 1, 1};
+    size_t rowPitch = 0;
+    size_t slicePitch = 0;
+};
+
+// Rectangle of width x height elements at (x, y) in a 2D buffer whose rows
+// hold rowElements elements.
+template<typename T = float>
+BufferRect makeBufferRect(size_t x, size_t y, size_t width, size_t height, size_t rowElements){
+    BufferRect rect;
+    rect.origin[0] = x*sizeof(T);
+    rect.origin[1] = y;
+    rect.region[0] = width*sizeof(T);
+    rect.region[1] = height;
+    rect.rowPitch = rowElements*sizeof(T);
+    return rect;
+}
+
+size_t getBufferRectEnd(const BufferRect& rect);
+
+struct DirtyRegionStats {
+    size_t marked = 0;
+    size_t uploads = 0;
+    size_t regionsUploaded = 0;
+    size_t bytesUploaded = 0;
+    size_t bytesSkipped = 0;
+};
+
+// Host-side record of which bytes of a buffer were modified since the last
+// upload. Overlapping and touching ranges are merged as they are marked;
+// coalesce() additionally joins ranges separated by less than a gap, since
+// moving a few untouched bytes is cheaper than another transfer command.
+class OpenCLDirtyRegions
+{
+    public:
+        OpenCLDirtyRegions();
+        void mark(size_t offset, size_t size);
+        void mark(const BufferRect& rect);
+        void markAll(size_t sizeBytes);
+        void clear();
+        bool isDirty() const;
+        size_t getDirtyBytes() const;
+        std::vector<BufferRange> coalesce(size_t mergeGap) const;
+
+    private:
+        // Start offset to end offset, non-overlapping and non-touching.
+        std::map<size_t, size_t> ranges = {};
+};
+
+#endif // OPENCL_BUFFER_REGIONS
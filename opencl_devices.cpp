@@ -0,0 +1,220 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <algorithm>
+
+#include "opencl_devices.h"
+#include "opencl_log.h"
+
+namespace {
+
+std::string getPlatformString(cl_platform_id platform, cl_platform_info param){
+    size_t size = 0;
+    if (clGetPlatformInfo(platform, param, 0, NULL, &size) != CL_SUCCESS || size == 0){
+        return "";
+    }
+    std::string value(size, '\0');
+    clGetPlatformInfo(platform, param, size, &value[0], NULL);
+    value.resize(std::strlen(value.c_str()));
+    return value;
+}
+
+std::string getDeviceString(cl_device_id device, cl_device_info param){
+    size_t size = 0;
+    if (clGetDeviceInfo(device, param, 0, NULL, &size) != CL_SUCCESS || size == 0){
+        return "";
+    }
+    std::string value(size, '\0');
+    clGetDeviceInfo(device, param, size, &value[0], NULL);
+    value.resize(std::strlen(value.c_str()));
+    return value;
+}
+
+std::string toLower(std::string value){
+    std::transform(value.begin(), value.end(), value.begin(),
+                   [](unsigned char c){ return std::tolower(c); });
+    return value;
+}
+
+bool containsIgnoreCase(const std::string& haystack, const std::string& needle){
+    return needle.empty() || toLower(haystack).find(toLower(needle)) != std::string::npos;
+}
+
+cl_device_type parseDeviceType(const std::string& value, cl_device_type fallback){
+    std::string type = toLower(value);
+    if (type == "gpu"){
+        return CL_DEVICE_TYPE_GPU;
+    }
+    if (type == "cpu"){
+        return CL_DEVICE_TYPE_CPU;
+    }
+    if (type == "accelerator"){
+        return CL_DEVICE_TYPE_ACCELERATOR;
+    }
+    if (type == "all" || type == "any"){
+        return CL_DEVICE_TYPE_ALL;
+    }
+    if (type == "default"){
+        return CL_DEVICE_TYPE_DEFAULT;
+    }
+    OPENCL_LOG_WARNING("Unknown OPENCL_INTERFACE_DEVICE type: " << value
+                       << ", keeping " << getDeviceTypeName(fallback));
+    return fallback;
+}
+
+std::vector<OpenCLDeviceInfo> filterDevices(const std::vector<OpenCLDeviceInfo>& devices,
+                                            const DeviceSelectionPolicy& policy){
+    std::vector<OpenCLDeviceInfo> matching;
+    for (const OpenCLDeviceInfo& info : devices){
+        if (!containsIgnoreCase(info.vendor, policy.vendorFilter) &&
+            !containsIgnoreCase(info.platformName, policy.vendorFilter)){
+            continue;
+        }
+        if (!containsIgnoreCase(info.name, policy.nameFilter)){
+            continue;
+        }
+        if (info.computeUnits < policy.minComputeUnits){
+            continue;
+        }
+        matching.push_back(info);
+    }
+    return matching;
+}
+
+}
+
+DeviceSelectionPolicy DeviceSelectionPolicy::fromEnvironment(){
+    DeviceSelectionPolicy policy;
+    const char* value = std::getenv("OPENCL_INTERFACE_DEVICE");
+    if (value == nullptr){
+        return policy;
+    }
+    std::stringstream stream(value);
+    std::string entry;
+    while (std::getline(stream, entry, ',')){
+        size_t separator = entry.find('=');
+        std::string key = toLower(entry.substr(0, separator));
+        std::string argument = separator == std::string::npos ? "" : entry.substr(separator + 1);
+        if (key == "type"){
+            policy.deviceType = parseDeviceType(argument, policy.deviceType);
+        } else if (key == "vendor"){
+            policy.vendorFilter = argument;
+        } else if (key == "name"){
+            policy.nameFilter = argument;
+        } else if (key == "min_cu"){
+            policy.minComputeUnits = std::strtoul(argument.c_str(), NULL, 10);
+        } else if (key == "best"){
+            policy.pickBest = true;
+        } else if (key == "nofallback"){
+            policy.cpuFallback = false;
+        } else if (key == "nohost"){
+            policy.hostFallback = false;
+        } else if (!key.empty()){
+            OPENCL_LOG_WARNING("Unknown OPENCL_INTERFACE_DEVICE option: " << key);
+        }
+    }
+    return policy;
+}
+
+std::vector<OpenCLDeviceInfo> enumerateOpenCLDevices(cl_device_type type){
+    std::vector<OpenCLDeviceInfo> devices;
+    cl_uint numPlatforms = 0;
+    if (clGetPlatformIDs(0, NULL, &numPlatforms) != CL_SUCCESS || numPlatforms == 0){
+        return devices;
+    }
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    clGetPlatformIDs(numPlatforms, platforms.data(), NULL);
+
+    for (cl_platform_id platform : platforms){
+        cl_uint numDevices = 0;
+        // Platforms without a matching device report CL_DEVICE_NOT_FOUND,
+        // which is not an error when scanning all of them.
+        if (clGetDeviceIDs(platform, type, 0, NULL, &numDevices) != CL_SUCCESS || numDevices == 0){
+            continue;
+        }
+        std::vector<cl_device_id> platformDevices(numDevices);
+        clGetDeviceIDs(platform, type, numDevices, platformDevices.data(), NULL);
+        std::string platformName = getPlatformString(platform, CL_PLATFORM_NAME);
+
+        for (cl_device_id device : platformDevices){
+            cl_bool available = CL_TRUE;
+            clGetDeviceInfo(device, CL_DEVICE_AVAILABLE, sizeof(cl_bool), &available, NULL);
+            if (available != CL_TRUE){
+                continue;
+            }
+            OpenCLDeviceInfo info;
+            info.platform = platform;
+            info.device = device;
+            info.platformName = platformName;
+            info.name = getDeviceString(device, CL_DEVICE_NAME);
+            info.vendor = getDeviceString(device, CL_DEVICE_VENDOR);
+            cl_bool unified = CL_FALSE;
+            clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(cl_device_type), &info.type, NULL);
+            clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &info.computeUnits, NULL);
+            clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &info.clockMHz, NULL);
+            clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &info.globalMemBytes, NULL);
+            clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &info.maxAllocBytes, NULL);
+            clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+            info.hostUnifiedMemory = unified == CL_TRUE;
+            devices.push_back(info);
+        }
+    }
+    return devices;
+}
+
+std::string getDeviceTypeName(cl_device_type type){
+    // ALL sets every bit, so it has to be matched before the single types.
+    if (type == CL_DEVICE_TYPE_ALL){
+        return "All";
+    }
+    if (type & CL_DEVICE_TYPE_GPU){
+        return "GPU";
+    }
+    if (type & CL_DEVICE_TYPE_CPU){
+        return "CPU";
+    }
+    if (type & CL_DEVICE_TYPE_ACCELERATOR){
+        return "Accelerator";
+    }
+    if (type & CL_DEVICE_TYPE_DEFAULT){
+        return "Default";
+    }
+    return "Other";
+}
+
+double scoreOpenCLDevice(const OpenCLDeviceInfo& info){
+    // Rough peak-throughput estimate. A GPU compute unit runs many more lanes
+    // than a CPU core, so weight device types before comparing CUs x clock.
+    double typeFactor = 1.0;
+    if (info.type & CL_DEVICE_TYPE_GPU){
+        typeFactor = 16.0;
+    } else if (info.type & CL_DEVICE_TYPE_ACCELERATOR){
+        typeFactor = 8.0;
+    }
+    return typeFactor * info.computeUnits * std::max<cl_uint>(info.clockMHz, 1);
+}
+
+cl_int selectOpenCLDevice(const DeviceSelectionPolicy& policy, OpenCLDeviceInfo *selected){
+    std::vector<OpenCLDeviceInfo> candidates = filterDevices(enumerateOpenCLDevices(policy.deviceType), policy);
+    if (candidates.empty() && policy.cpuFallback && policy.deviceType != CL_DEVICE_TYPE_CPU){
+        OPENCL_LOG_WARNING("No matching " << getDeviceTypeName(policy.deviceType)
+                           << " device found, falling back to CPU");
+        candidates = enumerateOpenCLDevices(CL_DEVICE_TYPE_CPU);
+    }
+    if (candidates.empty()){
+        return CL_DEVICE_NOT_FOUND;
+    }
+    size_t chosen = 0;
+    if (policy.pickBest){
+        for (size_t i = 1 ; i < candidates.size() ; i++){
+            if (scoreOpenCLDevice(candidates[i]) > scoreOpenCLDevice(candidates[chosen])){
+                chosen = i;
+            }
+        }
+    }
+    *selected = candidates[chosen];
+    return CL_SUCCESS;
+}
@@ -0,0 +1,48 @@
+#ifndef OPENCL_DEVICES
+#define OPENCL_DEVICES
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <CL/opencl.hpp>
+
+struct OpenCLDeviceInfo {
+    cl_platform_id platform = nullptr;
+    cl_device_id device = nullptr;
+    std::string platformName = "";
+    std::string name = "";
+    std::string vendor = "";
+    cl_device_type type = 0;
+    cl_uint computeUnits = 0;
+    cl_uint clockMHz = 0;
+    cl_ulong globalMemBytes = 0;
+    cl_ulong maxAllocBytes = 0;
+    bool hostUnifiedMemory = false;
+};
+
+// How the single-device interface picks its device. Filters are
+// case-insensitive substrings. When nothing of `deviceType` matches and
+// `cpuFallback` is set, the filters are dropped and a CPU device is used.
+// When no device can be used at all and `hostFallback` is set, the
+// interface runs registered host kernels instead.
+// fromEnvironment() reads OPENCL_INTERFACE_DEVICE, a comma separated list
+// such as "type=gpu,vendor=nvidia,name=rtx,min_cu=8,best,nofallback,nohost".
+struct DeviceSelectionPolicy {
+    cl_device_type deviceType = CL_DEVICE_TYPE_GPU;
+    std::string vendorFilter = "";
+    std::string nameFilter = "";
+    cl_uint minComputeUnits = 0;
+    bool pickBest = false;
+    bool cpuFallback = true;
+    bool hostFallback = true;
+
+    static DeviceSelectionPolicy fromEnvironment();
+};
+
+std::vector<OpenCLDeviceInfo> enumerateOpenCLDevices(cl_device_type type = CL_DEVICE_TYPE_ALL);
+std::string getDeviceTypeName(cl_device_type type);
+double scoreOpenCLDevice(const OpenCLDeviceInfo& info);
+cl_int selectOpenCLDevice(const DeviceSelectionPolicy& policy, OpenCLDeviceInfo *selected);
+
+#endif // OPENCL_DEVICES
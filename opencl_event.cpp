@@ -0,0 +1,103 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include "opencl_event.h"
+
+OpenCLEvent::OpenCLEvent(){
+}
+
+OpenCLEvent::OpenCLEvent(cl_event event){
+    this->event = event;
+}
+
+OpenCLEvent::OpenCLEvent(const OpenCLEvent& other){
+    this->event = other.event;
+    if (this->event != nullptr){
+        clRetainEvent(this->event);
+    }
+}
+
+OpenCLEvent::OpenCLEvent(OpenCLEvent&& other) noexcept {
+    this->event = other.event;
+    other.event = nullptr;
+}
+
+OpenCLEvent& OpenCLEvent::operator=(const OpenCLEvent& other){
+    if (this != &other){
+        if (other.event != nullptr){
+            clRetainEvent(other.event);
+        }
+        if (this->event != nullptr){
+            clReleaseEvent(this->event);
+        }
+        this->event = other.event;
+    }
+    return *this;
+}
+
+OpenCLEvent& OpenCLEvent::operator=(OpenCLEvent&& other) noexcept {
+    if (this != &other){
+        if (this->event != nullptr){
+            clReleaseEvent(this->event);
+        }
+        this->event = other.event;
+        other.event = nullptr;
+    }
+    return *this;
+}
+
+OpenCLEvent::~OpenCLEvent(){
+    if (this->event != nullptr){
+        clReleaseEvent(this->event);
+    }
+}
+
+cl_event OpenCLEvent::get() const {
+    return this->event;
+}
+
+bool OpenCLEvent::isValid() const {
+    return this->event != nullptr;
+}
+
+cl_int OpenCLEvent::getStatus() const {
+    if (this->event == nullptr){
+        return CL_INVALID_EVENT;
+    }
+    cl_int status;
+    cl_int result = clGetEventInfo(this->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                   sizeof(cl_int), &status, NULL);
+    if (result != CL_SUCCESS){
+        return result;
+    }
+    return status;
+}
+
+bool OpenCLEvent::isComplete() const {
+    return this->getStatus() == CL_COMPLETE;
+}
+
+cl_int OpenCLEvent::wait() const {
+    if (this->event == nullptr){
+        return CL_INVALID_EVENT;
+    }
+    return clWaitForEvents(1, &this->event);
+}
+
+cl_int OpenCLEvent::waitAll(const std::vector<OpenCLEvent>& events){
+    std::vector<cl_event> handles = toHandles(events);
+    if (handles.empty()){
+        return CL_SUCCESS;
+    }
+    return clWaitForEvents(handles.size(), handles.data());
+}
+
+std::vector<cl_event> OpenCLEvent::toHandles(const std::vector<OpenCLEvent>& events){
+    std::vector<cl_event> handles;
+    handles.reserve(events.size());
+    for (const OpenCLEvent& event : events){
+        if (event.isValid()){
+            handles.push_back(event.get());
+        }
+    }
+    return handles;
+}
@@ -0,0 +1,35 @@
+#ifndef OPENCL_EVENT
+#define OPENCL_EVENT
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <CL/opencl.hpp>
+
+// Owning wrapper around a cl_event. Copies retain the event and the last
+// owner releases it, so events can be stored in wait lists freely.
+class OpenCLEvent
+{
+    public:
+        OpenCLEvent();
+        explicit OpenCLEvent(cl_event event);
+        OpenCLEvent(const OpenCLEvent& other);
+        OpenCLEvent(OpenCLEvent&& other) noexcept;
+        OpenCLEvent& operator=(const OpenCLEvent& other);
+        OpenCLEvent& operator=(OpenCLEvent&& other) noexcept;
+        ~OpenCLEvent();
+
+        cl_event get() const;
+        bool isValid() const;
+        bool isComplete() const;
+        cl_int getStatus() const;
+        cl_int wait() const;
+
+        static cl_int waitAll(const std::vector<OpenCLEvent>& events);
+        static std::vector<cl_event> toHandles(const std::vector<OpenCLEvent>& events);
+
+    private:
+        cl_event event = nullptr;
+};
+
+#endif // OPENCL_EVENT
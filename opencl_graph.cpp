@@ -0,0 +1,445 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_graph.h"
+
+OpenCLGraph::OpenCLGraph(OpenCLInterface *interface){
+    this->errorEncountered = false;
+    this->interface = interface;
+}
+
+OpenCLGraph::~OpenCLGraph(){
+    this->cleanup();
+    for (GraphBuffer& buffer : this->buffers){
+        if (buffer.fromInterface){
+            clReleaseMemObject(buffer.handle);
+        }
+    }
+}
+
+int OpenCLGraph::addBuffer(size_t sizeBytes){
+    GraphBuffer buffer;
+    buffer.sizeBytes = sizeBytes;
+    this->buffers.push_back(buffer);
+    this->compiled = false;
+    return this->buffers.size() - 1;
+}
+
+int OpenCLGraph::addBuffer(const BufferArg& buffer){
+    cl_mem handle = this->interface->getBufferHandle(buffer.index, buffer.isInput);
+    if (handle == nullptr){
+        this->errorEncountered = true;
+        return -1;
+    }
+    clRetainMemObject(handle);
+    int index = this->addExternalBuffer(handle, 0);
+    this->buffers[index].fromInterface = true;
+    this->buffers[index].source = buffer;
+    return index;
+}
+
+int OpenCLGraph::addExternalBuffer(cl_mem handle, size_t sizeBytes){
+    GraphBuffer buffer;
+    buffer.sizeBytes = sizeBytes;
+    buffer.handle = handle;
+    buffer.external = true;
+    this->buffers.push_back(buffer);
+    this->compiled = false;
+    return this->buffers.size() - 1;
+}
+
+int OpenCLGraph::addNode(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize,
+                         std::vector<GraphArg> args){
+    try {
+        if (workDimensions < 1 || workDimensions > 3){
+            throw std::runtime_error("Work dimensions must be between 1 and 3");
+        }
+        for (const GraphArg& arg : args){
+            if (arg.buffer >= (int)this->buffers.size()){
+                throw std::runtime_error("Node " + std::string(kernelName) + " uses unknown buffer " +
+                                         std::to_string(arg.buffer));
+            }
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't add graph node: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    GraphNode node;
+    node.kernelName = kernelName;
+    node.workDimensions = workDimensions;
+    for (cl_uint i = 0 ; i < workDimensions ; i++){
+        node.globalWorkSize[i] = globalWorkSize[i];
+    }
+    node.args = args;
+    this->nodes.push_back(node);
+    this->compiled = false;
+    return this->nodes.size() - 1;
+}
+
+void OpenCLGraph::addDependency(int node, int dependency){
+    if (node == dependency){
+        return;
+    }
+    std::vector<int>& dependencies = this->nodes[node].dependencies;
+    if (std::find(dependencies.begin(), dependencies.end(), dependency) == dependencies.end()){
+        dependencies.push_back(dependency);
+        this->nodes[dependency].isSink = false;
+    }
+}
+
+void OpenCLGraph::buildDependencies(){
+    std::vector<int> lastWriter(this->buffers.size(), -1);
+    std::vector<std::vector<int>> readers(this->buffers.size());
+    for (GraphBuffer& buffer : this->buffers){
+        buffer.firstUse = -1;
+        buffer.lastUse = -1;
+    }
+    for (GraphNode& node : this->nodes){
+        node.dependencies.clear();
+        node.isSink = true;
+    }
+    for (int n = 0 ; n < (int)this->nodes.size() ; n++){
+        // Dependencies are taken from the state before this node, then the
+        // node's own accesses are recorded.
+        for (const GraphArg& arg : this->nodes[n].args){
+            if (arg.buffer < 0){
+                continue;
+            }
+            GraphBuffer& buffer = this->buffers[arg.buffer];
+            if (buffer.firstUse < 0){
+                buffer.firstUse = n;
+            }
+            buffer.lastUse = n;
+            if (lastWriter[arg.buffer] >= 0){
+                this->addDependency(n, lastWriter[arg.buffer]);
+            }
+            if (arg.access != GraphAccess::Read){
+                for (int reader : readers[arg.buffer]){
+                    this->addDependency(n, reader);
+                }
+            }
+        }
+        for (const GraphArg& arg : this->nodes[n].args){
+            if (arg.buffer < 0){
+                continue;
+            }
+            if (arg.access == GraphAccess::Read){
+                readers[arg.buffer].push_back(n);
+            } else {
+                lastWriter[arg.buffer] = n;
+                readers[arg.buffer].clear();
+            }
+        }
+    }
+}
+
+int OpenCLGraph::allocateIntermediates(){
+    struct Allocation {
+        size_t sizeBytes = 0;
+        int lastUse = -1;
+        std::vector<int> users = {};
+    };
+    std::vector<Allocation> plan;
+    std::vector<std::vector<int>> users(this->buffers.size());
+    for (int n = 0 ; n < (int)this->nodes.size() ; n++){
+        for (const GraphArg& arg : this->nodes[n].args){
+            if (arg.buffer >= 0){
+                users[arg.buffer].push_back(n);
+            }
+        }
+    }
+
+    std::vector<int> order;
+    for (int b = 0 ; b < (int)this->buffers.size() ; b++){
+        if (!this->buffers[b].external && this->buffers[b].firstUse >= 0){
+            order.push_back(b);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b){
+        return this->buffers[a].firstUse < this->buffers[b].firstUse;
+    });
+
+    for (int b : order){
+        GraphBuffer& buffer = this->buffers[b];
+        // Best fit among allocations whose occupants are all done before
+        // this buffer is first touched.
+        int chosen = -1;
+        for (int a = 0 ; a < (int)plan.size() ; a++){
+            if (plan[a].lastUse < buffer.firstUse && plan[a].sizeBytes >= buffer.sizeBytes &&
+                (chosen < 0 || plan[a].sizeBytes < plan[chosen].sizeBytes)){
+                chosen = a;
+            }
+        }
+        if (chosen < 0){
+            plan.emplace_back();
+            chosen = plan.size() - 1;
+            plan[chosen].sizeBytes = buffer.sizeBytes;
+        } else {
+            // Sharing memory is a write-after-read hazard the buffer
+            // accesses alone don't show, so order it explicitly.
+            for (int user : users[b]){
+                for (int previous : plan[chosen].users){
+                    this->addDependency(user, previous);
+                }
+            }
+        }
+        plan[chosen].lastUse = std::max(plan[chosen].lastUse, buffer.lastUse);
+        plan[chosen].users.insert(plan[chosen].users.end(), users[b].begin(), users[b].end());
+        buffer.allocation = chosen;
+        this->stats.intermediateBuffers++;
+        this->stats.intermediateBytes += buffer.sizeBytes;
+    }
+
+    for (const Allocation& allocation : plan){
+        cl_int result;
+        cl_mem handle = clCreateBuffer(this->interface->getContext(), CL_MEM_READ_WRITE,
+                                       std::max<size_t>(allocation.sizeBytes, 1), NULL, &result);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't allocate graph buffer: "
+                             << getOpenCLErrorName(result));
+            return -1;
+        }
+        this->allocations.push_back(handle);
+        this->stats.allocatedBytes += allocation.sizeBytes;
+    }
+    this->stats.allocations = plan.size();
+    for (GraphBuffer& buffer : this->buffers){
+        if (!buffer.external){
+            buffer.handle = buffer.allocation >= 0 ? this->allocations[buffer.allocation] : nullptr;
+        }
+    }
+    return 0;
+}
+
+int OpenCLGraph::createQueues(){
+    std::vector<size_t> level(this->nodes.size(), 0);
+    std::vector<size_t> levelWidth;
+    std::vector<size_t> slotInLevel(this->nodes.size(), 0);
+    for (size_t n = 0 ; n < this->nodes.size() ; n++){
+        for (int dependency : this->nodes[n].dependencies){
+            level[n] = std::max(level[n], level[dependency] + 1);
+        }
+        if (level[n] >= levelWidth.size()){
+            levelWidth.resize(level[n] + 1, 0);
+        }
+        slotInLevel[n] = levelWidth[level[n]]++;
+    }
+    this->stats.levels = levelWidth.size();
+    this->stats.maxParallelNodes = levelWidth.empty() ? 0 : *std::max_element(levelWidth.begin(), levelWidth.end());
+
+    cl_context context = this->interface->getContext();
+    cl_device_id device = this->interface->getDevice();
+    cl_command_queue_properties supported = 0;
+    clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(supported), &supported, NULL);
+    bool outOfOrder = supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+    size_t numQueues = outOfOrder ? 1 : std::min<size_t>(std::max<size_t>(this->stats.maxParallelNodes, 1), 4);
+    for (size_t i = 0 ; i < numQueues ; i++){
+        cl_int result;
+        cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, 0};
+        cl_command_queue queue = clCreateCommandQueueWithProperties(context, device,
+                                                                    outOfOrder ? properties : NULL,
+                                                                    &result);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't create graph queue: "
+                             << getOpenCLErrorName(result));
+            return -1;
+        }
+        this->queues.push_back(queue);
+    }
+    for (size_t n = 0 ; n < this->nodes.size() ; n++){
+        this->nodes[n].queue = this->queues[slotInLevel[n] % this->queues.size()];
+    }
+    return 0;
+}
+
+int OpenCLGraph::createKernels(){
+    for (GraphNode& node : this->nodes){
+        cl_int result;
+        // A kernel object per node: arguments are bound here once and
+        // never touched again on replay.
+        node.kernel = clCreateKernel(this->interface->getProgram(), node.kernelName.c_str(), &result);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't create kernel " << node.kernelName << ": "
+                             << getOpenCLErrorName(result));
+            return -1;
+        }
+        OpenCLKernelArgs args;
+        for (cl_uint i = 0 ; i < node.args.size() ; i++){
+            const GraphArg& arg = node.args[i];
+            if (arg.buffer >= 0){
+                args.set(i, this->buffers[arg.buffer].handle);
+            } else if (arg.isLocal){
+                args.set(i, LocalMemory{arg.localBytes});
+            } else {
+                args.setBytes(i, arg.value.data(), arg.value.size());
+            }
+        }
+        cl_uint failedIndex = 0;
+        result = args.apply(node.kernel, &failedIndex);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't set arg " << failedIndex << " of " << node.kernelName << ": "
+                             << getOpenCLErrorName(result));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int OpenCLGraph::compile(){
+    try {
+        if (this->interface == nullptr || !this->interface->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        this->interface->requireDevice("graphs");
+        if (this->nodes.empty()){
+            throw std::runtime_error("Graph has no nodes");
+        }
+        this->cleanup();
+        this->stats = GraphStats();
+        this->buildDependencies();
+        if (this->allocateIntermediates() != 0){
+            throw std::runtime_error("Couldn't allocate intermediate buffers");
+        }
+        if (this->createQueues() != 0){
+            throw std::runtime_error("Couldn't create queues");
+        }
+        if (this->createKernels() != 0){
+            throw std::runtime_error("Couldn't create node kernels");
+        }
+        this->stats.nodes = this->nodes.size();
+        for (const GraphNode& node : this->nodes){
+            this->stats.edges += node.dependencies.size();
+        }
+        OPENCL_LOG_INFO("Graph compiled: " << this->stats.nodes << " nodes, " << this->stats.edges
+                        << " edges, " << this->stats.levels << " levels, " << this->stats.allocations
+                        << " allocations for " << this->stats.intermediateBuffers << " intermediate buffers");
+        this->compiled = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't compile graph: " << e.what());
+        this->errorEncountered = true;
+        this->cleanup();
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLGraph::refreshInterfaceBuffers(){
+    for (GraphBuffer& buffer : this->buffers){
+        if (!buffer.fromInterface){
+            continue;
+        }
+        cl_mem handle = this->interface->getBufferHandle(buffer.source.index, buffer.source.isInput);
+        if (handle == nullptr){
+            return -1;
+        }
+        if (handle != buffer.handle){
+            // resizeBuffer() released the old object; node kernels still
+            // hold it, so bind everything again.
+            clRetainMemObject(handle);
+            clReleaseMemObject(buffer.handle);
+            buffer.handle = handle;
+            this->compiled = false;
+        }
+    }
+    return 0;
+}
+
+OpenCLEvent OpenCLGraph::run(const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (this->refreshInterfaceBuffers() != 0){
+            throw std::runtime_error("Interface buffer no longer exists");
+        }
+        if (!this->compiled && this->compile() != 0){
+            throw std::runtime_error("Graph not compiled");
+        }
+        // Roots wait for the caller's events and the previous replay; every
+        // other node is ordered behind a root through its dependencies.
+        std::vector<OpenCLEvent> rootWait = waitList;
+        if (this->lastRun.isValid()){
+            rootWait.push_back(this->lastRun);
+        }
+        std::vector<OpenCLEvent> events(this->nodes.size());
+        std::vector<cl_event> sinks;
+        for (size_t n = 0 ; n < this->nodes.size() ; n++){
+            GraphNode& node = this->nodes[n];
+            std::vector<cl_event> waitHandles;
+            if (node.dependencies.empty()){
+                waitHandles = OpenCLEvent::toHandles(rootWait);
+            }
+            for (int dependency : node.dependencies){
+                waitHandles.push_back(events[dependency].get());
+            }
+            cl_event event = nullptr;
+            cl_int result = clEnqueueNDRangeKernel(node.queue, node.kernel, node.workDimensions, NULL,
+                                                   node.globalWorkSize, NULL, waitHandles.size(),
+                                                   waitHandles.empty() ? NULL : waitHandles.data(),
+                                                   &event);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't enqueue " + node.kernelName + ": " +
+                                         this->interface->getCodeExplanation(result));
+            }
+            events[n] = OpenCLEvent(event);
+            if (node.isSink){
+                sinks.push_back(event);
+            }
+        }
+        cl_event done = nullptr;
+        cl_int result = clEnqueueMarkerWithWaitList(this->queues[0], sinks.size(), sinks.data(), &done);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue graph marker: " + this->interface->getCodeExplanation(result));
+        }
+        for (cl_command_queue queue : this->queues){
+            clFlush(queue);
+        }
+        this->lastRun = OpenCLEvent(done);
+        this->stats.runs++;
+        return this->lastRun;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't run graph: " << e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+cl_mem OpenCLGraph::getBufferHandle(int buffer){
+    if (buffer < 0 || buffer >= (int)this->buffers.size()){
+        return nullptr;
+    }
+    return this->buffers[buffer].handle;
+}
+
+GraphStats OpenCLGraph::getStats(){
+    return this->stats;
+}
+
+void OpenCLGraph::cleanup(){
+    if (this->lastRun.isValid()){
+        this->lastRun.wait();
+        this->lastRun = OpenCLEvent();
+    }
+    for (GraphNode& node : this->nodes){
+        if (node.kernel != nullptr){
+            clReleaseKernel(node.kernel);
+            node.kernel = nullptr;
+        }
+        node.queue = nullptr;
+    }
+    for (cl_mem handle : this->allocations){
+        clReleaseMemObject(handle);
+    }
+    this->allocations.clear();
+    for (GraphBuffer& buffer : this->buffers){
+        if (!buffer.external){
+            buffer.handle = nullptr;
+        }
+    }
+    for (cl_command_queue queue : this->queues){
+        clReleaseCommandQueue(queue);
+    }
+    this->queues.clear();
+    this->compiled = false;
+}
@@ -0,0 +1,156 @@
+#ifndef OPENCL_GRAPH
+#define OPENCL_GRAPH
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <CL/opencl.hpp>
+
+#include "opencl_event.h"
+#include "opencl_kernel_args.h"
+
+class OpenCLInterface;
+
+enum class GraphAccess {
+    Read,
+    Write,
+    ReadWrite
+};
+
+// One kernel argument of a graph node: a graph buffer with its access
+// mode, a by-value argument, or a __local size.
+struct GraphArg {
+    int buffer = -1;
+    GraphAccess access = GraphAccess::Read;
+    std::vector<unsigned char> value = {};
+    bool isLocal = false;
+    size_t localBytes = 0;
+};
+
+inline GraphArg graphRead(int buffer){
+    GraphArg arg;
+    arg.buffer = buffer;
+    arg.access = GraphAccess::Read;
+    return arg;
+}
+
+inline GraphArg graphWrite(int buffer){
+    GraphArg arg;
+    arg.buffer = buffer;
+    arg.access = GraphAccess::Write;
+    return arg;
+}
+
+inline GraphArg graphReadWrite(int buffer){
+    GraphArg arg;
+    arg.buffer = buffer;
+    arg.access = GraphAccess::ReadWrite;
+    return arg;
+}
+
+template<typename T>
+GraphArg graphValue(const T& value){
+    static_assert(IsKernelArgValue<T>::value && !std::is_pointer<T>::value,
+                  "Graph values must be trivially copyable; pass buffers with graphRead/graphWrite");
+    GraphArg arg;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&value);
+    arg.value.assign(bytes, bytes + sizeof(T));
+    return arg;
+}
+
+inline GraphArg graphLocal(const LocalMemory& local){
+    GraphArg arg;
+    arg.isLocal = true;
+    arg.localBytes = local.sizeBytes;
+    return arg;
+}
+
+struct GraphBuffer {
+    size_t sizeBytes = 0;
+    cl_mem handle = nullptr;
+    bool external = false;
+    // Set for buffers added by BufferArg. The graph holds a reference to the
+    // handle and looks it up again before every run in case the interface
+    // reallocated the buffer.
+    bool fromInterface = false;
+    BufferArg source;
+    int allocation = -1;
+    int firstUse = -1;
+    int lastUse = -1;
+};
+
+struct GraphNode {
+    std::string kernelName = "";
+    cl_kernel kernel = nullptr;
+    cl_uint workDimensions = 1;
+    size_t globalWorkSize[3] = {1, 1, 1};
+    std::vector<GraphArg> args = {};
+    std::vector<int> dependencies = {};
+    bool isSink = true;
+    cl_command_queue queue = nullptr;
+};
+
+struct GraphStats {
+    size_t nodes = 0;
+    size_t edges = 0;
+    size_t levels = 0;
+    size_t maxParallelNodes = 0;
+    size_t intermediateBuffers = 0;
+    size_t allocations = 0;
+    size_t intermediateBytes = 0;
+    size_t allocatedBytes = 0;
+    size_t runs = 0;
+};
+
+// Kernels of one interface's program connected through buffers. Nodes are
+// added in program order; compile() derives read-after-write,
+// write-after-read and write-after-write dependencies from the declared
+// buffer accesses, gives every node its own kernel object with its
+// arguments bound once, and packs intermediate buffers into shared device
+// allocations whose lifetimes don't overlap. run() replays the graph,
+// chaining nodes with events on an out-of-order queue (or round-robin over
+// in-order queues when the device lacks one), so independent branches run
+// concurrently and intermediates never leave the device.
+class OpenCLGraph
+{
+    public:
+        bool errorEncountered;
+        explicit OpenCLGraph(OpenCLInterface *interface);
+        ~OpenCLGraph();
+        OpenCLGraph(const OpenCLGraph&) = delete;
+        OpenCLGraph& operator=(const OpenCLGraph&) = delete;
+        int addBuffer(size_t sizeBytes);
+        template<typename T>
+        int addBuffer(size_t numElements){
+            return this->addBuffer(numElements*sizeof(T));
+        }
+        int addBuffer(const BufferArg& buffer);
+        int addExternalBuffer(cl_mem handle, size_t sizeBytes);
+        int addNode(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize,
+                    std::vector<GraphArg> args);
+        int compile();
+        OpenCLEvent run(const std::vector<OpenCLEvent>& waitList = {});
+        cl_mem getBufferHandle(int buffer);
+        GraphStats getStats();
+        void cleanup();
+
+    private:
+        OpenCLInterface *interface;
+        std::vector<GraphBuffer> buffers = {};
+        std::vector<GraphNode> nodes = {};
+        std::vector<cl_mem> allocations = {};
+        std::vector<cl_command_queue> queues = {};
+        bool compiled = false;
+        OpenCLEvent lastRun;
+        GraphStats stats;
+
+        int refreshInterfaceBuffers();
+        int createQueues();
+        void addDependency(int node, int dependency);
+        void buildDependencies();
+        int allocateIntermediates();
+        int createKernels();
+};
+
+#endif // OPENCL_GRAPH
@@ -0,0 +1,108 @@
+#ifndef OPENCL_HANDLE
+#define OPENCL_HANDLE
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <CL/opencl.hpp>
+
+// Retain/release functions per OpenCL object type. Only the specializations
+// below exist, so wrapping anything else fails to compile.
+template<typename T>
+struct OpenCLHandleTraits;
+
+#define OPENCL_DEFINE_HANDLE(CL_TYPE, RETAIN, RELEASE)          \
+    template<>                                                  \
+    struct OpenCLHandleTraits<CL_TYPE> {                        \
+        static void retain(CL_TYPE handle){ RETAIN(handle); }   \
+        static void release(CL_TYPE handle){ RELEASE(handle); } \
+    };
+
+OPENCL_DEFINE_HANDLE(cl_context, clRetainContext, clReleaseContext)
+OPENCL_DEFINE_HANDLE(cl_command_queue, clRetainCommandQueue, clReleaseCommandQueue)
+OPENCL_DEFINE_HANDLE(cl_program, clRetainProgram, clReleaseProgram)
+OPENCL_DEFINE_HANDLE(cl_kernel, clRetainKernel, clReleaseKernel)
+OPENCL_DEFINE_HANDLE(cl_mem, clRetainMemObject, clReleaseMemObject)
+OPENCL_DEFINE_HANDLE(cl_sampler, clRetainSampler, clReleaseSampler)
+
+#undef OPENCL_DEFINE_HANDLE
+
+// Owning wrapper around an OpenCL object, with the same semantics as
+// OpenCLEvent: copies retain, the last owner releases, moves transfer.
+// It converts to the raw handle so it can be passed to the C API directly.
+template<typename T>
+class OpenCLHandle
+{
+    public:
+        OpenCLHandle(){
+        }
+
+        explicit OpenCLHandle(T handle){
+            this->handle = handle;
+        }
+
+        OpenCLHandle(const OpenCLHandle& other){
+            this->handle = other.handle;
+            if (this->handle != nullptr){
+                OpenCLHandleTraits<T>::retain(this->handle);
+            }
+        }
+
+        OpenCLHandle(OpenCLHandle&& other) noexcept {
+            this->handle = other.handle;
+            other.handle = nullptr;
+        }
+
+        OpenCLHandle& operator=(const OpenCLHandle& other){
+            if (this != &other){
+                if (other.handle != nullptr){
+                    OpenCLHandleTraits<T>::retain(other.handle);
+                }
+                this->reset(other.handle);
+            }
+            return *this;
+        }
+
+        OpenCLHandle& operator=(OpenCLHandle&& other) noexcept {
+            if (this != &other){
+                this->reset(other.handle);
+                other.handle = nullptr;
+            }
+            return *this;
+        }
+
+        ~OpenCLHandle(){
+            this->reset();
+        }
+
+        // Takes ownership of `handle`, releasing the current one.
+        void reset(T handle = nullptr){
+            if (this->handle != nullptr){
+                OpenCLHandleTraits<T>::release(this->handle);
+            }
+            this->handle = handle;
+        }
+
+        // Gives up ownership without releasing.
+        T detach(){
+            T handle = this->handle;
+            this->handle = nullptr;
+            return handle;
+        }
+
+        T get() const {
+            return this->handle;
+        }
+
+        bool isValid() const {
+            return this->handle != nullptr;
+        }
+
+        operator T() const {
+            return this->handle;
+        }
+
+    private:
+        T handle = nullptr;
+};
+
+#endif // OPENCL_HANDLE
@@ -0,0 +1,463 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "opencl_host_executor.h"
+#include "opencl_log.h"
+
+// Hot loops are compiled once per vector extension on x86-64 and resolved
+// to the widest one the CPU has when the library is loaded. Elsewhere the
+// build's baseline (NEON on AArch64) is used.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define OPENCL_HOST_VECTORIZED __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define OPENCL_HOST_VECTORIZED
+#endif
+
+#if defined(__GNUC__)
+#define OPENCL_HOST_INLINE inline __attribute__((always_inline))
+#else
+#define OPENCL_HOST_INLINE inline
+#endif
+
+namespace {
+
+// Enough independent accumulators to fill a 512-bit register, so reductions
+// vectorize without reassociating the caller's loop.
+const size_t numLanes = 16;
+
+// Writes out[i] = op(i) in blocks of numLanes independent elements, a shape
+// the compiler vectorizes at -O2, followed by a scalar tail.
+template<typename Op>
+OPENCL_HOST_INLINE void mapLanes(float *__restrict out, size_t n, Op op){
+    size_t i = 0;
+    for ( ; i + numLanes <= n ; i += numLanes){
+        for (size_t k = 0 ; k < numLanes ; k++){
+            out[i + k] = op(i + k);
+        }
+    }
+    for ( ; i < n ; i++){
+        out[i] = op(i);
+    }
+}
+
+OPENCL_HOST_VECTORIZED
+void mapRange(HostMapOp op, const float *__restrict a, const float *__restrict b,
+              float *__restrict out, size_t n, float alpha, float beta){
+    switch (op){
+        case HostMapOp::Copy:
+            mapLanes(out, n, [=](size_t i){ return a[i]; });
+            break;
+        case HostMapOp::Add:
+            mapLanes(out, n, [=](size_t i){ return a[i] + b[i]; });
+            break;
+        case HostMapOp::Subtract:
+            mapLanes(out, n, [=](size_t i){ return a[i] - b[i]; });
+            break;
+        case HostMapOp::Multiply:
+            mapLanes(out, n, [=](size_t i){ return a[i] * b[i]; });
+            break;
+        case HostMapOp::Min:
+            mapLanes(out, n, [=](size_t i){ return a[i] < b[i] ? a[i] : b[i]; });
+            break;
+        case HostMapOp::Max:
+            mapLanes(out, n, [=](size_t i){ return a[i] > b[i] ? a[i] : b[i]; });
+            break;
+        case HostMapOp::Affine:
+            mapLanes(out, n, [=](size_t i){ return alpha*a[i] + beta; });
+            break;
+        case HostMapOp::Blend:
+            mapLanes(out, n, [=](size_t i){ return alpha*a[i] + beta*b[i]; });
+            break;
+    }
+}
+
+OPENCL_HOST_VECTORIZED
+void accumulateRow(float *__restrict out, const float *__restrict in, float weight, size_t n){
+    mapLanes(out, n, [=](size_t i){ return out[i] + weight*in[i]; });
+}
+
+void convolveRows(const float *in, float *out, size_t width, size_t height,
+                  const float *weights, size_t radius, size_t rowBegin, size_t rowEnd){
+    long r = (long)radius;
+    long w = (long)width;
+    size_t diameter = 2*radius + 1;
+    for (size_t y = rowBegin ; y < rowEnd ; y++){
+        float *row = out + y*width;
+        std::fill(row, row + width, 0.0f);
+        for (long ky = -r ; ky <= r ; ky++){
+            long sy = std::min(std::max((long)y + ky, 0L), (long)height - 1);
+            const float *source = in + sy*width;
+            for (long kx = -r ; kx <= r ; kx++){
+                float weight = weights[(ky + r)*diameter + (kx + r)];
+                // Columns whose tap stays inside the row take the vector
+                // path; the few at either edge clamp to the border pixel.
+                long first = std::min(std::max(-kx, 0L), w);
+                long last = std::max(std::min(w - kx, w), first);
+                accumulateRow(row + first, source + first + kx, weight, last - first);
+                for (long x = 0 ; x < first ; x++){
+                    row[x] += weight*source[std::min(std::max(x + kx, 0L), w - 1)];
+                }
+                for (long x = last ; x < w ; x++){
+                    row[x] += weight*source[std::min(std::max(x + kx, 0L), w - 1)];
+                }
+            }
+        }
+    }
+}
+
+template<typename T>
+OPENCL_HOST_INLINE T reduceLanes(const T *__restrict data, size_t n, ReduceOp op){
+    T lanes[numLanes];
+    for (size_t k = 0 ; k < numLanes ; k++){
+        lanes[k] = op == ReduceOp::Sum ? T(0) : data[0];
+    }
+    size_t i = 0;
+    if (op == ReduceOp::Sum){
+        for ( ; i + numLanes <= n ; i += numLanes){
+            for (size_t k = 0 ; k < numLanes ; k++){
+                lanes[k] += data[i + k];
+            }
+        }
+    } else if (op == ReduceOp::Min){
+        for ( ; i + numLanes <= n ; i += numLanes){
+            for (size_t k = 0 ; k < numLanes ; k++){
+                lanes[k] = data[i + k] < lanes[k] ? data[i + k] : lanes[k];
+            }
+        }
+    } else {
+        for ( ; i + numLanes <= n ; i += numLanes){
+            for (size_t k = 0 ; k < numLanes ; k++){
+                lanes[k] = data[i + k] > lanes[k] ? data[i + k] : lanes[k];
+            }
+        }
+    }
+    for ( ; i < n ; i++){
+        size_t k = i % numLanes;
+        lanes[k] = op == ReduceOp::Sum ? lanes[k] + data[i]
+                 : op == ReduceOp::Min ? std::min(lanes[k], data[i])
+                 : std::max(lanes[k], data[i]);
+    }
+    T result = lanes[0];
+    for (size_t k = 1 ; k < numLanes ; k++){
+        result = op == ReduceOp::Sum ? result + lanes[k]
+               : op == ReduceOp::Min ? std::min(result, lanes[k])
+               : std::max(result, lanes[k]);
+    }
+    return result;
+}
+
+OPENCL_HOST_VECTORIZED
+float reduceRange(const float *data, size_t n, ReduceOp op){
+    return reduceLanes(data, n, op);
+}
+
+OPENCL_HOST_VECTORIZED
+cl_int reduceRange(const cl_int *data, size_t n, ReduceOp op){
+    return reduceLanes(data, n, op);
+}
+
+OPENCL_HOST_VECTORIZED
+cl_uint reduceRange(const cl_uint *data, size_t n, ReduceOp op){
+    return reduceLanes(data, n, op);
+}
+
+// Keeps tasks above the executor's minimum size but still hands every
+// thread a few of them, so uneven progress evens out.
+size_t chooseGrain(OpenCLHostExecutor *executor, size_t count, size_t elementsPerItem){
+    size_t grain = std::max<size_t>(executor->getMinTaskElements() / std::max<size_t>(elementsPerItem, 1), 1);
+    size_t balanced = (count + 4*executor->getNumThreads() - 1) / (4*executor->getNumThreads());
+    return std::max<size_t>(std::min(grain, balanced), 1);
+}
+
+template<typename T>
+int reduceParallel(OpenCLHostExecutor *executor, const T *data, size_t numElements,
+                   ReduceOp op, T *result){
+    if (numElements == 0){
+        OPENCL_LOG_ERROR("Can't reduce an empty range");
+        return -1;
+    }
+    size_t grain = chooseGrain(executor, numElements, 1);
+    std::vector<T> partials((numElements + grain - 1) / grain);
+    int status = executor->parallelFor(numElements, grain, [&](size_t begin, size_t end){
+        partials[begin / grain] = reduceRange(data + begin, end - begin, op);
+    });
+    if (status != 0){
+        return -1;
+    }
+    *result = reduceLanes(partials.data(), partials.size(), op);
+    return 0;
+}
+
+}
+
+OpenCLHostExecutor::OpenCLHostExecutor(HostExecutorOptions options){
+    if (options.numThreads == 0){
+        options.numThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    options.minTaskElements = std::max<size_t>(options.minTaskElements, 1);
+    this->options = options;
+    // The dispatching thread works too, so one fewer worker is started.
+    for (size_t i = 1 ; i < options.numThreads ; i++){
+        this->workers.emplace_back(&OpenCLHostExecutor::work, this);
+    }
+    this->stats.threads = options.numThreads;
+    OPENCL_LOG_INFO("Host executor started with " << options.numThreads << " threads ("
+                    << getVectorExtension() << ")");
+}
+
+OpenCLHostExecutor::~OpenCLHostExecutor(){
+    this->shutdown();
+}
+
+void OpenCLHostExecutor::work(){
+    unsigned long long seen = 0;
+    while (true){
+        Range *range = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(this->wakeMutex);
+            this->wake.wait(lock, [&]{ return this->stopping || this->generation != seen; });
+            if (this->stopping){
+                return;
+            }
+            seen = this->generation;
+            range = this->current;
+            if (range == nullptr){
+                continue;
+            }
+            range->activeWorkers++;
+        }
+        this->runTasks(range);
+        std::lock_guard<std::mutex> lock(this->wakeMutex);
+        if (--range->activeWorkers == 0){
+            this->idle.notify_all();
+        }
+    }
+}
+
+void OpenCLHostExecutor::runTasks(Range *range){
+    while (true){
+        size_t task = range->nextTask.fetch_add(1);
+        if (task >= range->numTasks){
+            return;
+        }
+        size_t begin = task*range->grain;
+        size_t end = std::min(begin + range->grain, range->count);
+        try {
+            (*range->body)(begin, end);
+        } catch (const std::exception& e){
+            std::lock_guard<std::mutex> lock(this->wakeMutex);
+            if (range->error.empty()){
+                range->error = e.what();
+            }
+        }
+    }
+}
+
+int OpenCLHostExecutor::dispatch(size_t count, size_t grain,
+                                 const std::function<void(size_t begin, size_t end)>& body){
+    if (count == 0){
+        return 0;
+    }
+    Range range;
+    range.body = &body;
+    range.count = count;
+    range.grain = std::max<size_t>(grain, 1);
+    range.numTasks = (count + range.grain - 1) / range.grain;
+    this->stats.tasks += range.numTasks;
+    if (range.numTasks > 1 && !this->workers.empty()){
+        {
+            std::lock_guard<std::mutex> lock(this->wakeMutex);
+            this->current = &range;
+            this->generation++;
+        }
+        this->wake.notify_all();
+        this->runTasks(&range);
+        std::unique_lock<std::mutex> lock(this->wakeMutex);
+        this->current = nullptr;
+        this->idle.wait(lock, [&]{ return range.activeWorkers == 0; });
+    } else {
+        this->runTasks(&range);
+    }
+    if (!range.error.empty()){
+        OPENCL_LOG_ERROR("Host task failed: " << range.error);
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLHostExecutor::parallelFor(size_t count, size_t grain,
+                                    const std::function<void(size_t begin, size_t end)>& body){
+    std::lock_guard<std::mutex> lock(this->runMutex);
+    return this->dispatch(count, grain, body);
+}
+
+int OpenCLHostExecutor::run(const std::string& name, const HostKernel& kernel,
+                            const HostKernelArgs& args){
+    std::lock_guard<std::mutex> lock(this->runMutex);
+    auto start = std::chrono::steady_clock::now();
+    cl_uint dimensions = std::min<cl_uint>(std::max<cl_uint>(args.workDimensions, 1), 3);
+    size_t outer = args.globalWorkSize[dimensions - 1];
+    size_t inner = 1;
+    for (cl_uint i = 0 ; i + 1 < dimensions ; i++){
+        inner *= args.globalWorkSize[i];
+    }
+    size_t grain = std::max<size_t>(this->options.minTaskElements / std::max<size_t>(inner, 1), 1);
+    size_t balanced = (outer + 4*this->options.numThreads - 1) / (4*this->options.numThreads);
+    grain = std::max<size_t>(std::min(grain, balanced), 1);
+    int status = this->dispatch(outer, grain, [&](size_t begin, size_t end){
+        kernel(args, begin, end);
+    });
+    if (status != 0){
+        OPENCL_LOG_ERROR("Host kernel " << name << " failed");
+        return -1;
+    }
+    this->stats.launches++;
+    this->stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    OPENCL_LOG_DEBUG("Ran host kernel " << name << " over " << outer << " x " << inner << " items");
+    return 0;
+}
+
+size_t OpenCLHostExecutor::getNumThreads(){
+    return this->options.numThreads;
+}
+
+size_t OpenCLHostExecutor::getMinTaskElements(){
+    return this->options.minTaskElements;
+}
+
+const char* OpenCLHostExecutor::getVectorExtension(){
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")){
+        return "AVX-512";
+    }
+    if (__builtin_cpu_supports("avx2")){
+        return "AVX2";
+    }
+    return "SSE2";
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+HostExecutorStats OpenCLHostExecutor::getStats(){
+    std::lock_guard<std::mutex> lock(this->runMutex);
+    return this->stats;
+}
+
+void OpenCLHostExecutor::resetStats(){
+    std::lock_guard<std::mutex> lock(this->runMutex);
+    this->stats = HostExecutorStats();
+    this->stats.threads = this->options.numThreads;
+}
+
+void OpenCLHostExecutor::shutdown(){
+    {
+        std::lock_guard<std::mutex> lock(this->wakeMutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (std::thread& worker : this->workers){
+        if (worker.joinable()){
+            worker.join();
+        }
+    }
+    this->workers.clear();
+}
+
+int hostMap(OpenCLHostExecutor *executor, HostMapOp op, const float *a, const float *b,
+            float *out, size_t numElements, float alpha, float beta){
+    bool binary = op != HostMapOp::Copy && op != HostMapOp::Affine;
+    if (numElements == 0){
+        return 0;
+    }
+    if (a == nullptr || out == nullptr || (binary && b == nullptr)){
+        OPENCL_LOG_ERROR("Missing operand for host map");
+        return -1;
+    }
+    return executor->parallelFor(numElements, chooseGrain(executor, numElements, 1),
+                                 [&](size_t begin, size_t end){
+        mapRange(op, a + begin, binary ? b + begin : nullptr, out + begin, end - begin, alpha, beta);
+    });
+}
+
+int hostConvolve(OpenCLHostExecutor *executor, const float *in, float *out,
+                 size_t width, size_t height, const float *weights, size_t radius){
+    if (in == out){
+        OPENCL_LOG_ERROR("Host convolution can't run in place");
+        return -1;
+    }
+    if (width == 0 || height == 0){
+        return 0;
+    }
+    return executor->parallelFor(height, chooseGrain(executor, height, width*(2*radius + 1)),
+                                 [&](size_t begin, size_t end){
+        convolveRows(in, out, width, height, weights, radius, begin, end);
+    });
+}
+
+int hostReduce(OpenCLHostExecutor *executor, const float *data, size_t numElements,
+               ReduceOp op, float *result){
+    return reduceParallel(executor, data, numElements, op, result);
+}
+
+int hostReduce(OpenCLHostExecutor *executor, const cl_int *data, size_t numElements,
+               ReduceOp op, cl_int *result){
+    return reduceParallel(executor, data, numElements, op, result);
+}
+
+int hostReduce(OpenCLHostExecutor *executor, const cl_uint *data, size_t numElements,
+               ReduceOp op, cl_uint *result){
+    return reduceParallel(executor, data, numElements, op, result);
+}
+
+HostKernel makeHostMapKernel(HostMapOp op, float alpha, float beta){
+    return [op, alpha, beta](const HostKernelArgs& args, size_t begin, size_t end){
+        if (args.buffers.size() < 2){
+            throw std::runtime_error("Host map kernel needs an input and an output buffer");
+        }
+        bool binary = op != HostMapOp::Copy && op != HostMapOp::Affine;
+        if (binary && args.buffers.size() < 3){
+            throw std::runtime_error("Host map kernel needs two inputs for this operation");
+        }
+        // Rows or slices of a 2D or 3D range are contiguous runs of elements.
+        size_t itemsPerIndex = 1;
+        for (cl_uint i = 0 ; i + 1 < args.workDimensions ; i++){
+            itemsPerIndex *= args.globalWorkSize[i];
+        }
+        const HostBuffer& output = args.buffers.back();
+        begin *= itemsPerIndex;
+        end = std::min(end*itemsPerIndex, output.numElements);
+        if (begin >= end){
+            return;
+        }
+        const float *a = args.buffer<float>(0) + begin;
+        const float *b = binary ? args.buffer<float>(1) + begin : nullptr;
+        mapRange(op, a, b, static_cast<float*>(output.data) + begin, end - begin, alpha, beta);
+    };
+}
+
+HostKernel makeHostConvolutionKernel(std::vector<float> weights, size_t radius){
+    if (weights.size() != (2*radius + 1)*(2*radius + 1)){
+        OPENCL_LOG_ERROR("Convolution needs " << (2*radius + 1)*(2*radius + 1) << " weights, got "
+                         << weights.size());
+    }
+    return [weights, radius](const HostKernelArgs& args, size_t begin, size_t end){
+        size_t width = args.globalWorkSize[0];
+        size_t height = args.workDimensions > 1 ? args.globalWorkSize[1] : 1;
+        if (weights.size() != (2*radius + 1)*(2*radius + 1)){
+            throw std::runtime_error("Wrong number of convolution weights");
+        }
+        if (args.buffers.size() < 2 || args.buffers[0].numElements < width*height ||
+            args.buffers[1].numElements < width*height){
+            throw std::runtime_error("Host convolution kernel needs two width x height float buffers");
+        }
+        convolveRows(args.buffer<float>(0), args.buffer<float>(1), width, height,
+                     weights.data(), radius, begin, end);
+    };
+}
@@ -0,0 +1,148 @@
+#ifndef OPENCL_HOST_EXECUTOR
+#define OPENCL_HOST_EXECUTOR
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <CL/opencl.hpp>
+
+#include "opencl_primitives.h"
+#include "opencl_types.h"
+
+// One of the interface's buffers as a host kernel sees it: the caller's own
+// storage, which the kernel reads and writes in place.
+struct HostBuffer {
+    void *data = nullptr;
+    size_t numElements = 0;
+    size_t elementSize = sizeof(float);
+    const char* typeName = "float";
+};
+
+// Everything a host kernel launch gets. Buffers are in kernel argument
+// order, inputs before outputs, exactly as the device kernel receives them.
+// Scalar parameters are not forwarded; a host kernel captures them instead.
+struct HostKernelArgs {
+    std::vector<HostBuffer> buffers = {};
+    cl_uint workDimensions = 1;
+    size_t globalWorkSize[3] = {1, 1, 1};
+
+    template<typename T>
+    T* buffer(size_t index) const {
+        return static_cast<T*>(this->buffers.at(index).data);
+    }
+};
+
+// Host counterpart of a device kernel. It is called concurrently for
+// disjoint ranges [begin, end) of the outermost NDRange dimension (items
+// for 1D, rows for 2D, slices for 3D) and must cover the inner dimensions
+// itself.
+using HostKernel = std::function<void(const HostKernelArgs& args, size_t begin, size_t end)>;
+
+struct HostExecutorOptions {
+    // 0 uses every hardware thread.
+    size_t numThreads = 0;
+    // Ranges are not split into tasks smaller than this many elements.
+    size_t minTaskElements = 1 << 14;
+};
+
+struct HostExecutorStats {
+    size_t threads = 0;
+    size_t launches = 0;
+    size_t tasks = 0;
+    double elapsedSeconds = 0.0;
+};
+
+enum class HostMapOp {
+    Copy = 0,
+    Add = 1,
+    Subtract = 2,
+    Multiply = 3,
+    Min = 4,
+    Max = 5,
+    // alpha*a + beta
+    Affine = 6,
+    // alpha*a + beta*b
+    Blend = 7
+};
+
+// A fixed pool of worker threads that runs host kernels when no OpenCL
+// device is usable. parallelFor() cuts a range into tasks, which the
+// workers and the calling thread take from a shared counter until none are
+// left; only one range runs at a time. The built-in map, convolution and
+// reduction routines below are written as fixed-width lane loops the
+// compiler vectorizes, and on x86 are cloned for AVX-512, AVX2 and SSE2,
+// with the widest the CPU supports picked when the library loads.
+class OpenCLHostExecutor
+{
+    public:
+        OpenCLHostExecutor(HostExecutorOptions options = HostExecutorOptions());
+        ~OpenCLHostExecutor();
+        OpenCLHostExecutor(const OpenCLHostExecutor&) = delete;
+        OpenCLHostExecutor& operator=(const OpenCLHostExecutor&) = delete;
+
+        int parallelFor(size_t count, size_t grain,
+                        const std::function<void(size_t begin, size_t end)>& body);
+        int run(const std::string& name, const HostKernel& kernel, const HostKernelArgs& args);
+        size_t getNumThreads();
+        size_t getMinTaskElements();
+        static const char* getVectorExtension();
+        HostExecutorStats getStats();
+        void resetStats();
+        void shutdown();
+
+    private:
+        // Lives on the stack of the dispatching call, which only returns
+        // once no worker is inside it any more.
+        struct Range {
+            const std::function<void(size_t, size_t)> *body = nullptr;
+            size_t count = 0;
+            size_t grain = 1;
+            size_t numTasks = 0;
+            std::atomic<size_t> nextTask{0};
+            size_t activeWorkers = 0;
+            std::string error = "";
+        };
+
+        HostExecutorOptions options;
+        std::vector<std::thread> workers = {};
+        std::mutex runMutex;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        Range *current = nullptr;
+        unsigned long long generation = 0;
+        bool stopping = false;
+        HostExecutorStats stats;
+
+        void work();
+        void runTasks(Range *range);
+        int dispatch(size_t count, size_t grain,
+                     const std::function<void(size_t begin, size_t end)>& body);
+};
+
+int hostMap(OpenCLHostExecutor *executor, HostMapOp op, const float *a, const float *b,
+            float *out, size_t numElements, float alpha = 1.0f, float beta = 0.0f);
+int hostConvolve(OpenCLHostExecutor *executor, const float *in, float *out,
+                 size_t width, size_t height, const float *weights, size_t radius);
+int hostReduce(OpenCLHostExecutor *executor, const float *data, size_t numElements,
+               ReduceOp op, float *result);
+int hostReduce(OpenCLHostExecutor *executor, const cl_int *data, size_t numElements,
+               ReduceOp op, cl_int *result);
+int hostReduce(OpenCLHostExecutor *executor, const cl_uint *data, size_t numElements,
+               ReduceOp op, cl_uint *result);
+
+// Ready-made host kernels for registerHostKernel(). A map kernel reads one
+// or two float inputs and writes the last buffer, one element per work
+// item in any number of dimensions. A convolution kernel reads buffer 0 as
+// a width x height float image, writes buffer 1 and expects a 2D NDRange
+// of {width, height}.
+HostKernel makeHostMapKernel(HostMapOp op, float alpha = 1.0f, float beta = 0.0f);
+HostKernel makeHostConvolutionKernel(std::vector<float> weights, size_t radius);
+
+#endif // OPENCL_HOST_EXECUTOR
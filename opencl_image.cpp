@@ -0,0 +1,214 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include "opencl_image.h"
+
+OpenCLImageDesc makeImage2DDesc(void *data, size_t width, size_t height,
+                                cl_channel_order order, cl_channel_type type,
+                                size_t rowPitch){
+    OpenCLImageDesc desc;
+    desc.data = data;
+    desc.type = CL_MEM_OBJECT_IMAGE2D;
+    desc.width = width;
+    desc.height = height;
+    desc.rowPitch = rowPitch;
+    desc.format = {order, type};
+    return desc;
+}
+
+OpenCLImageDesc makeImage3DDesc(void *data, size_t width, size_t height, size_t depth,
+                                cl_channel_order order, cl_channel_type type,
+                                size_t rowPitch, size_t slicePitch){
+    OpenCLImageDesc desc = makeImage2DDesc(data, width, height, order, type, rowPitch);
+    desc.type = CL_MEM_OBJECT_IMAGE3D;
+    desc.depth = depth;
+    desc.slicePitch = slicePitch;
+    return desc;
+}
+
+OpenCLImageDesc makeImage2DArrayDesc(void *data, size_t width, size_t height, size_t arraySize,
+                                     cl_channel_order order, cl_channel_type type,
+                                     size_t rowPitch, size_t slicePitch){
+    OpenCLImageDesc desc = makeImage2DDesc(data, width, height, order, type, rowPitch);
+    desc.type = CL_MEM_OBJECT_IMAGE2D_ARRAY;
+    desc.arraySize = arraySize;
+    desc.slicePitch = slicePitch;
+    return desc;
+}
+
+size_t getImageChannelCount(cl_channel_order order){
+    // The x orders store their padding channel, so it counts towards the
+    // element size.
+    switch (order){
+        case CL_R:
+        case CL_A:
+        case CL_INTENSITY:
+        case CL_LUMINANCE:
+        case CL_DEPTH:
+            return 1;
+        case CL_RG:
+        case CL_RA:
+        case CL_Rx:
+        case CL_DEPTH_STENCIL:
+            return 2;
+        case CL_RGB:
+        case CL_RGx:
+        case CL_sRGB:
+            return 3;
+        case CL_RGBA:
+        case CL_BGRA:
+        case CL_ARGB:
+        case CL_ABGR:
+        case CL_RGBx:
+        case CL_sRGBA:
+        case CL_sBGRA:
+        case CL_sRGBx:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+size_t getImagePixelSize(const cl_image_format& format){
+    size_t channelSize;
+    if (format.image_channel_order == CL_DEPTH_STENCIL){
+        // 24-bit depth with 8-bit stencil, or float depth with the stencil
+        // in a second 32-bit word.
+        switch (format.image_channel_data_type){
+            case CL_UNORM_INT24:
+                return 4;
+            case CL_FLOAT:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+    switch (format.image_channel_data_type){
+        // Packed formats hold every channel in one element.
+        case CL_UNORM_SHORT_565:
+        case CL_UNORM_SHORT_555:
+            return 2;
+        case CL_UNORM_INT_101010:
+        case CL_UNORM_INT_101010_2:
+            return 4;
+        case CL_SNORM_INT8:
+        case CL_UNORM_INT8:
+        case CL_SIGNED_INT8:
+        case CL_UNSIGNED_INT8:
+            channelSize = 1;
+            break;
+        case CL_SNORM_INT16:
+        case CL_UNORM_INT16:
+        case CL_SIGNED_INT16:
+        case CL_UNSIGNED_INT16:
+        case CL_HALF_FLOAT:
+            channelSize = 2;
+            break;
+        // Depth values of 24 bits are stored in 32.
+        case CL_UNORM_INT24:
+        case CL_SIGNED_INT32:
+        case CL_UNSIGNED_INT32:
+        case CL_FLOAT:
+            channelSize = 4;
+            break;
+        default:
+            return 0;
+    }
+    return channelSize*getImageChannelCount(format.image_channel_order);
+}
+
+std::string getImageFormatName(const cl_image_format& format){
+    std::string order;
+    switch (format.image_channel_order){
+        case CL_R: order = "R"; break;
+        case CL_A: order = "A"; break;
+        case CL_RG: order = "RG"; break;
+        case CL_RA: order = "RA"; break;
+        case CL_RGB: order = "RGB"; break;
+        case CL_RGBA: order = "RGBA"; break;
+        case CL_BGRA: order = "BGRA"; break;
+        case CL_ARGB: order = "ARGB"; break;
+        case CL_INTENSITY: order = "INTENSITY"; break;
+        case CL_LUMINANCE: order = "LUMINANCE"; break;
+        case CL_Rx: order = "Rx"; break;
+        case CL_RGx: order = "RGx"; break;
+        case CL_RGBx: order = "RGBx"; break;
+        case CL_DEPTH: order = "DEPTH"; break;
+        case CL_DEPTH_STENCIL: order = "DEPTH_STENCIL"; break;
+        case CL_sRGB: order = "sRGB"; break;
+        case CL_sRGBx: order = "sRGBx"; break;
+        case CL_sRGBA: order = "sRGBA"; break;
+        case CL_sBGRA: order = "sBGRA"; break;
+        case CL_ABGR: order = "ABGR"; break;
+        default: order = "order " + std::to_string(format.image_channel_order); break;
+    }
+    std::string type;
+    switch (format.image_channel_data_type){
+        case CL_SNORM_INT8: type = "SNORM_INT8"; break;
+        case CL_SNORM_INT16: type = "SNORM_INT16"; break;
+        case CL_UNORM_INT8: type = "UNORM_INT8"; break;
+        case CL_UNORM_INT16: type = "UNORM_INT16"; break;
+        case CL_UNORM_SHORT_565: type = "UNORM_SHORT_565"; break;
+        case CL_UNORM_SHORT_555: type = "UNORM_SHORT_555"; break;
+        case CL_UNORM_INT_101010: type = "UNORM_INT_101010"; break;
+        case CL_UNORM_INT_101010_2: type = "UNORM_INT_101010_2"; break;
+        case CL_UNORM_INT24: type = "UNORM_INT24"; break;
+        case CL_SIGNED_INT8: type = "SIGNED_INT8"; break;
+        case CL_SIGNED_INT16: type = "SIGNED_INT16"; break;
+        case CL_SIGNED_INT32: type = "SIGNED_INT32"; break;
+        case CL_UNSIGNED_INT8: type = "UNSIGNED_INT8"; break;
+        case CL_UNSIGNED_INT16: type = "UNSIGNED_INT16"; break;
+        case CL_UNSIGNED_INT32: type = "UNSIGNED_INT32"; break;
+        case CL_HALF_FLOAT: type = "HALF_FLOAT"; break;
+        case CL_FLOAT: type = "FLOAT"; break;
+        default: type = "type " + std::to_string(format.image_channel_data_type); break;
+    }
+    return "CL_" + order + "/CL_" + type;
+}
+
+void getImageRegion(const OpenCLImageDesc& desc, size_t *region){
+    region[0] = desc.width;
+    region[1] = 1;
+    region[2] = 1;
+    switch (desc.type){
+        case CL_MEM_OBJECT_IMAGE1D_ARRAY:
+            region[1] = desc.arraySize;
+            break;
+        case CL_MEM_OBJECT_IMAGE2D:
+            region[1] = desc.height;
+            break;
+        case CL_MEM_OBJECT_IMAGE2D_ARRAY:
+            region[1] = desc.height;
+            region[2] = desc.arraySize;
+            break;
+        case CL_MEM_OBJECT_IMAGE3D:
+            region[1] = desc.height;
+            region[2] = desc.depth;
+            break;
+        default:
+            break;
+    }
+}
+
+size_t getImageRowPitch(const OpenCLImageDesc& desc){
+    return desc.rowPitch != 0 ? desc.rowPitch : desc.width*getImagePixelSize(desc.format);
+}
+
+size_t getImageSlicePitch(const OpenCLImageDesc& desc){
+    if (desc.slicePitch != 0){
+        return desc.slicePitch;
+    }
+    size_t region[3];
+    getImageRegion(desc, region);
+    // For a 1D array each "slice" is one row.
+    return desc.type == CL_MEM_OBJECT_IMAGE1D_ARRAY ? getImageRowPitch(desc)
+                                                    : getImageRowPitch(desc)*region[1];
+}
+
+size_t getImageSizeBytes(const OpenCLImageDesc& desc){
+    size_t region[3];
+    getImageRegion(desc, region);
+    if (desc.type == CL_MEM_OBJECT_IMAGE1D_ARRAY){
+        return getImageRowPitch(desc)*region[1];
+    }
+    return getImageSlicePitch(desc)*region[2];
+}
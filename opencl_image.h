@@ -0,0 +1,45 @@
+#ifndef OPENCL_IMAGE
+#define OPENCL_IMAGE
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <string>
+#include <CL/opencl.hpp>
+
+// Host-side description of an image argument. Height, depth and arraySize
+// are ignored by image types that don't have them. rowPitch and slicePitch
+// describe the host memory layout in bytes; zero means tightly packed.
+struct OpenCLImageDesc {
+    void *data = nullptr;
+    cl_mem_object_type type = CL_MEM_OBJECT_IMAGE2D;
+    size_t width = 0;
+    size_t height = 1;
+    size_t depth = 1;
+    size_t arraySize = 1;
+    size_t rowPitch = 0;
+    size_t slicePitch = 0;
+    cl_image_format format = {CL_RGBA, CL_UNORM_INT8};
+};
+
+OpenCLImageDesc makeImage2DDesc(void *data, size_t width, size_t height,
+                                cl_channel_order order, cl_channel_type type,
+                                size_t rowPitch = 0);
+OpenCLImageDesc makeImage3DDesc(void *data, size_t width, size_t height, size_t depth,
+                                cl_channel_order order, cl_channel_type type,
+                                size_t rowPitch = 0, size_t slicePitch = 0);
+OpenCLImageDesc makeImage2DArrayDesc(void *data, size_t width, size_t height, size_t arraySize,
+                                     cl_channel_order order, cl_channel_type type,
+                                     size_t rowPitch = 0, size_t slicePitch = 0);
+
+// Both return 0 for a channel order or data type they don't know.
+size_t getImageChannelCount(cl_channel_order order);
+size_t getImagePixelSize(const cl_image_format& format);
+std::string getImageFormatName(const cl_image_format& format);
+
+// Region of the whole image as passed to clEnqueueRead/Write/MapImage.
+void getImageRegion(const OpenCLImageDesc& desc, size_t *region);
+size_t getImageRowPitch(const OpenCLImageDesc& desc);
+size_t getImageSlicePitch(const OpenCLImageDesc& desc);
+size_t getImageSizeBytes(const OpenCLImageDesc& desc);
+
+#endif // OPENCL_IMAGE
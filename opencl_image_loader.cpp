@@ -0,0 +1,370 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "opencl_interface.h"
+#include "opencl_image_loader.h"
+
+static const char* imageLoaderSource = R"CLC(
+__kernel void decode_to_float(__global const uchar* pixels, __global float* values, const float scale){
+    size_t i = get_global_id(0);
+    values[i] = pixels[i]*scale;
+}
+
+__kernel void encode_from_float(__global const float* values, __global uchar* pixels, const float scale){
+    size_t i = get_global_id(0);
+    pixels[i] = convert_uchar_sat_rte(values[i]*scale);
+}
+)CLC";
+
+OpenCLImageLoader::OpenCLImageLoader(OpenCLInterface *interface,
+                                     size_t width,
+                                     size_t height,
+                                     size_t channels,
+                                     size_t maxBatchSize,
+                                     size_t numThreads,
+                                     size_t depth){
+    this->isInitialized = false;
+    this->errorEncountered = false;
+    this->interface = interface;
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    this->maxBatchSize = maxBatchSize;
+    this->numThreads = numThreads != 0 ? numThreads
+                                       : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    try {
+        if (interface == nullptr || !interface->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        interface->requireDevice("the image loader");
+        if (channels != 1 && channels != 3){
+            throw std::runtime_error("Only 1 (grayscale) and 3 (colour) channel images are supported");
+        }
+        if (width == 0 || height == 0 || maxBatchSize == 0 || depth == 0){
+            throw std::runtime_error("Image size, batch size and depth must not be zero");
+        }
+        this->context = interface->getContext();
+        this->device = interface->getDevice();
+        HostExecutorOptions poolOptions;
+        poolOptions.numThreads = this->numThreads;
+        this->pool.reset(new OpenCLHostExecutor(poolOptions));
+
+        cl_int result;
+        this->queue = clCreateCommandQueueWithProperties(this->context, this->device, 0, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create command queue: " + interface->getCodeExplanation(result));
+        }
+        if (this->createProgram() != 0){
+            throw std::runtime_error("Couldn't build conversion kernels");
+        }
+        this->slots.resize(depth);
+        for (ImageLoaderSlot& slot : this->slots){
+            if (this->createSlot(&slot, "decode_to_float") != 0){
+                throw std::runtime_error("Couldn't create staging buffers");
+            }
+        }
+        if (this->createSlot(&this->encodeSlot, "encode_from_float") != 0){
+            throw std::runtime_error("Couldn't create staging buffers");
+        }
+        OPENCL_LOG_INFO("Image loader created for " << maxBatchSize << " images of "
+                        << width << "x" << height << "x" << channels << " using "
+                        << this->numThreads << " threads");
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't create image loader: " << e.what());
+        this->errorEncountered = true;
+        this->cleanup();
+    }
+}
+
+OpenCLImageLoader::~OpenCLImageLoader(){
+    this->cleanup();
+}
+
+int OpenCLImageLoader::createProgram(){
+    cl_int result;
+    this->program = clCreateProgramWithSource(this->context, 1, &imageLoaderSource, NULL, &result);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't create program: " << getOpenCLErrorName(result));
+        return -1;
+    }
+    result = clBuildProgram(this->program, 1, &this->device, "", NULL, NULL);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't build program: " << getOpenCLErrorName(result));
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLImageLoader::createSlot(ImageLoaderSlot *slot, const char* kernelName){
+    try {
+        cl_int result;
+        size_t pixelBytes = this->maxBatchSize*this->getImageElements();
+        slot->kernel = clCreateKernel(this->program, kernelName, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create kernel: " + this->interface->getCodeExplanation(result));
+        }
+        // Pinned host memory, mapped once for the lifetime of the loader.
+        // Decoders write into the mapping and uploads read from it, so the
+        // driver can DMA without an intermediate copy.
+        slot->staging = clCreateBuffer(this->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                       pixelBytes, NULL, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create staging buffer: " + this->interface->getCodeExplanation(result));
+        }
+        slot->hostPixels = static_cast<unsigned char*>(
+            clEnqueueMapBuffer(this->queue, slot->staging, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                               0, pixelBytes, 0, NULL, NULL, &result));
+        if (result != CL_SUCCESS){
+            slot->hostPixels = nullptr;
+            throw std::runtime_error("Couldn't map staging buffer: " + this->interface->getCodeExplanation(result));
+        }
+        slot->pixels = clCreateBuffer(this->context, CL_MEM_READ_WRITE, pixelBytes, NULL, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create buffer: " + this->interface->getCodeExplanation(result));
+        }
+        if (slot != &this->encodeSlot){
+            slot->values = clCreateBuffer(this->context, CL_MEM_READ_WRITE,
+                                          pixelBytes*sizeof(float), NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create buffer: " + this->interface->getCodeExplanation(result));
+            }
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+size_t OpenCLImageLoader::getImageElements(){
+    return this->width*this->height*this->channels;
+}
+
+size_t OpenCLImageLoader::parallelFor(size_t count, const std::function<bool(size_t)>& task){
+    std::atomic<size_t> failures(0);
+    // One image per task: decode times vary too much for larger chunks.
+    int status = this->pool->parallelFor(count, 1, [&](size_t begin, size_t end){
+        for (size_t i = begin ; i < end ; i++){
+            if (!task(i)){
+                failures++;
+            }
+        }
+    });
+    return status == 0 ? failures.load() : count;
+}
+
+bool OpenCLImageLoader::decodeImage(const std::string& path, unsigned char *target){
+    size_t imageBytes = this->getImageElements();
+    try {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> encoded((std::istreambuf_iterator<char>(file)),
+                                           std::istreambuf_iterator<char>());
+        if (encoded.empty()){
+            throw std::runtime_error("Couldn't read " + path);
+        }
+        // imdecode only reallocates the destination when the decoded size
+        // or type differs, so a matching image is decoded in place.
+        cv::Mat decoded(this->height, this->width, this->channels == 1 ? CV_8UC1 : CV_8UC3, target);
+        cv::imdecode(encoded, this->channels == 1 ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR, &decoded);
+        if (decoded.empty()){
+            throw std::runtime_error("Couldn't decode " + path);
+        }
+        if (decoded.data != target){
+            throw std::runtime_error(path + " is " + std::to_string(decoded.cols) + "x" +
+                                     std::to_string(decoded.rows) + ", expected " +
+                                     std::to_string(this->width) + "x" + std::to_string(this->height));
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        std::memset(target, 0, imageBytes);
+        return false;
+    }
+    return true;
+}
+
+bool OpenCLImageLoader::encodeImage(const std::string& path, unsigned char *source){
+    try {
+        cv::Mat image(this->height, this->width, this->channels == 1 ? CV_8UC1 : CV_8UC3, source);
+        if (!cv::imwrite(path, image)){
+            throw std::runtime_error("Couldn't encode " + path);
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        return false;
+    }
+    return true;
+}
+
+OpenCLEvent OpenCLImageLoader::enqueueConvert(ImageLoaderSlot *slot, cl_mem input, cl_mem output,
+                                              size_t numElements, float scale,
+                                              const std::vector<OpenCLEvent>& waitList){
+    slot->args.set(0, input);
+    slot->args.set(1, output);
+    slot->args.set(2, scale);
+    cl_uint failedIndex = 0;
+    cl_int result = slot->args.apply(slot->kernel, &failedIndex);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't set conversion kernel arg " + std::to_string(failedIndex) + ": " +
+                                 this->interface->getCodeExplanation(result));
+    }
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+    cl_event event = nullptr;
+    result = clEnqueueNDRangeKernel(this->queue, slot->kernel, 1, NULL, &numElements, NULL,
+                                           waitHandles.size(),
+                                           waitHandles.empty() ? NULL : waitHandles.data(),
+                                           &event);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue conversion: " + this->interface->getCodeExplanation(result));
+    }
+    return OpenCLEvent(event);
+}
+
+OpenCLEvent OpenCLImageLoader::loadBatch(const std::vector<std::string>& paths, cl_mem *values){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Image loader not initialized!");
+        }
+        if (paths.empty() || paths.size() > this->maxBatchSize){
+            throw std::runtime_error("Batch must hold between 1 and " +
+                                     std::to_string(this->maxBatchSize) + " images");
+        }
+        ImageLoaderSlot *slot = &this->slots[this->nextBatch % this->slots.size()];
+        // The staging memory is only free once the upload of the batch that
+        // last used it has finished.
+        if (slot->ready.isValid() && slot->ready.wait() != CL_SUCCESS){
+            throw std::runtime_error("Previous batch in slot failed");
+        }
+
+        size_t imageBytes = this->getImageElements();
+        auto start = std::chrono::steady_clock::now();
+        size_t failures = this->parallelFor(paths.size(), [&](size_t i){
+            return this->decodeImage(paths[i], slot->hostPixels + i*imageBytes);
+        });
+        std::chrono::duration<double, std::milli> decodeTime = std::chrono::steady_clock::now() - start;
+
+        size_t batchBytes = paths.size()*imageBytes;
+        cl_event upload = nullptr;
+        cl_int result = clEnqueueWriteBuffer(this->queue, slot->pixels, CL_FALSE, 0, batchBytes,
+                                             slot->hostPixels, 0, NULL, &upload);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue upload: " + this->interface->getCodeExplanation(result));
+        }
+        slot->ready = this->enqueueConvert(slot, slot->pixels, slot->values, batchBytes,
+                                           1.0f/255.0f, {OpenCLEvent(upload)});
+        clFlush(this->queue);
+
+        this->stats.batches++;
+        this->stats.images += paths.size();
+        this->stats.failedImages += failures;
+        this->stats.uploadedBytes += batchBytes;
+        this->stats.decodeMs += decodeTime.count();
+        this->nextBatch++;
+        if (failures > 0){
+            OPENCL_LOG_ERROR(failures << " of " << paths.size()
+                             << " images failed to decode and were zeroed");
+            this->errorEncountered = true;
+        }
+        *values = slot->values;
+        return slot->ready;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't load image batch: " << e.what());
+        this->errorEncountered = true;
+    }
+    *values = nullptr;
+    return OpenCLEvent();
+}
+
+int OpenCLImageLoader::saveBatch(cl_mem values, const std::vector<std::string>& paths,
+                                 const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Image loader not initialized!");
+        }
+        if (paths.empty() || paths.size() > this->maxBatchSize){
+            throw std::runtime_error("Batch must hold between 1 and " +
+                                     std::to_string(this->maxBatchSize) + " images");
+        }
+        size_t imageBytes = this->getImageElements();
+        size_t batchBytes = paths.size()*imageBytes;
+        OpenCLEvent converted = this->enqueueConvert(&this->encodeSlot, values, this->encodeSlot.pixels,
+                                                     batchBytes, 255.0f, waitList);
+        cl_event convertedHandle = converted.get();
+        cl_int result = clEnqueueReadBuffer(this->queue, this->encodeSlot.pixels, CL_TRUE, 0, batchBytes,
+                                            this->encodeSlot.hostPixels, 1, &convertedHandle, NULL);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't read converted pixels: " + this->interface->getCodeExplanation(result));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t failures = this->parallelFor(paths.size(), [&](size_t i){
+            return this->encodeImage(paths[i], this->encodeSlot.hostPixels + i*imageBytes);
+        });
+        std::chrono::duration<double, std::milli> encodeTime = std::chrono::steady_clock::now() - start;
+        this->stats.downloadedBytes += batchBytes;
+        this->stats.encodeMs += encodeTime.count();
+        if (failures > 0){
+            throw std::runtime_error(std::to_string(failures) + " of " + std::to_string(paths.size()) +
+                                     " images failed to encode");
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't save image batch: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+ImageLoaderStats OpenCLImageLoader::getStats(){
+    return this->stats;
+}
+
+void OpenCLImageLoader::releaseSlot(ImageLoaderSlot *slot){
+    slot->ready.wait();
+    slot->ready = OpenCLEvent();
+    if (slot->hostPixels != nullptr){
+        clEnqueueUnmapMemObject(this->queue, slot->staging, slot->hostPixels, 0, NULL, NULL);
+        slot->hostPixels = nullptr;
+    }
+    for (cl_mem *handle : {&slot->staging, &slot->pixels, &slot->values}){
+        if (*handle != nullptr){
+            clReleaseMemObject(*handle);
+            *handle = nullptr;
+        }
+    }
+    if (slot->kernel != nullptr){
+        clReleaseKernel(slot->kernel);
+        slot->kernel = nullptr;
+    }
+    slot->args = OpenCLKernelArgs();
+}
+
+void OpenCLImageLoader::cleanup(){
+    if (this->queue != nullptr){
+        for (ImageLoaderSlot& slot : this->slots){
+            this->releaseSlot(&slot);
+        }
+        this->releaseSlot(&this->encodeSlot);
+        clFinish(this->queue);
+        clReleaseCommandQueue(this->queue);
+        this->queue = nullptr;
+    }
+    this->slots.clear();
+    if (this->program != nullptr){
+        clReleaseProgram(this->program);
+        this->program = nullptr;
+    }
+    this->pool.reset();
+    this->isInitialized = false;
+}
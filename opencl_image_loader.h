@@ -0,0 +1,97 @@
+#ifndef OPENCL_IMAGE_LOADER
+#define OPENCL_IMAGE_LOADER
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <CL/opencl.hpp>
+
+#include "opencl_event.h"
+#include "opencl_host_executor.h"
+#include "opencl_kernel_args.h"
+
+class OpenCLInterface;
+
+struct ImageLoaderStats {
+    size_t batches = 0;
+    size_t images = 0;
+    size_t failedImages = 0;
+    size_t uploadedBytes = 0;
+    size_t downloadedBytes = 0;
+    double decodeMs = 0.0;
+    double encodeMs = 0.0;
+};
+
+struct ImageLoaderSlot {
+    cl_mem staging = nullptr;
+    unsigned char *hostPixels = nullptr;
+    cl_mem pixels = nullptr;
+    cl_mem values = nullptr;
+    cl_kernel kernel = nullptr;
+    OpenCLKernelArgs args;
+    OpenCLEvent ready;
+};
+
+// Decodes batches of JPEG/PNG files on a pool of host threads straight into
+// pinned staging memory, uploads the 8-bit pixels asynchronously and
+// converts them to normalized floats on the device. Decoded pixels keep
+// OpenCV's layout: rows of interleaved channels, BGR for colour images.
+// Batches rotate over `depth` staging/device buffer sets, so the float
+// buffer of a batch stays valid until `depth` further batches are loaded.
+// saveBatch() is the reverse path: device floats are converted to 8-bit on
+// the device, read back through pinned memory and encoded in parallel.
+class OpenCLImageLoader
+{
+    public:
+        bool isInitialized;
+        bool errorEncountered;
+        OpenCLImageLoader(OpenCLInterface *interface,
+                          size_t width,
+                          size_t height,
+                          size_t channels,
+                          size_t maxBatchSize,
+                          size_t numThreads = 0,
+                          size_t depth = 2);
+        ~OpenCLImageLoader();
+        OpenCLImageLoader(const OpenCLImageLoader&) = delete;
+        OpenCLImageLoader& operator=(const OpenCLImageLoader&) = delete;
+        OpenCLEvent loadBatch(const std::vector<std::string>& paths, cl_mem *values);
+        int saveBatch(cl_mem values, const std::vector<std::string>& paths,
+                      const std::vector<OpenCLEvent>& waitList = {});
+        size_t getImageElements();
+        ImageLoaderStats getStats();
+        void cleanup();
+
+    private:
+        OpenCLInterface *interface;
+        cl_context context;
+        cl_device_id device;
+        cl_command_queue queue = nullptr;
+        cl_program program = nullptr;
+        size_t width;
+        size_t height;
+        size_t channels;
+        size_t maxBatchSize;
+        size_t numThreads;
+        // Decode and encode workers, started once and reused by every batch.
+        std::unique_ptr<OpenCLHostExecutor> pool;
+        std::vector<ImageLoaderSlot> slots = {};
+        ImageLoaderSlot encodeSlot;
+        size_t nextBatch = 0;
+        ImageLoaderStats stats;
+
+        int createProgram();
+        int createSlot(ImageLoaderSlot *slot, const char* kernelName);
+        void releaseSlot(ImageLoaderSlot *slot);
+        size_t parallelFor(size_t count, const std::function<bool(size_t)>& task);
+        bool decodeImage(const std::string& path, unsigned char *target);
+        bool encodeImage(const std::string& path, unsigned char *source);
+        OpenCLEvent enqueueConvert(ImageLoaderSlot *slot, cl_mem input, cl_mem output,
+                                   size_t numElements, float scale,
+                                   const std::vector<OpenCLEvent>& waitList);
+};
+
+#endif // OPENCL_IMAGE_LOADER
@@ -3,10 +3,136 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+#include <unordered_set>
 
 #include "opencl_interface.h"
 
+// Identifies one thread-safe session of one interface, so per-thread queue
+// caches never hand out a queue of a destroyed or reset interface. Live
+// generations are registered so threads can drop cache entries of sessions
+// that ended.
+static std::atomic<unsigned long long> threadQueueGenerations(0);
+static std::mutex liveGenerationsMutex;
+static std::unordered_set<unsigned long long> liveGenerations;
+
+static unsigned long long registerThreadQueueGeneration(){
+    unsigned long long generation = ++threadQueueGenerations;
+    std::lock_guard<std::mutex> lock(liveGenerationsMutex);
+    liveGenerations.insert(generation);
+    return generation;
+}
+
+static void retireThreadQueueGeneration(unsigned long long generation){
+    if (generation != 0){
+        std::lock_guard<std::mutex> lock(liveGenerationsMutex);
+        liveGenerations.erase(generation);
+    }
+}
+
 OpenCLInterface::OpenCLInterface(){
+    this->devicePolicy = DeviceSelectionPolicy::fromEnvironment();
+    this->construct();
+}
+
+OpenCLInterface::OpenCLInterface(cl_command_queue_properties queueProperties){
+    this->devicePolicy = DeviceSelectionPolicy::fromEnvironment();
+    this->queueProperties = queueProperties;
+    this->construct();
+}
+
+OpenCLInterface::OpenCLInterface(const DeviceSelectionPolicy& policy,
+                                 cl_command_queue_properties queueProperties){
+    this->devicePolicy = policy;
+    this->queueProperties = queueProperties;
+    this->construct();
+}
+
+OpenCLInterface::~OpenCLInterface(){
+    this->cleanup();
+}
+
+OpenCLInterface::OpenCLInterface(OpenCLInterface&& other) noexcept {
+    this->moveFrom(other);
+}
+
+OpenCLInterface& OpenCLInterface::operator=(OpenCLInterface&& other) noexcept {
+    if (this != &other){
+        this->cleanup();
+        this->moveFrom(other);
+    }
+    return *this;
+}
+
+void OpenCLInterface::moveFrom(OpenCLInterface& other){
+    // Thread queues point back at the interface that created them, so they
+    // don't follow it; threads get new ones from getThreadQueue().
+    other.dropThreadQueues();
+    this->isInitialized = other.isInitialized;
+    this->errorEncountered = other.errorEncountered;
+    this->platform = other.platform;
+    this->device = other.device;
+    this->context = std::move(other.context);
+    this->queue = std::move(other.queue);
+    this->queueProperties = other.queueProperties;
+    this->devicePolicy = other.devicePolicy;
+    this->program = std::move(other.program);
+    this->kernel = other.kernel;
+    this->kernels = std::move(other.kernels);
+    this->kernelArgs = std::move(other.kernelArgs);
+    this->samplers = std::move(other.samplers);
+    this->programSource = std::move(other.programSource);
+    this->programName = std::move(other.programName);
+    this->workDimensions = other.workDimensions;
+    this->globalWorkSize = other.globalWorkSize;
+    this->numArguments = other.numArguments;
+    this->buildOptions = std::move(other.buildOptions);
+    this->programCache = std::move(other.programCache);
+    this->programCacheKey = std::move(other.programCacheKey);
+    this->programFromBinary = other.programFromBinary;
+    this->inBuffers = std::move(other.inBuffers);
+    this->outBuffers = std::move(other.outBuffers);
+    this->inImages = std::move(other.inImages);
+    this->outImages = std::move(other.outImages);
+    this->inputImageDescs = std::move(other.inputImageDescs);
+    this->outputImageDescs = std::move(other.outputImageDescs);
+    this->supportedImageFormats = std::move(other.supportedImageFormats);
+    this->defaultAllocationPolicy = other.defaultAllocationPolicy;
+    this->inputAllocationPolicies = std::move(other.inputAllocationPolicies);
+    this->outputAllocationPolicies = std::move(other.outputAllocationPolicies);
+    this->memoryPool = std::move(other.memoryPool);
+    this->stagingRing = std::move(other.stagingRing);
+    this->autotuner = std::move(other.autotuner);
+    this->profiler = std::move(other.profiler);
+    this->localWorkSize = other.localWorkSize;
+    this->tuneOnLaunch = other.tuneOnLaunch;
+    this->threadSafe = other.threadSafe;
+    this->canCloneKernels = other.canCloneKernels;
+    this->threadQueueGeneration = 0;
+    this->dirtyRegionMergeGap = other.dirtyRegionMergeGap;
+    this->dirtyRegionStats = other.dirtyRegionStats;
+    this->hostExecutor = std::move(other.hostExecutor);
+    this->hostKernels = std::move(other.hostKernels);
+
+    // Leave the source empty so its destructor releases nothing.
+    other.isInitialized = false;
+    other.threadSafe = false;
+    other.kernel = nullptr;
+    other.kernels.clear();
+    other.kernelArgs.clear();
+    other.samplers.clear();
+    other.inBuffers.clear();
+    other.outBuffers.clear();
+    other.inImages.clear();
+    other.outImages.clear();
+    other.numArguments = 0;
+}
+
+void OpenCLInterface::construct(){
     this->isInitialized = false;
     this->errorEncountered = false;
     try {
@@ -23,15 +149,33 @@ OpenCLInterface::OpenCLInterface(){
             throw std::runtime_error("");
         }
 
-        std::cout << "Interface constructed successfully!\n\n";
+        this->profiler.setEnabled(this->queueProperties & CL_QUEUE_PROFILING_ENABLE);
+        OPENCL_LOG_INFO("Interface constructed successfully!");
         this->isInitialized = true;
     }
     catch (const std::exception& e){
-        std::cerr << "Error: Couldn't construct OpenCL interface" << e.what() << std::endl;
+        OPENCL_LOG_ERROR("Couldn't construct OpenCL interface: " << e.what());
         this->errorEncountered = true;
+        if (this->devicePolicy.hostFallback){
+            this->startHostFallback();
+        }
     }
 }
 
+void OpenCLInterface::startHostFallback(){
+    // Whatever part of the device setup succeeded is of no use now.
+    this->queue.reset();
+    this->context.reset();
+    this->platform = nullptr;
+    this->device = nullptr;
+    this->hostExecutor.reset(new OpenCLHostExecutor());
+    OPENCL_LOG_WARNING("No usable OpenCL device, running host kernels on "
+                       << this->hostExecutor->getNumThreads() << " threads ("
+                       << OpenCLHostExecutor::getVectorExtension() << ")");
+    this->errorEncountered = false;
+    this->isInitialized = true;
+}
+
 void OpenCLInterface::initialize(const char* programName,
                                  const char* source,
                                  cl_uint workDimensions,
@@ -40,6 +184,8 @@ void OpenCLInterface::initialize(const char* programName,
                                  std::vector<float*> inputPtrs,
                                  std::vector<size_t> outputNumElements,
                                  std::vector<float*> outputPtrs){
+    std::vector<OpenCLBufferDesc> inputs;
+    std::vector<OpenCLBufferDesc> outputs;
     try {
         if (inputNumElements.size() != inputPtrs.size()){
             throw std::runtime_error("Length of input data pointers and length of input sizes don't match!");
@@ -48,27 +194,64 @@ void OpenCLInterface::initialize(const char* programName,
         if (outputNumElements.size() != outputPtrs.size()){
             throw std::runtime_error("Length of output data pointers and length of output sizes don't match!");
         }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't initialize OpenCL interface: " << e.what());
+        this->errorEncountered = true;
+        return;
+    }
+    for (int i = 0 ; i < inputPtrs.size() ; i++){
+        inputs.push_back(makeBufferDesc(inputPtrs[i], inputNumElements[i]));
+    }
+    for (int i = 0 ; i < outputPtrs.size() ; i++){
+        outputs.push_back(makeBufferDesc(outputPtrs[i], outputNumElements[i]));
+    }
+    this->initialize(programName, source, workDimensions, globalWorkSize, inputs, outputs);
+}
 
+void OpenCLInterface::initialize(const char* programName,
+                                 const char* source,
+                                 cl_uint workDimensions,
+                                 size_t *globalWorkSize,
+                                 std::vector<OpenCLBufferDesc> inputs,
+                                 std::vector<OpenCLBufferDesc> outputs){
+    // Initializing again replaces everything a previous initialize() made.
+    this->releaseResources();
+    try {
         this->workDimensions = workDimensions;
         this->globalWorkSize = globalWorkSize;
 
-        int numElements;
-        float *dataPtr;
-        bool isInput;
-        for (int i = 0 ; i < inputPtrs.size() ; i++){
-            numElements = inputNumElements[i];
-            dataPtr = inputPtrs.at(i);
-            isInput = true;
-            if(this->newBuffer(numElements, dataPtr, isInput) != 0){
+        for (int i = 0 ; i < inputs.size() ; i++){
+            AllocationPolicy policy = i < this->inputAllocationPolicies.size()
+                                      ? this->inputAllocationPolicies[i]
+                                      : this->defaultAllocationPolicy;
+            if(this->newBuffer(inputs[i], true, policy) != 0){
+                throw std::runtime_error("");
+            }
+        }
+        for (int i = 0 ; i < outputs.size() ; i++){
+            AllocationPolicy policy = i < this->outputAllocationPolicies.size()
+                                      ? this->outputAllocationPolicies[i]
+                                      : this->defaultAllocationPolicy;
+            if(this->newBuffer(outputs[i], false, policy) != 0){
                 throw std::runtime_error("");
             }
         }
-        int numOutputs = outputPtrs.size();
-        for (int i = 0 ; i < numOutputs ; i++){
-            numElements = outputNumElements[i];
-            dataPtr = outputPtrs[i];
-            isInput = false;
-            if(this->newBuffer(numElements, dataPtr, isInput) != 0){
+        if (this->hostExecutor != nullptr){
+            if (!this->inputImageDescs.empty() || !this->outputImageDescs.empty()){
+                throw std::runtime_error("Images need an OpenCL device");
+            }
+            this->setSource(source, programName);
+            OPENCL_LOG_INFO("Interface initialized for host execution!");
+            this->isInitialized = true;
+            return;
+        }
+        for (int i = 0 ; i < this->inputImageDescs.size() ; i++){
+            if (this->newImage(this->inputImageDescs[i], true) != 0){
+                throw std::runtime_error("");
+            }
+        }
+        for (int i = 0 ; i < this->outputImageDescs.size() ; i++){
+            if (this->newImage(this->outputImageDescs[i], false) != 0){
                 throw std::runtime_error("");
             }
         }
@@ -87,45 +270,415 @@ void OpenCLInterface::initialize(const char* programName,
         if (this->setAllKernelArgs() != 0){
             throw std::runtime_error("");
         }
-        std::cout << "Interface initialized successfully!\n\n";
+        this->checkKernelArgTypes();
+        OPENCL_LOG_INFO("Interface initialized successfully!");
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't initialize OpenCL interface: " << e.what());
+        this->errorEncountered = true;
+        this->releaseResources();
+    }
+}
+
+int OpenCLInterface::reinitialize(const char* programName,
+                                  const char* source,
+                                  cl_uint workDimensions,
+                                  size_t *globalWorkSize,
+                                  std::vector<OpenCLBufferDesc> inputs,
+                                  std::vector<OpenCLBufferDesc> outputs){
+    if (this->hostExecutor != nullptr){
+        // Host buffers are the caller's own storage, so there is nothing
+        // worth keeping.
+        this->initialize(programName, source, workDimensions, globalWorkSize, inputs, outputs);
+        return this->inBuffers.size() == inputs.size() && this->outBuffers.size() == outputs.size() ? 0 : -1;
+    }
+    if (!this->program.isValid()){
+        this->initialize(programName, source, workDimensions, globalWorkSize, inputs, outputs);
+        return this->kernel != nullptr ? 0 : -1;
+    }
+    try {
+        for (const std::vector<OpenCLBuffer>* buffers : {&this->inBuffers, &this->outBuffers}){
+            for (const OpenCLBuffer& buffer : *buffers){
+                if (buffer.mapped != nullptr){
+                    throw std::runtime_error("Can't reinitialize while a buffer is mapped!");
+                }
+            }
+        }
+        this->dropThreadQueues();
+        bool rebuild = this->programSource != source || this->programName != programName;
+
+        // Buffers are laid out again in argument order, keeping every device
+        // allocation whose size and policy are unchanged. Images follow the
+        // buffers, so they are set aside and re-indexed afterwards.
+        std::vector<OpenCLBuffer> previousInputs = std::move(this->inBuffers);
+        std::vector<OpenCLBuffer> previousOutputs = std::move(this->outBuffers);
+        std::vector<OpenCLImage> inputImages = std::move(this->inImages);
+        std::vector<OpenCLImage> outputImages = std::move(this->outImages);
+        this->inBuffers.clear();
+        this->outBuffers.clear();
+        this->inImages.clear();
+        this->outImages.clear();
+        this->updateArgNum();
+        size_t kept = 0;
+        for (int i = 0 ; i < inputs.size() ; i++){
+            AllocationPolicy policy = i < this->inputAllocationPolicies.size()
+                                      ? this->inputAllocationPolicies[i]
+                                      : this->defaultAllocationPolicy;
+            if (this->reuseBuffer(i < previousInputs.size() ? &previousInputs[i] : nullptr,
+                                  inputs[i], true, policy)){
+                kept++;
+            } else if (this->newBuffer(inputs[i], true, policy) != 0){
+                throw std::runtime_error("Couldn't create input buffer " + std::to_string(i));
+            }
+        }
+        for (int i = 0 ; i < outputs.size() ; i++){
+            AllocationPolicy policy = i < this->outputAllocationPolicies.size()
+                                      ? this->outputAllocationPolicies[i]
+                                      : this->defaultAllocationPolicy;
+            if (this->reuseBuffer(i < previousOutputs.size() ? &previousOutputs[i] : nullptr,
+                                  outputs[i], false, policy)){
+                kept++;
+            } else if (this->newBuffer(outputs[i], false, policy) != 0){
+                throw std::runtime_error("Couldn't create output buffer " + std::to_string(i));
+            }
+        }
+        for (OpenCLBuffer& buffer : previousInputs){
+            this->releaseBufferHandle(&buffer);
+        }
+        for (OpenCLBuffer& buffer : previousOutputs){
+            this->releaseBufferHandle(&buffer);
+        }
+        for (OpenCLImage& image : inputImages){
+            image.index = this->numArguments;
+            this->inImages.push_back(std::move(image));
+            this->updateArgNum();
+        }
+        for (OpenCLImage& image : outputImages){
+            image.index = this->numArguments;
+            this->outImages.push_back(std::move(image));
+            this->updateArgNum();
+        }
+
+        this->workDimensions = workDimensions;
+        this->globalWorkSize = globalWorkSize;
+        if (rebuild){
+            this->releaseProgram();
+            this->setSource(source, programName);
+            if (this->createProgram() != 0 || this->buildProgram() != 0 || this->createKernel() != 0){
+                throw std::runtime_error("Couldn't rebuild program");
+            }
+            if (this->threadSafe){
+                // Keep the kernel registry complete for thread-safe mode.
+                this->getKernelNames();
+            }
+        }
+        if (this->setAllKernelArgs() != 0){
+            throw std::runtime_error("Couldn't bind buffers");
+        }
+        if (rebuild){
+            this->checkKernelArgTypes();
+        }
+        OPENCL_LOG_INFO("Interface reinitialized: kept " << kept << " of " << (inputs.size() + outputs.size())
+                        << " buffers, program " << (rebuild ? "rebuilt" : "kept"));
         this->isInitialized = true;
     } catch (const std::exception& e){
-        std::cerr << "Error: Couldn't initialize OpenCL interface: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR("Couldn't reinitialize OpenCL interface: " << e.what());
         this->errorEncountered = true;
+        this->releaseResources();
+        return -1;
+    }
+    return 0;
+}
+
+bool OpenCLInterface::reuseBuffer(OpenCLBuffer *previous, const OpenCLBufferDesc& desc, bool isInput,
+                                  AllocationPolicy policy){
+    if (previous == nullptr || previous->handle == nullptr){
+        return false;
+    }
+    AllocationPolicy resolved = this->resolveAllocationPolicy(policy);
+    if (previous->sizeBytes != desc.numElements*desc.elementSize ||
+        previous->elementSize != desc.elementSize || previous->policy != resolved){
+        return false;
     }
+    // A zero-copy buffer is tied to the host memory it was created on.
+    if (resolved == AllocationPolicy::UseHostPtr && previous->data != desc.data){
+        return false;
+    }
+    OpenCLBuffer buffer = *previous;
+    previous->handle = nullptr;
+    previous->hostStorage = nullptr;
+    previous->ownsHostStorage = false;
+    bool moved = buffer.data != desc.data;
+    buffer.index = this->numArguments;
+    buffer.numElements = desc.numElements;
+    buffer.typeName = desc.typeName;
+    buffer.data = desc.data;
+    buffer.dirty.clear();
+    if (isInput){
+        this->inBuffers.push_back(buffer);
+    } else {
+        this->outBuffers.push_back(buffer);
+    }
+    this->updateArgNum();
+    // The device keeps its contents unless the host data is somewhere else.
+    if (isInput && moved && desc.data != nullptr){
+        this->updateBuffer(this->inBuffers.size() - 1);
+    }
+    return true;
 }
 
-int OpenCLInterface::newBuffer(size_t numElements, float *data, bool isInput){
+int OpenCLInterface::newBuffer(const OpenCLBufferDesc& desc, bool isInput,
+                               AllocationPolicy policy){
     int index = this->numArguments;
-    size_t sizeBytes = numElements*sizeof(float);
-    cl_mem handle = nullptr;
+    size_t sizeBytes = desc.numElements*desc.elementSize;
 
     OpenCLBuffer buffer;
     buffer.index = index;
-    buffer.numElements = numElements;
+    buffer.numElements = desc.numElements;
     buffer.sizeBytes = sizeBytes;
+    buffer.elementSize = desc.elementSize;
+    buffer.typeName = desc.typeName;
     buffer.isInput = isInput;
-    buffer.data = data;
+    buffer.data = desc.data;
+    buffer.policy = this->resolveAllocationPolicy(policy);
     
+    if (this->allocateBufferHandle(&buffer) != 0){
+        return -1;
+    }
+    if (isInput){
+        this->inBuffers.push_back(buffer);
+    } else {
+        this->outBuffers.push_back(buffer);
+    }
+    this->updateArgNum();
+    return 0;
+}
+
+int OpenCLInterface::allocateBufferHandle(OpenCLBuffer *buffer){
+    cl_mem handle = nullptr;
+    if (this->hostExecutor != nullptr){
+        buffer->handle = nullptr;
+        return 0;
+    }
     try {
         int result;
-        result = this->createBuffer(sizeBytes, data, &handle, isInput);
-        if (result != 0){
-            std::string errorExplanation = this->getCodeExplanation(result);
-            throw std::runtime_error("Create buffer failed: " + errorExplanation);
+        if (this->memoryPool.isEnabled() && buffer->policy == AllocationPolicy::Copy){
+            handle = this->memoryPool.allocate(buffer->sizeBytes);
+            if (handle == nullptr){
+                throw std::runtime_error("Create buffer failed: pool allocation failed");
+            }
+            buffer->pooled = true;
+            if (buffer->isInput && buffer->data != nullptr){
+                result = clEnqueueWriteBuffer(this->queue, handle, CL_TRUE, 0, buffer->sizeBytes,
+                                              buffer->data, 0, NULL, NULL);
+                if (result != CL_SUCCESS){
+                    this->memoryPool.release(handle);
+                    throw std::runtime_error("Couldn't fill pooled buffer: " + this->getCodeExplanation(result));
+                }
+            }
+        } else {
+            buffer->pooled = false;
+            if (buffer->policy == AllocationPolicy::UseHostPtr && this->prepareHostStorage(buffer) != 0){
+                throw std::runtime_error("Couldn't allocate aligned host storage");
+            }
+            void *hostPtr = buffer->policy == AllocationPolicy::UseHostPtr ? buffer->hostStorage : buffer->data;
+            result = this->createBuffer(buffer->sizeBytes, hostPtr, &handle, buffer->isInput, buffer->policy);
+            if (result != 0){
+                std::string errorExplanation = this->getCodeExplanation(result);
+                throw std::runtime_error("Create buffer failed: " + errorExplanation);
+            }
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
+        if (buffer->ownsHostStorage){
+            freeHostMemory(buffer->hostStorage);
+            buffer->hostStorage = nullptr;
+            buffer->ownsHostStorage = false;
+        }
         this->errorEncountered = true;
         return -1;
     }
-    buffer.handle = handle;
-    if (isInput){
-        this->inBuffers.push_back(buffer);
+    buffer->handle = handle;
+    return 0;
+}
+
+void OpenCLInterface::releaseBufferHandle(OpenCLBuffer *buffer){
+    if (buffer->handle != nullptr){
+        if (buffer->pooled){
+            this->memoryPool.release(buffer->handle);
+        } else {
+            clReleaseMemObject(buffer->handle);
+        }
+        buffer->handle = nullptr;
+    }
+    if (buffer->ownsHostStorage){
+        freeHostMemory(buffer->hostStorage);
+        buffer->hostStorage = nullptr;
+        buffer->ownsHostStorage = false;
+    }
+}
+
+int OpenCLInterface::enableMemoryPool(size_t blockSize){
+    try {
+        this->requireDevice("the memory pool");
+        if (this->memoryPool.isEnabled()){
+            return 0;
+        }
+        if (this->memoryPool.initialize(this->context, this->device, blockSize) != 0){
+            throw std::runtime_error("Couldn't enable the memory pool");
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+MemoryPoolStats OpenCLInterface::getMemoryPoolStats(){
+    return this->memoryPool.getStats();
+}
+
+int OpenCLInterface::enableStagingRing(StagingRingOptions options){
+    try {
+        this->requireDevice("the staging ring");
+        if (this->stagingRing.initialize(this->context, this->queue, options) != 0){
+            throw std::runtime_error("Couldn't enable the staging ring");
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+StagingRingStats OpenCLInterface::getStagingRingStats(){
+    return this->stagingRing.getStats();
+}
+
+int OpenCLInterface::resizeBuffer(const int index, bool isInput, size_t numElements, float *data){
+    return this->resizeBuffer(index, isInput, makeBufferDesc(data, numElements));
+}
+
+int OpenCLInterface::resizeBuffer(const int index, bool isInput, OpenCLBufferDesc desc){
+    try {
+        OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(index) : &this->outBuffers.at(index);
+        if (buffer->mapped != nullptr){
+            throw std::runtime_error("Can't resize a mapped buffer!");
+        }
+        cl_mem oldHandle = buffer->handle;
+        this->releaseBufferHandle(buffer);
+        buffer->numElements = desc.numElements;
+        buffer->sizeBytes = desc.numElements*desc.elementSize;
+        buffer->elementSize = desc.elementSize;
+        buffer->typeName = desc.typeName;
+        buffer->data = desc.data;
+        buffer->dirty.clear();
+        if (this->allocateBufferHandle(buffer) != 0){
+            throw std::runtime_error("Couldn't reallocate buffer");
+        }
+        if (oldHandle != nullptr && this->rebindBuffer(oldHandle, buffer->handle) != 0){
+            throw std::runtime_error("Couldn't rebind resized buffer");
+        }
+        if (this->kernel != nullptr && this->setKernelArg(buffer->index, buffer->handle) != 0){
+            throw std::runtime_error("Couldn't rebind resized buffer");
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::rebindBuffer(cl_mem from, cl_mem to){
+    // Any kernel may still hold the released handle: the main kernel, ones
+    // bound with bindBuffer() or setKernelArgs(), and thread queue clones.
+    // The lock keeps cloneKernel() from copying a half-updated cache.
+    std::lock_guard<std::mutex> lock(this->threadMutex);
+    int status = 0;
+    for (auto& entry : this->kernelArgs){
+        if (entry.second.replace(from, to) == 0){
+            continue;
+        }
+        cl_uint failedIndex = 0;
+        cl_int result = entry.second.apply(entry.first, &failedIndex);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't rebind kernel arg " << failedIndex << ": "
+                             << getOpenCLErrorName(result));
+            status = -1;
+        }
+    }
+    for (auto& threadQueue : this->threadQueues){
+        threadQueue->replaceBuffer(from, to);
+    }
+    return status;
+}
+
+void OpenCLInterface::setAllocationPolicy(AllocationPolicy policy){
+    this->defaultAllocationPolicy = policy;
+}
+
+void OpenCLInterface::setImages(std::vector<OpenCLImageDesc> inputImages,
+                                std::vector<OpenCLImageDesc> outputImages){
+    this->inputImageDescs = inputImages;
+    this->outputImageDescs = outputImages;
+}
+
+void OpenCLInterface::setAllocationPolicies(std::vector<AllocationPolicy> inputPolicies,
+                                            std::vector<AllocationPolicy> outputPolicies){
+    this->inputAllocationPolicies = inputPolicies;
+    this->outputAllocationPolicies = outputPolicies;
+}
+
+bool OpenCLInterface::hasUnifiedMemory(){
+    cl_bool unified = CL_FALSE;
+    cl_int result = clGetDeviceInfo(this->device, CL_DEVICE_HOST_UNIFIED_MEMORY,
+                                    sizeof(cl_bool), &unified, NULL);
+    return result == CL_SUCCESS && unified == CL_TRUE;
+}
+
+AllocationPolicy OpenCLInterface::resolveAllocationPolicy(AllocationPolicy policy){
+    if (policy != AllocationPolicy::Auto){
+        return policy;
+    }
+    // Devices sharing physical memory with the host can work on the host
+    // allocation directly; discrete devices are better served by a copy.
+    return this->hasUnifiedMemory() ? AllocationPolicy::UseHostPtr : AllocationPolicy::Copy;
+}
+
+void* OpenCLInterface::allocateHostBytes(size_t sizeBytes){
+    const size_t pageSize = 4096;
+    size_t alignedBytes = ((sizeBytes + pageSize - 1) / pageSize) * pageSize;
+    if (alignedBytes == 0){
+        alignedBytes = pageSize;
+    }
+    return std::aligned_alloc(pageSize, alignedBytes);
+}
+
+void OpenCLInterface::freeHostMemory(void *data){
+    std::free(data);
+}
+
+int OpenCLInterface::prepareHostStorage(OpenCLBuffer *buffer){
+    const uintptr_t pageSize = 4096;
+    if (buffer->data != nullptr && reinterpret_cast<uintptr_t>(buffer->data) % pageSize == 0){
+        // Page-aligned caller memory is used as-is: true zero copy.
+        buffer->hostStorage = buffer->data;
+        buffer->ownsHostStorage = false;
+        return 0;
+    }
+    buffer->hostStorage = allocateHostBytes(buffer->sizeBytes);
+    if (buffer->hostStorage == nullptr){
+        return -1;
+    }
+    buffer->ownsHostStorage = true;
+    if (buffer->data != nullptr){
+        std::memcpy(buffer->hostStorage, buffer->data, buffer->sizeBytes);
     } else {
-        this->outBuffers.push_back(buffer);
+        std::memset(buffer->hostStorage, 0, buffer->sizeBytes);
     }
-    this->updateArgNum();
     return 0;
 }
 
@@ -136,237 +689,105 @@ void OpenCLInterface::updateArgNum(){
                          this->outImages.size();
 }
 
-int OpenCLInterface::newImage(int width, int height, int depth,
-                              float *data, bool isInput){
-    int index = this->numArguments;
-    cl_mem handle = nullptr;
+int OpenCLInterface::newImage(const OpenCLImageDesc& layout, bool isInput){
     OpenCLImage image;
-    image.format.image_channel_order = CL_RGB;
-    image.format.image_channel_data_type = CL_FLOAT;
-    image.desc = {0};
-    image.desc.image_type = CL_MEM_OBJECT_IMAGE2D;
-    image.desc.image_width = width;
-    image.desc.image_height = height;
-    image.desc.image_depth = depth;
-    image.index = index;
+    image.index = this->numArguments;
     image.isInput = isInput;
-    image.data = data;
-    
+    image.format = layout.format;
+    image.layout = layout;
+    image.data = layout.data;
+    image.desc = {0};
+    image.desc.image_type = layout.type;
+    image.desc.image_width = layout.width;
+    image.desc.image_height = layout.height;
+    image.desc.image_depth = layout.depth;
+    image.desc.image_array_size = layout.arraySize;
+    image.desc.image_row_pitch = layout.rowPitch;
+    image.desc.image_slice_pitch = layout.slicePitch;
+
     try {
-        int result;
-        result = this->createImage(&image.format, &image.desc, data, &handle, isInput);
-        if (result != 0){
-            std::string errorExplanation = this->getCodeExplanation(result);
-            throw std::runtime_error("Create buffer failed: " + errorExplanation);
+        if (getImagePixelSize(layout.format) == 0){
+            throw std::runtime_error("Unknown image format " + getImageFormatName(layout.format));
         }
+        if (!this->isImageFormatSupported(this->getImageFlags(isInput), layout.type, layout.format)){
+            throw std::runtime_error("Image format " + getImageFormatName(layout.format) +
+                                     " not supported by device");
+        }
+        cl_mem handle = nullptr;
+        if (this->createImage(&image.format, &image.desc, image.data, &handle, isInput) != 0){
+            throw std::runtime_error("Create image failed");
+        }
+        image.handle.reset(handle);
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
-    image.handle = handle;
     if (isInput){
-        this->inImages.push_back(image);
+        this->inImages.push_back(std::move(image));
     } else {
-        this->outImages.push_back(image);
+        this->outImages.push_back(std::move(image));
     }
     this->updateArgNum();
     return 0;
 }
 
+cl_mem_flags OpenCLInterface::getImageFlags(bool isInput){
+    return isInput ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY;
+}
+
+std::vector<cl_image_format> OpenCLInterface::getSupportedImageFormats(cl_mem_flags flags,
+                                                                       cl_mem_object_type type){
+    // The list only depends on the context, so it is queried once per
+    // flags/type pair.
+    auto key = std::make_pair(flags, type);
+    auto found = this->supportedImageFormats.find(key);
+    if (found != this->supportedImageFormats.end()){
+        return found->second;
+    }
+    std::vector<cl_image_format> formats;
+    cl_uint numFormats = 0;
+    cl_int result = clGetSupportedImageFormats(this->context, flags, type, 0, NULL, &numFormats);
+    if (result == CL_SUCCESS && numFormats > 0){
+        formats.resize(numFormats);
+        result = clGetSupportedImageFormats(this->context, flags, type, numFormats,
+                                            formats.data(), NULL);
+    }
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't query supported image formats: "
+                         << getOpenCLErrorName(result));
+        formats.clear();
+    }
+    this->supportedImageFormats[key] = formats;
+    return formats;
+}
+
+bool OpenCLInterface::isImageFormatSupported(cl_mem_flags flags, cl_mem_object_type type,
+                                             const cl_image_format& format){
+    for (const cl_image_format& supported : this->getSupportedImageFormats(flags, type)){
+        if (supported.image_channel_order == format.image_channel_order &&
+            supported.image_channel_data_type == format.image_channel_data_type){
+            return true;
+        }
+    }
+    return false;
+}
+
 std::string OpenCLInterface::getCodeExplanation(cl_int code){
-    std::string codeExplanation;
-    switch (code){
-        case 0:
-            codeExplanation = "CL_SUCCESS";
-            break;
-        case -1:
-            codeExplanation = "CL_DEVICE_NOT_FOUND";
-            break;
-        case -2:
-            codeExplanation = "CL_DEVICE_NOT_AVAILABLE";
-            break;
-        case -3:
-            codeExplanation = "CL_COMPILER_NOT_AVAILABLE";
-            break;
-        case -4:
-            codeExplanation = "CL_MEM_OBJECT_ALLOCATION_FAILURE";
-            break;
-        case -5:
-            codeExplanation = "CL_OUT_OF_RESOURCES";
-            break;
-        case -6:
-            codeExplanation = "CL_OUT_OF_HOST_MEMORY";
-            break;
-        case -7:
-            codeExplanation = "CL_PROFILING_INFO_NOT_AVAILABLE";
-            break;
-        case -8:
-            codeExplanation = "CL_MEM_COPY_OVERLAP";
-            break;
-        case -9:
-            codeExplanation = "CL_IMAGE_FORMAT_MISMATCH";
-            break;
-        case -10:
-            codeExplanation = "CL_IMAGE_FORMAT_NOT_SUPPORTED";
-            break;
-        case -11:
-            codeExplanation = "CL_BUILD_PROGRAM_FAILURE";
-            break;
-        case -12:
-            codeExplanation = "CL_MAP_FAILURE";
-            break;
-        case -13:
-            codeExplanation = "CL_MISALIGNED_SUB_BUFFER_OFFSET";
-            break;
-        case -14:
-            codeExplanation = "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
-            break;
-        case -15:
-            codeExplanation = "CL_COMPILE_PROGRAM_FAILURE";
-            break;
-        case -16:
-            codeExplanation = "CL_LINKER_NOT_AVAILABLE";
-            break;
-        case -17:
-            codeExplanation = "CL_LINK_PROGRAM_FAILURE";
-            break;
-        case -18:
-            codeExplanation = "CL_DEVICE_PARTITION_FAILED";
-            break;
-        case -19:
-            codeExplanation = "CL_KERNEL_ARG_INFO_NOT_AVAILABLE";
-            break;
-        case -30:
-            codeExplanation = "CL_INVALID_VALUE";
-            break;
-        case -31:
-            codeExplanation = "CL_INVALID_DEVICE_TYPE";
-            break;
-        case -32:
-            codeExplanation = "CL_INVALID_PLATFORM";
-            break;
-        case -33:
-            codeExplanation = "CL_INVALID_DEVICE";
-            break;
-        case -34:
-            codeExplanation = "CL_INVALID_CONTEXT";
-            break;
-        case -35:
-            codeExplanation = "CL_INVALID_QUEUE_PROPERTIES";
-            break;
-        case -36:
-            codeExplanation = "CL_INVALID_COMMAND_QUEUE";
-            break;
-        case -37:
-            codeExplanation = "CL_INVALID_HOST_PTR";
-            break;
-        case -38:
-            codeExplanation = "CL_INVALID_MEM_OBJECT";
-            break;
-        case -39:
-            codeExplanation = "CL_INVALID_IMAGE_FORMAT_DESCRIPTOR";
-            break;
-        case -40:
-            codeExplanation = "CL_INVALID_IMAGE_SIZE";
-            break;
-        case -41:
-            codeExplanation = "CL_INVALID_SAMPLER";
-            break;
-        case -42:
-            codeExplanation = "CL_INVALID_BINARY";
-            break;
-        case -43:
-            codeExplanation = "CL_INVALID_BUILD_OPTIONS";
-            break;
-        case -44:
-            codeExplanation = "CL_INVALID_PROGRAM";
-            break;
-        case -45:
-            codeExplanation = "CL_INVALID_PROGRAM_EXECUTABLE";
-            break;
-        case -46:
-            codeExplanation = "CL_INVALID_KERNEL_NAME";
-            break;
-        case -47:
-            codeExplanation = "CL_INVALID_KERNEL_DEFINITION";
-            break;
-        case -48:
-            codeExplanation = "CL_INVALID_KERNEL";
-            break;
-        case -49:
-            codeExplanation = "CL_INVALID_ARG_INDEX";
-            break;
-        case -50:
-            codeExplanation = "CL_INVALID_ARG_VALUE";
-            break;
-        case -51:
-            codeExplanation = "CL_INVALID_ARG_SIZE";
-            break;
-        case -52:
-            codeExplanation = "CL_INVALID_KERNEL_ARGS";
-            break;
-        case -53:
-            codeExplanation = "CL_INVALID_WORK_DIMENSION";
-            break;
-        case -54:
-            codeExplanation = "CL_INVALID_WORK_GROUP_SIZE";
-            break;
-        case -55:
-            codeExplanation = "CL_INVALID_WORK_ITEM_SIZE";
-            break;
-        case -56:
-            codeExplanation = "CL_INVALID_GLOBAL_OFFSET";
-            break;
-        case -57:
-            codeExplanation = "CL_INVALID_EVENT_WAIT_LIST";
-            break;
-        case -58:
-            codeExplanation = "CL_INVALID_EVENT";
-            break;
-        case -59:
-            codeExplanation = "CL_INVALID_OPERATION";
-            break;
-        case -60:
-            codeExplanation = "CL_INVALID_GL_OBJECT";
-            break;
-        case -61:
-            codeExplanation = "CL_INVALID_BUFFER_SIZE";
-            break;
-        case -62:
-            codeExplanation = "CL_INVALID_MIP_LEVEL";
-            break;
-        case -63:
-            codeExplanation = "CL_INVALID_GLOBAL_WORK_SIZE";
-            break;
-        case -64:
-            codeExplanation = "CL_INVALID_PROPERTY";
-            break;
-        case -65:
-            codeExplanation = "CL_INVALID_IMAGE_DESCRIPTOR";
-            break;
-        case -66:
-            codeExplanation = "CL_INVALID_COMPILER_OPTIONS";
-            break;
-        case -67:
-            codeExplanation = "CL_INVALID_LINKER_OPTIONS";
-            break;
-        case -68:
-            codeExplanation = "CL_INVALID_DEVICE_PARTITION_COUNT";
-        default:
-            std::cout << "Code not found!\n";
-        }
-    return codeExplanation;
+    return getOpenCLErrorName(code);
 }
 
 void OpenCLInterface::printCodeExplanation(cl_int code){
-    std::string explanation = this->getCodeExplanation(code);
-    std::cout << explanation << std::endl;
+    OPENCL_LOG_INFO(getOpenCLErrorName(code));
 }
 
 void OpenCLInterface::printInfo(){
     std::cout << "Platform ID: " << this->platform << std::endl;
     std::cout << "Device ID: " << this->device << std::endl;
+    if (this->hostExecutor != nullptr){
+        std::cout << "Host fallback: " << this->hostExecutor->getNumThreads() << " threads, "
+                  << OpenCLHostExecutor::getVectorExtension() << std::endl;
+    }
     if (!this->isInitialized){
         std::cout << "Initialized: false\n";
     } else {
@@ -386,6 +807,17 @@ void OpenCLInterface::printInfo(){
             printf("    Index: %d, size: %d, direction: output\n",
                     buffer->index, buffer->numElements);
         }
+        std::cout << "Images:\n";
+        for (const OpenCLImage& image : this->inImages){
+            std::cout << "    Index: " << image.index << ", size: " << image.layout.width << "x"
+                      << image.layout.height << ", format: " << getImageFormatName(image.format)
+                      << ", direction: input\n";
+        }
+        for (const OpenCLImage& image : this->outImages){
+            std::cout << "    Index: " << image.index << ", size: " << image.layout.width << "x"
+                      << image.layout.height << ", format: " << getImageFormatName(image.format)
+                      << ", direction: output\n";
+        }
     }
     std::cout << "\n\n";
 }
@@ -394,13 +826,13 @@ int OpenCLInterface::getPlatformIDs(){
     try {
         cl_int result = clGetPlatformIDs(1, &(this->platform), NULL);
         if (result == CL_SUCCESS) {
-            std::cout << "Platform ID received\n";
+            OPENCL_LOG_INFO("Platform ID received");
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
             throw std::runtime_error("Couldn't get platform ID: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
@@ -409,19 +841,19 @@ int OpenCLInterface::getPlatformIDs(){
 
 int OpenCLInterface::getDeviceIDs(){
     try {
-        cl_int result = clGetDeviceIDs(this->platform,
-                                       CL_DEVICE_TYPE_GPU,
-                                       1,
-                                       &(this->device),
-                                       NULL);
+        OpenCLDeviceInfo selected;
+        cl_int result = selectOpenCLDevice(this->devicePolicy, &selected);
         if (result == CL_SUCCESS) {
-            std::cout << "Device ID received\n";
+            this->platform = selected.platform;
+            this->device = selected.device;
+            OPENCL_LOG_INFO("Device ID received: " << selected.name
+                            << " (" << getDeviceTypeName(selected.type) << ")");
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
             throw std::runtime_error("Couldn't get device ID: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
@@ -430,16 +862,16 @@ int OpenCLInterface::getDeviceIDs(){
 
 int OpenCLInterface::createContext(){
     try {
-    cl_int result;
-        this->context = clCreateContext(0, 1, &(this->device), NULL, NULL, &result);
+        cl_int result;
+        this->context.reset(clCreateContext(0, 1, &(this->device), NULL, NULL, &result));
         if (result == CL_SUCCESS) {
-            std::cout << "Context created\n";
+            OPENCL_LOG_INFO("Context created");
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
             throw std::runtime_error("Couldn't create context: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
@@ -449,34 +881,58 @@ int OpenCLInterface::createContext(){
 int OpenCLInterface::createCommandQueue(){
     try {
         cl_int result;
-        this->queue = clCreateCommandQueueWithProperties(this->context, this->device, 0, &result);
+        if (this->queueProperties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE){
+            cl_command_queue_properties supported = 0;
+            clGetDeviceInfo(this->device, CL_DEVICE_QUEUE_PROPERTIES,
+                            sizeof(supported), &supported, NULL);
+            if (!(supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)){
+                OPENCL_LOG_WARNING("Out-of-order queue not supported by device, using in-order queue");
+                this->queueProperties &= ~(cl_command_queue_properties)CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+            }
+        }
+        if (this->queueProperties != 0){
+            cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, this->queueProperties, 0};
+            this->queue.reset(clCreateCommandQueueWithProperties(this->context, this->device, properties, &result));
+        } else {
+            this->queue.reset(clCreateCommandQueueWithProperties(this->context, this->device, 0, &result));
+        }
         if (result == CL_SUCCESS) {
-            std::cout << "Command queue created\n";
+            OPENCL_LOG_INFO("Command queue created");
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
             throw std::runtime_error("Couldn't create command queue: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
     return 0;
 }
 
-int OpenCLInterface::createBuffer(size_t bufferSize, float *data, cl_mem *outHandle, bool isInput){
+int OpenCLInterface::createBuffer(size_t bufferSize, void *data, cl_mem *outHandle, bool isInput,
+                                  AllocationPolicy policy){
     try {
         cl_int result;
         cl_mem handle;
-        if (isInput){
-            handle = clCreateBuffer(this->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                              bufferSize, data, &result);
-        } else {
-            handle = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, 
-                                              bufferSize, NULL, &result);
+        cl_mem_flags flags = isInput ? CL_MEM_READ_ONLY : CL_MEM_READ_WRITE;
+        void *hostPtr = nullptr;
+        if (policy == AllocationPolicy::UseHostPtr){
+            flags |= CL_MEM_USE_HOST_PTR;
+            hostPtr = data;
+        } else if (policy == AllocationPolicy::AllocHostPtr){
+            flags |= CL_MEM_ALLOC_HOST_PTR;
+            if (isInput && data != nullptr){
+                flags |= CL_MEM_COPY_HOST_PTR;
+                hostPtr = data;
+            }
+        } else if (isInput){
+            flags |= CL_MEM_COPY_HOST_PTR;
+            hostPtr = data;
         }
+        handle = clCreateBuffer(this->context, flags, bufferSize, hostPtr, &result);
         if (result == CL_SUCCESS) {
-            std::cout << "Buffer created with size: " << bufferSize << " bytes\n";
+            OPENCL_LOG_DEBUG("Buffer created with size: " << bufferSize << " bytes");
             *outHandle = handle;
 
         } else {
@@ -484,7 +940,7 @@ int OpenCLInterface::createBuffer(size_t bufferSize, float *data, cl_mem *outHan
             throw std::runtime_error("Couldn't create buffer: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
@@ -492,35 +948,32 @@ int OpenCLInterface::createBuffer(size_t bufferSize, float *data, cl_mem *outHan
 }
 
 int OpenCLInterface::createImage(cl_image_format *format, cl_image_desc *desc,
-                                 float *data, cl_mem *outHandle, bool isInput){
+                                 void *data, cl_mem *outHandle, bool isInput){
     try {
         cl_int result;
         cl_mem handle;
-        if (isInput){
-            handle = clCreateImage(this->context,
-                                   CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                                   format,
-                                   desc,
-                                   data,
-                                   &result);
+        cl_mem_flags flags = this->getImageFlags(isInput);
+        void *hostPtr = nullptr;
+        if (isInput && data != nullptr){
+            flags |= CL_MEM_COPY_HOST_PTR;
+            hostPtr = data;
         } else {
-            handle = clCreateImage(this->context,
-                                   CL_MEM_WRITE_ONLY,
-                                   format,
-                                   desc,
-                                   NULL,
-                                   &result);
+            // The pitches describe host memory and must be zero without
+            // a host pointer.
+            desc->image_row_pitch = 0;
+            desc->image_slice_pitch = 0;
         }
+        handle = clCreateImage(this->context, flags, format, desc, hostPtr, &result);
         if (result == CL_SUCCESS) {
-            std::cout << "Image created with format: " << "..." << " bytes\n";
+            OPENCL_LOG_DEBUG("Image created with format: " << getImageFormatName(*format));
             *outHandle = handle;
 
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
-            throw std::runtime_error("Couldn't create buffer: " + errorExplanation);
+            throw std::runtime_error("Couldn't create image: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
@@ -533,65 +986,274 @@ void OpenCLInterface::setGlobalWorkSize(size_t *size){
 }
 
 void OpenCLInterface::setSource(const char* source, const char* name){
+    // Copied, so reinitialize() can tell a changed program apart even when
+    // the caller reuses or frees its buffers.
     this->programSource = source;
     this->programName = name;
 }
 
-int OpenCLInterface::createProgram(){
+int OpenCLInterface::enableAutotuning(const char* databasePath, bool tuneOnLaunch){
     try {
-        cl_int result;
-        this->program = clCreateProgramWithSource(this->context, 1, &(this->programSource), NULL, &result);
-        if (result == CL_SUCCESS) {
-            std::cout << "Program created\n";
-        } else {
-            std::string errorExplanation = this->getCodeExplanation(result);
-            throw std::runtime_error("Couldn't create program: " + errorExplanation);
-        }
+        this->requireDevice("autotuning");
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
-    return 0;
+    this->tuneOnLaunch = tuneOnLaunch;
+    return this->autotuner.initialize(this->device, databasePath == nullptr ? "" : databasePath);
 }
 
-int OpenCLInterface::buildProgram(){
+int OpenCLInterface::tuneLocalWorkSize(const char* kernelName, cl_uint workDimensions,
+                                       size_t *globalWorkSize){
     try {
-        cl_int result = clBuildProgram(this->program, 1, &(this->device), NULL, NULL, NULL);
-        if (result == CL_SUCCESS) {
-            std::cout << "Program built\n";
-        } else {
-            std::string errorExplanation = this->getCodeExplanation(result);
-            throw std::runtime_error("Couldn't build program: " + errorExplanation);
+        if (!this->autotuner.isEnabled()){
+            throw std::runtime_error("Autotuning not enabled!");
+        }
+        cl_kernel target = this->getKernel(kernelName);
+        if (target == nullptr){
+            throw std::runtime_error(std::string("No kernel named ") + kernelName + " in program");
+        }
+        if (this->applyKernelArgs(target) != 0){
+            throw std::runtime_error("Couldn't bind arguments of kernel " + std::string(kernelName));
+        }
+        WorkSize tuned;
+        if (this->autotuner.tune(this->queue, target, kernelName, workDimensions,
+                                 globalWorkSize, &tuned) != 0){
+            throw std::runtime_error("Couldn't tune kernel " + std::string(kernelName));
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
     return 0;
 }
 
-int OpenCLInterface::createKernel(){
+const size_t* OpenCLInterface::getLocalWorkSize(const char* kernelName, cl_kernel target,
+                                                cl_uint workDimensions, size_t *globalWorkSize){
+    if (!this->autotuner.isEnabled()){
+        return NULL;
+    }
+    // Tuning runs the kernel many times on its live buffers, which would
+    // corrupt in-place or accumulating kernels, so unknown configurations
+    // use the driver's choice unless tuning on launch was asked for.
+    if (!this->autotuner.lookup(kernelName, workDimensions, globalWorkSize, &this->localWorkSize)){
+        if (!this->tuneOnLaunch ||
+            this->autotuner.tune(this->queue, target, kernelName, workDimensions,
+                                 globalWorkSize, &this->localWorkSize) != 0){
+            return NULL;
+        }
+    }
+    return this->localWorkSize[0] == 0 ? NULL : this->localWorkSize.data();
+}
+
+void OpenCLInterface::setBuildOptions(const char* options){
+    this->buildOptions = options == nullptr ? "" : options;
+}
+
+void OpenCLInterface::setBinaryCacheDirectory(const char* directory){
+    this->programCache.setDirectory(directory == nullptr ? "" : directory);
+}
+
+void OpenCLInterface::clearBinaryCache(){
+    this->programCache.clear();
+}
+
+ProgramCacheStats OpenCLInterface::getBinaryCacheStats(){
+    return this->programCache.getStats();
+}
+
+int OpenCLInterface::createProgram(){
+    this->programFromBinary = false;
+    if (this->programCache.isEnabled()){
+        this->programCacheKey = this->programCache.makeKey(this->programSource.c_str(),
+                                                           this->device,
+                                                           this->buildOptions);
+        if (this->createProgramFromBinary() == 0){
+            this->programCache.recordHit();
+            this->programFromBinary = true;
+            return 0;
+        }
+        this->programCache.recordMiss();
+    }
+    return this->createProgramFromSource();
+}
+
+int OpenCLInterface::createProgramFromSource(){
     try {
         cl_int result;
-        this->kernel = clCreateKernel(program, this->programName, &result);
+        const char *source = this->programSource.c_str();
+        this->program.reset(clCreateProgramWithSource(this->context, 1, &source, NULL, &result));
         if (result == CL_SUCCESS) {
-            std::cout << "Kernel created\n";
+            OPENCL_LOG_INFO("Program created");
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
-            throw std::runtime_error("Couldn't create kernel: " + errorExplanation);
+            throw std::runtime_error("Couldn't create program: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
     return 0;
 }
 
-int OpenCLInterface::setAllKernelArgs(){
-    for (int i = 0 ; i < this->inBuffers.size() ; i++){
+int OpenCLInterface::createProgramFromBinary(){
+    std::vector<unsigned char> binary;
+    if (!this->programCache.load(this->programCacheKey, binary)){
+        return -1;
+    }
+    cl_int result;
+    cl_int binaryStatus;
+    size_t binarySize = binary.size();
+    const unsigned char* binaryData = binary.data();
+    cl_program cachedProgram = clCreateProgramWithBinary(this->context, 1, &(this->device),
+                                                         &binarySize, &binaryData,
+                                                         &binaryStatus, &result);
+    if (result != CL_SUCCESS || binaryStatus != CL_SUCCESS){
+        OPENCL_LOG_WARNING("Cached program binary rejected: "
+                           << getOpenCLErrorName(result != CL_SUCCESS ? result : binaryStatus));
+        if (cachedProgram != nullptr){
+            clReleaseProgram(cachedProgram);
+        }
+        this->programCache.invalidate(this->programCacheKey);
+        return -1;
+    }
+    this->program.reset(cachedProgram);
+    OPENCL_LOG_INFO("Program created from cached binary");
+    return 0;
+}
+
+int OpenCLInterface::buildProgram(){
+    try {
+        cl_int result = clBuildProgram(this->program, 1, &(this->device),
+                                       this->buildOptions.c_str(), NULL, NULL);
+        if (result != CL_SUCCESS && this->programFromBinary){
+            // A binary the driver accepted at creation can still fail to
+            // build after a runtime update; drop it and compile from source.
+            OPENCL_LOG_WARNING("Cached program binary failed to build, rebuilding from source");
+            this->program.reset();
+            this->programCache.invalidate(this->programCacheKey);
+            this->programFromBinary = false;
+            if (this->createProgramFromSource() != 0){
+                throw std::runtime_error("Couldn't recreate program from source");
+            }
+            result = clBuildProgram(this->program, 1, &(this->device),
+                                    this->buildOptions.c_str(), NULL, NULL);
+        }
+        if (result == CL_SUCCESS) {
+            OPENCL_LOG_INFO("Program built");
+        } else {
+            std::string errorExplanation = this->getCodeExplanation(result);
+            throw std::runtime_error("Couldn't build program: " + errorExplanation);
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    if (!this->programFromBinary && this->programCache.isEnabled()){
+        this->storeProgramBinary();
+    }
+    return 0;
+}
+
+void OpenCLInterface::storeProgramBinary(){
+    size_t binarySize = 0;
+    cl_int result = clGetProgramInfo(this->program, CL_PROGRAM_BINARY_SIZES,
+                                     sizeof(size_t), &binarySize, NULL);
+    if (result != CL_SUCCESS || binarySize == 0){
+        OPENCL_LOG_INFO("Program binary not available for caching");
+        return;
+    }
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char* binaryData = binary.data();
+    result = clGetProgramInfo(this->program, CL_PROGRAM_BINARIES,
+                              sizeof(unsigned char*), &binaryData, NULL);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_WARNING("Couldn't read program binary: " << getOpenCLErrorName(result));
+        return;
+    }
+    if (this->programCache.store(this->programCacheKey, binary)){
+        OPENCL_LOG_INFO("Program binary cached");
+    }
+}
+
+int OpenCLInterface::createKernel(){
+    try {
+        this->kernel = this->getKernel(this->programName.c_str());
+        if (this->kernel != nullptr) {
+            OPENCL_LOG_INFO("Kernel created");
+        } else {
+            std::string errorExplanation = this->getCodeExplanation(CL_INVALID_KERNEL_NAME);
+            throw std::runtime_error("Couldn't create kernel: " + errorExplanation);
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::createKernels(){
+    try {
+        cl_uint numKernels = 0;
+        cl_int result = clCreateKernelsInProgram(this->program, 0, NULL, &numKernels);
+        if (result != CL_SUCCESS){
+            std::string errorExplanation = this->getCodeExplanation(result);
+            throw std::runtime_error("Couldn't count kernels in program: " + errorExplanation);
+        }
+        std::vector<cl_kernel> programKernels(numKernels);
+        result = clCreateKernelsInProgram(this->program, numKernels, programKernels.data(), NULL);
+        if (result != CL_SUCCESS){
+            std::string errorExplanation = this->getCodeExplanation(result);
+            throw std::runtime_error("Couldn't create kernels: " + errorExplanation);
+        }
+        for (cl_kernel programKernel : programKernels){
+            size_t nameSize = 0;
+            clGetKernelInfo(programKernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &nameSize);
+            std::string name(nameSize, '\0');
+            clGetKernelInfo(programKernel, CL_KERNEL_FUNCTION_NAME, nameSize, &name[0], NULL);
+            name.resize(name.find('\0') == std::string::npos ? name.size() : name.find('\0'));
+            this->kernels[name].reset(programKernel);
+        }
+        OPENCL_LOG_INFO("Created " << numKernels << " kernels");
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+cl_kernel OpenCLInterface::getKernel(const char* kernelName){
+    if (this->kernels.empty()){
+        if (this->createKernels() != 0){
+            return nullptr;
+        }
+    }
+    auto found = this->kernels.find(kernelName);
+    if (found == this->kernels.end()){
+        return nullptr;
+    }
+    return found->second;
+}
+
+std::vector<std::string> OpenCLInterface::getKernelNames(){
+    std::vector<std::string> names;
+    if (this->kernels.empty()){
+        this->createKernels();
+    }
+    for (const auto& entry : this->kernels){
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+int OpenCLInterface::setAllKernelArgs(){
+    for (int i = 0 ; i < this->inBuffers.size() ; i++){
         OpenCLBuffer *buffer = &this->inBuffers.at(i);
         if (setKernelArg(buffer->index, buffer->handle) != 0){
             return -1;
@@ -605,9 +1267,9 @@ int OpenCLInterface::setAllKernelArgs(){
         };
     }
 
-    for (int i = 0 ; i < this->outImages.size() ; i++){
-        OpenCLImage *buffer = &this->outImages.at(i);
-        if (setKernelArg(buffer->index, buffer->handle) != 0){
+    for (int i = 0 ; i < this->inImages.size() ; i++){
+        OpenCLImage *image = &this->inImages.at(i);
+        if (setKernelArg(image->index, image->handle) != 0){
             return -1;
         };
     }
@@ -621,39 +1283,198 @@ int OpenCLInterface::setAllKernelArgs(){
     return 0;
 }
 
+void OpenCLInterface::checkKernelArgTypes(){
+    // Argument type names are only reported for programs built with
+    // -cl-kernel-arg-info; without it there is nothing to compare against.
+    std::vector<OpenCLBuffer*> buffers;
+    for (OpenCLBuffer& buffer : this->inBuffers){
+        buffers.push_back(&buffer);
+    }
+    for (OpenCLBuffer& buffer : this->outBuffers){
+        buffers.push_back(&buffer);
+    }
+    for (OpenCLBuffer *buffer : buffers){
+        size_t size = 0;
+        cl_int result = clGetKernelArgInfo(this->kernel, buffer->index, CL_KERNEL_ARG_TYPE_NAME,
+                                           0, NULL, &size);
+        if (result != CL_SUCCESS || size == 0){
+            return;
+        }
+        std::string typeName(size, '\0');
+        clGetKernelArgInfo(this->kernel, buffer->index, CL_KERNEL_ARG_TYPE_NAME, size, &typeName[0], NULL);
+        typeName.resize(std::strlen(typeName.c_str()));
+        if (typeName != std::string(buffer->typeName) + "*"){
+            OPENCL_LOG_ERROR("Kernel argument " << buffer->index << " is " << typeName
+                             << " but the buffer holds " << buffer->typeName);
+        }
+    }
+}
+
 int OpenCLInterface::setKernelArg(const int index, cl_mem handle){
+    return this->setKernelArg(this->kernel, index, handle);
+}
+
+int OpenCLInterface::setKernelArg(cl_kernel kernel, const int index, cl_mem handle){
     try {
-        cl_int result;
-        std::cout << "Set kernel data: " << index << " " << handle << "\n";
+        OPENCL_LOG_DEBUG("Set kernel data: " << index << " " << handle);
 
-        result = clSetKernelArg(this->kernel,
-                                index,
-                                sizeof(cl_mem),
-                                &handle);
+        // Buffers go through the argument cache too, so a later
+        // setKernelArgs() compares against what the kernel really holds.
+        OpenCLKernelArgs *cache = &this->kernelArgs[kernel];
+        cache->set(index, handle);
+        cl_int result = cache->apply(kernel);
         if (result == CL_SUCCESS){
-            std::cout << "Kernel input arg set\n";
+            OPENCL_LOG_DEBUG("Kernel input arg set");
         } else {
             std::string errorExplanation = this->getCodeExplanation(result);
             throw std::runtime_error("Couldn't set kernel input arg: " + errorExplanation);
         }
     } catch (const std::exception& e){
-        std::cerr << "Error: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR(e.what());
         this->errorEncountered = true;
         return -1;
     }
     return 0;
 }
 
-float* OpenCLInterface::getBufferDataPtr(const int index, bool isInput){
-    if (isInput){
-        return this->inBuffers.at(index).data;
-    } else {
-        return this->outBuffers.at(index).data;
+OpenCLKernelArgs* OpenCLInterface::getKernelArgs(const char* kernelName){
+    cl_kernel target = this->getKernel(kernelName);
+    if (target == nullptr){
+        OPENCL_LOG_ERROR("No kernel named " << kernelName << " in program");
+        this->errorEncountered = true;
+        return nullptr;
+    }
+    return &this->kernelArgs[target];
+}
+
+int OpenCLInterface::stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const BufferArg& buffer){
+    try {
+        OpenCLBuffer *target = buffer.isInput ? &this->inBuffers.at(buffer.index)
+                                              : &this->outBuffers.at(buffer.index);
+        cache->set(argIndex, target->handle);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("No " << (buffer.isInput ? "input" : "output") << " buffer "
+                         << buffer.index << " for kernel arg " << argIndex);
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const ImageArg& image){
+    try {
+        OpenCLImage *target = image.isInput ? &this->inImages.at(image.index)
+                                            : &this->outImages.at(image.index);
+        cache->set(argIndex, target->handle.get());
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("No " << (image.isInput ? "input" : "output") << " image "
+                         << image.index << " for kernel arg " << argIndex);
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::applyKernelArgs(cl_kernel target){
+    auto found = this->kernelArgs.find(target);
+    if (found == this->kernelArgs.end()){
+        return 0;
+    }
+    cl_uint failedIndex = 0;
+    cl_int result = found->second.apply(target, &failedIndex);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't set kernel arg " << failedIndex << ": "
+                         << getOpenCLErrorName(result));
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+KernelArgStats OpenCLInterface::getKernelArgStats(const char* kernelName){
+    OpenCLKernelArgs *cache = this->getKernelArgs(kernelName);
+    return cache == nullptr ? KernelArgStats() : cache->getStats();
+}
+
+cl_sampler OpenCLInterface::createSampler(bool normalizedCoords, cl_addressing_mode addressing,
+                                          cl_filter_mode filter){
+    try {
+        cl_int result;
+        cl_sampler_properties properties[] = {
+            CL_SAMPLER_NORMALIZED_COORDS, (cl_sampler_properties)(normalizedCoords ? CL_TRUE : CL_FALSE),
+            CL_SAMPLER_ADDRESSING_MODE, addressing,
+            CL_SAMPLER_FILTER_MODE, filter,
+            0
+        };
+        cl_sampler sampler = clCreateSamplerWithProperties(this->context, properties, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create sampler: " + this->getCodeExplanation(result));
+        }
+        this->samplers.emplace_back(sampler);
+        return sampler;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+    }
+    return nullptr;
+}
+
+int OpenCLInterface::bindBuffer(const char* kernelName, cl_uint argIndex,
+                                const int bufferIndex, bool isInput){
+    try {
+        cl_kernel target = this->getKernel(kernelName);
+        if (target == nullptr){
+            throw std::runtime_error(std::string("No kernel named ") + kernelName + " in program");
+        }
+        OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(bufferIndex)
+                                       : &this->outBuffers.at(bufferIndex);
+        if (this->setKernelArg(target, argIndex, buffer->handle) != 0){
+            throw std::runtime_error("Couldn't bind buffer to kernel " + std::string(kernelName));
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
     }
+    return 0;
+}
+
+void* OpenCLInterface::getBufferData(const int index, bool isInput, size_t elementSize){
+    try {
+        OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(index) : &this->outBuffers.at(index);
+        // Viewing a vector buffer through its scalar type is fine; anything
+        // that would split an element is a type mismatch.
+        if (buffer->elementSize % elementSize != 0){
+            throw std::runtime_error(std::string("Buffer holds ") + buffer->typeName +
+                                     " elements, requested element size " + std::to_string(elementSize));
+        }
+        return buffer->data;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+    }
+    return nullptr;
 }
 
 void OpenCLInterface::updateBuffer(const int index) {
     OpenCLBuffer *buffer = &this->inBuffers.at(index);
+    buffer->dirty.clear();
+    if (this->hostExecutor != nullptr){
+        // Host kernels read the caller's data in place.
+        return;
+    }
+    if (buffer->policy != AllocationPolicy::Copy){
+        this->writeMappedBuffer(index);
+        return;
+    }
+    if (this->stagingRing.accepts(buffer->sizeBytes)){
+        if (this->stagingRing.write(this->queue, buffer->handle, 0, buffer->data, buffer->sizeBytes,
+                                    this->getActiveProfiler(), this->getProfileName(index, true)) != 0){
+            this->errorEncountered = true;
+        }
+        return;
+    }
+    cl_event event = nullptr;
     cl_int result = clEnqueueWriteBuffer(
         this->queue,
         buffer->handle,  // Existing valid cl_mem handle
@@ -661,9 +1482,212 @@ void OpenCLInterface::updateBuffer(const int index) {
         0,                       // Offset
         buffer->sizeBytes, // Size in bytes
         buffer->data,                 // Host pointer with NEW data
-        0, NULL, NULL
+        0, NULL, this->getProfileEvent(&event)
     );
-    std::cout << "Wrote to buffer with result: " << getCodeExplanation(result) << std::endl;
+    this->recordBufferProfile(index, true, ProfileCommand::Write,
+                        buffer->sizeBytes, event, true);
+    OPENCL_LOG_DEBUG("Wrote to buffer with result: " << getOpenCLErrorName(result));
+}
+
+void* OpenCLInterface::mapBufferData(const int index, bool isInput, cl_map_flags flags, size_t elementSize){
+    try {
+        OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(index) : &this->outBuffers.at(index);
+        if (buffer->elementSize % elementSize != 0){
+            throw std::runtime_error(std::string("Can't map buffer of ") + buffer->typeName +
+                                     " with element size " + std::to_string(elementSize));
+        }
+        if (buffer->mapped != nullptr){
+            throw std::runtime_error("Buffer is already mapped!");
+        }
+        if (this->hostExecutor != nullptr){
+            buffer->mapped = buffer->data;
+            return buffer->mapped;
+        }
+        cl_int result;
+        cl_event event = nullptr;
+        buffer->mapped = clEnqueueMapBuffer(this->queue, buffer->handle, CL_TRUE, flags,
+                                            0, buffer->sizeBytes, 0, NULL,
+                                            this->getProfileEvent(&event), &result);
+        this->recordBufferProfile(index, isInput, ProfileCommand::Map,
+                            buffer->sizeBytes, event, true);
+        if (result != CL_SUCCESS){
+            buffer->mapped = nullptr;
+            throw std::runtime_error("Couldn't map buffer: " + this->getCodeExplanation(result));
+        }
+        return buffer->mapped;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+    }
+    return nullptr;
+}
+
+int OpenCLInterface::unmapBuffer(const int index, bool isInput){
+    try {
+        OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(index) : &this->outBuffers.at(index);
+        if (buffer->mapped == nullptr){
+            throw std::runtime_error("Buffer is not mapped!");
+        }
+        if (this->hostExecutor != nullptr){
+            buffer->mapped = nullptr;
+            return 0;
+        }
+        cl_event event = nullptr;
+        cl_int result = clEnqueueUnmapMemObject(this->queue, buffer->handle, buffer->mapped,
+                                                0, NULL, &event);
+        buffer->mapped = nullptr;
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't unmap buffer: " + this->getCodeExplanation(result));
+        }
+        clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::writeMappedBuffer(const int index){
+    OpenCLBuffer *buffer = &this->inBuffers.at(index);
+    void *mapped = this->mapBufferData(index, true, CL_MAP_WRITE_INVALIDATE_REGION, buffer->elementSize);
+    if (mapped == nullptr){
+        return -1;
+    }
+    // When the caller's pointer is the mapped storage itself there is
+    // nothing to move.
+    if (mapped != buffer->data && buffer->data != nullptr){
+        std::memcpy(mapped, buffer->data, buffer->sizeBytes);
+    }
+    return this->unmapBuffer(index, true);
+}
+
+int OpenCLInterface::readMappedBuffer(const int index){
+    OpenCLBuffer *buffer = &this->outBuffers.at(index);
+    void *mapped = this->mapBufferData(index, false, CL_MAP_READ, buffer->elementSize);
+    if (mapped == nullptr){
+        return -1;
+    }
+    if (mapped != buffer->data && buffer->data != nullptr){
+        std::memcpy(buffer->data, mapped, buffer->sizeBytes);
+    }
+    return this->unmapBuffer(index, false);
+}
+
+int OpenCLInterface::updateImage(const int index){
+    try {
+        OpenCLImage *image = &this->inImages.at(index);
+        if (image->data == nullptr){
+            throw std::runtime_error("Image has no host data to upload");
+        }
+        size_t origin[3] = {0, 0, 0};
+        size_t region[3];
+        getImageRegion(image->layout, region);
+        cl_event event = nullptr;
+        cl_int result = clEnqueueWriteImage(this->queue, image->handle, CL_TRUE, origin, region,
+                                            getImageRowPitch(image->layout),
+                                            getImageSlicePitch(image->layout),
+                                            image->data, 0, NULL, this->getProfileEvent(&event));
+        this->recordImageProfile(index, true, ProfileCommand::Write,
+                            getImageSizeBytes(image->layout), event, true);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't write image: " + this->getCodeExplanation(result));
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::readImage(const int index){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to read image, but interface is not initialized!");
+        }
+        OpenCLImage *image = &this->outImages.at(index);
+        if (image->data == nullptr){
+            throw std::runtime_error("Image has no host data to read into");
+        }
+        size_t origin[3] = {0, 0, 0};
+        size_t region[3];
+        getImageRegion(image->layout, region);
+        cl_event event = nullptr;
+        cl_int result = clEnqueueReadImage(this->queue, image->handle, CL_TRUE, origin, region,
+                                           getImageRowPitch(image->layout),
+                                           getImageSlicePitch(image->layout),
+                                           image->data, 0, NULL, this->getProfileEvent(&event));
+        this->recordImageProfile(index, false, ProfileCommand::Read,
+                            getImageSizeBytes(image->layout), event, true);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't read image: " + this->getCodeExplanation(result));
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't read output image: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+void* OpenCLInterface::mapImageData(const int index, bool isInput, cl_map_flags flags,
+                                    size_t *rowPitch, size_t *slicePitch){
+    try {
+        OpenCLImage *image = isInput ? &this->inImages.at(index) : &this->outImages.at(index);
+        if (image->mapped != nullptr){
+            throw std::runtime_error("Image is already mapped!");
+        }
+        if (rowPitch == nullptr){
+            throw std::runtime_error("Mapping an image needs a row pitch output");
+        }
+        size_t origin[3] = {0, 0, 0};
+        size_t region[3];
+        getImageRegion(image->layout, region);
+        size_t unusedSlicePitch = 0;
+        cl_int result;
+        cl_event event = nullptr;
+        // The runtime picks the mapped layout; rows must be walked with the
+        // returned pitch, not the host layout's.
+        image->mapped = clEnqueueMapImage(this->queue, image->handle, CL_TRUE, flags, origin, region,
+                                          rowPitch, slicePitch != nullptr ? slicePitch : &unusedSlicePitch,
+                                          0, NULL, this->getProfileEvent(&event), &result);
+        this->recordImageProfile(index, isInput, ProfileCommand::Map,
+                            getImageSizeBytes(image->layout), event, true);
+        if (result != CL_SUCCESS){
+            image->mapped = nullptr;
+            throw std::runtime_error("Couldn't map image: " + this->getCodeExplanation(result));
+        }
+        return image->mapped;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+    }
+    return nullptr;
+}
+
+int OpenCLInterface::unmapImage(const int index, bool isInput){
+    try {
+        OpenCLImage *image = isInput ? &this->inImages.at(index) : &this->outImages.at(index);
+        if (image->mapped == nullptr){
+            throw std::runtime_error("Image is not mapped!");
+        }
+        cl_event event = nullptr;
+        cl_int result = clEnqueueUnmapMemObject(this->queue, image->handle, image->mapped,
+                                                0, NULL, &event);
+        image->mapped = nullptr;
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't unmap image: " + this->getCodeExplanation(result));
+        }
+        clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
 }
 
 void OpenCLInterface::executeAndRead(const int index){
@@ -672,13 +1696,56 @@ void OpenCLInterface::executeAndRead(const int index){
 }
 
 void OpenCLInterface::execute(){
-    if (this->isInitialized){
+    if (this->isInitialized && this->hostExecutor != nullptr){
+        this->runHostKernel(this->programName.c_str(), this->workDimensions, this->globalWorkSize);
+    } else if (this->isInitialized){
+        if (this->applyKernelArgs(this->kernel) != 0){
+            return;
+        }
+        const size_t *local = this->getLocalWorkSize(this->programName.c_str(), this->kernel,
+                                                     this->workDimensions, this->globalWorkSize);
+        cl_event event = nullptr;
         clEnqueueNDRangeKernel(this->queue, this->kernel,
                                this->workDimensions, NULL, this->globalWorkSize,
-                               NULL, 0, NULL, NULL);
+                               local, 0, NULL, this->getProfileEvent(&event));
+        this->recordProfile(this->programName.c_str(), ProfileCommand::Kernel, 0, event, true);
         clFinish(queue);
     } else {
-        std::cout << "Interface not initialized!\n";
+        OPENCL_LOG_ERROR("Interface not initialized!");
+    }
+}
+
+void OpenCLInterface::executeKernel(const char* kernelName, cl_uint workDimensions,
+                                    size_t *globalWorkSize){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        if (this->hostExecutor != nullptr){
+            this->runHostKernel(kernelName, workDimensions, globalWorkSize);
+            return;
+        }
+        cl_kernel target = this->getKernel(kernelName);
+        if (target == nullptr){
+            throw std::runtime_error(std::string("No kernel named ") + kernelName + " in program");
+        }
+        if (this->applyKernelArgs(target) != 0){
+            throw std::runtime_error("Couldn't bind arguments of kernel " + std::string(kernelName));
+        }
+        const size_t *local = this->getLocalWorkSize(kernelName, target,
+                                                     workDimensions, globalWorkSize);
+        cl_event event = nullptr;
+        cl_int result = clEnqueueNDRangeKernel(this->queue, target,
+                                               workDimensions, NULL, globalWorkSize,
+                                               local, 0, NULL, this->getProfileEvent(&event));
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue kernel: " + this->getCodeExplanation(result));
+        }
+        this->recordProfile(kernelName, ProfileCommand::Kernel, 0, event, true);
+        clFinish(queue);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
     }
 }
 
@@ -688,35 +1755,783 @@ void OpenCLInterface::readResult(const int index){
         if (buffer->isInput){
             throw std::runtime_error("Trying to read from input buffer!");
         }
-        if (this->isInitialized){
-            size_t bufferSize = buffer->numElements * sizeof(float);
-            std::cout << "Buffer handle is: " << buffer->handle << "\n";
+        if (this->isInitialized && this->hostExecutor != nullptr){
+            // Host kernels wrote the caller's data in place.
+        } else if (this->isInitialized && buffer->policy != AllocationPolicy::Copy){
+            if (this->readMappedBuffer(index) != 0){
+                throw std::runtime_error("Couldn't map output buffer");
+            }
+        } else if (this->isInitialized && this->stagingRing.accepts(buffer->sizeBytes)){
+            if (this->stagingRing.read(this->queue, buffer->handle, 0, buffer->data, buffer->sizeBytes,
+                                       this->getActiveProfiler(), this->getProfileName(index, false)) != 0){
+                throw std::runtime_error("Staged read failed");
+            }
+        } else if (this->isInitialized){
+            size_t bufferSize = buffer->sizeBytes;
+            OPENCL_LOG_DEBUG("Buffer handle is: " << buffer->handle);
+            cl_event event = nullptr;
             cl_int result = clEnqueueReadBuffer(this->queue, buffer->handle, CL_TRUE, 0,
-                                bufferSize, buffer->data, 0, NULL, NULL);
-            std::cout << "Read from buffer with result: " << getCodeExplanation(result) << std::endl;
+                                bufferSize, buffer->data, 0, NULL, this->getProfileEvent(&event));
+            this->recordBufferProfile(index, false, ProfileCommand::Read,
+                                bufferSize, event, true);
+            OPENCL_LOG_DEBUG("Read from buffer with result: " << getOpenCLErrorName(result));
         } else {
             throw std::runtime_error("Trying to read buffer, but interface is not initialized!\n");
         }
     }
     catch (const std::exception& e){
-        std::cerr << "Error: Couldn't read output buffer: " << e.what() << std::endl;
+        OPENCL_LOG_ERROR("Couldn't read output buffer: " << e.what());
         this->errorEncountered = true;
     }
 }
 
-void OpenCLInterface::cleanup(){
-    clReleaseKernel(this->kernel);
-    clReleaseProgram(this->program);
+OpenCLEvent OpenCLInterface::enqueueKernel(const char* kernelName, cl_kernel target,
+                                           cl_uint workDimensions, size_t *globalWorkSize,
+                                           const std::vector<OpenCLEvent>& waitList){
+    if (this->applyKernelArgs(target) != 0){
+        throw std::runtime_error("Couldn't bind arguments of kernel " + std::string(kernelName));
+    }
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+    const size_t *local = this->getLocalWorkSize(kernelName, target, workDimensions, globalWorkSize);
+    cl_event event = nullptr;
+    cl_int result = clEnqueueNDRangeKernel(this->queue, target,
+                                           workDimensions, NULL, globalWorkSize, local,
+                                           waitHandles.size(),
+                                           waitHandles.empty() ? NULL : waitHandles.data(),
+                                           &event);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue kernel: " + this->getCodeExplanation(result));
+    }
+    this->recordProfile(kernelName, ProfileCommand::Kernel, 0, event, false);
+    return OpenCLEvent(event);
+}
 
-    for (int i = 0 ; i < this->inBuffers.size() ; i++){
-        cl_mem handle = this->inBuffers[i].handle;
-        clReleaseMemObject(handle);
+OpenCLEvent OpenCLInterface::executeAsync(const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        if (this->hostExecutor != nullptr){
+            // Host launches complete before returning, so there is no event.
+            this->runHostKernel(this->programName.c_str(), this->workDimensions, this->globalWorkSize);
+            return OpenCLEvent();
+        }
+        return this->enqueueKernel(this->programName.c_str(), this->kernel, this->workDimensions,
+                                   this->globalWorkSize, waitList);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
     }
-    for (int i = 0 ; i < this->outBuffers.size() ; i++){
-        cl_mem handle = this->outBuffers[i].handle;
-        clReleaseMemObject(handle);
+    return OpenCLEvent();
+}
+
+OpenCLEvent OpenCLInterface::executeKernelAsync(const char* kernelName, cl_uint workDimensions,
+                                                size_t *globalWorkSize,
+                                                const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        if (this->hostExecutor != nullptr){
+            this->runHostKernel(kernelName, workDimensions, globalWorkSize);
+            return OpenCLEvent();
+        }
+        cl_kernel target = this->getKernel(kernelName);
+        if (target == nullptr){
+            throw std::runtime_error(std::string("No kernel named ") + kernelName + " in program");
+        }
+        return this->enqueueKernel(kernelName, target, workDimensions, globalWorkSize, waitList);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+OpenCLEvent OpenCLInterface::updateBufferAsync(const int index,
+                                               const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to update buffer, but interface is not initialized!");
+        }
+        OpenCLBuffer *buffer = &this->inBuffers.at(index);
+        if (buffer->mapped != nullptr){
+            throw std::runtime_error("Can't write to a mapped buffer!");
+        }
+        if (this->hostExecutor != nullptr){
+            buffer->dirty.clear();
+            return OpenCLEvent();
+        }
+        std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+        cl_event event = nullptr;
+        cl_int result = clEnqueueWriteBuffer(this->queue, buffer->handle, CL_FALSE, 0,
+                                             buffer->sizeBytes, buffer->data,
+                                             waitHandles.size(),
+                                             waitHandles.empty() ? NULL : waitHandles.data(),
+                                             &event);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue buffer write: " + this->getCodeExplanation(result));
+        }
+        // Only a queued write covers the pending edits; on failure they
+        // stay marked so a later upload still sends them.
+        buffer->dirty.clear();
+        this->recordBufferProfile(index, true, ProfileCommand::Write,
+                            buffer->sizeBytes, event, false);
+        return OpenCLEvent(event);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+OpenCLEvent OpenCLInterface::readResultAsync(const int index,
+                                             const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to read buffer, but interface is not initialized!");
+        }
+        OpenCLBuffer *buffer = &this->outBuffers.at(index);
+        if (buffer->mapped != nullptr){
+            throw std::runtime_error("Can't read into a mapped buffer!");
+        }
+        if (this->hostExecutor != nullptr){
+            return OpenCLEvent();
+        }
+        std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+        cl_event event = nullptr;
+        cl_int result = clEnqueueReadBuffer(this->queue, buffer->handle, CL_FALSE, 0,
+                                            buffer->sizeBytes, buffer->data,
+                                            waitHandles.size(),
+                                            waitHandles.empty() ? NULL : waitHandles.data(),
+                                            &event);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue buffer read: " + this->getCodeExplanation(result));
+        }
+        this->recordBufferProfile(index, false, ProfileCommand::Read,
+                            buffer->sizeBytes, event, false);
+        return OpenCLEvent(event);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't read output buffer: " << e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+OpenCLEvent OpenCLInterface::enqueueBufferRange(const int index, bool isInput, size_t offset, size_t size,
+                                                bool blocking, const std::vector<OpenCLEvent>& waitList){
+    OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(index) : &this->outBuffers.at(index);
+    if (offset + size > buffer->sizeBytes || offset + size < offset){
+        throw std::runtime_error("Range of " + std::to_string(size) + " bytes at offset " +
+                                 std::to_string(offset) + " exceeds " + this->getBufferName(index, isInput));
+    }
+    if (buffer->mapped != nullptr){
+        throw std::runtime_error("Can't transfer a range of a mapped buffer!");
+    }
+    if (this->hostExecutor != nullptr){
+        return OpenCLEvent();
+    }
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+    unsigned char *host = static_cast<unsigned char*>(buffer->data) + offset;
+    cl_event event = nullptr;
+    cl_int result;
+    if (blocking && buffer->policy != AllocationPolicy::Copy){
+        // Same zero-copy path as the whole-buffer transfers, limited to
+        // the range.
+        void *mapped = clEnqueueMapBuffer(this->queue, buffer->handle, CL_TRUE,
+                                          isInput ? CL_MAP_WRITE_INVALIDATE_REGION : CL_MAP_READ,
+                                          offset, size, waitHandles.size(),
+                                          waitHandles.empty() ? NULL : waitHandles.data(),
+                                          NULL, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't map buffer range: " + this->getCodeExplanation(result));
+        }
+        if (mapped != host){
+            std::memcpy(isInput ? mapped : host, isInput ? host : mapped, size);
+        }
+        result = clEnqueueUnmapMemObject(this->queue, buffer->handle, mapped, 0, NULL, &event);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't unmap buffer range: " + this->getCodeExplanation(result));
+        }
+        clWaitForEvents(1, &event);
+        return OpenCLEvent(event);
+    }
+    if (blocking && waitHandles.empty() && this->stagingRing.accepts(size)){
+        int status = isInput ? this->stagingRing.write(this->queue, buffer->handle, offset, host, size,
+                                                       this->getActiveProfiler(), this->getProfileName(index, true))
+                             : this->stagingRing.read(this->queue, buffer->handle, offset, host, size,
+                                                      this->getActiveProfiler(), this->getProfileName(index, false));
+        if (status != 0){
+            throw std::runtime_error("Staged range transfer failed");
+        }
+        return OpenCLEvent();
+    }
+    if (isInput){
+        result = clEnqueueWriteBuffer(this->queue, buffer->handle, blocking ? CL_TRUE : CL_FALSE,
+                                      offset, size, host, waitHandles.size(),
+                                      waitHandles.empty() ? NULL : waitHandles.data(), &event);
+    } else {
+        result = clEnqueueReadBuffer(this->queue, buffer->handle, blocking ? CL_TRUE : CL_FALSE,
+                                     offset, size, host, waitHandles.size(),
+                                     waitHandles.empty() ? NULL : waitHandles.data(), &event);
+    }
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue buffer range transfer: " + this->getCodeExplanation(result));
+    }
+    this->recordBufferProfile(index, isInput,
+                        isInput ? ProfileCommand::Write : ProfileCommand::Read, size, event, false);
+    return OpenCLEvent(event);
+}
+
+OpenCLEvent OpenCLInterface::enqueueBufferRect(const int index, bool isInput, const BufferRect& rect,
+                                               bool blocking, const std::vector<OpenCLEvent>& waitList){
+    OpenCLBuffer *buffer = isInput ? &this->inBuffers.at(index) : &this->outBuffers.at(index);
+    if (getBufferRectEnd(rect) > buffer->sizeBytes){
+        throw std::runtime_error("Rectangle exceeds " + this->getBufferName(index, isInput));
+    }
+    if (buffer->mapped != nullptr){
+        throw std::runtime_error("Can't transfer a region of a mapped buffer!");
+    }
+    if (this->hostExecutor != nullptr){
+        return OpenCLEvent();
+    }
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+    size_t bytes = rect.region[0]*rect.region[1]*rect.region[2];
+    cl_event event = nullptr;
+    cl_int result;
+    // Host and buffer share one layout, so both use the same origin and
+    // pitches.
+    if (isInput){
+        result = clEnqueueWriteBufferRect(this->queue, buffer->handle, blocking ? CL_TRUE : CL_FALSE,
+                                          rect.origin, rect.origin, rect.region,
+                                          rect.rowPitch, rect.slicePitch,
+                                          rect.rowPitch, rect.slicePitch, buffer->data,
+                                          waitHandles.size(),
+                                          waitHandles.empty() ? NULL : waitHandles.data(), &event);
+    } else {
+        result = clEnqueueReadBufferRect(this->queue, buffer->handle, blocking ? CL_TRUE : CL_FALSE,
+                                         rect.origin, rect.origin, rect.region,
+                                         rect.rowPitch, rect.slicePitch,
+                                         rect.rowPitch, rect.slicePitch, buffer->data,
+                                         waitHandles.size(),
+                                         waitHandles.empty() ? NULL : waitHandles.data(), &event);
+    }
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue buffer rectangle transfer: " + this->getCodeExplanation(result));
+    }
+    this->recordBufferProfile(index, isInput,
+                        isInput ? ProfileCommand::Write : ProfileCommand::Read, bytes, event, false);
+    return OpenCLEvent(event);
+}
+
+int OpenCLInterface::updateBufferRange(const int index, size_t offset, size_t numElements){
+    try {
+        OpenCLBuffer *buffer = &this->inBuffers.at(index);
+        this->enqueueBufferRange(index, true, offset*buffer->elementSize,
+                                 numElements*buffer->elementSize, true, {});
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't update buffer range: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::updateBufferRect(const int index, const BufferRect& rect){
+    try {
+        this->enqueueBufferRect(index, true, rect, true, {});
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't update buffer region: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::readResultRange(const int index, size_t offset, size_t numElements){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to read buffer, but interface is not initialized!");
+        }
+        OpenCLBuffer *buffer = &this->outBuffers.at(index);
+        this->enqueueBufferRange(index, false, offset*buffer->elementSize,
+                                 numElements*buffer->elementSize, true, {});
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't read output buffer range: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLInterface::readResultRect(const int index, const BufferRect& rect){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to read buffer, but interface is not initialized!");
+        }
+        this->enqueueBufferRect(index, false, rect, true, {});
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't read output buffer region: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+OpenCLEvent OpenCLInterface::readResultRangeAsync(const int index, size_t offset, size_t numElements,
+                                                  const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to read buffer, but interface is not initialized!");
+        }
+        OpenCLBuffer *buffer = &this->outBuffers.at(index);
+        return this->enqueueBufferRange(index, false, offset*buffer->elementSize,
+                                        numElements*buffer->elementSize, false, waitList);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't read output buffer range: " << e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+OpenCLEvent OpenCLInterface::readResultRectAsync(const int index, const BufferRect& rect,
+                                                 const std::vector<OpenCLEvent>& waitList){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Trying to read buffer, but interface is not initialized!");
+        }
+        return this->enqueueBufferRect(index, false, rect, false, waitList);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't read output buffer region: " << e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+void OpenCLInterface::markBufferDirty(const int index, size_t offset, size_t numElements){
+    OpenCLBuffer *buffer = &this->inBuffers.at(index);
+    size_t begin = std::min(offset*buffer->elementSize, buffer->sizeBytes);
+    size_t end = std::min((offset + numElements)*buffer->elementSize, buffer->sizeBytes);
+    buffer->dirty.mark(begin, end - begin);
+    this->dirtyRegionStats.marked++;
+}
+
+void OpenCLInterface::markBufferDirty(const int index, const BufferRect& rect){
+    OpenCLBuffer *buffer = &this->inBuffers.at(index);
+    if (getBufferRectEnd(rect) > buffer->sizeBytes){
+        OPENCL_LOG_ERROR("Dirty rectangle exceeds " << this->getBufferName(index, true));
+        this->errorEncountered = true;
+        return;
+    }
+    buffer->dirty.mark(rect);
+    this->dirtyRegionStats.marked++;
+}
+
+OpenCLEvent OpenCLInterface::uploadDirtyRegions(const int index, bool blocking,
+                                                const std::vector<OpenCLEvent>& waitList){
+    OpenCLBuffer *buffer = &this->inBuffers.at(index);
+    std::vector<BufferRange> regions = buffer->dirty.coalesce(this->dirtyRegionMergeGap);
+    std::vector<OpenCLEvent> writes;
+    size_t bytes = 0;
+    for (const BufferRange& region : regions){
+        writes.push_back(this->enqueueBufferRange(index, true, region.offset, region.size,
+                                                  blocking, waitList));
+        bytes += region.size;
+    }
+    buffer->dirty.clear();
+    this->dirtyRegionStats.uploads++;
+    this->dirtyRegionStats.regionsUploaded += regions.size();
+    this->dirtyRegionStats.bytesUploaded += bytes;
+    this->dirtyRegionStats.bytesSkipped += buffer->sizeBytes - bytes;
+    if (writes.size() == 1 || this->hostExecutor != nullptr){
+        return writes.empty() ? OpenCLEvent() : writes.front();
+    }
+    // Nothing or several writes: a marker gives the caller one event to
+    // wait on, also on out-of-order queues.
+    std::vector<cl_event> handles = OpenCLEvent::toHandles(writes.empty() ? waitList : writes);
+    cl_event marker = nullptr;
+    cl_int result = clEnqueueMarkerWithWaitList(this->queue, handles.size(),
+                                                handles.empty() ? NULL : handles.data(), &marker);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue marker: " + this->getCodeExplanation(result));
+    }
+    return OpenCLEvent(marker);
+}
+
+int OpenCLInterface::updateDirtyRegions(const int index){
+    try {
+        this->uploadDirtyRegions(index, true, {});
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't upload dirty regions: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+OpenCLEvent OpenCLInterface::updateDirtyRegionsAsync(const int index,
+                                                     const std::vector<OpenCLEvent>& waitList){
+    try {
+        return this->uploadDirtyRegions(index, false, waitList);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't upload dirty regions: " << e.what());
+        this->errorEncountered = true;
+    }
+    return OpenCLEvent();
+}
+
+void OpenCLInterface::setDirtyRegionMergeGap(size_t mergeGapBytes){
+    this->dirtyRegionMergeGap = mergeGapBytes;
+}
+
+DirtyRegionStats OpenCLInterface::getDirtyRegionStats(){
+    return this->dirtyRegionStats;
+}
+
+int OpenCLInterface::enableProfiling(){
+    try {
+        this->requireDevice("profiling");
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    if (this->queueProperties & CL_QUEUE_PROFILING_ENABLE){
+        this->profiler.setEnabled(true);
+        return 0;
+    }
+    // Profiling is a queue property, so the queue has to be recreated.
+    // Kernels and buffers belong to the context and are unaffected. The old
+    // queue is kept until the new one exists, so a failure changes nothing.
+    clFinish(this->queue);
+    OpenCLHandle<cl_command_queue> previous(this->queue.detach());
+    cl_command_queue_properties previousProperties = this->queueProperties;
+    this->queueProperties |= CL_QUEUE_PROFILING_ENABLE;
+    if (this->createCommandQueue() != 0){
+        this->queue = std::move(previous);
+        this->queueProperties = previousProperties;
+        return -1;
+    }
+    this->profiler.setEnabled(true);
+    return 0;
+}
+
+OpenCLProfiler* OpenCLInterface::getProfiler(){
+    return &this->profiler;
+}
+
+cl_event* OpenCLInterface::getProfileEvent(cl_event *event){
+    return this->profiler.isEnabled() ? event : NULL;
+}
+
+// Names are only formatted for commands that are actually recorded, so
+// launches and transfers allocate nothing while profiling is off.
+void OpenCLInterface::recordProfile(const char* name, ProfileCommand command,
+                                    size_t bytes, cl_event event, bool release){
+    if (event == nullptr){
+        return;
+    }
+    if (this->profiler.isEnabled()){
+        this->profiler.record(name, command, bytes, event);
+    }
+    if (release){
+        clReleaseEvent(event);
+    }
+}
+
+void OpenCLInterface::recordBufferProfile(const int index, bool isInput, ProfileCommand command,
+                                          size_t bytes, cl_event event, bool release){
+    if (event != nullptr && this->profiler.isEnabled()){
+        this->profiler.record(this->getBufferName(index, isInput), command, bytes, event);
+    }
+    if (event != nullptr && release){
+        clReleaseEvent(event);
+    }
+}
+
+void OpenCLInterface::recordImageProfile(const int index, bool isInput, ProfileCommand command,
+                                         size_t bytes, cl_event event, bool release){
+    if (event != nullptr && this->profiler.isEnabled()){
+        this->profiler.record(this->getImageName(index, isInput), command, bytes, event);
+    }
+    if (event != nullptr && release){
+        clReleaseEvent(event);
+    }
+}
+
+OpenCLProfiler* OpenCLInterface::getActiveProfiler(){
+    return this->profiler.isEnabled() ? &this->profiler : nullptr;
+}
+
+std::string OpenCLInterface::getProfileName(const int index, bool isInput){
+    return this->profiler.isEnabled() ? this->getBufferName(index, isInput) : std::string();
+}
+
+std::string OpenCLInterface::getBufferName(const int index, bool isInput){
+    return (isInput ? "input " : "output ") + std::to_string(index);
+}
+
+std::string OpenCLInterface::getImageName(const int index, bool isInput){
+    return (isInput ? "input image " : "output image ") + std::to_string(index);
+}
+
+void OpenCLInterface::flush(){
+    clFlush(this->queue);
+}
+
+void OpenCLInterface::finish(){
+    clFinish(this->queue);
+}
+
+cl_context OpenCLInterface::getContext(){
+    return this->context;
+}
+
+cl_device_id OpenCLInterface::getDevice(){
+    return this->device;
+}
+
+cl_program OpenCLInterface::getProgram(){
+    return this->program;
+}
+
+int OpenCLInterface::enableThreadSafety(){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        this->requireDevice("thread queues");
+        if (this->threadSafe){
+            return 0;
+        }
+        // Creating every kernel now leaves the kernel registry read-only
+        // while threads are running.
+        if (this->getKernelNames().empty()){
+            throw std::runtime_error("Program has no kernels");
+        }
+        char version[128] = {0};
+        int major = 0;
+        int minor = 0;
+        clGetDeviceInfo(this->device, CL_DEVICE_VERSION, sizeof(version) - 1, version, NULL);
+        std::sscanf(version, "OpenCL %d.%d", &major, &minor);
+        this->canCloneKernels = major > 2 || (major == 2 && minor >= 1);
+        this->threadSafe = true;
+        OPENCL_LOG_INFO("Thread-safe mode enabled, kernels are "
+                        << (this->canCloneKernels ? "cloned" : "recreated") << " per thread");
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't enable thread safety: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+OpenCLThreadQueue* OpenCLInterface::getThreadQueue(){
+    // Lock-free for every call after a thread's first one.
+    thread_local std::vector<std::pair<unsigned long long, OpenCLThreadQueue*>> cache;
+    unsigned long long generation = this->threadQueueGeneration.load();
+    for (const auto& entry : cache){
+        if (generation != 0 && entry.first == generation){
+            return entry.second;
+        }
+    }
+    try {
+        if (!this->threadSafe){
+            throw std::runtime_error("Thread safety not enabled!");
+        }
+        std::lock_guard<std::mutex> lock(this->threadMutex);
+        {
+            // Entries of interfaces that were destroyed, reset or moved from
+            // would otherwise pile up for the thread's lifetime.
+            std::lock_guard<std::mutex> liveLock(liveGenerationsMutex);
+            cache.erase(std::remove_if(cache.begin(), cache.end(),
+                                       [](const std::pair<unsigned long long, OpenCLThreadQueue*>& entry){
+                                           return liveGenerations.count(entry.first) == 0;
+                                       }),
+                        cache.end());
+        }
+        // The session starts with the first thread queue after thread
+        // safety was enabled or the previous queues were dropped.
+        if (this->threadQueueGeneration.load() == 0){
+            this->threadQueueGeneration = registerThreadQueueGeneration();
+        }
+        cl_int result;
+        cl_command_queue_properties properties = this->queueProperties &
+                                                 ~(cl_command_queue_properties)CL_QUEUE_PROFILING_ENABLE;
+        cl_queue_properties queueProperties[] = {CL_QUEUE_PROPERTIES, properties, 0};
+        cl_command_queue threadQueue = clCreateCommandQueueWithProperties(this->context, this->device,
+                                                                          properties != 0 ? queueProperties : NULL,
+                                                                          &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create command queue: " + this->getCodeExplanation(result));
+        }
+        this->threadQueues.emplace_back(new OpenCLThreadQueue(this, threadQueue));
+        cache.emplace_back(this->threadQueueGeneration.load(), this->threadQueues.back().get());
+        return this->threadQueues.back().get();
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't create thread queue: " << e.what());
+    }
+    return nullptr;
+}
+
+cl_kernel OpenCLInterface::cloneKernel(const char* kernelName, OpenCLKernelArgs *args){
+    // Cloning reads the source kernel's arguments, which must not happen
+    // concurrently on the same kernel object.
+    std::lock_guard<std::mutex> lock(this->threadMutex);
+    cl_kernel source = this->getKernel(kernelName);
+    if (source == nullptr){
+        return nullptr;
+    }
+    auto found = this->kernelArgs.find(source);
+    OpenCLKernelArgs sourceArgs = found != this->kernelArgs.end() ? found->second : OpenCLKernelArgs();
+    cl_int result;
+    cl_kernel clone;
+    if (this->canCloneKernels){
+        clone = clCloneKernel(source, &result);
+    } else {
+        clone = clCreateKernel(this->program, kernelName, &result);
+        if (result == CL_SUCCESS){
+            // A fresh kernel has no arguments; replay the cached ones.
+            sourceArgs.invalidate();
+            result = sourceArgs.apply(clone);
+        }
+    }
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't clone kernel " << kernelName << ": "
+                         << getOpenCLErrorName(result));
+        if (clone != nullptr){
+            clReleaseKernel(clone);
+        }
+        return nullptr;
+    }
+    *args = sourceArgs;
+    return clone;
+}
+
+cl_mem OpenCLInterface::getBufferHandle(const int index, bool isInput){
+    try {
+        return isInput ? this->inBuffers.at(index).handle : this->outBuffers.at(index).handle;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("No " << (isInput ? "input" : "output") << " buffer " << index);
+        this->errorEncountered = true;
+    }
+    return nullptr;
+}
+
+OpenCLBufferDesc OpenCLInterface::getBufferDesc(const int index, bool isInput){
+    OpenCLBufferDesc desc;
+    try {
+        const OpenCLBuffer& buffer = isInput ? this->inBuffers.at(index) : this->outBuffers.at(index);
+        desc.data = buffer.data;
+        desc.numElements = buffer.numElements;
+        desc.elementSize = buffer.elementSize;
+        desc.typeName = buffer.typeName;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("No " << (isInput ? "input" : "output") << " buffer " << index);
+        this->errorEncountered = true;
+    }
+    return desc;
+}
+
+int OpenCLInterface::registerHostKernel(const char* kernelName, HostKernel kernel){
+    if (kernelName == nullptr || !kernel){
+        OPENCL_LOG_ERROR("Host kernel needs a name and a function");
+        return -1;
     }
+    this->hostKernels[kernelName] = std::move(kernel);
+    return 0;
+}
 
-    clReleaseCommandQueue(this->queue);
-    clReleaseContext(this->context);
+bool OpenCLInterface::isHostFallback(){
+    return this->hostExecutor != nullptr;
+}
+
+void OpenCLInterface::requireDevice(const std::string& component){
+    if (this->hostExecutor != nullptr){
+        throw std::runtime_error("An OpenCL device is required for " + component +
+                                 ", but the interface is running on the host fallback");
+    }
+}
+
+OpenCLHostExecutor* OpenCLInterface::getHostExecutor(){
+    return this->hostExecutor.get();
+}
+
+int OpenCLInterface::runHostKernel(const char* kernelName, cl_uint workDimensions,
+                                   size_t *globalWorkSize){
+    try {
+        auto found = this->hostKernels.find(kernelName);
+        if (found == this->hostKernels.end()){
+            throw std::runtime_error(std::string("No host kernel registered for ") + kernelName);
+        }
+        if (globalWorkSize == nullptr || workDimensions == 0 || workDimensions > 3){
+            throw std::runtime_error("Invalid NDRange for host kernel " + std::string(kernelName));
+        }
+        // Buffers in the order the device kernel would get them.
+        HostKernelArgs args;
+        args.buffers.resize(this->inBuffers.size() + this->outBuffers.size());
+        for (const std::vector<OpenCLBuffer>* buffers : {&this->inBuffers, &this->outBuffers}){
+            for (const OpenCLBuffer& buffer : *buffers){
+                HostBuffer& view = args.buffers.at(buffer.index);
+                view.data = buffer.data;
+                view.numElements = buffer.numElements;
+                view.elementSize = buffer.elementSize;
+                view.typeName = buffer.typeName;
+            }
+        }
+        args.workDimensions = workDimensions;
+        for (cl_uint i = 0 ; i < workDimensions ; i++){
+            args.globalWorkSize[i] = globalWorkSize[i];
+        }
+        if (this->hostExecutor->run(kernelName, found->second, args) != 0){
+            throw std::runtime_error("Host kernel " + std::string(kernelName) + " failed");
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+void OpenCLInterface::dropThreadQueues(){
+    this->threadQueues.clear();
+    retireThreadQueueGeneration(this->threadQueueGeneration.exchange(0));
+}
+
+void OpenCLInterface::releaseProgram(){
+    this->dropThreadQueues();
+    this->kernelArgs.clear();
+    this->kernels.clear();
+    this->kernel = nullptr;
+    this->program.reset();
+}
+
+void OpenCLInterface::releaseResources(){
+    // Everything initialize() creates. The context, queue, memory pool and
+    // samplers belong to the interface and outlive it.
+    this->releaseProgram();
+    this->threadSafe = false;
+    for (OpenCLBuffer& buffer : this->inBuffers){
+        this->releaseBufferHandle(&buffer);
+    }
+    for (OpenCLBuffer& buffer : this->outBuffers){
+        this->releaseBufferHandle(&buffer);
+    }
+    this->inBuffers.clear();
+    this->outBuffers.clear();
+    this->inImages.clear();
+    this->outImages.clear();
+    this->updateArgNum();
+}
+
+void OpenCLInterface::cleanup(){
+    this->releaseResources();
+    this->samplers.clear();
+    this->memoryPool.cleanup();
+    this->stagingRing.cleanup();
+    this->queue.reset();
+    this->context.reset();
+    this->hostExecutor.reset();
+    this->isInitialized = false;
 }
@@ -6,25 +6,63 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <map>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <CL/opencl.hpp>
 
+#include "opencl_autotuner.h"
+#include "opencl_buffer_regions.h"
+#include "opencl_devices.h"
+#include "opencl_error_codes.h"
+#include "opencl_event.h"
+#include "opencl_handle.h"
+#include "opencl_host_executor.h"
+#include "opencl_image.h"
+#include "opencl_kernel_args.h"
+#include "opencl_log.h"
+#include "opencl_memory_pool.h"
+#include "opencl_profiler.h"
+#include "opencl_program_cache.h"
+#include "opencl_staging_ring.h"
+#include "opencl_thread_queue.h"
+#include "opencl_types.h"
+
+enum class AllocationPolicy {
+    Copy,
+    UseHostPtr,
+    AllocHostPtr,
+    Auto
+};
+
 struct OpenCLBuffer {
     size_t index;
     size_t numElements;
     size_t sizeBytes;
+    size_t elementSize = sizeof(float);
+    const char* typeName = "float";
     bool isInput;
-    float *data = nullptr;
+    void *data = nullptr;
     cl_mem handle = nullptr;
+    AllocationPolicy policy = AllocationPolicy::Copy;
+    void *hostStorage = nullptr;
+    bool ownsHostStorage = false;
+    void *mapped = nullptr;
+    bool pooled = false;
+    OpenCLDirtyRegions dirty;
 };
 
 struct OpenCLImage {
-    int index;
+    size_t index;
     bool isInput;
-    cl_mem handle;
+    OpenCLHandle<cl_mem> handle;
     cl_image_format format;
     cl_image_desc desc = {0};
-    float *data;
+    OpenCLImageDesc layout;
+    void *data = nullptr;
+    void *mapped = nullptr;
 };
 
 class OpenCLInterface
@@ -33,6 +71,14 @@ class OpenCLInterface
         bool isInitialized;
         bool errorEncountered;
         OpenCLInterface();
+        explicit OpenCLInterface(cl_command_queue_properties queueProperties);
+        explicit OpenCLInterface(const DeviceSelectionPolicy& policy,
+                                 cl_command_queue_properties queueProperties = 0);
+        ~OpenCLInterface();
+        OpenCLInterface(const OpenCLInterface&) = delete;
+        OpenCLInterface& operator=(const OpenCLInterface&) = delete;
+        OpenCLInterface(OpenCLInterface&& other) noexcept;
+        OpenCLInterface& operator=(OpenCLInterface&& other) noexcept;
         void initialize(const char* source,
                         const char* programName,
                         cl_uint workDimensions,
@@ -41,52 +87,268 @@ class OpenCLInterface
                         std::vector<float*> inputPtrs,
                         std::vector<size_t> outputNumElements,
                         std::vector<float*> outputPtrs);
+        void initialize(const char* programName,
+                        const char* source,
+                        cl_uint workDimensions,
+                        size_t *globalWorkSize,
+                        std::vector<OpenCLBufferDesc> inputs,
+                        std::vector<OpenCLBufferDesc> outputs);
+        int reinitialize(const char* programName,
+                         const char* source,
+                         cl_uint workDimensions,
+                         size_t *globalWorkSize,
+                         std::vector<OpenCLBufferDesc> inputs,
+                         std::vector<OpenCLBufferDesc> outputs);
         void setGlobalWorkSize(size_t *size);
         void setSource(const char* source, const char* name);
-        float* getBufferDataPtr(const int index, bool isInput);
+        template<typename T = float>
+        T* getBufferDataPtr(const int index, bool isInput){
+            return static_cast<T*>(this->getBufferData(index, isInput, sizeof(T)));
+        }
         void updateBuffer(const int index);
+        int updateBufferRange(const int index, size_t offset, size_t numElements);
+        int updateBufferRect(const int index, const BufferRect& rect);
+        void markBufferDirty(const int index, size_t offset, size_t numElements);
+        void markBufferDirty(const int index, const BufferRect& rect);
+        int updateDirtyRegions(const int index);
+        void setDirtyRegionMergeGap(size_t mergeGapBytes);
+        DirtyRegionStats getDirtyRegionStats();
+        int updateImage(const int index);
+        int readImage(const int index);
+        template<typename T = unsigned char>
+        T* mapImage(const int index, bool isInput, cl_map_flags flags,
+                    size_t *rowPitch, size_t *slicePitch = nullptr){
+            return static_cast<T*>(this->mapImageData(index, isInput, flags, rowPitch, slicePitch));
+        }
+        int unmapImage(const int index, bool isInput);
+        std::vector<cl_image_format> getSupportedImageFormats(cl_mem_flags flags,
+                                                              cl_mem_object_type type);
+        bool isImageFormatSupported(cl_mem_flags flags, cl_mem_object_type type,
+                                    const cl_image_format& format);
         void printInfo();
         void cleanup();
         void executeAndRead(const int index);
         void execute();
         void readResult(const int index);
+        int readResultRange(const int index, size_t offset, size_t numElements);
+        int readResultRect(const int index, const BufferRect& rect);
+        void executeKernel(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize);
+        int bindBuffer(const char* kernelName, cl_uint argIndex, const int bufferIndex, bool isInput);
+        template<typename... Args>
+        int setKernelArgs(const char* kernelName, const Args&... args){
+            OpenCLKernelArgs *cache = this->getKernelArgs(kernelName);
+            if (cache == nullptr){
+                return -1;
+            }
+            cl_uint argIndex = 0;
+            int result = 0;
+            ((result |= this->stageKernelArg(cache, argIndex++, args)), ...);
+            return result == 0 ? 0 : -1;
+        }
+        template<typename T>
+        int setKernelArg(const char* kernelName, cl_uint argIndex, const T& value){
+            OpenCLKernelArgs *cache = this->getKernelArgs(kernelName);
+            if (cache == nullptr){
+                return -1;
+            }
+            return this->stageKernelArg(cache, argIndex, value);
+        }
+        KernelArgStats getKernelArgStats(const char* kernelName);
+        cl_sampler createSampler(bool normalizedCoords, cl_addressing_mode addressing,
+                                 cl_filter_mode filter);
+        std::vector<std::string> getKernelNames();
+        OpenCLEvent executeAsync(const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent executeKernelAsync(const char* kernelName, cl_uint workDimensions,
+                                       size_t *globalWorkSize,
+                                       const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent updateBufferAsync(const int index,
+                                      const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent readResultAsync(const int index,
+                                    const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent updateDirtyRegionsAsync(const int index,
+                                            const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent readResultRangeAsync(const int index, size_t offset, size_t numElements,
+                                         const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent readResultRectAsync(const int index, const BufferRect& rect,
+                                        const std::vector<OpenCLEvent>& waitList = {});
+        void flush();
+        void finish();
+        cl_context getContext();
+        cl_device_id getDevice();
+        cl_program getProgram();
+        cl_mem getBufferHandle(const int index, bool isInput);
+        OpenCLBufferDesc getBufferDesc(const int index, bool isInput);
+        int enableThreadSafety();
+        OpenCLThreadQueue* getThreadQueue();
+        cl_kernel cloneKernel(const char* kernelName, OpenCLKernelArgs *args);
+        static std::string getCodeExplanation(cl_int code);
+        void setAllocationPolicy(AllocationPolicy policy);
+        void setAllocationPolicies(std::vector<AllocationPolicy> inputPolicies,
+                                   std::vector<AllocationPolicy> outputPolicies);
+        void setImages(std::vector<OpenCLImageDesc> inputImages,
+                       std::vector<OpenCLImageDesc> outputImages);
+        bool hasUnifiedMemory();
+        template<typename T = float>
+        T* mapBuffer(const int index, bool isInput, cl_map_flags flags){
+            return static_cast<T*>(this->mapBufferData(index, isInput, flags, sizeof(T)));
+        }
+        int unmapBuffer(const int index, bool isInput);
+        template<typename T = float>
+        static T* allocateHostMemory(size_t numElements){
+            return static_cast<T*>(allocateHostBytes(numElements*sizeof(T)));
+        }
+        static void* allocateHostBytes(size_t sizeBytes);
+        static void freeHostMemory(void *data);
+        int enableMemoryPool(size_t blockSize = 64 << 20);
+        MemoryPoolStats getMemoryPoolStats();
+        int enableStagingRing(StagingRingOptions options = StagingRingOptions());
+        StagingRingStats getStagingRingStats();
+        int resizeBuffer(const int index, bool isInput, size_t numElements, float *data);
+        template<typename T>
+        int resizeBuffer(const int index, bool isInput, size_t numElements, T *data){
+            return this->resizeBuffer(index, isInput, makeBufferDesc(data, numElements));
+        }
+        int resizeBuffer(const int index, bool isInput, OpenCLBufferDesc desc);
+        int enableAutotuning(const char* databasePath, bool tuneOnLaunch = false);
+        int tuneLocalWorkSize(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize);
+        int enableProfiling();
+        OpenCLProfiler* getProfiler();
+        void setBuildOptions(const char* options);
+        void setBinaryCacheDirectory(const char* directory);
+        void clearBinaryCache();
+        ProgramCacheStats getBinaryCacheStats();
+        int registerHostKernel(const char* kernelName, HostKernel kernel);
+        bool isHostFallback();
+        // Throws for features that only exist on a real device, naming the
+        // component in the error.
+        void requireDevice(const std::string& component);
+        OpenCLHostExecutor* getHostExecutor();
 
     private:
         cl_platform_id platform;
         cl_device_id device;
-        cl_context context;
-        cl_command_queue queue;
-        cl_program program;
-        cl_kernel kernel;
-        const char* programSource = "No program";
-        const char* programName = "No program name";
+        OpenCLHandle<cl_context> context;
+        OpenCLHandle<cl_command_queue> queue;
+        cl_command_queue_properties queueProperties = 0;
+        DeviceSelectionPolicy devicePolicy;
+        OpenCLHandle<cl_program> program;
+        cl_kernel kernel = nullptr;
+        std::map<std::string, OpenCLHandle<cl_kernel>> kernels = {};
+        std::map<cl_kernel, OpenCLKernelArgs> kernelArgs = {};
+        std::vector<OpenCLHandle<cl_sampler>> samplers = {};
+        std::string programSource = "No program";
+        std::string programName = "No program name";
         cl_uint workDimensions;
         size_t *globalWorkSize;
         size_t numArguments;
+        std::string buildOptions = "";
+        OpenCLProgramCache programCache;
+        std::string programCacheKey = "";
+        bool programFromBinary = false;
         std::vector<OpenCLBuffer> inBuffers = {};
         std::vector<OpenCLBuffer> outBuffers = {};
         std::vector<OpenCLImage> inImages = {};
         std::vector<OpenCLImage> outImages = {};
+        std::vector<OpenCLImageDesc> inputImageDescs = {};
+        std::vector<OpenCLImageDesc> outputImageDescs = {};
+        std::map<std::pair<cl_mem_flags, cl_mem_object_type>,
+                 std::vector<cl_image_format>> supportedImageFormats = {};
+        AllocationPolicy defaultAllocationPolicy = AllocationPolicy::Copy;
+        std::vector<AllocationPolicy> inputAllocationPolicies = {};
+        std::vector<AllocationPolicy> outputAllocationPolicies = {};
+        OpenCLMemoryPool memoryPool;
+        OpenCLStagingRing stagingRing;
+        OpenCLAutotuner autotuner;
+        OpenCLProfiler profiler;
+        WorkSize localWorkSize = {0, 0, 0};
+        bool tuneOnLaunch = false;
+        bool threadSafe = false;
+        bool canCloneKernels = false;
+        std::mutex threadMutex;
+        std::vector<std::unique_ptr<OpenCLThreadQueue>> threadQueues = {};
+        std::atomic<unsigned long long> threadQueueGeneration{0};
+        size_t dirtyRegionMergeGap = 4096;
+        DirtyRegionStats dirtyRegionStats;
+        std::unique_ptr<OpenCLHostExecutor> hostExecutor;
+        std::map<std::string, HostKernel> hostKernels = {};
 
-
-        std::string getCodeExplanation(cl_int code);
+        void construct();
+        void startHostFallback();
+        int runHostKernel(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize);
+        void moveFrom(OpenCLInterface& other);
+        void dropThreadQueues();
+        void releaseProgram();
+        void releaseResources();
+        bool reuseBuffer(OpenCLBuffer *previous, const OpenCLBufferDesc& desc, bool isInput,
+                         AllocationPolicy policy);
+        cl_event* getProfileEvent(cl_event *event);
+        void recordProfile(const char* name, ProfileCommand command,
+                           size_t bytes, cl_event event, bool release);
+        void recordBufferProfile(const int index, bool isInput, ProfileCommand command,
+                                 size_t bytes, cl_event event, bool release);
+        void recordImageProfile(const int index, bool isInput, ProfileCommand command,
+                                size_t bytes, cl_event event, bool release);
+        OpenCLProfiler* getActiveProfiler();
+        std::string getProfileName(const int index, bool isInput);
+        std::string getBufferName(const int index, bool isInput);
+        const size_t* getLocalWorkSize(const char* kernelName, cl_kernel target,
+                                       cl_uint workDimensions, size_t *globalWorkSize);
+        OpenCLEvent enqueueKernel(const char* kernelName, cl_kernel target, cl_uint workDimensions,
+                                  size_t *globalWorkSize,
+                                  const std::vector<OpenCLEvent>& waitList);
         void printCodeExplanation(cl_int code);
         int getPlatformIDs();
         int getDeviceIDs();
         int createContext();
         int createCommandQueue();
         void updateArgNum();
-        int newBuffer(size_t numElements, float *data, bool isInput);
-        int newImage(int width, int height, int depth,
-                              float *data, bool isInput);
-        int createBuffer(size_t bufferSize, float *data, cl_mem *handle, bool isInput);
+        int newBuffer(const OpenCLBufferDesc& desc, bool isInput,
+                      AllocationPolicy policy = AllocationPolicy::Copy);
+        int allocateBufferHandle(OpenCLBuffer *buffer);
+        void releaseBufferHandle(OpenCLBuffer *buffer);
+        AllocationPolicy resolveAllocationPolicy(AllocationPolicy policy);
+        int prepareHostStorage(OpenCLBuffer *buffer);
+        OpenCLEvent enqueueBufferRange(const int index, bool isInput, size_t offset, size_t size,
+                                       bool blocking, const std::vector<OpenCLEvent>& waitList);
+        OpenCLEvent enqueueBufferRect(const int index, bool isInput, const BufferRect& rect,
+                                      bool blocking, const std::vector<OpenCLEvent>& waitList);
+        OpenCLEvent uploadDirtyRegions(const int index, bool blocking,
+                                       const std::vector<OpenCLEvent>& waitList);
+        int writeMappedBuffer(const int index);
+        int readMappedBuffer(const int index);
+        int newImage(const OpenCLImageDesc& layout, bool isInput);
+        int createBuffer(size_t bufferSize, void *data, cl_mem *handle, bool isInput,
+                         AllocationPolicy policy = AllocationPolicy::Copy);
         int createImage(cl_image_format *format, cl_image_desc *desc,
-                                         float *data, cl_mem *outHandle, bool isInput);
+                        void *data, cl_mem *outHandle, bool isInput);
+        cl_mem_flags getImageFlags(bool isInput);
+        std::string getImageName(const int index, bool isInput);
         int createProgram();
+        int createProgramFromSource();
+        int createProgramFromBinary();
         int buildProgram();
+        void storeProgramBinary();
         int createKernel();
+        int createKernels();
+        cl_kernel getKernel(const char* kernelName);
+        OpenCLKernelArgs* getKernelArgs(const char* kernelName);
+        template<typename T>
+        int stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const T& value){
+            cache->set(argIndex, value);
+            return 0;
+        }
+        int stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const BufferArg& buffer);
+        int stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const ImageArg& image);
+        int applyKernelArgs(cl_kernel target);
+        int rebindBuffer(cl_mem from, cl_mem to);
         int setAllKernelArgs();
+        void checkKernelArgTypes();
+        void* getBufferData(const int index, bool isInput, size_t elementSize);
+        void* mapImageData(const int index, bool isInput, cl_map_flags flags,
+                           size_t *rowPitch, size_t *slicePitch);
+        void* mapBufferData(const int index, bool isInput, cl_map_flags flags, size_t elementSize);
         int setKernelArg(const int index, cl_mem handle);
+        int setKernelArg(cl_kernel kernel, const int index, cl_mem handle);
 
 };
 
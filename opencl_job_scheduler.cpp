@@ -0,0 +1,382 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_job_scheduler.h"
+
+OpenCLJobScheduler::OpenCLJobScheduler(OpenCLInterface *interface, JobSchedulerOptions options)
+    : batchWindowUs(options.batchWindow.count()),
+      maxBatchSize(std::max<size_t>(options.maxBatchSize, 1)),
+      pending(0),
+      nextDeque(0),
+      stopping(false){
+    this->isInitialized = false;
+    this->errorEncountered = false;
+    this->interface = interface;
+    this->maxBatchItems = options.maxBatchItems;
+    try {
+        if (interface == nullptr || !interface->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        interface->requireDevice("the job scheduler");
+        if (interface->enableThreadSafety() != 0){
+            throw std::runtime_error("Couldn't enable thread-safe mode");
+        }
+        // Launch submission is cheap next to decoding or I/O on the
+        // producer side, so a few workers are enough to keep one device fed.
+        size_t numWorkers = options.numWorkers;
+        if (numWorkers == 0){
+            numWorkers = std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1), 4);
+        }
+        for (size_t i = 0 ; i < numWorkers ; i++){
+            this->deques.emplace_back(new JobDeque());
+            this->workers.emplace_back(new Worker());
+        }
+        for (size_t i = 0 ; i < numWorkers ; i++){
+            this->workers[i]->thread = std::thread(&OpenCLJobScheduler::run, this, i);
+        }
+        OPENCL_LOG_INFO("Job scheduler started with " << numWorkers << " workers");
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't create job scheduler: " << e.what());
+        this->errorEncountered = true;
+    }
+}
+
+OpenCLJobScheduler::~OpenCLJobScheduler(){
+    this->shutdown();
+}
+
+std::string OpenCLJobScheduler::makeKey(const ScheduledJob& job){
+    std::string key = job.kernelName;
+    for (const OpenCLBufferDesc& input : job.inputs){
+        key += "|i" + std::to_string(input.numElements*input.elementSize / job.numItems);
+    }
+    for (const OpenCLBufferDesc& output : job.outputs){
+        key += "|o" + std::to_string(output.numElements*output.elementSize / job.numItems);
+    }
+    return key;
+}
+
+std::future<int> OpenCLJobScheduler::submit(ScheduledJob job){
+    std::unique_ptr<PendingJob> pendingJob(new PendingJob());
+    std::future<int> result = pendingJob->done.get_future();
+    try {
+        if (!this->isInitialized || this->stopping){
+            throw std::runtime_error("Scheduler not running!");
+        }
+        if (job.numItems == 0 || job.numItems > this->maxBatchItems){
+            throw std::runtime_error("Job must have between 1 and " + std::to_string(this->maxBatchItems) + " items");
+        }
+        for (const std::vector<OpenCLBufferDesc>* descs : {&job.inputs, &job.outputs}){
+            for (const OpenCLBufferDesc& desc : *descs){
+                if (desc.data == nullptr || desc.numElements % job.numItems != 0){
+                    throw std::runtime_error("Job buffers must hold a whole number of elements per item");
+                }
+            }
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't submit job: " << e.what());
+        pendingJob->done.set_value(-1);
+        return result;
+    }
+
+    pendingJob->key = makeKey(job);
+    pendingJob->job = std::move(job);
+    pendingJob->submitted = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(this->statsMutex);
+        if (!this->timingStarted){
+            this->firstSubmit = pendingJob->submitted;
+            this->timingStarted = true;
+        }
+        this->stats.submitted++;
+    }
+    JobDeque *deque = this->deques[this->nextDeque++ % this->deques.size()].get();
+    {
+        std::lock_guard<std::mutex> lock(deque->mutex);
+        deque->jobs.push_back(pendingJob.get());
+        this->pending++;
+        // shutdown() may have started since the check above. Workers only
+        // exit once they see it with nothing pending, so if stopping is
+        // still false here a worker will pick this job up; otherwise it
+        // is taken back out and failed.
+        if (this->stopping){
+            deque->jobs.pop_back();
+            this->pending--;
+        } else {
+            pendingJob.release();
+        }
+    }
+    if (pendingJob != nullptr){
+        OPENCL_LOG_ERROR("Couldn't submit job: Scheduler not running!");
+        {
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            this->stats.submitted--;
+        }
+        pendingJob->done.set_value(-1);
+        return result;
+    }
+    this->wake.notify_all();
+    return result;
+}
+
+PendingJob* OpenCLJobScheduler::take(size_t workerIndex){
+    {
+        JobDeque *own = this->deques[workerIndex].get();
+        std::lock_guard<std::mutex> lock(own->mutex);
+        if (!own->jobs.empty()){
+            PendingJob *job = own->jobs.back();
+            own->jobs.pop_back();
+            this->pending--;
+            return job;
+        }
+    }
+    for (size_t k = 1 ; k < this->deques.size() ; k++){
+        JobDeque *victim = this->deques[(workerIndex + k) % this->deques.size()].get();
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->jobs.empty()){
+            PendingJob *job = victim->jobs.front();
+            victim->jobs.pop_front();
+            this->pending--;
+            std::lock_guard<std::mutex> statsLock(this->statsMutex);
+            this->stats.steals++;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void OpenCLJobScheduler::collect(size_t workerIndex, std::vector<PendingJob*> *batch, size_t *items){
+    const std::string& key = batch->front()->key;
+    size_t stolen = 0;
+    for (size_t k = 0 ; k < this->deques.size() && batch->size() < this->maxBatchSize ; k++){
+        JobDeque *deque = this->deques[(workerIndex + k) % this->deques.size()].get();
+        std::lock_guard<std::mutex> lock(deque->mutex);
+        for (auto it = deque->jobs.begin() ; it != deque->jobs.end() && batch->size() < this->maxBatchSize ; ){
+            PendingJob *job = *it;
+            if (job->key != key || *items + job->job.numItems > this->maxBatchItems){
+                ++it;
+                continue;
+            }
+            batch->push_back(job);
+            *items += job->job.numItems;
+            it = deque->jobs.erase(it);
+            this->pending--;
+            if (k != 0){
+                stolen++;
+            }
+        }
+    }
+    if (stolen > 0){
+        std::lock_guard<std::mutex> lock(this->statsMutex);
+        this->stats.steals += stolen;
+    }
+}
+
+void OpenCLJobScheduler::run(size_t workerIndex){
+    Worker *worker = this->workers[workerIndex].get();
+    while (true){
+        PendingJob *first = this->take(workerIndex);
+        if (first == nullptr){
+            if (this->stopping && this->pending == 0){
+                break;
+            }
+            std::unique_lock<std::mutex> lock(this->wakeMutex);
+            this->wake.wait_for(lock, std::chrono::milliseconds(1), [this](){
+                return this->pending > 0 || this->stopping;
+            });
+            continue;
+        }
+
+        std::vector<PendingJob*> batch = {first};
+        size_t items = first->job.numItems;
+        this->collect(workerIndex, &batch, &items);
+        // The window runs from the first job's submission, so batching
+        // adds at most one window to any job's latency.
+        auto deadline = first->submitted + std::chrono::microseconds(this->batchWindowUs.load());
+        while (batch.size() < this->maxBatchSize && !this->stopping &&
+               std::chrono::steady_clock::now() < deadline){
+            {
+                std::unique_lock<std::mutex> lock(this->wakeMutex);
+                this->wake.wait_until(lock, deadline);
+            }
+            this->collect(workerIndex, &batch, &items);
+        }
+        this->complete(batch, this->execute(worker, batch, items));
+    }
+}
+
+int OpenCLJobScheduler::reserve(Worker *worker, size_t slot, size_t sizeBytes){
+    if (slot >= worker->buffers.size()){
+        worker->buffers.resize(slot + 1, nullptr);
+        worker->capacities.resize(slot + 1, 0);
+        worker->staging.resize(slot + 1);
+    }
+    worker->staging[slot].resize(sizeBytes);
+    if (worker->capacities[slot] >= sizeBytes){
+        return 0;
+    }
+    if (worker->buffers[slot] != nullptr){
+        clReleaseMemObject(worker->buffers[slot]);
+        worker->buffers[slot] = nullptr;
+    }
+    // Grow geometrically so a slowly rising batch size doesn't reallocate
+    // on every launch.
+    size_t capacity = std::max(sizeBytes, worker->capacities[slot]*2);
+    cl_int result;
+    worker->buffers[slot] = clCreateBuffer(this->interface->getContext(), CL_MEM_READ_WRITE,
+                                           capacity, NULL, &result);
+    if (result != CL_SUCCESS){
+        worker->buffers[slot] = nullptr;
+        worker->capacities[slot] = 0;
+        OPENCL_LOG_ERROR("Couldn't create batch buffer: "
+                         << getOpenCLErrorName(result));
+        return -1;
+    }
+    worker->capacities[slot] = capacity;
+    return 0;
+}
+
+int OpenCLJobScheduler::execute(Worker *worker, const std::vector<PendingJob*>& batch, size_t items){
+    OpenCLThreadQueue *queue = this->interface->getThreadQueue();
+    if (queue == nullptr){
+        return -1;
+    }
+    const ScheduledJob& shape = batch.front()->job;
+    const char* kernelName = shape.kernelName.c_str();
+    size_t numInputs = shape.inputs.size();
+    size_t numSlots = numInputs + shape.outputs.size();
+
+    std::vector<OpenCLEvent> uploads;
+    for (size_t slot = 0 ; slot < numSlots ; slot++){
+        bool isInput = slot < numInputs;
+        const OpenCLBufferDesc& desc = isInput ? shape.inputs[slot] : shape.outputs[slot - numInputs];
+        size_t bytesPerItem = desc.numElements*desc.elementSize / shape.numItems;
+        if (this->reserve(worker, slot, bytesPerItem*items) != 0 ||
+            queue->setKernelArg(kernelName, slot, worker->buffers[slot]) != 0){
+            return -1;
+        }
+        if (!isInput){
+            continue;
+        }
+        size_t offset = 0;
+        for (PendingJob *job : batch){
+            size_t bytes = bytesPerItem*job->job.numItems;
+            std::memcpy(worker->staging[slot].data() + offset, job->job.inputs[slot].data, bytes);
+            offset += bytes;
+        }
+        uploads.push_back(queue->writeBufferAsync(worker->buffers[slot], 0, offset,
+                                                  worker->staging[slot].data()));
+        if (!uploads.back().isValid()){
+            return -1;
+        }
+    }
+
+    OpenCLEvent kernel = queue->executeKernelAsync(kernelName, 1, &items, uploads);
+    if (!kernel.isValid()){
+        return -1;
+    }
+    std::vector<OpenCLEvent> reads;
+    for (size_t slot = numInputs ; slot < numSlots ; slot++){
+        reads.push_back(queue->readBufferAsync(worker->buffers[slot], 0, worker->staging[slot].size(),
+                                               worker->staging[slot].data(), {kernel}));
+        if (!reads.back().isValid()){
+            return -1;
+        }
+    }
+    queue->flush();
+    if (OpenCLEvent::waitAll(reads) != CL_SUCCESS){
+        return -1;
+    }
+
+    for (size_t slot = numInputs ; slot < numSlots ; slot++){
+        size_t offset = 0;
+        for (PendingJob *job : batch){
+            const OpenCLBufferDesc& desc = job->job.outputs[slot - numInputs];
+            size_t bytes = desc.numElements*desc.elementSize;
+            std::memcpy(desc.data, worker->staging[slot].data() + offset, bytes);
+            offset += bytes;
+        }
+    }
+    return 0;
+}
+
+void OpenCLJobScheduler::complete(const std::vector<PendingJob*>& batch, int status){
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(this->statsMutex);
+        for (PendingJob *job : batch){
+            std::chrono::duration<double, std::micro> latency = now - job->submitted;
+            this->totalLatencyUs += latency.count();
+            this->stats.maxLatencyUs = std::max(this->stats.maxLatencyUs, latency.count());
+        }
+        this->stats.batches++;
+        if (status == 0){
+            this->stats.completed += batch.size();
+        } else {
+            this->stats.failed += batch.size();
+        }
+        this->lastComplete = now;
+    }
+    for (PendingJob *job : batch){
+        job->done.set_value(status);
+        delete job;
+    }
+}
+
+void OpenCLJobScheduler::setBatchWindow(std::chrono::microseconds window){
+    this->batchWindowUs = window.count();
+}
+
+void OpenCLJobScheduler::setMaxBatchSize(size_t maxBatchSize){
+    this->maxBatchSize = std::max<size_t>(maxBatchSize, 1);
+}
+
+JobSchedulerStats OpenCLJobScheduler::getStats(){
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    JobSchedulerStats result = this->stats;
+    size_t finished = result.completed + result.failed;
+    if (result.batches > 0){
+        result.meanBatchSize = (double)finished / result.batches;
+    }
+    if (finished > 0){
+        result.meanLatencyUs = this->totalLatencyUs / finished;
+        std::chrono::duration<double> elapsed = this->lastComplete - this->firstSubmit;
+        result.elapsedSeconds = elapsed.count();
+        if (result.elapsedSeconds > 0.0){
+            result.jobsPerSecond = result.completed / result.elapsedSeconds;
+        }
+    }
+    return result;
+}
+
+void OpenCLJobScheduler::resetStats(){
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    this->stats = JobSchedulerStats();
+    this->totalLatencyUs = 0.0;
+    this->timingStarted = false;
+}
+
+void OpenCLJobScheduler::shutdown(){
+    // Workers drain every queued job before they exit.
+    this->stopping = true;
+    this->wake.notify_all();
+    for (std::unique_ptr<Worker>& worker : this->workers){
+        if (worker->thread.joinable()){
+            worker->thread.join();
+        }
+        for (cl_mem handle : worker->buffers){
+            if (handle != nullptr){
+                clReleaseMemObject(handle);
+            }
+        }
+        worker->buffers.clear();
+        worker->capacities.clear();
+    }
+    this->workers.clear();
+    this->isInitialized = false;
+}
@@ -0,0 +1,127 @@
+#ifndef OPENCL_JOB_SCHEDULER
+#define OPENCL_JOB_SCHEDULER
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <CL/opencl.hpp>
+
+#include "opencl_types.h"
+
+class OpenCLInterface;
+
+// One small element-wise job. Every input and output holds `numItems` work
+// items' worth of elements (numElements must be a multiple of numItems), and
+// the kernel must index all of its buffer arguments by get_global_id(0),
+// which is what lets jobs be concatenated into one launch.
+struct ScheduledJob {
+    std::string kernelName = "";
+    size_t numItems = 0;
+    std::vector<OpenCLBufferDesc> inputs = {};
+    std::vector<OpenCLBufferDesc> outputs = {};
+};
+
+struct JobSchedulerOptions {
+    size_t numWorkers = 0;
+    std::chrono::microseconds batchWindow = std::chrono::microseconds(200);
+    size_t maxBatchSize = 256;
+    size_t maxBatchItems = 1 << 22;
+};
+
+struct JobSchedulerStats {
+    size_t submitted = 0;
+    size_t completed = 0;
+    size_t failed = 0;
+    size_t batches = 0;
+    size_t steals = 0;
+    double meanBatchSize = 0.0;
+    double meanLatencyUs = 0.0;
+    double maxLatencyUs = 0.0;
+    double elapsedSeconds = 0.0;
+    double jobsPerSecond = 0.0;
+};
+
+struct PendingJob {
+    ScheduledJob job;
+    std::string key = "";
+    std::promise<int> done;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+struct JobDeque {
+    std::mutex mutex;
+    std::deque<PendingJob*> jobs;
+};
+
+// Gathers small jobs from any number of producer threads and launches them
+// in batches. Producers push onto one of the per-worker deques; a worker
+// takes from the back of its own deque and steals from the front of the
+// others when it runs dry. Having taken a job, a worker collects compatible
+// jobs (same kernel and per-item layout) until the batch is full or the
+// batching window since the first job's submission has passed, then uploads
+// them as one contiguous buffer per argument, runs a single NDRange over all
+// items and scatters the results back. Workers submit through the
+// interface's per-thread queues, so enableThreadSafety() is called on it.
+class OpenCLJobScheduler
+{
+    public:
+        bool isInitialized;
+        bool errorEncountered;
+        OpenCLJobScheduler(OpenCLInterface *interface,
+                           JobSchedulerOptions options = JobSchedulerOptions());
+        ~OpenCLJobScheduler();
+        OpenCLJobScheduler(const OpenCLJobScheduler&) = delete;
+        OpenCLJobScheduler& operator=(const OpenCLJobScheduler&) = delete;
+
+        std::future<int> submit(ScheduledJob job);
+        void setBatchWindow(std::chrono::microseconds window);
+        void setMaxBatchSize(size_t maxBatchSize);
+        JobSchedulerStats getStats();
+        void resetStats();
+        void shutdown();
+
+    private:
+        struct Worker {
+            std::thread thread;
+            std::vector<cl_mem> buffers = {};
+            std::vector<size_t> capacities = {};
+            std::vector<std::vector<unsigned char>> staging = {};
+        };
+
+        OpenCLInterface *interface;
+        size_t maxBatchItems;
+        std::atomic<long long> batchWindowUs;
+        std::atomic<size_t> maxBatchSize;
+        std::vector<std::unique_ptr<JobDeque>> deques = {};
+        std::vector<std::unique_ptr<Worker>> workers = {};
+        std::atomic<size_t> pending;
+        std::atomic<size_t> nextDeque;
+        std::atomic<bool> stopping;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::mutex statsMutex;
+        JobSchedulerStats stats;
+        double totalLatencyUs = 0.0;
+        bool timingStarted = false;
+        std::chrono::steady_clock::time_point firstSubmit;
+        std::chrono::steady_clock::time_point lastComplete;
+
+        void run(size_t workerIndex);
+        PendingJob* take(size_t workerIndex);
+        void collect(size_t workerIndex, std::vector<PendingJob*> *batch, size_t *items);
+        int execute(Worker *worker, const std::vector<PendingJob*>& batch, size_t items);
+        int reserve(Worker *worker, size_t slot, size_t sizeBytes);
+        void complete(const std::vector<PendingJob*>& batch, int status);
+        static std::string makeKey(const ScheduledJob& job);
+};
+
+#endif // OPENCL_JOB_SCHEDULER
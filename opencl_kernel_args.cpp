@@ -0,0 +1,106 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <cstring>
+
+#include "opencl_kernel_args.h"
+
+OpenCLKernelArgs::OpenCLKernelArgs(){
+}
+
+OpenCLKernelArgs::Slot* OpenCLKernelArgs::getSlot(cl_uint index){
+    if (index >= this->slots.size()){
+        this->slots.resize(index + 1);
+    }
+    return &this->slots[index];
+}
+
+void OpenCLKernelArgs::setBytes(cl_uint index, const void *value, size_t size){
+    Slot *slot = this->getSlot(index);
+    this->stats.staged++;
+    if (slot->staged && !slot->local && slot->size == size &&
+        std::memcmp(slot->value.data(), value, size) == 0){
+        this->stats.skipped++;
+        return;
+    }
+    const unsigned char *bytes = static_cast<const unsigned char*>(value);
+    slot->value.assign(bytes, bytes + size);
+    slot->size = size;
+    slot->local = false;
+    slot->staged = true;
+    slot->dirty = true;
+}
+
+void OpenCLKernelArgs::set(cl_uint index, const LocalMemory& local){
+    Slot *slot = this->getSlot(index);
+    this->stats.staged++;
+    if (slot->staged && slot->local && slot->size == local.sizeBytes){
+        this->stats.skipped++;
+        return;
+    }
+    slot->value.clear();
+    slot->size = local.sizeBytes;
+    slot->local = true;
+    slot->staged = true;
+    slot->dirty = true;
+}
+
+bool OpenCLKernelArgs::isPending(){
+    for (const Slot& slot : this->slots){
+        if (slot.dirty){
+            return true;
+        }
+    }
+    return false;
+}
+
+cl_int OpenCLKernelArgs::apply(cl_kernel kernel, cl_uint *failedIndex){
+    for (cl_uint i = 0 ; i < this->slots.size() ; i++){
+        Slot& slot = this->slots[i];
+        if (!slot.dirty){
+            continue;
+        }
+        // A __local argument is set with a size and a NULL value.
+        cl_int result = clSetKernelArg(kernel, i, slot.size,
+                                       slot.local ? NULL : slot.value.data());
+        if (result != CL_SUCCESS){
+            // Forget the value so the same argument is not skipped as
+            // unchanged when the caller retries with it.
+            slot.staged = false;
+            slot.dirty = false;
+            if (failedIndex != nullptr){
+                *failedIndex = i;
+            }
+            return result;
+        }
+        slot.dirty = false;
+        this->stats.applied++;
+    }
+    return CL_SUCCESS;
+}
+
+void OpenCLKernelArgs::invalidate(){
+    for (Slot& slot : this->slots){
+        slot.dirty = slot.staged;
+    }
+}
+
+// Restages every argument holding `from` with `to`, for when the memory
+// object behind a buffer was reallocated. Matching arguments are marked
+// dirty even if the handle value didn't change, since it may now name a
+// different object.
+size_t OpenCLKernelArgs::replace(cl_mem from, cl_mem to){
+    size_t replaced = 0;
+    for (Slot& slot : this->slots){
+        if (slot.staged && !slot.local && slot.size == sizeof(cl_mem) &&
+            std::memcmp(slot.value.data(), &from, sizeof(cl_mem)) == 0){
+            std::memcpy(slot.value.data(), &to, sizeof(cl_mem));
+            slot.dirty = true;
+            replaced++;
+        }
+    }
+    return replaced;
+}
+
+KernelArgStats OpenCLKernelArgs::getStats(){
+    return this->stats;
+}
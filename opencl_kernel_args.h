@@ -0,0 +1,104 @@
+#ifndef OPENCL_KERNEL_ARGS
+#define OPENCL_KERNEL_ARGS
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <type_traits>
+#include <CL/opencl.hpp>
+
+// A __local argument. Only the size is passed; the memory lives on the
+// device for the duration of one work-group.
+struct LocalMemory {
+    size_t sizeBytes = 0;
+};
+
+template<typename T>
+LocalMemory localMemory(size_t numElements){
+    LocalMemory local;
+    local.sizeBytes = numElements*sizeof(T);
+    return local;
+}
+
+// Refers to one of the interface's own buffers, resolved to its cl_mem
+// handle when the argument is set.
+struct BufferArg {
+    int index = 0;
+    bool isInput = true;
+};
+
+inline BufferArg inputBuffer(int index){
+    return BufferArg{index, true};
+}
+
+inline BufferArg outputBuffer(int index){
+    return BufferArg{index, false};
+}
+
+// Same for the interface's images.
+struct ImageArg {
+    int index = 0;
+    bool isInput = true;
+};
+
+inline ImageArg inputImage(int index){
+    return ImageArg{index, true};
+}
+
+inline ImageArg outputImage(int index){
+    return ImageArg{index, false};
+}
+
+// Host pointers other than memory objects and samplers can't be passed by
+// value to a kernel; catching them here avoids binding a pointer's bits.
+template<typename T>
+struct IsKernelArgValue {
+    static constexpr bool value = std::is_trivially_copyable<T>::value &&
+                                  (!std::is_pointer<T>::value ||
+                                   std::is_same<T, cl_mem>::value ||
+                                   std::is_same<T, cl_sampler>::value);
+};
+
+struct KernelArgStats {
+    size_t staged = 0;
+    size_t applied = 0;
+    size_t skipped = 0;
+};
+
+// Cached argument values of one kernel. Values are compared byte-wise with
+// what was last staged, and only arguments whose value changed are passed
+// to clSetKernelArg on the next apply().
+class OpenCLKernelArgs
+{
+    public:
+        OpenCLKernelArgs();
+
+        template<typename T>
+        void set(cl_uint index, const T& value){
+            static_assert(IsKernelArgValue<T>::value,
+                          "Kernel arguments must be trivially copyable values, cl_mem or cl_sampler");
+            this->setBytes(index, &value, sizeof(T));
+        }
+        void set(cl_uint index, const LocalMemory& local);
+        void setBytes(cl_uint index, const void *value, size_t size);
+        bool isPending();
+        cl_int apply(cl_kernel kernel, cl_uint *failedIndex = nullptr);
+        void invalidate();
+        size_t replace(cl_mem from, cl_mem to);
+        KernelArgStats getStats();
+
+    private:
+        struct Slot {
+            std::vector<unsigned char> value = {};
+            size_t size = 0;
+            bool local = false;
+            bool staged = false;
+            bool dirty = false;
+        };
+        std::vector<Slot> slots = {};
+        KernelArgStats stats;
+
+        Slot* getSlot(cl_uint index);
+};
+
+#endif // OPENCL_KERNEL_ARGS
@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+
+#include "opencl_log.h"
+
+namespace {
+
+void writeToStdio(LogLevel level, const char* text, size_t length){
+    if (level >= LogLevel::Warning){
+        // Whatever stdout still holds was logged earlier.
+        std::fflush(stdout);
+        std::fwrite(text, 1, length, stderr);
+        return;
+    }
+    std::fwrite(text, 1, length, stdout);
+}
+
+std::atomic<LogSink> sink(&writeToStdio);
+
+std::atomic<int>& levelSetting(){
+    static std::atomic<int> level((int)OpenCLLog::parseLevel(std::getenv("OPENCL_INTERFACE_LOG_LEVEL"),
+                                                             LogLevel::Info));
+    return level;
+}
+
+// Pending lines of one thread. Only the owning thread touches it, so no
+// lock is needed until the lines are handed to the sink.
+struct ThreadLogBuffer {
+    char data[8192];
+    size_t length = 0;
+
+    void flush(){
+        if (this->length > 0){
+            sink.load()(LogLevel::Info, this->data, this->length);
+            this->length = 0;
+        }
+    }
+
+    ~ThreadLogBuffer(){
+        this->flush();
+    }
+};
+
+ThreadLogBuffer& threadBuffer(){
+    thread_local ThreadLogBuffer buffer;
+    return buffer;
+}
+
+}
+
+void OpenCLLog::setLevel(LogLevel level){
+    levelSetting().store((int)level, std::memory_order_relaxed);
+}
+
+LogLevel OpenCLLog::getLevel(){
+    return (LogLevel)currentLevel();
+}
+
+int OpenCLLog::currentLevel(){
+    return levelSetting().load(std::memory_order_relaxed);
+}
+
+void OpenCLLog::setSink(LogSink newSink){
+    flush();
+    sink.store(newSink != nullptr ? newSink : &writeToStdio);
+}
+
+void OpenCLLog::flush(){
+    threadBuffer().flush();
+}
+
+LogLevel OpenCLLog::parseLevel(const char* name, LogLevel fallback){
+    if (name == nullptr){
+        return fallback;
+    }
+    std::string lower(name);
+    for (char& c : lower){
+        c = (char)std::tolower((unsigned char)c);
+    }
+    const char* names[] = {"trace", "debug", "info", "warning", "error", "off"};
+    for (int i = 0 ; i < 6 ; i++){
+        if (lower == names[i]){
+            return (LogLevel)i;
+        }
+    }
+    return fallback;
+}
+
+OpenCLLogLine::OpenCLLogLine(LogLevel level){
+    this->level = level;
+    if (level == LogLevel::Error){
+        this->append("Error: ", 7);
+    } else if (level == LogLevel::Warning){
+        this->append("Warning: ", 9);
+    }
+}
+
+OpenCLLogLine::~OpenCLLogLine(){
+    // append() keeps one byte free for the newline.
+    this->text[this->length++] = '\n';
+    ThreadLogBuffer& buffer = threadBuffer();
+    if (this->level >= LogLevel::Warning){
+        // Earlier lines of this thread go first so the output stays in order.
+        buffer.flush();
+        sink.load()(this->level, this->text, this->length);
+        return;
+    }
+    if (buffer.length + this->length > sizeof(buffer.data)){
+        buffer.flush();
+    }
+    std::memcpy(buffer.data + buffer.length, this->text, this->length);
+    buffer.length += this->length;
+}
+
+OpenCLLogLine& OpenCLLogLine::append(const char* data, size_t size){
+    size_t space = capacity - 1 - this->length;
+    size = size < space ? size : space;
+    std::memcpy(this->text + this->length, data, size);
+    this->length += size;
+    return *this;
+}
+
+OpenCLLogLine& OpenCLLogLine::operator<<(const char* text){
+    return text != nullptr ? this->append(text, std::strlen(text)) : this->append("(null)", 6);
+}
+
+OpenCLLogLine& OpenCLLogLine::operator<<(const std::string& text){
+    return this->append(text.data(), text.size());
+}
+
+OpenCLLogLine& OpenCLLogLine::operator<<(char c){
+    return this->append(&c, 1);
+}
+
+OpenCLLogLine& OpenCLLogLine::operator<<(bool value){
+    return this->append(value ? "1" : "0", 1);
+}
+
+OpenCLLogLine& OpenCLLogLine::operator<<(const void* pointer){
+    char digits[32];
+    int size = std::snprintf(digits, sizeof(digits), "%p", pointer);
+    return this->append(digits, size > 0 ? size : 0);
+}
+
+OpenCLLogLine& OpenCLLogLine::appendSigned(long long value){
+    char digits[32];
+    int size = std::snprintf(digits, sizeof(digits), "%lld", value);
+    return this->append(digits, size > 0 ? size : 0);
+}
+
+OpenCLLogLine& OpenCLLogLine::appendUnsigned(unsigned long long value){
+    char digits[32];
+    int size = std::snprintf(digits, sizeof(digits), "%llu", value);
+    return this->append(digits, size > 0 ? size : 0);
+}
+
+OpenCLLogLine& OpenCLLogLine::appendDouble(double value){
+    char digits[32];
+    int size = std::snprintf(digits, sizeof(digits), "%g", value);
+    return this->append(digits, size > 0 ? size : 0);
+}
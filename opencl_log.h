@@ -0,0 +1,131 @@
+#ifndef OPENCL_LOG
+#define OPENCL_LOG
+
+#include <string>
+#include <type_traits>
+
+enum class LogLevel {
+    Trace = 0,
+    Debug = 1,
+    Info = 2,
+    Warning = 3,
+    Error = 4,
+    Off = 5
+};
+
+// Messages below this level are removed at compile time. Their arguments are
+// still type-checked, so variables used only for logging stay referenced,
+// but they are never evaluated.
+// Set through the OPENCL_INTERFACE_LOG_LEVEL CMake cache variable.
+#ifndef OPENCL_LOG_COMPILED_LEVEL
+#define OPENCL_LOG_COMPILED_LEVEL 0
+#endif
+
+// Receives one or more complete, newline-terminated lines.
+typedef void (*LogSink)(LogLevel level, const char* text, size_t length);
+
+// Process-wide log settings. Lines are collected in a per-thread buffer
+// without locking and handed to the sink when the buffer fills, when a
+// warning or error is logged, on flush() and when the thread exits. The
+// default sink writes warnings and errors to stderr and the rest to stdout.
+class OpenCLLog
+{
+    public:
+        static void setLevel(LogLevel level);
+        static LogLevel getLevel();
+        static void setSink(LogSink sink);
+        static void flush();
+        static LogLevel parseLevel(const char* name, LogLevel fallback);
+
+        static bool isEnabled(LogLevel level){
+            return (int)level >= OPENCL_LOG_COMPILED_LEVEL && (int)level >= currentLevel();
+        }
+
+    private:
+        static int currentLevel();
+};
+
+// One line being composed. Formats into fixed storage on the stack, so an
+// enabled message costs no heap allocation unless its arguments do.
+class OpenCLLogLine
+{
+    public:
+        explicit OpenCLLogLine(LogLevel level);
+        ~OpenCLLogLine();
+        OpenCLLogLine(const OpenCLLogLine&) = delete;
+        OpenCLLogLine& operator=(const OpenCLLogLine&) = delete;
+
+        OpenCLLogLine& operator<<(const char* text);
+        OpenCLLogLine& operator<<(const std::string& text);
+        OpenCLLogLine& operator<<(char c);
+        OpenCLLogLine& operator<<(bool value);
+        OpenCLLogLine& operator<<(const void* pointer);
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value, OpenCLLogLine&>::type operator<<(T value){
+            return std::is_signed<T>::value ? this->appendSigned((long long)value)
+                                            : this->appendUnsigned((unsigned long long)value);
+        }
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value, OpenCLLogLine&>::type operator<<(T value){
+            return this->appendDouble((double)value);
+        }
+
+    private:
+        static constexpr size_t capacity = 512;
+        LogLevel level;
+        char text[capacity];
+        size_t length = 0;
+
+        OpenCLLogLine& append(const char* data, size_t size);
+        OpenCLLogLine& appendSigned(long long value);
+        OpenCLLogLine& appendUnsigned(unsigned long long value);
+        OpenCLLogLine& appendDouble(double value);
+};
+
+#define OPENCL_LOG_AT(LEVEL, ...)                      \
+    do {                                               \
+        if (OpenCLLog::isEnabled(LEVEL)){              \
+            OpenCLLogLine openclLogLine(LEVEL);        \
+            openclLogLine << __VA_ARGS__;              \
+        }                                              \
+    } while (0)
+
+#define OPENCL_LOG_DISCARD(...)                        \
+    do {                                               \
+        if (false){                                    \
+            OpenCLLogLine openclLogLine(LogLevel::Off);\
+            openclLogLine << __VA_ARGS__;              \
+        }                                              \
+    } while (0)
+
+#if OPENCL_LOG_COMPILED_LEVEL <= 0
+#define OPENCL_LOG_TRACE(...) OPENCL_LOG_AT(LogLevel::Trace, __VA_ARGS__)
+#else
+#define OPENCL_LOG_TRACE(...) OPENCL_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if OPENCL_LOG_COMPILED_LEVEL <= 1
+#define OPENCL_LOG_DEBUG(...) OPENCL_LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#else
+#define OPENCL_LOG_DEBUG(...) OPENCL_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if OPENCL_LOG_COMPILED_LEVEL <= 2
+#define OPENCL_LOG_INFO(...) OPENCL_LOG_AT(LogLevel::Info, __VA_ARGS__)
+#else
+#define OPENCL_LOG_INFO(...) OPENCL_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if OPENCL_LOG_COMPILED_LEVEL <= 3
+#define OPENCL_LOG_WARNING(...) OPENCL_LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#else
+#define OPENCL_LOG_WARNING(...) OPENCL_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if OPENCL_LOG_COMPILED_LEVEL <= 4
+#define OPENCL_LOG_ERROR(...) OPENCL_LOG_AT(LogLevel::Error, __VA_ARGS__)
+#else
+#define OPENCL_LOG_ERROR(...) OPENCL_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#endif // OPENCL_LOG
@@ -0,0 +1,218 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "opencl_memory_pool.h"
+#include "opencl_log.h"
+
+OpenCLMemoryPool::OpenCLMemoryPool(){
+}
+
+OpenCLMemoryPool::~OpenCLMemoryPool(){
+    this->cleanup();
+}
+
+OpenCLMemoryPool::OpenCLMemoryPool(OpenCLMemoryPool&& other) noexcept {
+    *this = std::move(other);
+}
+
+OpenCLMemoryPool& OpenCLMemoryPool::operator=(OpenCLMemoryPool&& other) noexcept {
+    if (this != &other){
+        this->cleanup();
+        this->context = other.context;
+        this->flags = other.flags;
+        this->blockSize = other.blockSize;
+        this->alignment = other.alignment;
+        this->blocks = std::move(other.blocks);
+        this->freeSlices = std::move(other.freeSlices);
+        this->liveSlices = std::move(other.liveSlices);
+        this->stats = other.stats;
+        // Leave the source disabled and empty so it releases nothing.
+        other.context = nullptr;
+        other.blocks.clear();
+        other.freeSlices.clear();
+        other.liveSlices.clear();
+        other.stats = MemoryPoolStats();
+    }
+    return *this;
+}
+
+int OpenCLMemoryPool::initialize(cl_context context, cl_device_id device,
+                                 size_t blockSize, cl_mem_flags flags){
+    cl_uint alignBits = 0;
+    cl_int result = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                                    sizeof(cl_uint), &alignBits, NULL);
+    if (result != CL_SUCCESS || alignBits == 0){
+        OPENCL_LOG_ERROR("Couldn't query device base address alignment");
+        return -1;
+    }
+    this->context = context;
+    this->flags = flags;
+    this->alignment = std::max<size_t>(alignBits / 8, 1);
+    this->blockSize = std::max(blockSize, this->alignment);
+    OPENCL_LOG_INFO("Memory pool created with block size " << this->blockSize
+                    << " bytes and alignment " << this->alignment << " bytes");
+    return 0;
+}
+
+bool OpenCLMemoryPool::isEnabled(){
+    return this->context != nullptr;
+}
+
+size_t OpenCLMemoryPool::getAlignment(){
+    return this->alignment;
+}
+
+size_t OpenCLMemoryPool::getSizeClass(size_t sizeBytes){
+    size_t classSize = this->alignment;
+    while (classSize < sizeBytes){
+        classSize <<= 1;
+    }
+    return classSize;
+}
+
+int OpenCLMemoryPool::newBlock(size_t sizeBytes){
+    cl_int result;
+    cl_mem handle = clCreateBuffer(this->context, this->flags, sizeBytes, NULL, &result);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't reserve pool block of " << sizeBytes << " bytes");
+        return -1;
+    }
+    MemoryPoolBlock block;
+    block.handle = handle;
+    block.sizeBytes = sizeBytes;
+    this->blocks.push_back(block);
+    this->stats.blocks++;
+    this->stats.reservedBytes += sizeBytes;
+    return 0;
+}
+
+int OpenCLMemoryPool::reserveSlice(size_t classSize, MemoryPoolSlice *slice){
+    auto freeList = this->freeSlices.find(classSize);
+    if (freeList != this->freeSlices.end() && !freeList->second.empty()){
+        *slice = freeList->second.back();
+        freeList->second.pop_back();
+        this->stats.freeListBytes -= classSize;
+        this->stats.reuses++;
+        return 0;
+    }
+    // Slices are handed out from the end of the used range; since every
+    // class size is a multiple of the alignment, offsets stay aligned.
+    for (size_t i = 0 ; i < this->blocks.size() ; i++){
+        MemoryPoolBlock *block = &this->blocks[i];
+        if (block->sizeBytes - block->usedBytes >= classSize){
+            slice->block = i;
+            slice->offset = block->usedBytes;
+            slice->sizeBytes = classSize;
+            block->usedBytes += classSize;
+            return 0;
+        }
+    }
+    size_t newBlockSize = std::max(this->blockSize, classSize);
+    if (this->newBlock(newBlockSize) != 0){
+        return -1;
+    }
+    MemoryPoolBlock *block = &this->blocks.back();
+    slice->block = this->blocks.size() - 1;
+    slice->offset = 0;
+    slice->sizeBytes = classSize;
+    block->usedBytes = classSize;
+    return 0;
+}
+
+cl_mem OpenCLMemoryPool::allocate(size_t sizeBytes){
+    try {
+        if (!this->isEnabled()){
+            throw std::runtime_error("Memory pool not initialized!");
+        }
+        size_t classSize = this->getSizeClass(std::max<size_t>(sizeBytes, 1));
+        MemoryPoolSlice slice;
+        if (this->reserveSlice(classSize, &slice) != 0){
+            throw std::runtime_error("Couldn't reserve pool slice");
+        }
+        slice.requestedBytes = sizeBytes;
+
+        cl_int result;
+        cl_buffer_region region = {slice.offset, slice.sizeBytes};
+        cl_mem handle = clCreateSubBuffer(this->blocks[slice.block].handle, 0,
+                                          CL_BUFFER_CREATE_TYPE_REGION, &region, &result);
+        if (result != CL_SUCCESS){
+            this->freeSlices[classSize].push_back(slice);
+            this->stats.freeListBytes += classSize;
+            throw std::runtime_error("Couldn't create sub-buffer of " + std::to_string(classSize) + " bytes");
+        }
+        this->liveSlices[handle] = slice;
+        this->stats.allocations++;
+        this->stats.inUseBytes += slice.sizeBytes;
+        this->stats.requestedBytes += sizeBytes;
+        this->stats.highWaterMark = std::max(this->stats.highWaterMark, this->stats.inUseBytes);
+        return handle;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+    }
+    return nullptr;
+}
+
+bool OpenCLMemoryPool::owns(cl_mem handle){
+    return this->liveSlices.find(handle) != this->liveSlices.end();
+}
+
+int OpenCLMemoryPool::release(cl_mem handle){
+    auto found = this->liveSlices.find(handle);
+    if (found == this->liveSlices.end()){
+        OPENCL_LOG_ERROR("Handle " << handle << " is not owned by the memory pool");
+        return -1;
+    }
+    MemoryPoolSlice slice = found->second;
+    this->liveSlices.erase(found);
+    clReleaseMemObject(handle);
+    this->stats.inUseBytes -= slice.sizeBytes;
+    this->stats.requestedBytes -= slice.requestedBytes;
+    this->stats.freeListBytes += slice.sizeBytes;
+    this->freeSlices[slice.sizeBytes].push_back(slice);
+    return 0;
+}
+
+MemoryPoolStats OpenCLMemoryPool::getStats(){
+    MemoryPoolStats result = this->stats;
+    if (result.inUseBytes > 0){
+        result.internalFragmentation = 1.0 - (double)result.requestedBytes / result.inUseBytes;
+    }
+    // External fragmentation compares the largest request that could be
+    // served without a new block against all memory not currently in use.
+    size_t largestFree = 0;
+    size_t totalFree = result.freeListBytes;
+    for (const MemoryPoolBlock& block : this->blocks){
+        size_t tail = block.sizeBytes - block.usedBytes;
+        totalFree += tail;
+        largestFree = std::max(largestFree, tail);
+    }
+    for (const auto& freeList : this->freeSlices){
+        if (!freeList.second.empty()){
+            largestFree = std::max(largestFree, freeList.first);
+        }
+    }
+    if (totalFree > 0){
+        result.externalFragmentation = 1.0 - (double)largestFree / totalFree;
+    }
+    return result;
+}
+
+void OpenCLMemoryPool::cleanup(){
+    for (auto& entry : this->liveSlices){
+        clReleaseMemObject(entry.first);
+    }
+    this->liveSlices.clear();
+    this->freeSlices.clear();
+    for (MemoryPoolBlock& block : this->blocks){
+        clReleaseMemObject(block.handle);
+    }
+    this->blocks.clear();
+    this->stats = MemoryPoolStats();
+    // Disabled until initialize() is called again.
+    this->context = nullptr;
+    this->alignment = 0;
+    this->blockSize = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef OPENCL_MEMORY_POOL
+#define OPENCL_MEMORY_POOL
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <CL/opencl.hpp>
+
+struct MemoryPoolStats {
+    size_t blocks = 0;
+    size_t reservedBytes = 0;
+    size_t inUseBytes = 0;
+    size_t requestedBytes = 0;
+    size_t highWaterMark = 0;
+    size_t freeListBytes = 0;
+    size_t allocations = 0;
+    size_t reuses = 0;
+    double internalFragmentation = 0.0;
+    double externalFragmentation = 0.0;
+};
+
+struct MemoryPoolBlock {
+    cl_mem handle = nullptr;
+    size_t sizeBytes = 0;
+    size_t usedBytes = 0;
+};
+
+struct MemoryPoolSlice {
+    size_t block = 0;
+    size_t offset = 0;
+    size_t sizeBytes = 0;
+    size_t requestedBytes = 0;
+};
+
+// Reserves large device blocks and hands out sub-buffer slices of them.
+// Slice sizes are rounded up to a power-of-two size class no smaller than
+// CL_DEVICE_MEM_BASE_ADDR_ALIGN, so every slice offset satisfies the device's
+// sub-buffer alignment. Released slices go on a free list for their class and
+// are handed out again before new block space is used. The pool owns its
+// blocks and every live slice; it can be moved but not copied.
+class OpenCLMemoryPool
+{
+    public:
+        OpenCLMemoryPool();
+        ~OpenCLMemoryPool();
+        OpenCLMemoryPool(const OpenCLMemoryPool&) = delete;
+        OpenCLMemoryPool& operator=(const OpenCLMemoryPool&) = delete;
+        OpenCLMemoryPool(OpenCLMemoryPool&& other) noexcept;
+        OpenCLMemoryPool& operator=(OpenCLMemoryPool&& other) noexcept;
+        int initialize(cl_context context, cl_device_id device,
+                       size_t blockSize = 64 << 20,
+                       cl_mem_flags flags = CL_MEM_READ_WRITE);
+        bool isEnabled();
+        cl_mem allocate(size_t sizeBytes);
+        int release(cl_mem handle);
+        bool owns(cl_mem handle);
+        size_t getAlignment();
+        MemoryPoolStats getStats();
+        void cleanup();
+
+    private:
+        cl_context context = nullptr;
+        cl_mem_flags flags = CL_MEM_READ_WRITE;
+        size_t blockSize = 0;
+        size_t alignment = 0;
+        std::vector<MemoryPoolBlock> blocks = {};
+        std::map<size_t, std::vector<MemoryPoolSlice>> freeSlices = {};
+        std::unordered_map<cl_mem, MemoryPoolSlice> liveSlices = {};
+        MemoryPoolStats stats;
+
+        size_t getSizeClass(size_t sizeBytes);
+        int reserveSlice(size_t classSize, MemoryPoolSlice *slice);
+        int newBlock(size_t sizeBytes);
+};
+
+#endif // OPENCL_MEMORY_POOL
@@ -0,0 +1,460 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_multi_device.h"
+
+OpenCLMultiDevice::OpenCLMultiDevice(cl_device_type deviceType, bool sharedContext){
+    this->isInitialized = false;
+    this->errorEncountered = false;
+    this->sharedContext = sharedContext;
+    try {
+        std::vector<OpenCLDeviceInfo> devices = enumerateOpenCLDevices(deviceType);
+        if (devices.empty()){
+            throw std::runtime_error("No OpenCL devices found");
+        }
+        if (this->createContexts(devices) != 0){
+            throw std::runtime_error("");
+        }
+        OPENCL_LOG_INFO("Multi-device interface constructed with " << this->workers.size() << " devices");
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't construct multi-device interface: " << e.what());
+        this->errorEncountered = true;
+        this->cleanup();
+    }
+}
+
+OpenCLMultiDevice::~OpenCLMultiDevice(){
+    this->cleanup();
+}
+
+int OpenCLMultiDevice::createContexts(const std::vector<OpenCLDeviceInfo>& devices){
+    try {
+        for (const OpenCLDeviceInfo& info : devices){
+            size_t contextIndex = this->contexts.size();
+            if (this->sharedContext){
+                // One context per platform: devices of the same platform can
+                // share a program build and memory objects.
+                for (size_t i = 0 ; i < this->workers.size() ; i++){
+                    if (this->workers[i].info.platform == info.platform){
+                        contextIndex = this->workers[i].contextIndex;
+                        break;
+                    }
+                }
+            }
+            if (contextIndex == this->contexts.size()){
+                this->contexts.push_back(MultiDeviceContext());
+            }
+            this->contexts[contextIndex].devices.push_back(info.device);
+
+            DeviceWorker worker;
+            worker.info = info;
+            worker.contextIndex = contextIndex;
+            worker.weight = std::max(1.0, (double)info.computeUnits * std::max<cl_uint>(info.clockMHz, 1));
+            this->workers.push_back(worker);
+        }
+
+        cl_int result;
+        for (MultiDeviceContext& context : this->contexts){
+            context.context = clCreateContext(0, context.devices.size(), context.devices.data(),
+                                              NULL, NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create context: " + OpenCLInterface::getCodeExplanation(result));
+            }
+        }
+        cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+        for (DeviceWorker& worker : this->workers){
+            worker.queue = clCreateCommandQueueWithProperties(this->contexts[worker.contextIndex].context,
+                                                              worker.info.device, properties, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create command queue for " + worker.info.name +
+                                         ": " + OpenCLInterface::getCodeExplanation(result));
+            }
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+void OpenCLMultiDevice::initialize(const char* source,
+                                   const char* kernelName,
+                                   cl_uint workDimensions,
+                                   size_t *globalWorkSize,
+                                   std::vector<size_t> inputNumElements,
+                                   std::vector<float*> inputPtrs,
+                                   std::vector<bool> inputPartitioned,
+                                   std::vector<size_t> outputNumElements,
+                                   std::vector<float*> outputPtrs){
+    try {
+        if (this->workers.empty() || this->contexts.empty()){
+            throw std::runtime_error("Multi-device interface not constructed!");
+        }
+        // A failed build or run earlier doesn't stop a fresh start.
+        this->errorEncountered = false;
+        if (inputNumElements.size() != inputPtrs.size() || inputPtrs.size() != inputPartitioned.size()){
+            throw std::runtime_error("Length of input data pointers, sizes and partition flags don't match!");
+        }
+        if (outputNumElements.size() != outputPtrs.size()){
+            throw std::runtime_error("Length of output data pointers and length of output sizes don't match!");
+        }
+        if (workDimensions < 1 || workDimensions > 3 || globalWorkSize[0] == 0){
+            throw std::runtime_error("Invalid work size");
+        }
+        // Initializing again replaces the program, kernels and buffers;
+        // contexts, queues and the learned weights are kept.
+        this->releaseProgramState();
+        this->workDimensions = workDimensions;
+        for (cl_uint i = 0 ; i < workDimensions ; i++){
+            this->globalWorkSize[i] = globalWorkSize[i];
+        }
+
+        for (size_t i = 0 ; i < inputPtrs.size() ; i++){
+            MultiDeviceBuffer buffer;
+            buffer.numElements = inputNumElements[i];
+            buffer.isInput = true;
+            buffer.partitioned = inputPartitioned[i];
+            buffer.data = inputPtrs[i];
+            buffer.elementsPerItem = buffer.numElements / this->globalWorkSize[0];
+            if (buffer.partitioned && buffer.numElements % this->globalWorkSize[0] != 0){
+                throw std::runtime_error("Partitioned input " + std::to_string(i) +
+                                         " is not a whole number of elements per work-item row");
+            }
+            this->buffers.push_back(buffer);
+        }
+        for (size_t i = 0 ; i < outputPtrs.size() ; i++){
+            MultiDeviceBuffer buffer;
+            buffer.numElements = outputNumElements[i];
+            buffer.isInput = false;
+            buffer.partitioned = true;
+            buffer.data = outputPtrs[i];
+            buffer.elementsPerItem = buffer.numElements / this->globalWorkSize[0];
+            if (buffer.numElements % this->globalWorkSize[0] != 0){
+                throw std::runtime_error("Output " + std::to_string(i) +
+                                         " is not a whole number of elements per work-item row");
+            }
+            this->buffers.push_back(buffer);
+        }
+
+        if (this->buildPrograms(source) != 0 || this->createWorkers(kernelName) != 0){
+            throw std::runtime_error("");
+        }
+        OPENCL_LOG_INFO("Multi-device interface initialized successfully!");
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't initialize multi-device interface: " << e.what());
+        this->errorEncountered = true;
+        this->releaseProgramState();
+    }
+}
+
+int OpenCLMultiDevice::buildPrograms(const char* source){
+    try {
+        cl_int result;
+        for (MultiDeviceContext& context : this->contexts){
+            context.program = clCreateProgramWithSource(context.context, 1, &source, NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create program: " + OpenCLInterface::getCodeExplanation(result));
+            }
+            result = clBuildProgram(context.program, context.devices.size(), context.devices.data(),
+                                    NULL, NULL, NULL);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't build program: " + OpenCLInterface::getCodeExplanation(result));
+            }
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLMultiDevice::createWorkers(const char* kernelName){
+    try {
+        cl_int result;
+        for (DeviceWorker& worker : this->workers){
+            worker.kernel = clCreateKernel(this->contexts[worker.contextIndex].program, kernelName, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create kernel: " + OpenCLInterface::getCodeExplanation(result));
+            }
+            worker.handles.assign(this->buffers.size(), nullptr);
+            worker.capacityBytes.assign(this->buffers.size(), 0);
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+void OpenCLMultiDevice::setGranularity(size_t granularity){
+    this->granularity = std::max<size_t>(granularity, 1);
+}
+
+void OpenCLMultiDevice::partition(){
+    size_t total = this->globalWorkSize[0];
+    double weightSum = 0.0;
+    for (const DeviceWorker& worker : this->workers){
+        weightSum += worker.weight;
+    }
+    size_t begin = 0;
+    for (size_t i = 0 ; i < this->workers.size() ; i++){
+        DeviceWorker *worker = &this->workers[i];
+        size_t share;
+        if (i + 1 == this->workers.size()){
+            share = total - begin;
+        } else {
+            share = (size_t)(total * (worker->weight / weightSum));
+            share = (share / this->granularity) * this->granularity;
+            share = std::min(share, total - begin);
+        }
+        worker->sliceBegin = begin;
+        worker->sliceEnd = begin + share;
+        begin += share;
+    }
+}
+
+size_t OpenCLMultiDevice::getSliceOffset(const MultiDeviceBuffer& buffer, const DeviceWorker& worker){
+    return buffer.partitioned ? worker.sliceBegin*buffer.elementsPerItem : 0;
+}
+
+size_t OpenCLMultiDevice::getSliceElements(const MultiDeviceBuffer& buffer, const DeviceWorker& worker){
+    if (!buffer.partitioned){
+        return buffer.numElements;
+    }
+    return (worker.sliceEnd - worker.sliceBegin)*buffer.elementsPerItem;
+}
+
+int OpenCLMultiDevice::ensureCapacity(DeviceWorker *worker, size_t bufferIndex, size_t sizeBytes){
+    if (worker->capacityBytes[bufferIndex] >= sizeBytes && worker->handles[bufferIndex] != nullptr){
+        return 0;
+    }
+    if (worker->handles[bufferIndex] != nullptr){
+        clReleaseMemObject(worker->handles[bufferIndex]);
+        worker->handles[bufferIndex] = nullptr;
+    }
+    // Leave headroom so small shifts in the partition don't reallocate.
+    const MultiDeviceBuffer& buffer = this->buffers[bufferIndex];
+    size_t capacity = std::min(sizeBytes + sizeBytes / 4, buffer.numElements*sizeof(float));
+    capacity = std::max<size_t>(capacity, sizeof(float));
+    cl_int result;
+    cl_mem_flags flags = buffer.isInput ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY;
+    worker->handles[bufferIndex] = clCreateBuffer(this->contexts[worker->contextIndex].context,
+                                                  flags, capacity, NULL, &result);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't create buffer on " << worker->info.name << ": "
+                         << getOpenCLErrorName(result));
+        worker->handles[bufferIndex] = nullptr;
+        worker->capacityBytes[bufferIndex] = 0;
+        return -1;
+    }
+    worker->capacityBytes[bufferIndex] = capacity;
+    return 0;
+}
+
+int OpenCLMultiDevice::enqueueWorker(DeviceWorker *worker, std::vector<cl_event> *events){
+    size_t items = worker->sliceEnd - worker->sliceBegin;
+    if (items == 0){
+        return 0;
+    }
+    cl_int result;
+    std::vector<cl_event> writeEvents;
+    for (size_t i = 0 ; i < this->buffers.size() ; i++){
+        const MultiDeviceBuffer& buffer = this->buffers[i];
+        size_t sliceBytes = this->getSliceElements(buffer, *worker)*sizeof(float);
+        if (this->ensureCapacity(worker, i, sliceBytes) != 0){
+            return -1;
+        }
+        result = clSetKernelArg(worker->kernel, i, sizeof(cl_mem), &worker->handles[i]);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't set kernel arg: " << getOpenCLErrorName(result));
+            return -1;
+        }
+        if (buffer.isInput){
+            cl_event event;
+            result = clEnqueueWriteBuffer(worker->queue, worker->handles[i], CL_FALSE, 0, sliceBytes,
+                                          buffer.data + this->getSliceOffset(buffer, *worker),
+                                          0, NULL, &event);
+            if (result != CL_SUCCESS){
+                OPENCL_LOG_ERROR("Couldn't upload slice: " << getOpenCLErrorName(result));
+                return -1;
+            }
+            events->push_back(event);
+        }
+    }
+
+    size_t workSize[3] = {items, this->globalWorkSize[1], this->globalWorkSize[2]};
+    cl_event kernelEvent;
+    result = clEnqueueNDRangeKernel(worker->queue, worker->kernel, this->workDimensions,
+                                    NULL, workSize, NULL, 0, NULL, &kernelEvent);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't enqueue kernel on " << worker->info.name << ": "
+                         << getOpenCLErrorName(result));
+        return -1;
+    }
+    events->push_back(kernelEvent);
+
+    for (size_t i = 0 ; i < this->buffers.size() ; i++){
+        const MultiDeviceBuffer& buffer = this->buffers[i];
+        if (buffer.isInput){
+            continue;
+        }
+        cl_event event;
+        size_t sliceBytes = this->getSliceElements(buffer, *worker)*sizeof(float);
+        result = clEnqueueReadBuffer(worker->queue, worker->handles[i], CL_FALSE, 0, sliceBytes,
+                                     buffer.data + this->getSliceOffset(buffer, *worker),
+                                     0, NULL, &event);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't read slice: " << getOpenCLErrorName(result));
+            return -1;
+        }
+        events->push_back(event);
+    }
+    clFlush(worker->queue);
+    return 0;
+}
+
+int OpenCLMultiDevice::execute(){
+    if (!this->isInitialized){
+        OPENCL_LOG_ERROR("Interface not initialized!");
+        return -1;
+    }
+    this->partition();
+    std::vector<std::vector<cl_event>> events(this->workers.size());
+    int status = 0;
+    for (size_t i = 0 ; i < this->workers.size() ; i++){
+        if (this->enqueueWorker(&this->workers[i], &events[i]) != 0){
+            status = -1;
+        }
+    }
+    for (DeviceWorker& worker : this->workers){
+        clFinish(worker.queue);
+    }
+    if (status == 0){
+        this->updateWeights(events);
+    } else {
+        this->errorEncountered = true;
+    }
+    for (std::vector<cl_event>& workerEvents : events){
+        for (cl_event event : workerEvents){
+            clReleaseEvent(event);
+        }
+    }
+    return status;
+}
+
+void OpenCLMultiDevice::updateWeights(const std::vector<std::vector<cl_event>>& events){
+    std::vector<double> throughput(this->workers.size(), 0.0);
+    double throughputSum = 0.0;
+    double weightSum = 0.0;
+    for (size_t i = 0 ; i < this->workers.size() ; i++){
+        DeviceWorker *worker = &this->workers[i];
+        weightSum += worker->weight;
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        for (cl_event event : events[i]){
+            cl_ulong eventStart, eventEnd;
+            if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &eventStart, NULL) != CL_SUCCESS ||
+                clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &eventEnd, NULL) != CL_SUCCESS){
+                continue;
+            }
+            start = (start == 0) ? eventStart : std::min(start, eventStart);
+            end = std::max(end, eventEnd);
+        }
+        worker->lastMs = (end - start)*1e-6;
+        size_t items = worker->sliceEnd - worker->sliceBegin;
+        if (items > 0 && worker->lastMs > 0.0){
+            throughput[i] = items / worker->lastMs;
+            throughputSum += throughput[i];
+        }
+    }
+    if (throughputSum <= 0.0){
+        return;
+    }
+    // Blend measured throughput with the previous weights so one noisy run
+    // doesn't swing the whole partition. Devices that got no work keep their
+    // previous relative weight.
+    for (size_t i = 0 ; i < this->workers.size() ; i++){
+        DeviceWorker *worker = &this->workers[i];
+        double previous = worker->weight / weightSum;
+        double measured = throughput[i] > 0.0 ? throughput[i] / throughputSum : previous;
+        worker->weight = 0.5*previous + 0.5*measured;
+    }
+}
+
+size_t OpenCLMultiDevice::getDeviceCount(){
+    return this->workers.size();
+}
+
+std::vector<double> OpenCLMultiDevice::getWeights(){
+    std::vector<double> weights;
+    double weightSum = 0.0;
+    for (const DeviceWorker& worker : this->workers){
+        weightSum += worker.weight;
+    }
+    for (const DeviceWorker& worker : this->workers){
+        weights.push_back(weightSum > 0.0 ? worker.weight / weightSum : 0.0);
+    }
+    return weights;
+}
+
+void OpenCLMultiDevice::printInfo(){
+    std::vector<double> weights = this->getWeights();
+    for (size_t i = 0 ; i < this->workers.size() ; i++){
+        const DeviceWorker& worker = this->workers[i];
+        std::cout << "Device " << i << ": " << worker.info.name
+                  << " (" << getDeviceTypeName(worker.info.type) << ", " << worker.info.platformName << ")"
+                  << " share: " << weights[i]
+                  << " slice: [" << worker.sliceBegin << ", " << worker.sliceEnd << ")"
+                  << " last run: " << worker.lastMs << " ms\n";
+    }
+    std::cout << "\n";
+}
+
+void OpenCLMultiDevice::releaseProgramState(){
+    for (DeviceWorker& worker : this->workers){
+        for (cl_mem handle : worker.handles){
+            if (handle != nullptr){
+                clReleaseMemObject(handle);
+            }
+        }
+        worker.handles.clear();
+        worker.capacityBytes.clear();
+        if (worker.kernel != nullptr){
+            clReleaseKernel(worker.kernel);
+            worker.kernel = nullptr;
+        }
+    }
+    for (MultiDeviceContext& context : this->contexts){
+        if (context.program != nullptr){
+            clReleaseProgram(context.program);
+            context.program = nullptr;
+        }
+    }
+    this->buffers.clear();
+    this->isInitialized = false;
+}
+
+void OpenCLMultiDevice::cleanup(){
+    this->releaseProgramState();
+    for (DeviceWorker& worker : this->workers){
+        if (worker.queue != nullptr){
+            clReleaseCommandQueue(worker.queue);
+            worker.queue = nullptr;
+        }
+    }
+    for (MultiDeviceContext& context : this->contexts){
+        if (context.context != nullptr){
+            clReleaseContext(context.context);
+        }
+    }
+    this->workers.clear();
+    this->contexts.clear();
+}
@@ -0,0 +1,93 @@
+#ifndef OPENCL_MULTI_DEVICE
+#define OPENCL_MULTI_DEVICE
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <CL/opencl.hpp>
+
+#include "opencl_devices.h"
+
+struct MultiDeviceBuffer {
+    size_t numElements;
+    size_t elementsPerItem;
+    bool isInput;
+    bool partitioned;
+    float *data = nullptr;
+};
+
+struct MultiDeviceContext {
+    cl_context context = nullptr;
+    cl_program program = nullptr;
+    std::vector<cl_device_id> devices = {};
+};
+
+struct DeviceWorker {
+    OpenCLDeviceInfo info;
+    size_t contextIndex = 0;
+    cl_command_queue queue = nullptr;
+    cl_kernel kernel = nullptr;
+    std::vector<cl_mem> handles = {};
+    std::vector<size_t> capacityBytes = {};
+    size_t sliceBegin = 0;
+    size_t sliceEnd = 0;
+    double weight = 1.0;
+    double lastMs = 0.0;
+};
+
+// Splits one kernel launch across every device found on every platform.
+// Work is partitioned along dimension 0 of the global work size. Buffers
+// marked as partitioned are split the same way, and each device receives
+// only the rows of its share. Other inputs are broadcast whole. Each device
+// runs its slice as a launch starting at zero, so kernels must index their
+// buffers relative to the slice (as element-wise kernels naturally do).
+// Shares start proportional to compute units times clock and are then
+// re-weighted after every execute() by each device's measured throughput.
+class OpenCLMultiDevice
+{
+    public:
+        bool isInitialized;
+        bool errorEncountered;
+        OpenCLMultiDevice(cl_device_type deviceType = CL_DEVICE_TYPE_ALL, bool sharedContext = true);
+        ~OpenCLMultiDevice();
+        OpenCLMultiDevice(const OpenCLMultiDevice&) = delete;
+        OpenCLMultiDevice& operator=(const OpenCLMultiDevice&) = delete;
+        void initialize(const char* source,
+                        const char* kernelName,
+                        cl_uint workDimensions,
+                        size_t *globalWorkSize,
+                        std::vector<size_t> inputNumElements,
+                        std::vector<float*> inputPtrs,
+                        std::vector<bool> inputPartitioned,
+                        std::vector<size_t> outputNumElements,
+                        std::vector<float*> outputPtrs);
+        void setGranularity(size_t granularity);
+        int execute();
+        size_t getDeviceCount();
+        std::vector<double> getWeights();
+        void printInfo();
+        void cleanup();
+
+    private:
+        bool sharedContext;
+        std::vector<MultiDeviceContext> contexts = {};
+        std::vector<DeviceWorker> workers = {};
+        std::vector<MultiDeviceBuffer> buffers = {};
+        cl_uint workDimensions = 1;
+        size_t globalWorkSize[3] = {1, 1, 1};
+        size_t granularity = 1;
+
+        int createContexts(const std::vector<OpenCLDeviceInfo>& devices);
+        int buildPrograms(const char* source);
+        int createWorkers(const char* kernelName);
+        void releaseProgramState();
+        void partition();
+        int ensureCapacity(DeviceWorker *worker, size_t bufferIndex, size_t sizeBytes);
+        int enqueueWorker(DeviceWorker *worker, std::vector<cl_event> *events);
+        void updateWeights(const std::vector<std::vector<cl_event>>& events);
+        size_t getSliceOffset(const MultiDeviceBuffer& buffer, const DeviceWorker& worker);
+        size_t getSliceElements(const MultiDeviceBuffer& buffer, const DeviceWorker& worker);
+};
+
+#endif // OPENCL_MULTI_DEVICE
@@ -0,0 +1,788 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_primitives.h"
+
+// Built once per element type with T, T_LOWEST and T_HIGHEST defined, plus
+// PRIM_KEY_FLOAT or PRIM_KEY_SIGNED to order radix keys. WG is the fixed
+// work-group size every kernel is launched with.
+static const char* primitivesSource = R"CLC(
+#ifdef PRIM_SUBGROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+#define WG PRIM_WORK_GROUP_SIZE
+#define ITEMS 4
+#define RADIX_BITS 4
+#define RADIX 16
+
+inline T apply_op(int op, T a, T b){
+    return op == 0 ? a + b : (op == 1 ? min(a, b) : max(a, b));
+}
+
+inline T identity_op(int op){
+    return op == 0 ? (T)0 : (op == 1 ? T_HIGHEST : T_LOWEST);
+}
+
+// Combines one value per work-item; every work-item gets the result.
+inline T group_reduce(int op, T x, __local T* scratch){
+#ifdef PRIM_SUBGROUPS
+    T partial = op == 0 ? sub_group_reduce_add(x)
+                        : (op == 1 ? sub_group_reduce_min(x) : sub_group_reduce_max(x));
+    if (get_sub_group_local_id() == 0){
+        scratch[get_sub_group_id()] = partial;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (get_local_id(0) == 0){
+        T total = scratch[0];
+        for (uint i = 1 ; i < get_num_sub_groups() ; i++){
+            total = apply_op(op, total, scratch[i]);
+        }
+        scratch[0] = total;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+#else
+    uint lid = get_local_id(0);
+    scratch[lid] = x;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint stride = WG/2 ; stride > 0 ; stride >>= 1){
+        if (lid < stride){
+            scratch[lid] = apply_op(op, scratch[lid], scratch[lid + stride]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+#endif
+    T result = scratch[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return result;
+}
+
+// Exclusive prefix sum over the work-group; *total receives the sum of all
+// values. scratch holds at least WG + 1 elements.
+#ifdef PRIM_SUBGROUPS
+#define DEFINE_GROUP_SCAN(S)                                                    \
+inline S group_scan_##S(S x, __local S* scratch, S* total){                     \
+    S prefix = sub_group_scan_exclusive_add(x);                                 \
+    if (get_sub_group_local_id() == get_sub_group_size() - 1){                  \
+        scratch[get_sub_group_id()] = prefix + x;                               \
+    }                                                                           \
+    barrier(CLK_LOCAL_MEM_FENCE);                                               \
+    if (get_local_id(0) == 0){                                                  \
+        S sum = 0;                                                              \
+        for (uint i = 0 ; i < get_num_sub_groups() ; i++){                      \
+            S value = scratch[i];                                               \
+            scratch[i] = sum;                                                   \
+            sum += value;                                                       \
+        }                                                                       \
+        scratch[WG] = sum;                                                      \
+    }                                                                           \
+    barrier(CLK_LOCAL_MEM_FENCE);                                               \
+    prefix += scratch[get_sub_group_id()];                                      \
+    *total = scratch[WG];                                                       \
+    barrier(CLK_LOCAL_MEM_FENCE);                                               \
+    return prefix;                                                              \
+}
+#else
+#define DEFINE_GROUP_SCAN(S)                                                    \
+inline S group_scan_##S(S x, __local S* scratch, S* total){                     \
+    uint lid = get_local_id(0);                                                 \
+    scratch[lid] = x;                                                           \
+    barrier(CLK_LOCAL_MEM_FENCE);                                               \
+    for (uint offset = 1 ; offset < WG ; offset <<= 1){                         \
+        S add = lid >= offset ? scratch[lid - offset] : (S)0;                   \
+        barrier(CLK_LOCAL_MEM_FENCE);                                           \
+        scratch[lid] += add;                                                    \
+        barrier(CLK_LOCAL_MEM_FENCE);                                           \
+    }                                                                           \
+    S prefix = lid > 0 ? scratch[lid - 1] : (S)0;                               \
+    *total = scratch[WG - 1];                                                   \
+    barrier(CLK_LOCAL_MEM_FENCE);                                               \
+    return prefix;                                                              \
+}
+#endif
+
+DEFINE_GROUP_SCAN(T)
+DEFINE_GROUP_SCAN(uint)
+
+__kernel void reduce(__global const T* in, __global T* out, const uint n, const int op){
+    __local T scratch[WG + 1];
+    T acc = identity_op(op);
+    for (uint i = get_global_id(0) ; i < n ; i += get_global_size(0)){
+        acc = apply_op(op, acc, in[i]);
+    }
+    T total = group_reduce(op, acc, scratch);
+    if (get_local_id(0) == 0){
+        out[get_group_id(0)] = total;
+    }
+}
+
+// Each group scans a tile of WG*ITEMS elements. The tile is staged through
+// local memory so global loads and stores stay coalesced while each
+// work-item scans ITEMS consecutive elements serially.
+__kernel void scan_blocks(__global const T* in, __global T* out, __global T* blockSums, const uint n){
+    __local T tile[WG*ITEMS];
+    __local T scratch[WG + 1];
+    uint lid = get_local_id(0);
+    uint base = get_group_id(0)*WG*ITEMS;
+    for (uint k = 0 ; k < ITEMS ; k++){
+        uint i = base + k*WG + lid;
+        tile[k*WG + lid] = i < n ? in[i] : (T)0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    T values[ITEMS];
+    T sum = 0;
+    for (uint k = 0 ; k < ITEMS ; k++){
+        values[k] = tile[lid*ITEMS + k];
+        sum += values[k];
+    }
+    T total;
+    T prefix = group_scan_T(sum, scratch, &total);
+    for (uint k = 0 ; k < ITEMS ; k++){
+        tile[lid*ITEMS + k] = prefix;
+        prefix += values[k];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint k = 0 ; k < ITEMS ; k++){
+        uint i = base + k*WG + lid;
+        if (i < n){
+            out[i] = tile[k*WG + lid];
+        }
+    }
+    if (lid == 0 && blockSums != 0){
+        blockSums[get_group_id(0)] = total;
+    }
+}
+
+__kernel void scan_add_offsets(__global T* out, __global const T* blockSums, const uint n){
+    T offset = blockSums[get_group_id(0)];
+    uint base = get_group_id(0)*WG*ITEMS;
+    for (uint k = 0 ; k < ITEMS ; k++){
+        uint i = base + k*WG + get_local_id(0);
+        if (i < n){
+            out[i] += offset;
+        }
+    }
+}
+
+__kernel void scan_make_inclusive(__global T* out, __global const T* in, const uint n){
+    for (uint i = get_global_id(0) ; i < n ; i += get_global_size(0)){
+        out[i] += in[i];
+    }
+}
+
+// Bins of width (highest - lowest)/numBins; values outside [lowest, highest]
+// and NaNs are not counted, highest itself goes to the last bin.
+inline int bin_of(T x, float lowest, float highest, float scale, uint numBins){
+    float v = (float)x;
+    if (!(v >= lowest && v <= highest)){
+        return -1;
+    }
+    return (int)min((uint)((v - lowest)*scale), numBins - 1);
+}
+
+__kernel void histogram_local(__global const T* in, __global uint* bins, const uint n,
+                              const float lowest, const float highest, const float scale,
+                              const uint numBins, __local uint* localBins){
+    for (uint i = get_local_id(0) ; i < numBins ; i += WG){
+        localBins[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint i = get_global_id(0) ; i < n ; i += get_global_size(0)){
+        int bin = bin_of(in[i], lowest, highest, scale, numBins);
+        if (bin >= 0){
+            atomic_inc(&localBins[bin]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint i = get_local_id(0) ; i < numBins ; i += WG){
+        uint count = localBins[i];
+        if (count != 0){
+            atomic_add(&bins[i], count);
+        }
+    }
+}
+
+__kernel void histogram_global(__global const T* in, __global uint* bins, const uint n,
+                               const float lowest, const float highest, const float scale,
+                               const uint numBins){
+    for (uint i = get_global_id(0) ; i < n ; i += get_global_size(0)){
+        int bin = bin_of(in[i], lowest, highest, scale, numBins);
+        if (bin >= 0){
+            atomic_inc(&bins[bin]);
+        }
+    }
+}
+
+inline uint keep(T x, T threshold, int op){
+    switch (op){
+        case 0: return x == threshold;
+        case 1: return x != threshold;
+        case 2: return x < threshold;
+        case 3: return x <= threshold;
+        case 4: return x > threshold;
+        default: return x >= threshold;
+    }
+}
+
+__kernel void compact_flags(__global const T* in, __global uint* flags, const uint n,
+                            const T threshold, const int op){
+    uint i = get_global_id(0);
+    if (i < n){
+        flags[i] = keep(in[i], threshold, op);
+    }
+}
+
+__kernel void compact_scatter(__global const T* in, __global const uint* flags,
+                              __global const uint* positions, __global T* out, const uint n){
+    uint i = get_global_id(0);
+    if (i < n && flags[i]){
+        out[positions[i]] = in[i];
+    }
+}
+
+// Maps the key's bits to an unsigned integer with the same ordering.
+inline uint radix_key(T x){
+#if defined(PRIM_KEY_FLOAT)
+    uint u = as_uint(x);
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+#elif defined(PRIM_KEY_SIGNED)
+    return as_uint(x) ^ 0x80000000u;
+#else
+    return as_uint(x);
+#endif
+}
+
+// Per-group digit counts, stored digit-major so one exclusive scan over
+// them yields every group's output offset for every digit.
+__kernel void radix_count(__global const T* keys, __global uint* counts, const uint n, const uint shift){
+    __local uint bins[RADIX];
+    uint lid = get_local_id(0);
+    if (lid < RADIX){
+        bins[lid] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    uint i = get_global_id(0);
+    if (i < n){
+        atomic_inc(&bins[(radix_key(keys[i]) >> shift) & (RADIX - 1)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (lid < RADIX){
+        counts[lid*get_num_groups(0) + get_group_id(0)] = bins[lid];
+    }
+}
+
+// Stable scatter: an item's rank among the group's items with the same
+// digit comes from one group scan per digit.
+__kernel void radix_scatter(__global const T* keysIn, __global T* keysOut,
+                            __global const uint* valuesIn, __global uint* valuesOut,
+                            __global const uint* offsets, const uint n, const uint shift){
+    __local uint scratch[WG + 1];
+    uint i = get_global_id(0);
+    bool valid = i < n;
+    T key = valid ? keysIn[i] : (T)0;
+    uint digit = valid ? (radix_key(key) >> shift) & (RADIX - 1) : RADIX;
+    uint rank = 0;
+    for (uint d = 0 ; d < RADIX ; d++){
+        uint total;
+        uint before = group_scan_uint(digit == d ? 1u : 0u, scratch, &total);
+        if (digit == d){
+            rank = before;
+        }
+    }
+    if (valid){
+        uint target = offsets[digit*get_num_groups(0) + get_group_id(0)] + rank;
+        keysOut[target] = key;
+        if (valuesIn != 0){
+            valuesOut[target] = valuesIn[i];
+        }
+    }
+}
+)CLC";
+
+static const char* primitiveKernelNames[] = {
+    "reduce", "scan_blocks", "scan_add_offsets", "scan_make_inclusive",
+    "histogram_local", "histogram_global", "compact_flags", "compact_scatter",
+    "radix_count", "radix_scatter"
+};
+
+static const size_t radixBits = 4;
+static const size_t radixDigits = 16;
+static const size_t scanItems = 4;
+
+OpenCLPrimitives::OpenCLPrimitives(OpenCLInterface *interface, PrimitivesOptions options){
+    this->isInitialized = false;
+    this->errorEncountered = false;
+    this->interface = interface;
+    try {
+        if (interface == nullptr || !interface->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        interface->requireDevice("device primitives");
+        this->context = interface->getContext();
+        this->device = interface->getDevice();
+
+        size_t maxWorkGroupSize = 1;
+        cl_uint computeUnits = 1;
+        cl_ulong localMem = 0;
+        clGetDeviceInfo(this->device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
+        clGetDeviceInfo(this->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, NULL);
+        clGetDeviceInfo(this->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMem, NULL);
+        // The group reduction and scans assume a power of two, and the
+        // radix kernels need at least one work-item per digit.
+        size_t limit = std::min(std::max<size_t>(options.workGroupSize, radixDigits), maxWorkGroupSize);
+        this->workGroupSize = 1;
+        while (this->workGroupSize*2 <= limit){
+            this->workGroupSize *= 2;
+        }
+        if (this->workGroupSize < radixDigits){
+            throw std::runtime_error("Device work-groups are too small");
+        }
+        // Enough groups to fill every compute unit a few times over for
+        // the grid-stride kernels; more only adds partial results.
+        this->maxGroups = std::min<size_t>(std::max<cl_uint>(computeUnits, 1)*4, this->workGroupSize);
+        this->localMemBytes = localMem;
+
+        if (options.useSubgroups){
+            size_t size = 0;
+            clGetDeviceInfo(this->device, CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+            std::string extensions(size, '\0');
+            clGetDeviceInfo(this->device, CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL);
+            clGetDeviceInfo(this->device, CL_DEVICE_OPENCL_C_VERSION, 0, NULL, &size);
+            std::string version(size, '\0');
+            clGetDeviceInfo(this->device, CL_DEVICE_OPENCL_C_VERSION, size, &version[0], NULL);
+            // "OpenCL C <major>.<minor> ..."; subgroup built-ins need 2.0.
+            int major = version.size() > 9 ? version[9] - '0' : 1;
+            this->subgroups = extensions.find("cl_khr_subgroups") != std::string::npos && major >= 2;
+            this->languageVersion = "-cl-std=CL" + std::to_string(major) + ".0";
+        }
+
+        cl_int result;
+        this->queue = clCreateCommandQueueWithProperties(this->context, this->device, NULL, &result);
+        if (result != CL_SUCCESS){
+            this->queue = nullptr;
+            throw std::runtime_error("Couldn't create command queue: " + interface->getCodeExplanation(result));
+        }
+        OPENCL_LOG_INFO("Primitives created with work-group size " << this->workGroupSize
+                        << (this->subgroups ? " using subgroups" : " using local memory"));
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't create primitives: " << e.what());
+        this->errorEncountered = true;
+    }
+}
+
+OpenCLPrimitives::~OpenCLPrimitives(){
+    this->cleanup();
+}
+
+bool OpenCLPrimitives::checkType(const PrimitiveBuffer& buffer, const char* typeName){
+    if (std::strcmp(buffer.typeName, typeName) != 0){
+        OPENCL_LOG_ERROR("Buffer holds " << buffer.typeName << " elements, not " << typeName);
+        this->errorEncountered = true;
+        return false;
+    }
+    return true;
+}
+
+PrimitiveBuffer OpenCLPrimitives::getBuffer(const int index, bool isInput){
+    OpenCLBufferDesc desc = this->interface->getBufferDesc(index, isInput);
+    PrimitiveBuffer buffer;
+    buffer.handle = this->interface->getBufferHandle(index, isInput);
+    buffer.numElements = desc.numElements;
+    buffer.typeName = desc.typeName;
+    return buffer;
+}
+
+int OpenCLPrimitives::buildProgram(const std::string& typeName, PrimitiveProgram *program){
+    std::string options = "-DPRIM_WORK_GROUP_SIZE=" + std::to_string(this->workGroupSize);
+    if (typeName == "float"){
+        options += " -DT=float -DT_LOWEST=(-INFINITY) -DT_HIGHEST=INFINITY -DPRIM_KEY_FLOAT";
+    } else if (typeName == "int"){
+        options += " -DT=int -DT_LOWEST=INT_MIN -DT_HIGHEST=INT_MAX -DPRIM_KEY_SIGNED";
+    } else if (typeName == "uint"){
+        options += " -DT=uint -DT_LOWEST=0 -DT_HIGHEST=UINT_MAX";
+    } else {
+        OPENCL_LOG_ERROR("Primitives support int, uint and float elements, not " << typeName);
+        return -1;
+    }
+    if (this->subgroups){
+        options += " " + this->languageVersion + " -DPRIM_SUBGROUPS";
+    }
+    cl_int result;
+    program->program = clCreateProgramWithSource(this->context, 1, &primitivesSource, NULL, &result);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't create primitives program: " << getOpenCLErrorName(result));
+        return -1;
+    }
+    result = clBuildProgram(program->program, 1, &this->device, options.c_str(), NULL, NULL);
+    if (result != CL_SUCCESS){
+        size_t size = 0;
+        clGetProgramBuildInfo(program->program, this->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+        std::string log(size, '\0');
+        clGetProgramBuildInfo(program->program, this->device, CL_PROGRAM_BUILD_LOG, size, &log[0], NULL);
+        OPENCL_LOG_ERROR("Couldn't build primitives for " << typeName << ": "
+                         << getOpenCLErrorName(result) << "\n" << log);
+        return -1;
+    }
+    for (const char* name : primitiveKernelNames){
+        PrimitiveKernel kernel;
+        kernel.kernel = clCreateKernel(program->program, name, &result);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't create kernel " << name << ": " << getOpenCLErrorName(result));
+            return -1;
+        }
+        size_t kernelWorkGroupSize = 0;
+        clGetKernelWorkGroupInfo(kernel.kernel, this->device, CL_KERNEL_WORK_GROUP_SIZE,
+                                 sizeof(size_t), &kernelWorkGroupSize, NULL);
+        program->kernels[name] = kernel;
+        if (kernelWorkGroupSize < this->workGroupSize){
+            OPENCL_LOG_ERROR("Kernel " << name << " supports work-groups of " << kernelWorkGroupSize
+                             << ", primitives need " << this->workGroupSize);
+            return -1;
+        }
+    }
+    this->stats.programsBuilt++;
+    return 0;
+}
+
+PrimitiveKernel* OpenCLPrimitives::getKernel(const std::string& typeName, const char* kernelName){
+    auto found = this->programs.find(typeName);
+    if (found == this->programs.end()){
+        found = this->programs.emplace(typeName, PrimitiveProgram()).first;
+        if (this->buildProgram(typeName, &found->second) != 0){
+            throw std::runtime_error("Couldn't build primitives program");
+        }
+    }
+    return &found->second.kernels.at(kernelName);
+}
+
+cl_mem OpenCLPrimitives::reserve(size_t slot, size_t sizeBytes){
+    if (slot >= this->scratch.size()){
+        this->scratch.resize(slot + 1, nullptr);
+        this->scratchSizes.resize(slot + 1, 0);
+    }
+    if (this->scratchSizes[slot] < sizeBytes){
+        if (this->scratch[slot] != nullptr){
+            clReleaseMemObject(this->scratch[slot]);
+            this->scratch[slot] = nullptr;
+            this->scratchSizes[slot] = 0;
+        }
+        cl_int result;
+        cl_mem handle = clCreateBuffer(this->context, CL_MEM_READ_WRITE,
+                                       std::max<size_t>(sizeBytes, 1), NULL, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create scratch buffer: " + this->interface->getCodeExplanation(result));
+        }
+        this->scratch[slot] = handle;
+        this->scratchSizes[slot] = sizeBytes;
+    }
+    return this->scratch[slot];
+}
+
+void OpenCLPrimitives::launch(PrimitiveKernel *kernel, size_t numGroups){
+    cl_uint failedIndex = 0;
+    cl_int result = kernel->args.apply(kernel->kernel, &failedIndex);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't set arg " + std::to_string(failedIndex) + ": " +
+                                 this->interface->getCodeExplanation(result));
+    }
+    size_t global = numGroups*this->workGroupSize;
+    size_t local = this->workGroupSize;
+    result = clEnqueueNDRangeKernel(this->queue, kernel->kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue primitive: " + this->interface->getCodeExplanation(result));
+    }
+    this->stats.launches++;
+}
+
+void OpenCLPrimitives::begin(){
+    if (!this->isInitialized){
+        throw std::runtime_error("Primitives not initialized!");
+    }
+    // Inputs usually come from kernels the interface just queued.
+    this->interface->finish();
+}
+
+void OpenCLPrimitives::readBytes(cl_mem buffer, size_t offset, size_t sizeBytes, void *target){
+    cl_int result = clEnqueueReadBuffer(this->queue, buffer, CL_TRUE, offset, sizeBytes, target, 0, NULL, NULL);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't read result: " + this->interface->getCodeExplanation(result));
+    }
+    this->stats.resultBytesRead += sizeBytes;
+}
+
+void OpenCLPrimitives::scanLevel(const std::string& typeName, cl_mem input, cl_mem output,
+                                 size_t numElements, size_t level){
+    size_t tile = this->workGroupSize*scanItems;
+    size_t numBlocks = (numElements + tile - 1) / tile;
+    cl_uint n = (cl_uint)numElements;
+    PrimitiveKernel *blocks = this->getKernel(typeName, "scan_blocks");
+    if (numBlocks == 1){
+        blocks->args.set(0, input);
+        blocks->args.set(1, output);
+        blocks->args.set(2, (cl_mem)nullptr);
+        blocks->args.set(3, n);
+        this->launch(blocks, 1);
+        return;
+    }
+    // Scan every tile, scan the tile totals (recursively, in place) and
+    // add each tile's total offset back onto its elements.
+    cl_mem sums = this->reserve(ScratchScanLevels + level, numBlocks*sizeof(cl_uint));
+    blocks->args.set(0, input);
+    blocks->args.set(1, output);
+    blocks->args.set(2, sums);
+    blocks->args.set(3, n);
+    this->launch(blocks, numBlocks);
+    this->scanLevel(typeName, sums, sums, numBlocks, level + 1);
+    PrimitiveKernel *offsets = this->getKernel(typeName, "scan_add_offsets");
+    offsets->args.set(0, output);
+    offsets->args.set(1, sums);
+    offsets->args.set(2, n);
+    this->launch(offsets, numBlocks);
+}
+
+int OpenCLPrimitives::reduceBytes(const PrimitiveBuffer& input, ReduceOp op, void *result){
+    auto start = std::chrono::steady_clock::now();
+    try {
+        this->begin();
+        if (input.numElements == 0){
+            throw std::runtime_error("Can't reduce an empty buffer");
+        }
+        size_t numGroups = std::min(this->maxGroups,
+                                    (input.numElements + this->workGroupSize - 1) / this->workGroupSize);
+        cl_mem partials = this->reserve(ScratchPartials, numGroups*sizeof(cl_uint));
+        PrimitiveKernel *kernel = this->getKernel(input.typeName, "reduce");
+        cl_int opCode = (cl_int)op;
+        kernel->args.set(0, input.handle);
+        kernel->args.set(1, partials);
+        kernel->args.set(2, (cl_uint)input.numElements);
+        kernel->args.set(3, opCode);
+        this->launch(kernel, numGroups);
+        if (numGroups > 1){
+            // One group folds the partials; it reads them all before
+            // writing its result over the first one.
+            kernel->args.set(0, partials);
+            kernel->args.set(2, (cl_uint)numGroups);
+            this->launch(kernel, 1);
+        }
+        this->readBytes(partials, 0, sizeof(cl_uint), result);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't reduce buffer: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    this->stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+int OpenCLPrimitives::scan(const PrimitiveBuffer& input, cl_mem output, bool inclusive){
+    auto start = std::chrono::steady_clock::now();
+    try {
+        this->begin();
+        if (inclusive && output == input.handle){
+            throw std::runtime_error("Inclusive scan needs an output separate from the input");
+        }
+        if (input.numElements == 0){
+            return 0;
+        }
+        this->scanLevel(input.typeName, input.handle, output, input.numElements, 0);
+        if (inclusive){
+            PrimitiveKernel *kernel = this->getKernel(input.typeName, "scan_make_inclusive");
+            kernel->args.set(0, output);
+            kernel->args.set(1, input.handle);
+            kernel->args.set(2, (cl_uint)input.numElements);
+            this->launch(kernel, std::min(this->maxGroups,
+                                          (input.numElements + this->workGroupSize - 1) / this->workGroupSize));
+        }
+        clFinish(this->queue);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't scan buffer: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    this->stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+int OpenCLPrimitives::sort(const PrimitiveBuffer& keys, cl_mem values){
+    auto start = std::chrono::steady_clock::now();
+    try {
+        this->begin();
+        size_t n = keys.numElements;
+        if (n < 2){
+            return 0;
+        }
+        size_t numGroups = (n + this->workGroupSize - 1) / this->workGroupSize;
+        cl_mem keysTemp = this->reserve(ScratchSortKeys, n*sizeof(cl_uint));
+        cl_mem valuesTemp = values != nullptr ? this->reserve(ScratchSortValues, n*sizeof(cl_uint)) : nullptr;
+        cl_mem counts = this->reserve(ScratchCounts, radixDigits*numGroups*sizeof(cl_uint));
+        PrimitiveKernel *count = this->getKernel(keys.typeName, "radix_count");
+        PrimitiveKernel *scatter = this->getKernel(keys.typeName, "radix_scatter");
+
+        // Least significant digit first. Eight passes of four bits move the
+        // data back and forth an even number of times, so the sorted keys
+        // end up in the caller's buffer.
+        cl_mem keysIn = keys.handle;
+        cl_mem keysOut = keysTemp;
+        cl_mem valuesIn = values;
+        cl_mem valuesOut = valuesTemp;
+        for (cl_uint shift = 0 ; shift < 32 ; shift += radixBits){
+            count->args.set(0, keysIn);
+            count->args.set(1, counts);
+            count->args.set(2, (cl_uint)n);
+            count->args.set(3, shift);
+            this->launch(count, numGroups);
+            this->scanLevel("uint", counts, counts, radixDigits*numGroups, 0);
+            scatter->args.set(0, keysIn);
+            scatter->args.set(1, keysOut);
+            scatter->args.set(2, valuesIn);
+            scatter->args.set(3, valuesOut);
+            scatter->args.set(4, counts);
+            scatter->args.set(5, (cl_uint)n);
+            scatter->args.set(6, shift);
+            this->launch(scatter, numGroups);
+            std::swap(keysIn, keysOut);
+            std::swap(valuesIn, valuesOut);
+        }
+        clFinish(this->queue);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't sort buffer: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    this->stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+int OpenCLPrimitives::histogramRange(const PrimitiveBuffer& input, double lowest, double highest,
+                                     size_t numBins, std::vector<unsigned int> *counts){
+    auto start = std::chrono::steady_clock::now();
+    try {
+        this->begin();
+        if (numBins == 0 || !(highest > lowest)){
+            throw std::runtime_error("Histogram needs at least one bin and highest > lowest");
+        }
+        cl_mem bins = this->reserve(ScratchCounts, numBins*sizeof(cl_uint));
+        cl_uint zero = 0;
+        cl_int result = clEnqueueFillBuffer(this->queue, bins, &zero, sizeof(cl_uint), 0,
+                                            numBins*sizeof(cl_uint), 0, NULL, NULL);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't clear histogram: " + this->interface->getCodeExplanation(result));
+        }
+        size_t numGroups = std::max<size_t>(std::min(this->maxGroups,
+                                            (input.numElements + this->workGroupSize - 1) / this->workGroupSize), 1);
+        // Private sub-histograms in local memory absorb most of the atomic
+        // traffic, as long as they leave room for occupancy.
+        bool local = numBins*sizeof(cl_uint) <= this->localMemBytes / 2;
+        PrimitiveKernel *kernel = this->getKernel(input.typeName, local ? "histogram_local" : "histogram_global");
+        kernel->args.set(0, input.handle);
+        kernel->args.set(1, bins);
+        kernel->args.set(2, (cl_uint)input.numElements);
+        kernel->args.set(3, (cl_float)lowest);
+        kernel->args.set(4, (cl_float)highest);
+        kernel->args.set(5, (cl_float)(numBins / (highest - lowest)));
+        kernel->args.set(6, (cl_uint)numBins);
+        if (local){
+            kernel->args.set(7, localMemory<cl_uint>(numBins));
+        }
+        this->launch(kernel, numGroups);
+        counts->resize(numBins);
+        this->readBytes(bins, 0, numBins*sizeof(cl_uint), counts->data());
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't build histogram: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    this->stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+int OpenCLPrimitives::compactBytes(const PrimitiveBuffer& input, CompareOp op, const void *threshold,
+                                   cl_mem output, size_t *count){
+    auto start = std::chrono::steady_clock::now();
+    try {
+        this->begin();
+        size_t n = input.numElements;
+        *count = 0;
+        if (n == 0){
+            return 0;
+        }
+        size_t numGroups = (n + this->workGroupSize - 1) / this->workGroupSize;
+        cl_mem flags = this->reserve(ScratchFlags, n*sizeof(cl_uint));
+        cl_mem positions = this->reserve(ScratchPositions, n*sizeof(cl_uint));
+        PrimitiveKernel *flag = this->getKernel(input.typeName, "compact_flags");
+        flag->args.set(0, input.handle);
+        flag->args.set(1, flags);
+        flag->args.set(2, (cl_uint)n);
+        flag->args.setBytes(3, threshold, sizeof(cl_uint));
+        flag->args.set(4, (cl_int)op);
+        this->launch(flag, numGroups);
+        this->scanLevel("uint", flags, positions, n, 0);
+        PrimitiveKernel *scatter = this->getKernel(input.typeName, "compact_scatter");
+        scatter->args.set(0, input.handle);
+        scatter->args.set(1, flags);
+        scatter->args.set(2, positions);
+        scatter->args.set(3, output);
+        scatter->args.set(4, (cl_uint)n);
+        this->launch(scatter, numGroups);
+        // The kept count is the last position plus the last flag.
+        cl_uint last[2] = {0, 0};
+        this->readBytes(positions, (n - 1)*sizeof(cl_uint), sizeof(cl_uint), &last[0]);
+        this->readBytes(flags, (n - 1)*sizeof(cl_uint), sizeof(cl_uint), &last[1]);
+        *count = (size_t)last[0] + last[1];
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't compact buffer: " << e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    this->stats.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+bool OpenCLPrimitives::hasSubgroups(){
+    return this->subgroups;
+}
+
+size_t OpenCLPrimitives::getWorkGroupSize(){
+    return this->workGroupSize;
+}
+
+PrimitivesStats OpenCLPrimitives::getStats(){
+    return this->stats;
+}
+
+void OpenCLPrimitives::resetStats(){
+    this->stats = PrimitivesStats();
+}
+
+void OpenCLPrimitives::cleanup(){
+    if (this->queue != nullptr){
+        clFinish(this->queue);
+    }
+    for (auto& entry : this->programs){
+        for (auto& kernel : entry.second.kernels){
+            clReleaseKernel(kernel.second.kernel);
+        }
+        if (entry.second.program != nullptr){
+            clReleaseProgram(entry.second.program);
+        }
+    }
+    this->programs.clear();
+    for (cl_mem handle : this->scratch){
+        if (handle != nullptr){
+            clReleaseMemObject(handle);
+        }
+    }
+    this->scratch.clear();
+    this->scratchSizes.clear();
+    if (this->queue != nullptr){
+        clReleaseCommandQueue(this->queue);
+    }
+    this->queue = nullptr;
+    this->isInitialized = false;
+}
@@ -0,0 +1,162 @@
+#ifndef OPENCL_PRIMITIVES
+#define OPENCL_PRIMITIVES
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <map>
+#include <CL/opencl.hpp>
+
+#include "opencl_kernel_args.h"
+#include "opencl_types.h"
+
+class OpenCLInterface;
+
+enum class ReduceOp {
+    Sum = 0,
+    Min = 1,
+    Max = 2
+};
+
+enum class CompareOp {
+    Equal = 0,
+    NotEqual = 1,
+    Less = 2,
+    LessEqual = 3,
+    Greater = 4,
+    GreaterEqual = 5
+};
+
+// A device buffer of 32-bit int, uint or float elements.
+struct PrimitiveBuffer {
+    cl_mem handle = nullptr;
+    size_t numElements = 0;
+    const char* typeName = "float";
+};
+
+template<typename T>
+PrimitiveBuffer makePrimitiveBuffer(cl_mem handle, size_t numElements){
+    PrimitiveBuffer buffer;
+    buffer.handle = handle;
+    buffer.numElements = numElements;
+    buffer.typeName = ClType<T>::name;
+    return buffer;
+}
+
+struct PrimitivesOptions {
+    // Rounded down to a power of two the device supports.
+    size_t workGroupSize = 256;
+    // Use cl_khr_subgroups collectives inside work-groups when available.
+    bool useSubgroups = true;
+};
+
+struct PrimitivesStats {
+    size_t programsBuilt = 0;
+    size_t launches = 0;
+    size_t resultBytesRead = 0;
+    double elapsedSeconds = 0.0;
+};
+
+struct PrimitiveKernel {
+    cl_kernel kernel = nullptr;
+    OpenCLKernelArgs args;
+};
+
+// Reduction, prefix scan, radix sort, histogram and stream compaction on
+// device buffers, so a kernel's output can be summarized without reading it
+// back. A program is built per element type on first use. Work-groups
+// combine their items through subgroup collectives when the device has
+// cl_khr_subgroups, and through local memory otherwise; multi-level
+// passes keep their intermediates in scratch buffers that are reused across
+// calls. Every call first waits for the interface's queue, runs on its own
+// queue and returns once the result is complete.
+class OpenCLPrimitives
+{
+    public:
+        bool isInitialized;
+        bool errorEncountered;
+        OpenCLPrimitives(OpenCLInterface *interface,
+                         PrimitivesOptions options = PrimitivesOptions());
+        ~OpenCLPrimitives();
+        OpenCLPrimitives(const OpenCLPrimitives&) = delete;
+        OpenCLPrimitives& operator=(const OpenCLPrimitives&) = delete;
+
+        PrimitiveBuffer getBuffer(const int index, bool isInput);
+        template<typename T>
+        int reduce(const PrimitiveBuffer& input, ReduceOp op, T *result){
+            if (!this->checkType(input, ClType<T>::name)){
+                return -1;
+            }
+            return this->reduceBytes(input, op, result);
+        }
+        int scan(const PrimitiveBuffer& input, cl_mem output, bool inclusive = false);
+        int sort(const PrimitiveBuffer& keys, cl_mem values = nullptr);
+        template<typename T>
+        int histogram(const PrimitiveBuffer& input, T lowest, T highest, size_t numBins,
+                      std::vector<unsigned int> *counts){
+            if (!this->checkType(input, ClType<T>::name)){
+                return -1;
+            }
+            return this->histogramRange(input, (double)lowest, (double)highest, numBins, counts);
+        }
+        template<typename T>
+        int compact(const PrimitiveBuffer& input, CompareOp op, T threshold,
+                    cl_mem output, size_t *count){
+            if (!this->checkType(input, ClType<T>::name)){
+                return -1;
+            }
+            return this->compactBytes(input, op, &threshold, output, count);
+        }
+        bool hasSubgroups();
+        size_t getWorkGroupSize();
+        PrimitivesStats getStats();
+        void resetStats();
+        void cleanup();
+
+    private:
+        enum ScratchSlot {
+            ScratchPartials = 0,
+            ScratchSortKeys,
+            ScratchSortValues,
+            ScratchCounts,
+            ScratchFlags,
+            ScratchPositions,
+            ScratchScanLevels
+        };
+        struct PrimitiveProgram {
+            cl_program program = nullptr;
+            std::map<std::string, PrimitiveKernel> kernels = {};
+        };
+
+        OpenCLInterface *interface;
+        cl_context context;
+        cl_device_id device;
+        cl_command_queue queue = nullptr;
+        size_t workGroupSize = 256;
+        size_t maxGroups = 256;
+        size_t localMemBytes = 0;
+        bool subgroups = false;
+        std::string languageVersion = "";
+        std::map<std::string, PrimitiveProgram> programs = {};
+        std::vector<cl_mem> scratch = {};
+        std::vector<size_t> scratchSizes = {};
+        PrimitivesStats stats;
+
+        bool checkType(const PrimitiveBuffer& buffer, const char* typeName);
+        int buildProgram(const std::string& typeName, PrimitiveProgram *program);
+        PrimitiveKernel* getKernel(const std::string& typeName, const char* kernelName);
+        cl_mem reserve(size_t slot, size_t sizeBytes);
+        void launch(PrimitiveKernel *kernel, size_t numGroups);
+        void begin();
+        void scanLevel(const std::string& typeName, cl_mem input, cl_mem output,
+                       size_t numElements, size_t level);
+        void readBytes(cl_mem buffer, size_t offset, size_t sizeBytes, void *target);
+        int reduceBytes(const PrimitiveBuffer& input, ReduceOp op, void *result);
+        int histogramRange(const PrimitiveBuffer& input, double lowest, double highest,
+                           size_t numBins, std::vector<unsigned int> *counts);
+        int compactBytes(const PrimitiveBuffer& input, CompareOp op, const void *threshold,
+                         cl_mem output, size_t *count);
+};
+
+#endif // OPENCL_PRIMITIVES
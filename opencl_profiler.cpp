@@ -0,0 +1,287 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include "opencl_profiler.h"
+#include "opencl_log.h"
+
+namespace {
+
+std::string escapeJson(const std::string& value){
+    std::string escaped;
+    for (char c : value){
+        switch (c){
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            default:
+                escaped += c;
+        }
+    }
+    return escaped;
+}
+
+int writeFile(const std::string& path, const std::string& content){
+    std::ofstream file(path, std::ios::trunc);
+    file << content;
+    if (!file){
+        OPENCL_LOG_ERROR("Couldn't write profile to " << path);
+        return -1;
+    }
+    return 0;
+}
+
+}
+
+OpenCLProfiler::OpenCLProfiler(){
+}
+
+OpenCLProfiler::~OpenCLProfiler(){
+    this->reset();
+}
+
+OpenCLProfiler::OpenCLProfiler(OpenCLProfiler&& other) noexcept {
+    *this = std::move(other);
+}
+
+OpenCLProfiler& OpenCLProfiler::operator=(OpenCLProfiler&& other) noexcept {
+    if (this != &other){
+        this->reset();
+        this->enabled = other.enabled;
+        this->records = std::move(other.records);
+        this->firstUnresolved = other.firstUnresolved;
+        this->maxPendingEvents = other.maxPendingEvents;
+        this->maxRecords = other.maxRecords;
+        this->droppedRecords = other.droppedRecords;
+        other.records.clear();
+        other.firstUnresolved = 0;
+        other.droppedRecords = 0;
+    }
+    return *this;
+}
+
+void OpenCLProfiler::setEnabled(bool enabled){
+    this->enabled = enabled;
+}
+
+bool OpenCLProfiler::isEnabled(){
+    return this->enabled;
+}
+
+void OpenCLProfiler::setLimits(size_t maxPendingEvents, size_t maxRecords){
+    this->maxPendingEvents = std::max<size_t>(maxPendingEvents, 1);
+    this->maxRecords = std::max<size_t>(maxRecords, 2);
+}
+
+size_t OpenCLProfiler::getDroppedRecords(){
+    return this->droppedRecords;
+}
+
+const char* OpenCLProfiler::getCommandName(ProfileCommand command){
+    switch (command){
+        case ProfileCommand::Kernel:
+            return "kernel";
+        case ProfileCommand::Write:
+            return "write";
+        case ProfileCommand::Read:
+            return "read";
+        case ProfileCommand::Map:
+            return "map";
+    }
+    return "unknown";
+}
+
+void OpenCLProfiler::record(const std::string& name, ProfileCommand command, size_t bytes, cl_event event){
+    if (!this->enabled || event == nullptr){
+        return;
+    }
+    clRetainEvent(event);
+    ProfileRecord record;
+    record.name = name;
+    record.command = command;
+    record.bytes = bytes;
+    record.event = event;
+    this->records.push_back(record);
+    if (this->records.size() - this->firstUnresolved >= this->maxPendingEvents){
+        this->resolve();
+    }
+    if (this->records.size() > this->maxRecords){
+        this->trim();
+    }
+}
+
+void OpenCLProfiler::trim(){
+    // Dropping half at a time keeps the erase amortized constant per record.
+    size_t count = std::min(this->firstUnresolved, this->records.size() - this->maxRecords / 2);
+    this->records.erase(this->records.begin(), this->records.begin() + count);
+    this->firstUnresolved -= count;
+    this->droppedRecords += count;
+}
+
+int OpenCLProfiler::resolve(){
+    int status = 0;
+    for (size_t i = this->firstUnresolved ; i < this->records.size() ; i++){
+        ProfileRecord& record = this->records[i];
+        if (record.resolved){
+            continue;
+        }
+        clWaitForEvents(1, &record.event);
+        cl_int result = CL_SUCCESS;
+        result |= clGetEventProfilingInfo(record.event, CL_PROFILING_COMMAND_QUEUED,
+                                          sizeof(cl_ulong), &record.queued, NULL);
+        result |= clGetEventProfilingInfo(record.event, CL_PROFILING_COMMAND_SUBMIT,
+                                          sizeof(cl_ulong), &record.submit, NULL);
+        result |= clGetEventProfilingInfo(record.event, CL_PROFILING_COMMAND_START,
+                                          sizeof(cl_ulong), &record.start, NULL);
+        result |= clGetEventProfilingInfo(record.event, CL_PROFILING_COMMAND_END,
+                                          sizeof(cl_ulong), &record.end, NULL);
+        if (result != CL_SUCCESS){
+            status = -1;
+        }
+        clReleaseEvent(record.event);
+        record.event = nullptr;
+        record.resolved = true;
+    }
+    this->firstUnresolved = this->records.size();
+    if (status != 0){
+        OPENCL_LOG_ERROR("Some profiling timestamps were unavailable; "
+                         << "was the queue created with CL_QUEUE_PROFILING_ENABLE?");
+    }
+    return status;
+}
+
+std::vector<ProfileRecord> OpenCLProfiler::getRecords(){
+    this->resolve();
+    return this->records;
+}
+
+std::vector<ProfileSummary> OpenCLProfiler::getSummary(){
+    this->resolve();
+    std::map<std::pair<int, std::string>, std::vector<const ProfileRecord*>> groups;
+    for (const ProfileRecord& record : this->records){
+        groups[{(int)record.command, record.name}].push_back(&record);
+    }
+
+    std::vector<ProfileSummary> summaries;
+    for (const auto& group : groups){
+        ProfileSummary summary;
+        summary.name = group.first.second;
+        summary.command = (ProfileCommand)group.first.first;
+        std::vector<double> durations;
+        for (const ProfileRecord* record : group.second){
+            double ms = record->end >= record->start ? (record->end - record->start)*1e-6 : 0.0;
+            durations.push_back(ms);
+            summary.bytes += record->bytes;
+            summary.totalMs += ms;
+        }
+        std::sort(durations.begin(), durations.end());
+        summary.count = durations.size();
+        summary.minMs = durations.front();
+        summary.maxMs = durations.back();
+        summary.meanMs = summary.totalMs / summary.count;
+        size_t p99Index = (size_t)std::ceil(0.99*summary.count) - 1;
+        summary.p99Ms = durations[std::min(p99Index, summary.count - 1)];
+        if (summary.totalMs > 0.0 && summary.bytes > 0){
+            summary.bandwidthGBs = summary.bytes / (summary.totalMs*1e-3) / 1e9;
+        }
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+std::string OpenCLProfiler::exportJson(){
+    std::vector<ProfileSummary> summaries = this->getSummary();
+    std::ostringstream json;
+    json << "{\"summary\":[";
+    for (size_t i = 0 ; i < summaries.size() ; i++){
+        const ProfileSummary& summary = summaries[i];
+        json << (i == 0 ? "" : ",")
+             << "{\"name\":\"" << escapeJson(summary.name) << "\""
+             << ",\"command\":\"" << getCommandName(summary.command) << "\""
+             << ",\"count\":" << summary.count
+             << ",\"bytes\":" << summary.bytes
+             << ",\"min_ms\":" << summary.minMs
+             << ",\"mean_ms\":" << summary.meanMs
+             << ",\"p99_ms\":" << summary.p99Ms
+             << ",\"max_ms\":" << summary.maxMs
+             << ",\"total_ms\":" << summary.totalMs
+             << ",\"bandwidth_gbs\":" << summary.bandwidthGBs << "}";
+    }
+    json << "],\"records\":[";
+    for (size_t i = 0 ; i < this->records.size() ; i++){
+        const ProfileRecord& record = this->records[i];
+        json << (i == 0 ? "" : ",")
+             << "{\"name\":\"" << escapeJson(record.name) << "\""
+             << ",\"command\":\"" << getCommandName(record.command) << "\""
+             << ",\"bytes\":" << record.bytes
+             << ",\"queued_ns\":" << record.queued
+             << ",\"submit_ns\":" << record.submit
+             << ",\"start_ns\":" << record.start
+             << ",\"end_ns\":" << record.end << "}";
+    }
+    json << "]}\n";
+    return json.str();
+}
+
+std::string OpenCLProfiler::exportChromeTrace(){
+    this->resolve();
+    cl_ulong origin = 0;
+    for (const ProfileRecord& record : this->records){
+        if (record.start != 0 && (origin == 0 || record.start < origin)){
+            origin = record.start;
+        }
+    }
+    // One track per command type so transfer/compute overlap is visible in
+    // chrome://tracing or Perfetto.
+    std::ostringstream json;
+    json << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    const char* tracks[] = {"compute", "upload", "readback", "map"};
+    for (int i = 0 ; i < 4 ; i++){
+        json << (i == 0 ? "" : ",")
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1
+             << ",\"args\":{\"name\":\"" << tracks[i] << "\"}}";
+    }
+    for (const ProfileRecord& record : this->records){
+        if (record.start == 0 || record.end < record.start){
+            continue;
+        }
+        json << ",{\"name\":\"" << escapeJson(record.name) << "\""
+             << ",\"cat\":\"" << getCommandName(record.command) << "\""
+             << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << (int)record.command + 1
+             << ",\"ts\":" << (record.start - origin)*1e-3
+             << ",\"dur\":" << (record.end - record.start)*1e-3
+             << ",\"args\":{\"bytes\":" << record.bytes
+             << ",\"queued_to_start_us\":" << (record.start - record.queued)*1e-3 << "}}";
+    }
+    json << "]}\n";
+    return json.str();
+}
+
+int OpenCLProfiler::writeJson(const std::string& path){
+    return writeFile(path, this->exportJson());
+}
+
+int OpenCLProfiler::writeChromeTrace(const std::string& path){
+    return writeFile(path, this->exportChromeTrace());
+}
+
+void OpenCLProfiler::reset(){
+    for (ProfileRecord& record : this->records){
+        if (record.event != nullptr){
+            clReleaseEvent(record.event);
+        }
+    }
+    this->records.clear();
+    this->firstUnresolved = 0;
+    this->droppedRecords = 0;
+}
@@ -0,0 +1,84 @@
+#ifndef OPENCL_PROFILER
+#define OPENCL_PROFILER
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <CL/opencl.hpp>
+
+enum class ProfileCommand {
+    Kernel,
+    Write,
+    Read,
+    Map
+};
+
+struct ProfileRecord {
+    std::string name;
+    ProfileCommand command;
+    size_t bytes = 0;
+    cl_event event = nullptr;
+    bool resolved = false;
+    cl_ulong queued = 0;
+    cl_ulong submit = 0;
+    cl_ulong start = 0;
+    cl_ulong end = 0;
+};
+
+struct ProfileSummary {
+    std::string name;
+    ProfileCommand command;
+    size_t count = 0;
+    size_t bytes = 0;
+    double minMs = 0.0;
+    double meanMs = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+    double totalMs = 0.0;
+    double bandwidthGBs = 0.0;
+};
+
+// Collects queued/submit/start/end timestamps of profiled commands. Events
+// are retained when recorded and resolved when results are requested, or
+// once maxPendingEvents are outstanding, so recording rarely synchronizes
+// and never holds more than that many events. Past maxRecords, the oldest
+// half of the resolved records is dropped.
+class OpenCLProfiler
+{
+    public:
+        OpenCLProfiler();
+        ~OpenCLProfiler();
+        OpenCLProfiler(const OpenCLProfiler&) = delete;
+        OpenCLProfiler& operator=(const OpenCLProfiler&) = delete;
+        OpenCLProfiler(OpenCLProfiler&& other) noexcept;
+        OpenCLProfiler& operator=(OpenCLProfiler&& other) noexcept;
+
+        void setEnabled(bool enabled);
+        bool isEnabled();
+        void setLimits(size_t maxPendingEvents, size_t maxRecords);
+        size_t getDroppedRecords();
+        void record(const std::string& name, ProfileCommand command, size_t bytes, cl_event event);
+        int resolve();
+        std::vector<ProfileRecord> getRecords();
+        std::vector<ProfileSummary> getSummary();
+        std::string exportJson();
+        std::string exportChromeTrace();
+        int writeJson(const std::string& path);
+        int writeChromeTrace(const std::string& path);
+        void reset();
+
+        static const char* getCommandName(ProfileCommand command);
+
+    private:
+        bool enabled = false;
+        std::vector<ProfileRecord> records = {};
+        size_t firstUnresolved = 0;
+        size_t maxPendingEvents = 1024;
+        size_t maxRecords = 1 << 20;
+        size_t droppedRecords = 0;
+
+        void trim();
+};
+
+#endif // OPENCL_PROFILER
@@ -0,0 +1,205 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <random>
+#include <thread>
+#include <filesystem>
+
+#include "opencl_program_cache.h"
+#include "opencl_log.h"
+
+namespace {
+
+const char* CACHE_MAGIC = "OCLBIN01";
+const size_t CACHE_MAGIC_LENGTH = 8;
+const char* CACHE_EXTENSION = ".clbin";
+
+uint64_t fnv1a64(const char* data, size_t length){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0 ; i < length ; i++){
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::string toHex(uint64_t value){
+    std::ostringstream stream;
+    stream << std::hex << std::setw(16) << std::setfill('0') << value;
+    return stream.str();
+}
+
+}
+
+OpenCLProgramCache::OpenCLProgramCache(){
+    const char* directory = std::getenv("OPENCL_INTERFACE_CACHE_DIR");
+    if (directory != nullptr){
+        this->setDirectory(directory);
+    }
+}
+
+void OpenCLProgramCache::setDirectory(const std::string& directory){
+    this->directory = directory;
+    if (directory.empty()){
+        return;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error){
+        OPENCL_LOG_ERROR("Couldn't create program cache directory " << directory
+                         << ": " << error.message());
+        this->directory.clear();
+    }
+}
+
+bool OpenCLProgramCache::isEnabled(){
+    return !this->directory.empty();
+}
+
+std::string OpenCLProgramCache::getDeviceString(cl_device_id device, cl_device_info param){
+    size_t size = 0;
+    if (clGetDeviceInfo(device, param, 0, NULL, &size) != CL_SUCCESS || size == 0){
+        return "";
+    }
+    std::string value(size, '\0');
+    clGetDeviceInfo(device, param, size, &value[0], NULL);
+    value.resize(std::strlen(value.c_str()));
+    return value;
+}
+
+std::string OpenCLProgramCache::makeKey(const char* source, cl_device_id device, const std::string& buildOptions){
+    std::string key;
+    key += "source=" + toHex(fnv1a64(source, std::strlen(source)));
+    key += ";length=" + std::to_string(std::strlen(source));
+    key += ";device=" + this->getDeviceString(device, CL_DEVICE_NAME);
+    key += ";vendor=" + this->getDeviceString(device, CL_DEVICE_VENDOR);
+    key += ";driver=" + this->getDeviceString(device, CL_DRIVER_VERSION);
+    key += ";version=" + this->getDeviceString(device, CL_DEVICE_VERSION);
+    key += ";options=" + buildOptions;
+    return key;
+}
+
+std::string OpenCLProgramCache::getEntryPath(const std::string& key){
+    std::filesystem::path path(this->directory);
+    path /= toHex(fnv1a64(key.data(), key.size())) + CACHE_EXTENSION;
+    return path.string();
+}
+
+bool OpenCLProgramCache::load(const std::string& key, std::vector<unsigned char>& binary){
+    if (!this->isEnabled()){
+        return false;
+    }
+    std::string path = this->getEntryPath(key);
+    std::ifstream file(path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+
+    char magic[CACHE_MAGIC_LENGTH];
+    uint64_t keyLength = 0;
+    uint64_t binaryLength = 0;
+    file.read(magic, CACHE_MAGIC_LENGTH);
+    file.read(reinterpret_cast<char*>(&keyLength), sizeof(keyLength));
+    if (!file || std::memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LENGTH) != 0 || keyLength != key.size()){
+        file.close();
+        this->invalidate(key);
+        return false;
+    }
+    std::string storedKey(keyLength, '\0');
+    file.read(&storedKey[0], keyLength);
+    file.read(reinterpret_cast<char*>(&binaryLength), sizeof(binaryLength));
+    if (!file || storedKey != key || binaryLength == 0){
+        file.close();
+        this->invalidate(key);
+        return false;
+    }
+    binary.resize(binaryLength);
+    file.read(reinterpret_cast<char*>(binary.data()), binaryLength);
+    if (!file || file.gcount() != (std::streamsize)binaryLength){
+        file.close();
+        this->invalidate(key);
+        binary.clear();
+        return false;
+    }
+    return true;
+}
+
+bool OpenCLProgramCache::store(const std::string& key, const std::vector<unsigned char>& binary){
+    if (!this->isEnabled() || binary.empty()){
+        return false;
+    }
+    std::string path = this->getEntryPath(key);
+
+    std::random_device random;
+    size_t threadHash = std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::string temporaryPath = path + ".tmp." + toHex(((uint64_t)random() << 32) ^ random() ^ threadHash);
+
+    try {
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file){
+                throw std::runtime_error("Couldn't open " + temporaryPath);
+            }
+            uint64_t keyLength = key.size();
+            uint64_t binaryLength = binary.size();
+            file.write(CACHE_MAGIC, CACHE_MAGIC_LENGTH);
+            file.write(reinterpret_cast<const char*>(&keyLength), sizeof(keyLength));
+            file.write(key.data(), keyLength);
+            file.write(reinterpret_cast<const char*>(&binaryLength), sizeof(binaryLength));
+            file.write(reinterpret_cast<const char*>(binary.data()), binaryLength);
+            file.flush();
+            if (!file){
+                throw std::runtime_error("Couldn't write " + temporaryPath);
+            }
+        }
+        std::filesystem::rename(temporaryPath, path);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't store program binary: " << e.what());
+        std::error_code error;
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    this->stats.stores++;
+    return true;
+}
+
+void OpenCLProgramCache::invalidate(const std::string& key){
+    if (!this->isEnabled()){
+        return;
+    }
+    std::error_code error;
+    if (std::filesystem::remove(this->getEntryPath(key), error)){
+        this->stats.invalidations++;
+    }
+}
+
+void OpenCLProgramCache::clear(){
+    if (!this->isEnabled()){
+        return;
+    }
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(this->directory, error)){
+        std::string name = entry.path().filename().string();
+        if (name.find(CACHE_EXTENSION) != std::string::npos){
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+}
+
+void OpenCLProgramCache::recordHit(){
+    this->stats.hits++;
+}
+
+void OpenCLProgramCache::recordMiss(){
+    this->stats.misses++;
+}
+
+ProgramCacheStats OpenCLProgramCache::getStats(){
+    return this->stats;
+}
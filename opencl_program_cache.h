@@ -0,0 +1,46 @@
+#ifndef OPENCL_PROGRAM_CACHE
+#define OPENCL_PROGRAM_CACHE
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <CL/opencl.hpp>
+
+struct ProgramCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t stores = 0;
+    size_t invalidations = 0;
+};
+
+// On-disk cache of compiled program binaries. An entry is identified by a
+// key built from the source hash, device name, driver version and build
+// options; the full key is stored inside the entry so hash collisions and
+// stale files are detected on load instead of handing a wrong binary to the
+// driver. Entries are written to a temporary file and renamed into place so
+// concurrent processes never observe a partially written binary.
+class OpenCLProgramCache
+{
+    public:
+        OpenCLProgramCache();
+        void setDirectory(const std::string& directory);
+        bool isEnabled();
+        std::string makeKey(const char* source, cl_device_id device, const std::string& buildOptions);
+        bool load(const std::string& key, std::vector<unsigned char>& binary);
+        bool store(const std::string& key, const std::vector<unsigned char>& binary);
+        void invalidate(const std::string& key);
+        void clear();
+        void recordHit();
+        void recordMiss();
+        ProgramCacheStats getStats();
+
+    private:
+        std::string directory;
+        ProgramCacheStats stats;
+
+        std::string getEntryPath(const std::string& key);
+        std::string getDeviceString(cl_device_id device, cl_device_info param);
+};
+
+#endif // OPENCL_PROGRAM_CACHE
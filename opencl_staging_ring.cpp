@@ -0,0 +1,240 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "opencl_staging_ring.h"
+#include "opencl_error_codes.h"
+#include "opencl_log.h"
+
+OpenCLStagingRing::OpenCLStagingRing(){
+}
+
+OpenCLStagingRing::~OpenCLStagingRing(){
+    this->cleanup();
+}
+
+OpenCLStagingRing::OpenCLStagingRing(OpenCLStagingRing&& other) noexcept {
+    *this = std::move(other);
+}
+
+OpenCLStagingRing& OpenCLStagingRing::operator=(OpenCLStagingRing&& other) noexcept {
+    if (this != &other){
+        this->cleanup();
+        this->options = other.options;
+        this->mapQueue = std::move(other.mapQueue);
+        this->slots = std::move(other.slots);
+        this->nextSlot = other.nextSlot;
+        this->stats = other.stats;
+        other.slots.clear();
+        other.nextSlot = 0;
+        other.stats = StagingRingStats();
+    }
+    return *this;
+}
+
+int OpenCLStagingRing::initialize(cl_context context, cl_command_queue queue,
+                                  StagingRingOptions options){
+    // One slot can't overlap anything, so the ring always has at least two.
+    options.numSlots = std::max<size_t>(options.numSlots, 2);
+    options.chunkSize = std::max<size_t>(options.chunkSize, 4096);
+    this->cleanup();
+    this->options = options;
+    clRetainCommandQueue(queue);
+    this->mapQueue.reset(queue);
+    for (size_t i = 0 ; i < options.numSlots ; i++){
+        cl_int result;
+        StagingSlot slot;
+        slot.handle = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                     options.chunkSize, NULL, &result);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't create staging buffer: " << getOpenCLErrorName(result));
+            this->cleanup();
+            return -1;
+        }
+        slot.host = clEnqueueMapBuffer(queue, slot.handle, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                       0, options.chunkSize, 0, NULL, NULL, &result);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't map staging buffer: " << getOpenCLErrorName(result));
+            clReleaseMemObject(slot.handle);
+            this->cleanup();
+            return -1;
+        }
+        this->slots.push_back(slot);
+    }
+    this->stats.slots = options.numSlots;
+    this->stats.chunkSize = options.chunkSize;
+    OPENCL_LOG_INFO("Staging ring created with " << options.numSlots << " slots of "
+                    << options.chunkSize << " bytes");
+    return 0;
+}
+
+bool OpenCLStagingRing::isEnabled(){
+    return !this->slots.empty();
+}
+
+bool OpenCLStagingRing::accepts(size_t sizeBytes){
+    return this->isEnabled() && sizeBytes >= this->options.minTransferSize;
+}
+
+int OpenCLStagingRing::wait(StagingSlot *slot){
+    if (slot->pending == nullptr){
+        return 0;
+    }
+    cl_int status = CL_COMPLETE;
+    clGetEventInfo(slot->pending, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+    if (status != CL_COMPLETE){
+        // The host got ahead of the DMA engine; with enough slots this
+        // should be rare.
+        this->stats.stalls++;
+    }
+    cl_int result = clWaitForEvents(1, &slot->pending);
+    clReleaseEvent(slot->pending);
+    slot->pending = nullptr;
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Staging transfer failed: " << getOpenCLErrorName(result));
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLStagingRing::drain(){
+    int status = 0;
+    for (StagingSlot& slot : this->slots){
+        status |= this->wait(&slot);
+    }
+    return status == 0 ? 0 : -1;
+}
+
+int OpenCLStagingRing::write(cl_command_queue queue, cl_mem target, size_t offset,
+                             const void *source, size_t sizeBytes,
+                             OpenCLProfiler *profiler, const std::string& name){
+    auto start = std::chrono::steady_clock::now();
+    const unsigned char *from = static_cast<const unsigned char*>(source);
+    for (size_t done = 0 ; done < sizeBytes ; ){
+        size_t chunk = std::min(this->options.chunkSize, sizeBytes - done);
+        StagingSlot *slot = &this->slots[this->nextSlot];
+        this->nextSlot = (this->nextSlot + 1) % this->slots.size();
+        if (this->wait(slot) != 0){
+            this->drain();
+            return -1;
+        }
+        std::memcpy(slot->host, from + done, chunk);
+        cl_int result = clEnqueueWriteBuffer(queue, target, CL_FALSE, offset + done, chunk,
+                                             slot->host, 0, NULL, &slot->pending);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't enqueue staged write: " << getOpenCLErrorName(result));
+            slot->pending = nullptr;
+            this->drain();
+            return -1;
+        }
+        // Start the DMA now so it runs while the next chunk is copied.
+        clFlush(queue);
+        if (profiler != nullptr){
+            profiler->record(name, ProfileCommand::Write, chunk, slot->pending);
+        }
+        this->stats.chunks++;
+        done += chunk;
+    }
+    if (this->drain() != 0){
+        return -1;
+    }
+    this->stats.writes++;
+    this->stats.bytesWritten += sizeBytes;
+    this->stats.writeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (this->stats.writeSeconds > 0.0){
+        this->stats.writeGBps = this->stats.bytesWritten / this->stats.writeSeconds / 1e9;
+    }
+    return 0;
+}
+
+int OpenCLStagingRing::read(cl_command_queue queue, cl_mem source, size_t offset,
+                            void *target, size_t sizeBytes,
+                            OpenCLProfiler *profiler, const std::string& name){
+    auto start = std::chrono::steady_clock::now();
+    unsigned char *to = static_cast<unsigned char*>(target);
+    size_t chunkSize = this->options.chunkSize;
+    size_t numSlots = this->slots.size();
+    size_t numChunks = (sizeBytes + chunkSize - 1) / chunkSize;
+    size_t first = this->nextSlot;
+    if (this->drain() != 0){
+        return -1;
+    }
+    // Chunk k always lands in slot (first + k) % numSlots. Every slot gets a
+    // read up front; each time the oldest one arrives it is copied out and
+    // the slot is refilled with the chunk numSlots further on.
+    auto issue = [&](size_t k){
+        StagingSlot *slot = &this->slots[(first + k) % numSlots];
+        size_t chunk = std::min(chunkSize, sizeBytes - k*chunkSize);
+        cl_int result = clEnqueueReadBuffer(queue, source, CL_FALSE, offset + k*chunkSize, chunk,
+                                            slot->host, 0, NULL, &slot->pending);
+        if (result != CL_SUCCESS){
+            OPENCL_LOG_ERROR("Couldn't enqueue staged read: " << getOpenCLErrorName(result));
+            slot->pending = nullptr;
+            return -1;
+        }
+        if (profiler != nullptr){
+            profiler->record(name, ProfileCommand::Read, chunk, slot->pending);
+        }
+        this->stats.chunks++;
+        return 0;
+    };
+    int status = 0;
+    for (size_t k = 0 ; k < std::min(numSlots, numChunks) && status == 0 ; k++){
+        status = issue(k);
+    }
+    clFlush(queue);
+    for (size_t k = 0 ; k < numChunks && status == 0 ; k++){
+        StagingSlot *slot = &this->slots[(first + k) % numSlots];
+        if (this->wait(slot) != 0){
+            status = -1;
+            break;
+        }
+        std::memcpy(to + k*chunkSize, slot->host, std::min(chunkSize, sizeBytes - k*chunkSize));
+        if (k + numSlots < numChunks){
+            status = issue(k + numSlots);
+            clFlush(queue);
+        }
+    }
+    this->nextSlot = (first + numChunks) % numSlots;
+    if (status != 0){
+        this->drain();
+        return -1;
+    }
+    this->stats.reads++;
+    this->stats.bytesRead += sizeBytes;
+    this->stats.readSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (this->stats.readSeconds > 0.0){
+        this->stats.readGBps = this->stats.bytesRead / this->stats.readSeconds / 1e9;
+    }
+    return 0;
+}
+
+StagingRingStats OpenCLStagingRing::getStats(){
+    return this->stats;
+}
+
+void OpenCLStagingRing::resetStats(){
+    this->stats = StagingRingStats();
+    this->stats.slots = this->slots.size();
+    this->stats.chunkSize = this->slots.empty() ? 0 : this->options.chunkSize;
+}
+
+void OpenCLStagingRing::cleanup(){
+    this->drain();
+    if (this->mapQueue.isValid() && !this->slots.empty()){
+        for (StagingSlot& slot : this->slots){
+            clEnqueueUnmapMemObject(this->mapQueue, slot.handle, slot.host, 0, NULL, NULL);
+        }
+        clFinish(this->mapQueue);
+    }
+    for (StagingSlot& slot : this->slots){
+        clReleaseMemObject(slot.handle);
+    }
+    this->slots.clear();
+    this->mapQueue.reset();
+    this->nextSlot = 0;
+    this->stats = StagingRingStats();
+}
@@ -0,0 +1,85 @@
+#ifndef OPENCL_STAGING_RING
+#define OPENCL_STAGING_RING
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <CL/opencl.hpp>
+
+#include "opencl_handle.h"
+#include "opencl_profiler.h"
+
+struct StagingRingOptions {
+    size_t numSlots = 4;
+    size_t chunkSize = 4 << 20;
+    // Transfers smaller than this go straight from the caller's pointer;
+    // chunking only pays off once the copy is long enough to overlap.
+    size_t minTransferSize = 1 << 20;
+};
+
+struct StagingRingStats {
+    size_t slots = 0;
+    size_t chunkSize = 0;
+    size_t writes = 0;
+    size_t reads = 0;
+    size_t chunks = 0;
+    size_t stalls = 0;
+    size_t bytesWritten = 0;
+    size_t bytesRead = 0;
+    double writeSeconds = 0.0;
+    double readSeconds = 0.0;
+    double writeGBps = 0.0;
+    double readGBps = 0.0;
+};
+
+struct StagingSlot {
+    cl_mem handle = nullptr;
+    void *host = nullptr;
+    cl_event pending = nullptr;
+};
+
+// A fixed ring of pinned staging buffers. Each slot is a CL_MEM_ALLOC_HOST_PTR
+// buffer that stays mapped for the ring's lifetime, so its host pointer is
+// page-locked memory the driver can DMA from directly. Transfers are split
+// into chunks that cycle through the slots: while the device copies one
+// chunk, the host copies the next one into (or the previous one out of) a
+// different slot. A slot is only reused once its last transfer completed.
+// The ring keeps a reference to the queue the slots were mapped on so it
+// can unmap and release them from its destructor; it can be moved but not
+// copied.
+class OpenCLStagingRing
+{
+    public:
+        OpenCLStagingRing();
+        ~OpenCLStagingRing();
+        OpenCLStagingRing(const OpenCLStagingRing&) = delete;
+        OpenCLStagingRing& operator=(const OpenCLStagingRing&) = delete;
+        OpenCLStagingRing(OpenCLStagingRing&& other) noexcept;
+        OpenCLStagingRing& operator=(OpenCLStagingRing&& other) noexcept;
+        int initialize(cl_context context, cl_command_queue queue,
+                       StagingRingOptions options = StagingRingOptions());
+        bool isEnabled();
+        bool accepts(size_t sizeBytes);
+        int write(cl_command_queue queue, cl_mem target, size_t offset,
+                  const void *source, size_t sizeBytes,
+                  OpenCLProfiler *profiler = nullptr, const std::string& name = "");
+        int read(cl_command_queue queue, cl_mem source, size_t offset,
+                 void *target, size_t sizeBytes,
+                 OpenCLProfiler *profiler = nullptr, const std::string& name = "");
+        StagingRingStats getStats();
+        void resetStats();
+        void cleanup();
+
+    private:
+        StagingRingOptions options;
+        OpenCLHandle<cl_command_queue> mapQueue;
+        std::vector<StagingSlot> slots = {};
+        size_t nextSlot = 0;
+        StagingRingStats stats;
+
+        int wait(StagingSlot *slot);
+        int drain();
+};
+
+#endif // OPENCL_STAGING_RING
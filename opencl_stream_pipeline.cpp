@@ -0,0 +1,336 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_stream_pipeline.h"
+
+OpenCLStreamPipeline::OpenCLStreamPipeline(OpenCLInterface *interface,
+                                           const char* kernelName,
+                                           cl_uint workDimensions,
+                                           size_t *globalWorkSize,
+                                           std::vector<size_t> inputNumElements,
+                                           std::vector<size_t> outputNumElements,
+                                           size_t depth){
+    this->isInitialized = false;
+    this->errorEncountered = false;
+    this->interface = interface;
+    try {
+        if (interface == nullptr || !interface->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        interface->requireDevice("stream pipelines");
+        if (workDimensions < 1 || workDimensions > 3){
+            throw std::runtime_error("Work dimensions must be between 1 and 3");
+        }
+        if (depth < 2 || depth > 3){
+            throw std::runtime_error("Pipeline depth must be 2 or 3");
+        }
+        this->context = interface->getContext();
+        this->device = interface->getDevice();
+        this->workDimensions = workDimensions;
+        for (cl_uint i = 0 ; i < workDimensions ; i++){
+            this->globalWorkSize[i] = globalWorkSize[i];
+        }
+        this->inputSizes = inputNumElements;
+        this->outputSizes = outputNumElements;
+        for (size_t numElements : inputNumElements){
+            this->bytesPerBatch += numElements*sizeof(float);
+        }
+        for (size_t numElements : outputNumElements){
+            this->bytesPerBatch += numElements*sizeof(float);
+        }
+
+        if (this->createQueue(&this->uploadQueue) != 0 ||
+            this->createQueue(&this->computeQueue) != 0 ||
+            this->createQueue(&this->downloadQueue) != 0){
+            throw std::runtime_error("Couldn't create pipeline queues");
+        }
+
+        this->slots.resize(depth);
+        for (size_t i = 0 ; i < depth ; i++){
+            if (this->createSlot(interface->getProgram(), kernelName, &this->slots[i]) != 0){
+                throw std::runtime_error("Couldn't create pipeline buffer set");
+            }
+        }
+        OPENCL_LOG_INFO("Stream pipeline created with depth " << depth);
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't create stream pipeline: " << e.what());
+        this->errorEncountered = true;
+        this->cleanup();
+    }
+}
+
+OpenCLStreamPipeline::~OpenCLStreamPipeline(){
+    this->cleanup();
+}
+
+int OpenCLStreamPipeline::createQueue(cl_command_queue *queue){
+    cl_int result;
+    cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    *queue = clCreateCommandQueueWithProperties(this->context, this->device, properties, &result);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't create command queue: "
+                         << getOpenCLErrorName(result));
+        *queue = nullptr;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLStreamPipeline::createSlot(cl_program program, const char* kernelName, StreamSlot *slot){
+    try {
+        cl_int result;
+        // Each slot owns its kernel object so its arguments are bound once
+        // instead of being re-set on every launch.
+        slot->kernel = clCreateKernel(program, kernelName, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create kernel: " + this->interface->getCodeExplanation(result));
+        }
+        cl_uint argIndex = 0;
+        for (size_t numElements : this->inputSizes){
+            cl_mem handle = clCreateBuffer(this->context, CL_MEM_READ_ONLY,
+                                           numElements*sizeof(float), NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create buffer: " + this->interface->getCodeExplanation(result));
+            }
+            slot->inputs.push_back(handle);
+            result = clSetKernelArg(slot->kernel, argIndex, sizeof(cl_mem), &handle);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't set kernel argument " + std::to_string(argIndex) + ": " + this->interface->getCodeExplanation(result));
+            }
+            argIndex++;
+        }
+        for (size_t numElements : this->outputSizes){
+            cl_mem handle = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY,
+                                           numElements*sizeof(float), NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create buffer: " + this->interface->getCodeExplanation(result));
+            }
+            slot->outputs.push_back(handle);
+            result = clSetKernelArg(slot->kernel, argIndex, sizeof(cl_mem), &handle);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't set kernel argument " + std::to_string(argIndex) + ": " + this->interface->getCodeExplanation(result));
+            }
+            argIndex++;
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+long long OpenCLStreamPipeline::submit(std::vector<const float*> inputPtrs, std::vector<float*> outputPtrs){
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Pipeline not initialized!");
+        }
+        if (inputPtrs.size() != this->inputSizes.size() || outputPtrs.size() != this->outputSizes.size()){
+            throw std::runtime_error("Number of data pointers doesn't match pipeline buffers!");
+        }
+        long long batchId = this->nextBatchId;
+        StreamSlot *slot = &this->slots[batchId % this->slots.size()];
+
+        // Reusing a slot is the pipeline's backpressure: the batch that last
+        // used these buffers must be fully read back first.
+        if (slot->pending && this->completeSlot(slot) != 0){
+            throw std::runtime_error("Previous batch in slot failed");
+        }
+        if (!this->timingStarted){
+            this->firstSubmit = std::chrono::steady_clock::now();
+            this->timingStarted = true;
+        }
+
+        cl_int result;
+        slot->uploadEvents.clear();
+        slot->downloadEvents.clear();
+        for (size_t i = 0 ; i < inputPtrs.size() ; i++){
+            cl_event event = nullptr;
+            result = clEnqueueWriteBuffer(this->uploadQueue, slot->inputs[i], CL_FALSE, 0,
+                                          this->inputSizes[i]*sizeof(float), inputPtrs[i],
+                                          0, NULL, &event);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't enqueue upload: " + this->interface->getCodeExplanation(result));
+            }
+            slot->uploadEvents.emplace_back(event);
+        }
+        clFlush(this->uploadQueue);
+
+        std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(slot->uploadEvents);
+        cl_event computeEvent = nullptr;
+        result = clEnqueueNDRangeKernel(this->computeQueue, slot->kernel, this->workDimensions,
+                                        NULL, this->globalWorkSize, NULL,
+                                        waitHandles.size(),
+                                        waitHandles.empty() ? NULL : waitHandles.data(),
+                                        &computeEvent);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue kernel: " + this->interface->getCodeExplanation(result));
+        }
+        slot->computeEvent = OpenCLEvent(computeEvent);
+        clFlush(this->computeQueue);
+
+        for (size_t i = 0 ; i < outputPtrs.size() ; i++){
+            cl_event event = nullptr;
+            result = clEnqueueReadBuffer(this->downloadQueue, slot->outputs[i], CL_FALSE, 0,
+                                         this->outputSizes[i]*sizeof(float), outputPtrs[i],
+                                         1, &computeEvent, &event);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't enqueue readback: " + this->interface->getCodeExplanation(result));
+            }
+            slot->downloadEvents.emplace_back(event);
+        }
+        clFlush(this->downloadQueue);
+
+        slot->batchId = batchId;
+        slot->pending = true;
+        this->nextBatchId++;
+        return batchId;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't submit batch: " << e.what());
+        this->errorEncountered = true;
+    }
+    return -1;
+}
+
+int OpenCLStreamPipeline::wait(long long batchId){
+    if (batchId < 0 || this->slots.empty()){
+        return -1;
+    }
+    StreamSlot *slot = &this->slots[batchId % this->slots.size()];
+    if (slot->batchId != batchId || !slot->pending){
+        // Already completed, or overwritten by a later batch which implies
+        // this one completed before the slot was reused. The slot only
+        // knows about its latest batch, so failures are looked up by id.
+        if (this->failedBatches.count(batchId) != 0){
+            return -1;
+        }
+        return batchId < this->nextBatchId ? 0 : -1;
+    }
+    return this->completeSlot(slot);
+}
+
+int OpenCLStreamPipeline::drain(){
+    int status = 0;
+    long long first = std::max(0LL, this->nextBatchId - (long long)this->slots.size());
+    for (long long batchId = first ; batchId < this->nextBatchId ; batchId++){
+        if (this->wait(batchId) != 0){
+            status = -1;
+        }
+    }
+    return status;
+}
+
+int OpenCLStreamPipeline::completeSlot(StreamSlot *slot){
+    slot->pending = false;
+    cl_int result = OpenCLEvent::waitAll(slot->downloadEvents);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Batch " << slot->batchId << " failed: "
+                         << getOpenCLErrorName(result));
+        this->failedBatches.insert(slot->batchId);
+        this->errorEncountered = true;
+        return -1;
+    }
+    this->lastComplete = std::chrono::steady_clock::now();
+
+    // A stage whose events carry no profiling info reports zero timestamps;
+    // it is left out rather than counted as a 0 ms (or wrapped) sample.
+    cl_ulong uploadStart, uploadEnd, computeStart, computeEnd, downloadStart, downloadEnd;
+    double uploadMs = this->getSpanMs(slot->uploadEvents, &uploadStart, &uploadEnd);
+    double computeMs = this->getSpanMs({slot->computeEvent}, &computeStart, &computeEnd);
+    double downloadMs = this->getSpanMs(slot->downloadEvents, &downloadStart, &downloadEnd);
+    if (uploadEnd != 0){
+        this->recordStage(&this->stats.upload, uploadMs);
+    }
+    if (computeEnd != 0){
+        this->recordStage(&this->stats.compute, computeMs);
+    }
+    if (downloadEnd != 0){
+        this->recordStage(&this->stats.download, downloadMs);
+    }
+    if (uploadStart != 0 && downloadEnd >= uploadStart){
+        this->recordStage(&this->stats.endToEnd, (downloadEnd - uploadStart)*1e-6);
+    }
+    this->stats.batches++;
+    return 0;
+}
+
+double OpenCLStreamPipeline::getSpanMs(const std::vector<OpenCLEvent>& events, cl_ulong *start, cl_ulong *end){
+    *start = 0;
+    *end = 0;
+    for (const OpenCLEvent& event : events){
+        cl_ulong eventStart, eventEnd;
+        if (clGetEventProfilingInfo(event.get(), CL_PROFILING_COMMAND_START,
+                                    sizeof(cl_ulong), &eventStart, NULL) != CL_SUCCESS ||
+            clGetEventProfilingInfo(event.get(), CL_PROFILING_COMMAND_END,
+                                    sizeof(cl_ulong), &eventEnd, NULL) != CL_SUCCESS){
+            continue;
+        }
+        *start = (*start == 0) ? eventStart : std::min(*start, eventStart);
+        *end = std::max(*end, eventEnd);
+    }
+    return (*end - *start)*1e-6;
+}
+
+void OpenCLStreamPipeline::recordStage(StreamStageStats *stage, double ms){
+    if (stage->count == 0){
+        stage->minMs = ms;
+        stage->maxMs = ms;
+    } else {
+        stage->minMs = std::min(stage->minMs, ms);
+        stage->maxMs = std::max(stage->maxMs, ms);
+    }
+    stage->count++;
+    stage->totalMs += ms;
+    stage->meanMs = stage->totalMs / stage->count;
+}
+
+StreamPipelineStats OpenCLStreamPipeline::getStats(){
+    StreamPipelineStats result = this->stats;
+    if (result.batches > 0){
+        std::chrono::duration<double> elapsed = this->lastComplete - this->firstSubmit;
+        result.elapsedSeconds = elapsed.count();
+        if (result.elapsedSeconds > 0.0){
+            result.batchesPerSecond = result.batches / result.elapsedSeconds;
+            result.bytesPerSecond = (double)result.batches*this->bytesPerBatch / result.elapsedSeconds;
+        }
+    }
+    return result;
+}
+
+void OpenCLStreamPipeline::resetStats(){
+    this->stats = StreamPipelineStats();
+    this->timingStarted = false;
+}
+
+void OpenCLStreamPipeline::cleanup(){
+    this->drain();
+    for (StreamSlot& slot : this->slots){
+        for (cl_mem handle : slot.inputs){
+            clReleaseMemObject(handle);
+        }
+        for (cl_mem handle : slot.outputs){
+            clReleaseMemObject(handle);
+        }
+        if (slot.kernel != nullptr){
+            clReleaseKernel(slot.kernel);
+        }
+    }
+    this->slots.clear();
+    if (this->uploadQueue != nullptr){
+        clReleaseCommandQueue(this->uploadQueue);
+    }
+    if (this->computeQueue != nullptr){
+        clReleaseCommandQueue(this->computeQueue);
+    }
+    if (this->downloadQueue != nullptr){
+        clReleaseCommandQueue(this->downloadQueue);
+    }
+    this->uploadQueue = nullptr;
+    this->computeQueue = nullptr;
+    this->downloadQueue = nullptr;
+    this->isInitialized = false;
+}
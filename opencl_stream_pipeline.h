@@ -0,0 +1,101 @@
+#ifndef OPENCL_STREAM_PIPELINE
+#define OPENCL_STREAM_PIPELINE
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <set>
+#include <string>
+#include <chrono>
+#include <CL/opencl.hpp>
+
+#include "opencl_event.h"
+
+class OpenCLInterface;
+
+struct StreamStageStats {
+    size_t count = 0;
+    double minMs = 0.0;
+    double meanMs = 0.0;
+    double maxMs = 0.0;
+    double totalMs = 0.0;
+};
+
+struct StreamPipelineStats {
+    size_t batches = 0;
+    double elapsedSeconds = 0.0;
+    double batchesPerSecond = 0.0;
+    double bytesPerSecond = 0.0;
+    StreamStageStats upload;
+    StreamStageStats compute;
+    StreamStageStats download;
+    StreamStageStats endToEnd;
+};
+
+struct StreamSlot {
+    long long batchId = -1;
+    bool pending = false;
+    cl_kernel kernel = nullptr;
+    std::vector<cl_mem> inputs = {};
+    std::vector<cl_mem> outputs = {};
+    std::vector<OpenCLEvent> uploadEvents = {};
+    OpenCLEvent computeEvent;
+    std::vector<OpenCLEvent> downloadEvents = {};
+};
+
+// Streams batches through one kernel of an initialized interface. Each batch
+// is assigned one of `depth` device buffer sets in turn; uploads, kernel
+// launches and readbacks go to three separate queues and are chained with
+// events, so with depth 3 the upload of batch i+1 and the readback of batch
+// i-1 overlap with compute on batch i. Host pointers passed to submit() must
+// stay valid until the batch has been waited for.
+class OpenCLStreamPipeline
+{
+    public:
+        bool isInitialized;
+        bool errorEncountered;
+        OpenCLStreamPipeline(OpenCLInterface *interface,
+                             const char* kernelName,
+                             cl_uint workDimensions,
+                             size_t *globalWorkSize,
+                             std::vector<size_t> inputNumElements,
+                             std::vector<size_t> outputNumElements,
+                             size_t depth = 3);
+        ~OpenCLStreamPipeline();
+        OpenCLStreamPipeline(const OpenCLStreamPipeline&) = delete;
+        OpenCLStreamPipeline& operator=(const OpenCLStreamPipeline&) = delete;
+        long long submit(std::vector<const float*> inputPtrs, std::vector<float*> outputPtrs);
+        int wait(long long batchId);
+        int drain();
+        StreamPipelineStats getStats();
+        void resetStats();
+        void cleanup();
+
+    private:
+        OpenCLInterface *interface;
+        cl_context context;
+        cl_device_id device;
+        cl_command_queue uploadQueue = nullptr;
+        cl_command_queue computeQueue = nullptr;
+        cl_command_queue downloadQueue = nullptr;
+        cl_uint workDimensions;
+        size_t globalWorkSize[3] = {1, 1, 1};
+        std::vector<size_t> inputSizes = {};
+        std::vector<size_t> outputSizes = {};
+        std::vector<StreamSlot> slots = {};
+        std::set<long long> failedBatches = {};
+        long long nextBatchId = 0;
+        size_t bytesPerBatch = 0;
+        StreamPipelineStats stats;
+        bool timingStarted = false;
+        std::chrono::steady_clock::time_point firstSubmit;
+        std::chrono::steady_clock::time_point lastComplete;
+
+        int createQueue(cl_command_queue *queue);
+        int createSlot(cl_program program, const char* kernelName, StreamSlot *slot);
+        int completeSlot(StreamSlot *slot);
+        void recordStage(StreamStageStats *stage, double ms);
+        double getSpanMs(const std::vector<OpenCLEvent>& events, cl_ulong *start, cl_ulong *end);
+};
+
+#endif // OPENCL_STREAM_PIPELINE
@@ -0,0 +1,176 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_thread_queue.h"
+
+OpenCLThreadQueue::OpenCLThreadQueue(OpenCLInterface *interface, cl_command_queue queue){
+    this->interface = interface;
+    this->queue = queue;
+}
+
+OpenCLThreadQueue::~OpenCLThreadQueue(){
+    if (this->queue != nullptr){
+        clFinish(this->queue);
+    }
+    for (auto& entry : this->kernels){
+        clReleaseKernel(entry.second);
+    }
+    if (this->queue != nullptr){
+        clReleaseCommandQueue(this->queue);
+    }
+}
+
+cl_command_queue OpenCLThreadQueue::getQueue(){
+    return this->queue;
+}
+
+cl_kernel OpenCLThreadQueue::getKernel(const char* kernelName){
+    auto found = this->kernels.find(kernelName);
+    if (found != this->kernels.end()){
+        return found->second;
+    }
+    OpenCLKernelArgs args;
+    cl_kernel clone = this->interface->cloneKernel(kernelName, &args);
+    if (clone == nullptr){
+        return nullptr;
+    }
+    this->kernels[kernelName] = clone;
+    this->kernelArgs[clone] = args;
+    return clone;
+}
+
+// Called by the interface, from the thread resizing a buffer. The argument
+// caches belong to this queue's thread, so the replacement is only queued
+// here and applied by that thread before it next touches its kernels.
+void OpenCLThreadQueue::replaceBuffer(cl_mem from, cl_mem to){
+    std::lock_guard<std::mutex> lock(this->replacementsMutex);
+    this->replacements.emplace_back(from, to);
+    this->hasReplacements = true;
+}
+
+void OpenCLThreadQueue::applyReplacements(){
+    if (!this->hasReplacements){
+        return;
+    }
+    std::vector<std::pair<cl_mem, cl_mem>> pending;
+    {
+        std::lock_guard<std::mutex> lock(this->replacementsMutex);
+        pending.swap(this->replacements);
+        this->hasReplacements = false;
+    }
+    // In order, since a buffer may have been resized more than once.
+    for (const auto& replacement : pending){
+        for (auto& entry : this->kernelArgs){
+            entry.second.replace(replacement.first, replacement.second);
+        }
+    }
+}
+
+OpenCLKernelArgs* OpenCLThreadQueue::getKernelArgs(const char* kernelName){
+    this->applyReplacements();
+    cl_kernel target = this->getKernel(kernelName);
+    if (target == nullptr){
+        OPENCL_LOG_ERROR("No kernel named " << kernelName << " in program");
+        return nullptr;
+    }
+    return &this->kernelArgs[target];
+}
+
+int OpenCLThreadQueue::stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const BufferArg& buffer){
+    cl_mem handle = this->interface->getBufferHandle(buffer.index, buffer.isInput);
+    if (handle == nullptr){
+        return -1;
+    }
+    cache->set(argIndex, handle);
+    return 0;
+}
+
+OpenCLEvent OpenCLThreadQueue::executeKernelAsync(const char* kernelName, cl_uint workDimensions,
+                                                  size_t *globalWorkSize,
+                                                  const std::vector<OpenCLEvent>& waitList){
+    try {
+        this->applyReplacements();
+        cl_kernel target = this->getKernel(kernelName);
+        if (target == nullptr){
+            throw std::runtime_error(std::string("No kernel named ") + kernelName + " in program");
+        }
+        cl_uint failedIndex = 0;
+        cl_int result = this->kernelArgs[target].apply(target, &failedIndex);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't set kernel arg " + std::to_string(failedIndex) + ": " +
+                                     this->interface->getCodeExplanation(result));
+        }
+        std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+        cl_event event = nullptr;
+        result = clEnqueueNDRangeKernel(this->queue, target, workDimensions, NULL, globalWorkSize, NULL,
+                                        waitHandles.size(),
+                                        waitHandles.empty() ? NULL : waitHandles.data(),
+                                        &event);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue kernel: " + this->interface->getCodeExplanation(result));
+        }
+        return OpenCLEvent(event);
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+    }
+    return OpenCLEvent();
+}
+
+int OpenCLThreadQueue::executeKernel(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize){
+    // Waits for this launch only, not for other threads' work.
+    OpenCLEvent event = this->executeKernelAsync(kernelName, workDimensions, globalWorkSize);
+    return event.isValid() && event.wait() == CL_SUCCESS ? 0 : -1;
+}
+
+OpenCLEvent OpenCLThreadQueue::writeBufferAsync(cl_mem handle, size_t offset, size_t sizeBytes,
+                                                const void *data,
+                                                const std::vector<OpenCLEvent>& waitList){
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+    cl_event event = nullptr;
+    cl_int result = clEnqueueWriteBuffer(this->queue, handle, CL_FALSE, offset, sizeBytes, data,
+                                         waitHandles.size(),
+                                         waitHandles.empty() ? NULL : waitHandles.data(),
+                                         &event);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't enqueue buffer write: "
+                         << getOpenCLErrorName(result));
+        return OpenCLEvent();
+    }
+    return OpenCLEvent(event);
+}
+
+OpenCLEvent OpenCLThreadQueue::readBufferAsync(cl_mem handle, size_t offset, size_t sizeBytes, void *data,
+                                               const std::vector<OpenCLEvent>& waitList){
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(waitList);
+    cl_event event = nullptr;
+    cl_int result = clEnqueueReadBuffer(this->queue, handle, CL_FALSE, offset, sizeBytes, data,
+                                        waitHandles.size(),
+                                        waitHandles.empty() ? NULL : waitHandles.data(),
+                                        &event);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't enqueue buffer read: "
+                         << getOpenCLErrorName(result));
+        return OpenCLEvent();
+    }
+    return OpenCLEvent(event);
+}
+
+int OpenCLThreadQueue::writeBuffer(cl_mem handle, size_t offset, size_t sizeBytes, const void *data){
+    OpenCLEvent event = this->writeBufferAsync(handle, offset, sizeBytes, data);
+    return event.isValid() && event.wait() == CL_SUCCESS ? 0 : -1;
+}
+
+int OpenCLThreadQueue::readBuffer(cl_mem handle, size_t offset, size_t sizeBytes, void *data){
+    OpenCLEvent event = this->readBufferAsync(handle, offset, sizeBytes, data);
+    return event.isValid() && event.wait() == CL_SUCCESS ? 0 : -1;
+}
+
+void OpenCLThreadQueue::flush(){
+    clFlush(this->queue);
+}
+
+void OpenCLThreadQueue::finish(){
+    clFinish(this->queue);
+}
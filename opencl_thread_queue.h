@@ -0,0 +1,89 @@
+#ifndef OPENCL_THREAD_QUEUE
+#define OPENCL_THREAD_QUEUE
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <CL/opencl.hpp>
+
+#include "opencl_event.h"
+#include "opencl_kernel_args.h"
+
+class OpenCLInterface;
+
+// The calling thread's view of a shared interface: its own command queue
+// and its own clones of the program's kernels, so argument binding and
+// submission never touch state another thread can see. Obtain it with
+// OpenCLInterface::getThreadQueue(); it is only to be used by the thread it
+// was created for. Commands on it are not recorded by the profiler.
+class OpenCLThreadQueue
+{
+    public:
+        OpenCLThreadQueue(OpenCLInterface *interface, cl_command_queue queue);
+        ~OpenCLThreadQueue();
+        OpenCLThreadQueue(const OpenCLThreadQueue&) = delete;
+        OpenCLThreadQueue& operator=(const OpenCLThreadQueue&) = delete;
+
+        cl_command_queue getQueue();
+        cl_kernel getKernel(const char* kernelName);
+        template<typename... Args>
+        int setKernelArgs(const char* kernelName, const Args&... args){
+            OpenCLKernelArgs *cache = this->getKernelArgs(kernelName);
+            if (cache == nullptr){
+                return -1;
+            }
+            cl_uint argIndex = 0;
+            int result = 0;
+            ((result |= this->stageKernelArg(cache, argIndex++, args)), ...);
+            return result == 0 ? 0 : -1;
+        }
+        template<typename T>
+        int setKernelArg(const char* kernelName, cl_uint argIndex, const T& value){
+            OpenCLKernelArgs *cache = this->getKernelArgs(kernelName);
+            if (cache == nullptr){
+                return -1;
+            }
+            return this->stageKernelArg(cache, argIndex, value);
+        }
+        OpenCLEvent executeKernelAsync(const char* kernelName, cl_uint workDimensions,
+                                       size_t *globalWorkSize,
+                                       const std::vector<OpenCLEvent>& waitList = {});
+        int executeKernel(const char* kernelName, cl_uint workDimensions, size_t *globalWorkSize);
+        OpenCLEvent writeBufferAsync(cl_mem handle, size_t offset, size_t sizeBytes, const void *data,
+                                     const std::vector<OpenCLEvent>& waitList = {});
+        OpenCLEvent readBufferAsync(cl_mem handle, size_t offset, size_t sizeBytes, void *data,
+                                    const std::vector<OpenCLEvent>& waitList = {});
+        int writeBuffer(cl_mem handle, size_t offset, size_t sizeBytes, const void *data);
+        int readBuffer(cl_mem handle, size_t offset, size_t sizeBytes, void *data);
+        void flush();
+        void finish();
+        void replaceBuffer(cl_mem from, cl_mem to);
+
+    private:
+        OpenCLInterface *interface;
+        cl_command_queue queue;
+        std::unordered_map<std::string, cl_kernel> kernels = {};
+        std::unordered_map<cl_kernel, OpenCLKernelArgs> kernelArgs = {};
+        // Handle replacements from resizeBuffer(), queued by the resizing
+        // thread and applied by this queue's own thread.
+        std::mutex replacementsMutex;
+        std::vector<std::pair<cl_mem, cl_mem>> replacements = {};
+        std::atomic<bool> hasReplacements{false};
+
+        void applyReplacements();
+
+        OpenCLKernelArgs* getKernelArgs(const char* kernelName);
+        template<typename T>
+        int stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const T& value){
+            cache->set(argIndex, value);
+            return 0;
+        }
+        int stageKernelArg(OpenCLKernelArgs *cache, cl_uint argIndex, const BufferArg& buffer);
+};
+
+#endif // OPENCL_THREAD_QUEUE
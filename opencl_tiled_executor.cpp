@@ -0,0 +1,345 @@
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "opencl_interface.h"
+#include "opencl_tiled_executor.h"
+
+OpenCLTiledExecutor::OpenCLTiledExecutor(OpenCLInterface *interface,
+                                         const char* kernelName,
+                                         cl_uint workDimensions,
+                                         size_t *globalWorkSize,
+                                         std::vector<OpenCLBufferDesc> inputs,
+                                         std::vector<OpenCLBufferDesc> outputs,
+                                         TiledExecutorOptions options){
+    this->isInitialized = false;
+    this->errorEncountered = false;
+    this->interface = interface;
+    try {
+        if (interface == nullptr || !interface->isInitialized){
+            throw std::runtime_error("Interface not initialized!");
+        }
+        interface->requireDevice("the tiled executor");
+        if (workDimensions < 1 || workDimensions > 3){
+            throw std::runtime_error("Work dimensions must be between 1 and 3");
+        }
+        if (options.depth < 2 || options.depth > 3){
+            throw std::runtime_error("Tile depth must be 2 or 3");
+        }
+        this->context = interface->getContext();
+        this->device = interface->getDevice();
+        this->workDimensions = workDimensions;
+        for (cl_uint i = 0 ; i < workDimensions ; i++){
+            this->globalWorkSize[i] = globalWorkSize[i];
+        }
+        this->totalRows = globalWorkSize[workDimensions - 1];
+        this->haloRows = options.haloRows;
+        this->inputs = inputs;
+        this->outputs = outputs;
+        if (this->totalRows == 0){
+            throw std::runtime_error("Global work size is empty");
+        }
+        for (const OpenCLBufferDesc& desc : inputs){
+            if (desc.data == nullptr || desc.numElements % this->totalRows != 0){
+                throw std::runtime_error("Inputs must hold a whole number of elements per row");
+            }
+            this->inputRowBytes.push_back(desc.numElements / this->totalRows * desc.elementSize);
+        }
+        for (const OpenCLBufferDesc& desc : outputs){
+            if (desc.data == nullptr || desc.numElements % this->totalRows != 0){
+                throw std::runtime_error("Outputs must hold a whole number of elements per row");
+            }
+            this->outputRowBytes.push_back(desc.numElements / this->totalRows * desc.elementSize);
+        }
+
+        this->tileRows = this->chooseTileRows(options);
+        if (this->tileRows == 0){
+            throw std::runtime_error("Not even one row with its halo fits on the device");
+        }
+
+        if (this->createQueue(&this->uploadQueue) != 0 ||
+            this->createQueue(&this->computeQueue) != 0 ||
+            this->createQueue(&this->downloadQueue) != 0){
+            throw std::runtime_error("Couldn't create tile queues");
+        }
+        this->slots.resize(options.depth);
+        for (TileSlot& slot : this->slots){
+            if (this->createSlot(interface->getProgram(), kernelName, &slot) != 0){
+                throw std::runtime_error("Couldn't create tile buffer set");
+            }
+        }
+        OPENCL_LOG_INFO("Tiled executor created: " << this->getNumTiles() << " tiles of "
+                        << this->tileRows << " rows, halo " << this->haloRows);
+        this->isInitialized = true;
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't create tiled executor: " << e.what());
+        this->errorEncountered = true;
+    }
+}
+
+OpenCLTiledExecutor::~OpenCLTiledExecutor(){
+    this->cleanup();
+}
+
+size_t OpenCLTiledExecutor::chooseTileRows(const TiledExecutorOptions& options){
+    cl_ulong maxAlloc = 0;
+    cl_ulong globalMem = 0;
+    clGetDeviceInfo(this->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, NULL);
+    clGetDeviceInfo(this->device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, NULL);
+
+    size_t rows = this->totalRows;
+    if (options.maxTileRows > 0){
+        rows = std::min(rows, options.maxTileRows);
+    }
+    // Every single buffer has to respect the allocation limit...
+    size_t halo = 2*this->haloRows;
+    size_t rowBytes = 0;
+    size_t haloBytes = 0;
+    for (size_t bytes : this->inputRowBytes){
+        if (bytes == 0){
+            continue;
+        }
+        size_t fit = maxAlloc / bytes;
+        rows = fit > halo ? std::min(rows, fit - halo) : 0;
+        rowBytes += bytes;
+        haloBytes += halo*bytes;
+    }
+    for (size_t bytes : this->outputRowBytes){
+        if (bytes == 0){
+            continue;
+        }
+        rows = std::min<size_t>(rows, maxAlloc / bytes);
+        rowBytes += bytes;
+    }
+    // ...and all buffer sets together have to fit in the memory budget.
+    double budget = globalMem*options.memoryFraction / options.depth;
+    if (rowBytes > 0){
+        rows = budget > haloBytes ? std::min<size_t>(rows, (budget - haloBytes) / rowBytes) : 0;
+    }
+    return rows;
+}
+
+int OpenCLTiledExecutor::createQueue(cl_command_queue *queue){
+    cl_int result;
+    *queue = clCreateCommandQueueWithProperties(this->context, this->device, NULL, &result);
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Couldn't create command queue: "
+                         << getOpenCLErrorName(result));
+        *queue = nullptr;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLTiledExecutor::createSlot(cl_program program, const char* kernelName, TileSlot *slot){
+    try {
+        cl_int result;
+        slot->kernel = clCreateKernel(program, kernelName, &result);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't create kernel: " + this->interface->getCodeExplanation(result));
+        }
+        size_t inputRows = std::min(this->tileRows + 2*this->haloRows, this->totalRows);
+        cl_uint argIndex = 0;
+        for (size_t rowBytes : this->inputRowBytes){
+            cl_mem handle = clCreateBuffer(this->context, CL_MEM_READ_ONLY,
+                                           std::max<size_t>(inputRows*rowBytes, 1), NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create buffer: " + this->interface->getCodeExplanation(result));
+            }
+            slot->inputs.push_back(handle);
+            slot->args.set(argIndex++, handle);
+        }
+        for (size_t rowBytes : this->outputRowBytes){
+            cl_mem handle = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY,
+                                           std::max<size_t>(this->tileRows*rowBytes, 1), NULL, &result);
+            if (result != CL_SUCCESS){
+                throw std::runtime_error("Couldn't create buffer: " + this->interface->getCodeExplanation(result));
+            }
+            slot->outputs.push_back(handle);
+            slot->args.set(argIndex++, handle);
+        }
+        // argIndex itself is the tile's row offset, set per launch.
+        slot->args.set(argIndex + 1, (cl_int)this->totalRows);
+        cl_uint failedIndex = 0;
+        result = slot->args.apply(slot->kernel, &failedIndex);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't set kernel arg " + std::to_string(failedIndex) + ": " +
+                                     this->interface->getCodeExplanation(result));
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR(e.what());
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+void OpenCLTiledExecutor::submitTile(TileSlot *slot, size_t firstRow, size_t numRows){
+    size_t begin = firstRow > this->haloRows ? firstRow - this->haloRows : 0;
+    size_t end = std::min(firstRow + numRows + this->haloRows, this->totalRows);
+    cl_int result;
+
+    std::vector<OpenCLEvent> uploads;
+    for (size_t i = 0 ; i < this->inputs.size() ; i++){
+        size_t rowBytes = this->inputRowBytes[i];
+        const unsigned char *host = static_cast<const unsigned char*>(this->inputs[i].data);
+        cl_event event = nullptr;
+        result = clEnqueueWriteBuffer(this->uploadQueue, slot->inputs[i], CL_FALSE, 0,
+                                      (end - begin)*rowBytes, host + begin*rowBytes,
+                                      0, NULL, &event);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue tile upload: " + this->interface->getCodeExplanation(result));
+        }
+        uploads.emplace_back(event);
+        this->stats.bytesUploaded += (end - begin)*rowBytes;
+        this->stats.haloBytesUploaded += (end - begin - numRows)*rowBytes;
+    }
+    clFlush(this->uploadQueue);
+
+    slot->args.set(this->inputs.size() + this->outputs.size(), (cl_int)begin);
+    cl_uint failedIndex = 0;
+    result = slot->args.apply(slot->kernel, &failedIndex);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't set kernel arg " + std::to_string(failedIndex) + ": " +
+                                 this->interface->getCodeExplanation(result));
+    }
+    size_t offset[3] = {0, 0, 0};
+    size_t global[3] = {this->globalWorkSize[0], this->globalWorkSize[1], this->globalWorkSize[2]};
+    offset[this->workDimensions - 1] = firstRow;
+    global[this->workDimensions - 1] = numRows;
+    std::vector<cl_event> waitHandles = OpenCLEvent::toHandles(uploads);
+    cl_event computeEvent = nullptr;
+    result = clEnqueueNDRangeKernel(this->computeQueue, slot->kernel, this->workDimensions,
+                                    offset, global, NULL,
+                                    waitHandles.size(),
+                                    waitHandles.empty() ? NULL : waitHandles.data(),
+                                    &computeEvent);
+    if (result != CL_SUCCESS){
+        throw std::runtime_error("Couldn't enqueue tile kernel: " + this->interface->getCodeExplanation(result));
+    }
+    OpenCLEvent compute(computeEvent);
+    clFlush(this->computeQueue);
+
+    slot->downloadEvents.clear();
+    for (size_t i = 0 ; i < this->outputs.size() ; i++){
+        size_t rowBytes = this->outputRowBytes[i];
+        unsigned char *host = static_cast<unsigned char*>(this->outputs[i].data);
+        cl_event event = nullptr;
+        result = clEnqueueReadBuffer(this->downloadQueue, slot->outputs[i], CL_FALSE, 0,
+                                     numRows*rowBytes, host + firstRow*rowBytes,
+                                     1, &computeEvent, &event);
+        if (result != CL_SUCCESS){
+            throw std::runtime_error("Couldn't enqueue tile readback: " + this->interface->getCodeExplanation(result));
+        }
+        slot->downloadEvents.emplace_back(event);
+        this->stats.bytesDownloaded += numRows*rowBytes;
+    }
+    if (this->outputs.empty()){
+        slot->downloadEvents.push_back(compute);
+    }
+    clFlush(this->downloadQueue);
+    slot->pending = true;
+    this->stats.tiles++;
+    this->stats.tileRows += numRows;
+}
+
+int OpenCLTiledExecutor::completeSlot(TileSlot *slot){
+    slot->pending = false;
+    cl_int result = OpenCLEvent::waitAll(slot->downloadEvents);
+    slot->downloadEvents.clear();
+    if (result != CL_SUCCESS){
+        OPENCL_LOG_ERROR("Tile failed: " << getOpenCLErrorName(result));
+        this->errorEncountered = true;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenCLTiledExecutor::run(){
+    int status = 0;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        if (!this->isInitialized){
+            throw std::runtime_error("Tiled executor not initialized!");
+        }
+        size_t tile = 0;
+        for (size_t firstRow = 0 ; firstRow < this->totalRows ; firstRow += this->tileRows, tile++){
+            TileSlot *slot = &this->slots[tile % this->slots.size()];
+            // Reusing a buffer set waits for the tile that last used it,
+            // which bounds device memory to `depth` tiles.
+            if (slot->pending && this->completeSlot(slot) != 0){
+                throw std::runtime_error("Previous tile in buffer set failed");
+            }
+            this->submitTile(slot, firstRow, std::min(this->tileRows, this->totalRows - firstRow));
+        }
+    } catch (const std::exception& e){
+        OPENCL_LOG_ERROR("Couldn't run tiles: " << e.what());
+        this->errorEncountered = true;
+        status = -1;
+    }
+    for (TileSlot& slot : this->slots){
+        if (slot.pending && this->completeSlot(&slot) != 0){
+            status = -1;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    this->stats.elapsedSeconds += elapsed.count();
+    this->stats.runs++;
+    return status;
+}
+
+size_t OpenCLTiledExecutor::getTileRows(){
+    return this->tileRows;
+}
+
+size_t OpenCLTiledExecutor::getNumTiles(){
+    if (this->tileRows == 0){
+        return 0;
+    }
+    return (this->totalRows + this->tileRows - 1) / this->tileRows;
+}
+
+TiledExecutorStats OpenCLTiledExecutor::getStats(){
+    TiledExecutorStats result = this->stats;
+    if (result.elapsedSeconds > 0.0){
+        result.bytesPerSecond = (result.bytesUploaded + result.bytesDownloaded) / result.elapsedSeconds;
+    }
+    return result;
+}
+
+void OpenCLTiledExecutor::resetStats(){
+    this->stats = TiledExecutorStats();
+}
+
+void OpenCLTiledExecutor::cleanup(){
+    for (TileSlot& slot : this->slots){
+        if (slot.pending){
+            this->completeSlot(&slot);
+        }
+        for (cl_mem handle : slot.inputs){
+            clReleaseMemObject(handle);
+        }
+        for (cl_mem handle : slot.outputs){
+            clReleaseMemObject(handle);
+        }
+        if (slot.kernel != nullptr){
+            clReleaseKernel(slot.kernel);
+        }
+    }
+    this->slots.clear();
+    if (this->uploadQueue != nullptr){
+        clReleaseCommandQueue(this->uploadQueue);
+    }
+    if (this->computeQueue != nullptr){
+        clReleaseCommandQueue(this->computeQueue);
+    }
+    if (this->downloadQueue != nullptr){
+        clReleaseCommandQueue(this->downloadQueue);
+    }
+    this->uploadQueue = nullptr;
+    this->computeQueue = nullptr;
+    this->downloadQueue = nullptr;
+    this->isInitialized = false;
+}
@@ -0,0 +1,109 @@
+#ifndef OPENCL_TILED_EXECUTOR
+#define OPENCL_TILED_EXECUTOR
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <vector>
+#include <CL/opencl.hpp>
+
+#include "opencl_event.h"
+#include "opencl_kernel_args.h"
+#include "opencl_types.h"
+
+class OpenCLInterface;
+
+struct TiledExecutorOptions {
+    // Rows of the tiled dimension per tile; 0 picks the largest that fits.
+    size_t maxTileRows = 0;
+    // Extra input rows uploaded on each side of a tile for stencil kernels.
+    size_t haloRows = 0;
+    // Buffer sets in flight; 2 overlaps upload with compute, 3 also
+    // overlaps readback.
+    size_t depth = 3;
+    // Share of global memory all buffer sets together may occupy.
+    double memoryFraction = 0.5;
+};
+
+struct TiledExecutorStats {
+    size_t runs = 0;
+    size_t tiles = 0;
+    size_t tileRows = 0;
+    size_t bytesUploaded = 0;
+    size_t haloBytesUploaded = 0;
+    size_t bytesDownloaded = 0;
+    double elapsedSeconds = 0.0;
+    double bytesPerSecond = 0.0;
+};
+
+struct TileSlot {
+    bool pending = false;
+    cl_kernel kernel = nullptr;
+    OpenCLKernelArgs args;
+    std::vector<cl_mem> inputs = {};
+    std::vector<cl_mem> outputs = {};
+    std::vector<OpenCLEvent> downloadEvents = {};
+};
+
+// Runs one kernel over host arrays too large to hold on the device at once.
+// The last work dimension (rows of a 2D raster) is split into tiles; every
+// input and output holds the same number of elements per row. Each tile's
+// rows, plus haloRows on either side clamped to the data, are uploaded into
+// one of `depth` buffer sets and the kernel is launched over the tile with
+// global_work_offset set to its first row, so get_global_id() still returns
+// absolute coordinates. Uploads, launches and readbacks go to separate
+// queues, so the next tile uploads while the current one computes.
+//
+// Kernel arguments are the inputs, then the outputs, then two ints: the
+// absolute row held at the start of the input buffers and the total number
+// of rows. An input element at absolute row r is at (r - rowOffset) rows
+// into its buffer; outputs are indexed by (r - get_global_offset(last)).
+class OpenCLTiledExecutor
+{
+    public:
+        bool isInitialized;
+        bool errorEncountered;
+        OpenCLTiledExecutor(OpenCLInterface *interface,
+                            const char* kernelName,
+                            cl_uint workDimensions,
+                            size_t *globalWorkSize,
+                            std::vector<OpenCLBufferDesc> inputs,
+                            std::vector<OpenCLBufferDesc> outputs,
+                            TiledExecutorOptions options = TiledExecutorOptions());
+        ~OpenCLTiledExecutor();
+        OpenCLTiledExecutor(const OpenCLTiledExecutor&) = delete;
+        OpenCLTiledExecutor& operator=(const OpenCLTiledExecutor&) = delete;
+
+        int run();
+        size_t getTileRows();
+        size_t getNumTiles();
+        TiledExecutorStats getStats();
+        void resetStats();
+        void cleanup();
+
+    private:
+        OpenCLInterface *interface;
+        cl_context context;
+        cl_device_id device;
+        cl_command_queue uploadQueue = nullptr;
+        cl_command_queue computeQueue = nullptr;
+        cl_command_queue downloadQueue = nullptr;
+        cl_uint workDimensions;
+        size_t globalWorkSize[3] = {1, 1, 1};
+        size_t totalRows = 0;
+        size_t tileRows = 0;
+        size_t haloRows = 0;
+        std::vector<OpenCLBufferDesc> inputs = {};
+        std::vector<OpenCLBufferDesc> outputs = {};
+        std::vector<size_t> inputRowBytes = {};
+        std::vector<size_t> outputRowBytes = {};
+        std::vector<TileSlot> slots = {};
+        TiledExecutorStats stats;
+
+        size_t chooseTileRows(const TiledExecutorOptions& options);
+        int createQueue(cl_command_queue *queue);
+        int createSlot(cl_program program, const char* kernelName, TileSlot *slot);
+        int completeSlot(TileSlot *slot);
+        void submitTile(TileSlot *slot, size_t firstRow, size_t numRows);
+};
+
+#endif // OPENCL_TILED_EXECUTOR
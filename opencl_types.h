@@ -0,0 +1,75 @@
+#ifndef OPENCL_TYPES
+#define OPENCL_TYPES
+
+#define CL_HPP_TARGET_OPENCL_VERSION 300
+
+#include <cstdint>
+#include <cstddef>
+#include <CL/opencl.hpp>
+
+// Host-side storage for OpenCL half. cl_half is a plain uint16_t typedef, so
+// it can't be told apart from ushort at compile time; this wrapper can.
+struct Half {
+    uint16_t bits;
+};
+
+// Maps a host element type to its OpenCL C name and size. Only the
+// specializations below exist, so unsupported element types fail to compile
+// instead of being silently reinterpreted.
+template<typename T>
+struct ClType;
+
+#define OPENCL_DEFINE_TYPE(HOST_TYPE, CL_NAME, WIDTH)            \
+    template<>                                                  \
+    struct ClType<HOST_TYPE> {                                  \
+        static constexpr const char* name = CL_NAME;            \
+        static constexpr size_t size = sizeof(HOST_TYPE);       \
+        static constexpr size_t vectorWidth = WIDTH;            \
+    };
+
+OPENCL_DEFINE_TYPE(int8_t, "char", 1)
+OPENCL_DEFINE_TYPE(uint8_t, "uchar", 1)
+OPENCL_DEFINE_TYPE(int16_t, "short", 1)
+OPENCL_DEFINE_TYPE(uint16_t, "ushort", 1)
+OPENCL_DEFINE_TYPE(int32_t, "int", 1)
+OPENCL_DEFINE_TYPE(uint32_t, "uint", 1)
+OPENCL_DEFINE_TYPE(int64_t, "long", 1)
+OPENCL_DEFINE_TYPE(uint64_t, "ulong", 1)
+OPENCL_DEFINE_TYPE(Half, "half", 1)
+OPENCL_DEFINE_TYPE(float, "float", 1)
+OPENCL_DEFINE_TYPE(double, "double", 1)
+OPENCL_DEFINE_TYPE(cl_uchar4, "uchar4", 4)
+OPENCL_DEFINE_TYPE(cl_int2, "int2", 2)
+OPENCL_DEFINE_TYPE(cl_int4, "int4", 4)
+OPENCL_DEFINE_TYPE(cl_float2, "float2", 2)
+OPENCL_DEFINE_TYPE(cl_float4, "float4", 4)
+OPENCL_DEFINE_TYPE(cl_double2, "double2", 2)
+
+#undef OPENCL_DEFINE_TYPE
+
+// Untyped description of a buffer's host memory, built from a typed pointer
+// so the element size and kernel type name come from ClType<T>.
+struct OpenCLBufferDesc {
+    void *data = nullptr;
+    size_t numElements = 0;
+    size_t elementSize = sizeof(float);
+    const char* typeName = "float";
+};
+
+template<typename T>
+OpenCLBufferDesc makeBufferDesc(T *data, size_t numElements){
+    static_assert(sizeof(T) == ClType<T>::size, "Element size mismatch");
+    OpenCLBufferDesc desc;
+    desc.data = data;
+    desc.numElements = numElements;
+    desc.elementSize = ClType<T>::size;
+    desc.typeName = ClType<T>::name;
+    return desc;
+}
+
+template<typename T>
+OpenCLBufferDesc makeBufferDesc(const T *data, size_t numElements){
+    return makeBufferDesc(const_cast<T*>(data), numElements);
+}
+
+#endif // OPENCL_TYPES